@@ -78,6 +78,9 @@ struct ocpp_charger;
 /**
  * @brief Creates a new OCPP charger instance.
  *
+ * @param[in] ctx Filesystem (struct fs) to keep transaction messages in
+ *            until the CSMS answers them, or NULL to keep them in RAM only.
+ *
  * @return Pointer to the newly created charger instance.
  */
 struct charger *ocpp_charger_create(void *ctx);
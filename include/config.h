@@ -59,6 +59,10 @@ enum {
 };
 
 typedef void (*config_save_cb_t)(void *ctx);
+/* key is NULL when several keys have changed at once */
+typedef void (*config_change_cb_t)(const char *key, void *ctx);
+typedef int (*config_json_writer_t)(const void *data, size_t datasize,
+		void *ctx);
 
 struct config_charger {
 	char mode[CONFIG_CHARGER_MODE_MAXLEN];
@@ -112,6 +116,13 @@ static_assert(sizeof(struct config) == 1096, "config size mismatch");
 
 struct kvstore;
 
+typedef enum {
+#define CONFIG_DEFINE(id, key, field, type, count, perm)	CONFIG_KEY_##id,
+#include "config.def"
+#undef CONFIG_DEFINE
+	CONFIG_KEY_MAX,
+} config_key_t;
+
 /**
  * @brief Initializes the configuration module.
  * @param[in] nvs Handle to the non-volatile storage.
@@ -184,12 +195,87 @@ int config_reset(const char *key);
 
 /**
  * @brief Updates configuration values using a JSON string.
+ *
+ * The JSON is a flat object of configuration keys. Numbers and booleans map
+ * to integer and bool fields, strings to character fields and hex strings
+ * to byte arrays. Either every value is applied and saved at once or none
+ * is, e.g. `{"log.level":1,"chg.param":"00f200000001"}`.
+ *
  * @param[in] json JSON-formatted configuration string.
  * @param[in] json_len Length of the JSON string.
- * @return 0 on success, negative error code on failure.
+ * @return 0 on success, negative error code on failure. -ENOENT for an
+ *         unknown key, -EPERM for a read-only or device state key, -ENOMEM
+ *         or -ERANGE for a value not fitting in its field and -EINVAL for
+ *         malformed JSON.
  */
 int config_update_json(const char *json, size_t json_len);
 
+/**
+ * @brief Exports the writable configuration values in JSON.
+ *
+ * The output is the format accepted by @ref config_update_json and gets
+ * passed to the writer in small chunks. Write-only values such as
+ * net.server.pass are left out, so they can be imported but never read back
+ * this way. So is the state of this device, such as ocpp.checkpoint and
+ * net.mac, which is neither exported nor imported.
+ *
+ * @param[in] writer Function to be called with each chunk of the output.
+ * @param[in] ctx Context to be passed to the writer.
+ * @return the number of bytes written on success, negative error code
+ *         returned by the writer otherwise.
+ */
+int config_export_json(config_json_writer_t writer, void *ctx);
+
+/**
+ * @brief Pins the current configuration generation for reading.
+ *
+ * Reading never blocks writers nor gets blocked by them. The generation
+ * stays intact until released while writers publish newer ones. Release it
+ * as soon as possible since a writer waits for a free generation when all of
+ * them are pinned.
+ *
+ * @return Pointer to the immutable configuration.
+ */
+const struct config *config_snapshot_acquire(void);
+
+/**
+ * @brief Releases the generation pinned by @ref config_snapshot_acquire.
+ * @param[in] snapshot Pointer returned by @ref config_snapshot_acquire.
+ */
+void config_snapshot_release(const struct config *snapshot);
+
+/**
+ * @brief Returns the number of generations published since initialized.
+ *
+ * It can be used to tell cheaply whether any value has changed.
+ *
+ * @return Generation number.
+ */
+uint32_t config_generation(void);
+
+/**
+ * @brief Registers a callback to be called when a configuration changes.
+ *
+ * The callback is called in the context of the writer after the change is
+ * visible to readers.
+ *
+ * @param[in] key Key prefix of interest, e.g. "net." for all network
+ *            settings. NULL for all keys. It should remain valid while
+ *            subscribed.
+ * @param[in] cb Callback function.
+ * @param[in] ctx Context to be passed to the callback function.
+ * @return 0 on success, -ENOSPC if there is no room for another subscriber.
+ */
+int config_subscribe(const char *key, config_change_cb_t cb, void *ctx);
+
+/**
+ * @brief Removes the callback registered by @ref config_subscribe.
+ * @param[in] cb Callback function.
+ * @param[in] ctx Context given when subscribed.
+ * @return 0 on success, -ENOENT if not subscribed.
+ */
+int config_unsubscribe(config_change_cb_t cb, void *ctx);
+
 /**
  * @brief Checks if the configuration setting for the given key is zeroed.
  *
@@ -206,6 +292,20 @@ int config_update_json(const char *json, size_t json_len);
  */
 bool config_is_zeroed(const char *key);
 
+/*
+ * Typed accessors generated from config.def, e.g. config_get_net_health()
+ * and config_set_net_health(). They skip the key lookup entirely.
+ *
+ * The value always holds the whole field, i.e. `count` elements of `type`
+ * as defined in config.def. String fields are no exception: pass a buffer
+ * as large as the field rather than a string literal to the setter.
+ */
+#define CONFIG_DEFINE(id, key, field, type, count, perm)		\
+	int config_get_##id(type *value);				\
+	int config_set_##id(const type *value);
+#include "config.def"
+#undef CONFIG_DEFINE
+
 #if defined(__cplusplus)
 }
 #endif
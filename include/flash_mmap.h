@@ -0,0 +1,65 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+
+#ifndef FLASH_MMAP_H
+#define FLASH_MMAP_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "libmcu/flash.h"
+
+/* Partition indices for flash_create() */
+#define FLASH_PARTITION_FS		0
+#define FLASH_PARTITION_UID_SNAPSHOT	1
+
+/**
+ * @brief Map a whole flash partition into the address space for reading.
+ *
+ * The mapping stays valid until the process exits and reflects whatever is
+ * written through the flash API afterwards.
+ *
+ * @param[in]  flash Flash partition from flash_create().
+ * @param[out] size  Size of the mapped partition in bytes (can be NULL).
+ *
+ * @return Pointer to the start of the partition, or NULL on failure.
+ */
+const void *flash_mmap(struct flash *flash, size_t *size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* FLASH_MMAP_H */
@@ -38,6 +38,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <errno.h>
 #include "libmcu/flash.h"
 
 #define FS_FILENAME_MAX		32
@@ -52,6 +53,19 @@ struct fs;
 typedef void (*fs_dir_cb_t)(struct fs *fs,
 		const fs_file_t type, const char *name, void *ctx);
 
+/**
+ * @brief A segment of a vectored write.
+ *
+ * @note @ref offset is the file offset for @ref fs_writev and is ignored by
+ *       @ref fs_append_batch and @ref fs_replace where segments are written
+ *       back to back.
+ */
+struct fs_iovec {
+	size_t offset;
+	const void *data;
+	size_t datasize;
+};
+
 struct fs_api {
 	int (*mount)(struct fs *self);
 	int (*unmount)(struct fs *self);
@@ -63,6 +77,12 @@ struct fs_api {
 			const void *data, const size_t datasize);
 	int (*append)(struct fs *self, const char *filepath,
 			const void *data, const size_t datasize);
+	int (*writev)(struct fs *self, const char *filepath,
+			const struct fs_iovec *iov, const size_t iovcnt);
+	int (*append_batch)(struct fs *self, const char *filepath,
+			const struct fs_iovec *iov, const size_t iovcnt);
+	int (*replace)(struct fs *self, const char *filepath,
+			const struct fs_iovec *iov, const size_t iovcnt);
 	int (*erase)(struct fs *self, const char *filepath);
 	int (*size)(struct fs *self, const char *filepath, size_t *size);
 	int (*dir)(struct fs *self,
@@ -97,6 +117,104 @@ static inline int fs_append(struct fs *self, const char *filepath,
 	return ((struct fs_api *)self)->append(self, filepath, data, datasize);
 }
 
+/**
+ * @brief Write several segments into a file with a single open and commit.
+ *
+ * Each segment is written at its own offset. Backends without native support
+ * fall back to one @ref fs_write per segment.
+ *
+ * @param[in] self Filesystem instance.
+ * @param[in] filepath Path of the file to write.
+ * @param[in] iov Segments to write.
+ * @param[in] iovcnt Number of segments.
+ *
+ * @return Total number of bytes written on success, or a negative error code.
+ */
+static inline int fs_writev(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	const struct fs_api *api = (const struct fs_api *)self;
+	int total = 0;
+
+	if (api->writev) {
+		return api->writev(self, filepath, iov, iovcnt);
+	}
+
+	for (size_t i = 0; i < iovcnt; i++) {
+		const int err = api->write(self, filepath,
+				iov[i].offset, iov[i].data, iov[i].datasize);
+		if (err < 0) {
+			return total? total : err;
+		}
+		total += err;
+	}
+
+	return total;
+}
+
+/**
+ * @brief Append several segments to a file with a single open and commit.
+ *
+ * Backends without native support fall back to one @ref fs_append per
+ * segment.
+ *
+ * @param[in] self Filesystem instance.
+ * @param[in] filepath Path of the file to append to.
+ * @param[in] iov Segments to append in order. The offsets are ignored.
+ * @param[in] iovcnt Number of segments.
+ *
+ * @return Total number of bytes written on success, or a negative error code.
+ */
+static inline int fs_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	const struct fs_api *api = (const struct fs_api *)self;
+	int total = 0;
+
+	if (api->append_batch) {
+		return api->append_batch(self, filepath, iov, iovcnt);
+	}
+
+	for (size_t i = 0; i < iovcnt; i++) {
+		const int err = api->append(self, filepath,
+				iov[i].data, iov[i].datasize);
+		if (err < 0) {
+			return total? total : err;
+		}
+		total += err;
+	}
+
+	return total;
+}
+
+/**
+ * @brief Replace the whole content of a file, which may shrink it.
+ *
+ * The old content is kept until the new one is committed on backends with
+ * native support. Otherwise it falls back to @ref fs_delete followed by
+ * @ref fs_append_batch, which leaves the file missing if interrupted.
+ *
+ * @param[in] self Filesystem instance.
+ * @param[in] filepath Path of the file to replace.
+ * @param[in] iov New content in order. The offsets are ignored.
+ * @param[in] iovcnt Number of segments.
+ *
+ * @return Total number of bytes written on success, or a negative error code.
+ */
+static inline int fs_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	const struct fs_api *api = (const struct fs_api *)self;
+
+	if (api->replace) {
+		return api->replace(self, filepath, iov, iovcnt);
+	}
+
+	const int err = api->erase(self, filepath);
+	if (err < 0 && err != -ENOENT) {
+		return err;
+	}
+
+	return fs_append_batch(self, filepath, iov, iovcnt);
+}
+
 static inline int fs_delete(struct fs *self, const char *filepath) {
 	return ((struct fs_api *)self)->erase(self, filepath);
 }
@@ -37,10 +37,58 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include "libmcu/kvstore.h"
 #include "fs/fs.h"
 
+/**
+ * @brief Create a key-value store on top of the filesystem.
+ *
+ * Every write goes straight to the filesystem. Keys are stored as files under
+ * the directory of the namespace given to kvstore_open(), or at the root when
+ * no namespace is opened. A key not found in its namespace is looked up at
+ * the root, where it was stored before namespaces were supported, and moved
+ * into the namespace on that first read.
+ *
+ * @param[in] fs Filesystem instance.
+ *
+ * @return The key-value store instance, or NULL on failure.
+ */
 struct kvstore *fs_kvstore_create(struct fs *fs);
+
+/**
+ * @brief Create a key-value store with a write-back cache.
+ *
+ * Written values are kept in RAM and committed to the filesystem later, so
+ * repeated writes to the same key cost a single flash write. Reads are served
+ * from RAM for cached keys, which always return the latest written value. A
+ * value read from the filesystem is cached too, if it fits without
+ * committing dirty values.
+ *
+ * Dirty values are committed when the cache exceeds @p cache_size, when the
+ * oldest one gets older than @p flush_interval_ms on the next access, or on
+ * @ref fs_kvstore_flush. Values larger than @p cache_size are written
+ * through.
+ *
+ * @param[in] fs Filesystem instance.
+ * @param[in] cache_size Maximum bytes of values kept in RAM.
+ * @param[in] flush_interval_ms Maximum age of a dirty value. 0 to flush only
+ *            on demand or on cache pressure.
+ *
+ * @return The key-value store instance, or NULL on failure.
+ */
+struct kvstore *fs_kvstore_create_cached(struct fs *fs,
+		size_t cache_size, uint32_t flush_interval_ms);
+
+/**
+ * @brief Commit all dirty values to the filesystem.
+ *
+ * @param[in] kvstore The key-value store instance.
+ *
+ * @return 0 on success, or the first error occurred.
+ */
+int fs_kvstore_flush(struct kvstore *kvstore);
+
 void fs_kvstore_destroy(struct kvstore *kvstore);
 int fs_kvstore_count(void);
 
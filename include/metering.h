@@ -73,7 +73,9 @@ struct metering_energy;
  * @param[in] energy  Energy data to be saved
  * @param[in] ctx     User context pointer passed during registration
  *
- * @return true if save operation was successful, false otherwise
+ * @return true if the data was accepted for saving, false otherwise. The
+ *         implementation may commit it later, in which case a failure can
+ *         only be reported asynchronously.
  */
 typedef bool (*metering_save_cb_t)(const struct metering *self,
 		const struct metering_energy *energy, void *ctx);
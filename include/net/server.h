@@ -51,8 +51,11 @@ struct server_api {
 	int (*send)(struct server *self,
 			const void *data, const size_t datasize);
 	int (*recv)(struct server *self, void *buf, const size_t bufsize);
+	int (*peek)(struct server *self, const void **msg);
+	int (*consume)(struct server *self);
 	bool (*connected)(const struct server *self);
 	uint32_t (*downtime)(const struct server *self);
+	void *(*txbuf)(struct server *self, size_t *bufsize);
 };
 
 /**
@@ -133,18 +136,38 @@ static inline int server_send(struct server *self,
 	return ((struct server_api *)self)->send(self, data, datasize);
 }
 
+/**
+ * @brief Get the transmit buffer of the server.
+ *
+ * This function returns the payload area of the transport's own transmit
+ * buffer, with any headroom the transport needs for its framing already
+ * reserved in front. Data built in place there and passed to
+ * @ref server_send is sent without being copied again. The buffer stays
+ * valid until the next call to @ref server_send.
+ *
+ * @param[in] self Pointer to the server structure.
+ * @param[out] bufsize Size of the payload area, in bytes.
+ *
+ * @return Pointer to the payload area, or NULL if the transport does not
+ *         provide one.
+ */
+static inline void *server_txbuf(struct server *self, size_t *bufsize) {
+	const struct server_api *api = (const struct server_api *)self;
+	return api->txbuf? api->txbuf(self, bufsize) : NULL;
+}
+
 /**
  * @brief Receive data from the server.
  *
- * This function receives data from the server's connection and stores
- * it in the provided buffer. It ensures that the received data does
- * not exceed the buffer size.
+ * This function copies the oldest received message into the provided
+ * buffer and removes it from the receive queue. A message that does not
+ * fit in the buffer is dropped.
  *
  * @param[in] self Pointer to the server structure.
  * @param[out] buf Pointer to the buffer where received data will be stored.
  * @param[in] bufsize Size of the buffer, in bytes.
  *
- * @return Number of bytes received on success, or a negative error code on
+ * @return Length of the message on success, or a negative error code on
  *         failure.
  */
 static inline int server_recv(struct server *self,
@@ -152,6 +175,36 @@ static inline int server_recv(struct server *self,
 	return ((struct server_api *)self)->recv(self, buf, bufsize);
 }
 
+/**
+ * @brief Get the oldest received message without copying it.
+ *
+ * Messages are queued whole by the transport, one per WebSocket message
+ * for instance, so the caller never sees a partial one. Messages larger
+ * than the transport's limit are dropped before being queued.
+ *
+ * @param[in] self Pointer to the server structure.
+ * @param[out] msg Pointer to the message in the transport's receive queue.
+ *             It stays valid until @ref server_consume is called.
+ *
+ * @return Length of the message in bytes, or a negative error code if there
+ *         is none.
+ */
+static inline int server_peek(struct server *self, const void **msg) {
+	return ((struct server_api *)self)->peek(self, msg);
+}
+
+/**
+ * @brief Remove the message returned by @ref server_peek from the receive
+ *        queue.
+ *
+ * @param[in] self Pointer to the server structure.
+ *
+ * @return 0 on success, or a negative error code if there is no message.
+ */
+static inline int server_consume(struct server *self) {
+	return ((struct server_api *)self)->consume(self);
+}
+
 /**
  * @brief Check if the server is connected.
  *
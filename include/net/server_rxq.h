@@ -0,0 +1,131 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2024 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef SERVER_RXQ_H
+#define SERVER_RXQ_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Receive queue shared by the server transports. Each received message is
+ * kept as one length-prefixed record, stored contiguously so that the
+ * reader can parse it in place without copying it out first.
+ *
+ * A single writer (the transport's receive callback) and a single reader
+ * may run in different threads. */
+struct server_rxq;
+
+/**
+ * @brief Create a receive queue.
+ *
+ * @param[in] capacity Size of the queue storage in bytes.
+ * @param[in] msg_maxlen Largest message accepted, in bytes. Messages
+ *            longer than this are dropped at @ref server_rxq_begin or
+ *            @ref server_rxq_append. It is capped to what fits in
+ *            @p capacity.
+ *
+ * @return Pointer to the queue, or NULL on failure.
+ */
+struct server_rxq *server_rxq_create(const size_t capacity,
+		const size_t msg_maxlen);
+void server_rxq_destroy(struct server_rxq *self);
+
+/**
+ * @brief Start a new message.
+ *
+ * Room for @p sizehint bytes is reserved up front. A message that is still
+ * open is dropped.
+ *
+ * @param[in] self Pointer to the queue.
+ * @param[in] sizehint Expected message length, in bytes. The message may
+ *            grow beyond it if there is room left.
+ *
+ * @return 0 on success, -EMSGSIZE if @p sizehint exceeds the message size
+ *         limit, or -ENOSPC if the queue is full.
+ */
+int server_rxq_begin(struct server_rxq *self, const size_t sizehint);
+
+/**
+ * @brief Append a fragment to the message started by @ref server_rxq_begin.
+ *
+ * The message is dropped when it does not fit anymore, and any fragment
+ * that follows is ignored until the next @ref server_rxq_begin.
+ *
+ * @return 0 on success, -ENOENT if no message is open, -EMSGSIZE if the
+ *         message exceeds the size limit, or -ENOSPC if the queue is full.
+ */
+int server_rxq_append(struct server_rxq *self,
+		const void *data, const size_t datasize);
+
+/**
+ * @brief Complete the open message and make it visible to the reader.
+ *
+ * @return 0 on success, or -ENOENT if no message is open.
+ */
+int server_rxq_end(struct server_rxq *self);
+
+/**
+ * @brief Get the oldest message without removing it from the queue.
+ *
+ * @param[in] self Pointer to the queue.
+ * @param[out] msg Pointer to the message in the queue storage. It stays
+ *             valid until @ref server_rxq_consume is called.
+ *
+ * @return Length of the message in bytes, or -ENODATA if the queue is
+ *         empty.
+ */
+int server_rxq_peek(struct server_rxq *self, const void **msg);
+
+/**
+ * @brief Remove the oldest message from the queue.
+ *
+ * @return 0 on success, or -ENODATA if the queue is empty.
+ */
+int server_rxq_consume(struct server_rxq *self);
+
+/**
+ * @brief Copy out and remove the oldest message from the queue.
+ *
+ * @return Length of the message in bytes, -ENODATA if the queue is empty,
+ *         or -EMSGSIZE if the message does not fit in @p bufsize. The
+ *         message is removed in that case as well.
+ */
+int server_rxq_read(struct server_rxq *self, void *buf, const size_t bufsize);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* SERVER_RXQ_H */
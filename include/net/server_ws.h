@@ -75,6 +75,20 @@ struct ws_param {
 	uint32_t ping_interval_sec;
 
 	size_t rxq_maxsize; /* Maximum size of the receive queue in bytes. */
+	/* Largest message accepted, in bytes. Larger ones are dropped as they
+	 * arrive. 0 for as large as the receive queue allows. */
+	size_t rxmsg_maxsize;
+
+	/* RFC 7692 permessage-deflate, offered to the server when enabled.
+	 * The window size bounds the memory it takes per connection: about
+	 * 2^window_bits bytes to inflate and 2^(window_bits+2) +
+	 * 2^(mem_level+9) bytes to deflate. Only the host port offers it so
+	 * far. The esp-idf port ignores these and runs uncompressed. */
+	struct {
+		bool enabled;
+		uint8_t window_bits; /* 9 to 15. 0 for 15. */
+		uint8_t mem_level; /* 1 to 9. 0 for the library default. */
+	} deflate;
 
 	/* This is a flag to indicate whether the server should be started and
 	 * stopped manually. If set to true, the server will not start or stop
@@ -90,8 +104,13 @@ struct ws_server;
 typedef void (*ws_receive_cb_t)(struct ws_server *srv,
 		const void *data, const size_t datasize, void *ctx);
 
+/* How many instances can be made is up to the port. The host port makes a
+ * new one on every call, all serviced by a single thread in which the
+ * receive callback runs. */
 struct server *ws_create_server(const struct ws_param *param,
 		ws_receive_cb_t cb, void *cb_ctx);
+/* The connection is closed and the instance freed asynchronously. It must
+ * not be used once this is called. */
 void ws_delete_server(struct ws_server *srv);
 
 #if defined(__cplusplus)
@@ -0,0 +1,179 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if !defined(PERSIST_QUEUE_MAX)
+#define PERSIST_QUEUE_MAX		4
+#endif
+#if !defined(PERSIST_DATA_MAXLEN)
+/* Large enough for ocpp.config, the largest value persisted. */
+#define PERSIST_DATA_MAXLEN		576
+#endif
+#if !defined(PERSIST_KEY_MAXLEN)
+#define PERSIST_KEY_MAXLEN		32
+#endif
+
+typedef enum {
+	PERSIST_PRIO_LOW,	/**< Configuration changes */
+	PERSIST_PRIO_NORMAL,	/**< Periodic state like energy counters */
+	PERSIST_PRIO_HIGH,	/**< Billing related state */
+} persist_prio_t;
+
+/**
+ * @brief Function committing a value to non-volatile storage.
+ *
+ * It runs in the context of the persistence worker, or in the caller context
+ * of @ref persist_flush.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+typedef int (*persist_writer_t)(const char *key,
+		const void *data, size_t datasize);
+
+/**
+ * @brief Completion callback of a persistence request.
+ *
+ * It is called with no lock of the module held, so it may request or flush
+ * again.
+ *
+ * @param[in] key The key of the request.
+ * @param[in] err 0 on success, -ECANCELED when superseded by a newer request
+ *            for the same key, or the error returned by the writer.
+ * @param[in] ctx User context given with the request.
+ */
+typedef void (*persist_done_cb_t)(const char *key, int err, void *ctx);
+
+/**
+ * @brief Initialize the persistence queue.
+ *
+ * Requests are queued but not committed until @ref persist_start is called
+ * or @ref persist_step is run.
+ *
+ * @param[in] writer Function to commit a value.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int persist_init(persist_writer_t writer);
+
+/**
+ * @brief Start the persistence worker.
+ *
+ * The worker commits queued requests in its own thread so that slow flash
+ * writes do not stall the caller.
+ *
+ * @return 0 on success, -EALREADY if already started, or negative error code
+ *         on failure.
+ */
+int persist_start(void);
+
+/**
+ * @brief Stop the persistence worker.
+ *
+ * Pending requests are committed before returning.
+ */
+void persist_deinit(void);
+
+/**
+ * @brief Queue a value to be committed to non-volatile storage.
+ *
+ * The data is copied into a slot of a fixed pool, so the caller may reuse
+ * the buffer right away. A
+ * pending request for the same key is replaced by the new one, taking the
+ * higher priority of the two. Requests are committed in priority order, and
+ * in request order within the same priority.
+ *
+ * If the queue is full or the data is larger than @ref PERSIST_DATA_MAXLEN,
+ * the value is committed synchronously in the caller context.
+ *
+ * A return of 0 means the value is queued, not that it is durable. The
+ * outcome of the commit is given to @p cb.
+ *
+ * @param[in] key Key of the value.
+ * @param[in] data Data to be written.
+ * @param[in] datasize Size of the data.
+ * @param[in] prio Priority of the request.
+ * @param[in] cb Completion callback. Can be NULL.
+ * @param[in] cb_ctx User context passed to the callback.
+ *
+ * @return 0 when queued or committed synchronously, negative error code on
+ *         failure.
+ */
+int persist_request(const char *key, const void *data, size_t datasize,
+		persist_prio_t prio, persist_done_cb_t cb, void *cb_ctx);
+
+/**
+ * @brief Durability barrier.
+ *
+ * Commits the pending requests of @p min_prio or higher in the caller context
+ * and waits for the one in progress, if any. Once it returns, those requests
+ * made before the call are durable. Lower priority requests are left to the
+ * worker.
+ *
+ * @param[in] min_prio Lowest priority to commit. @ref PERSIST_PRIO_LOW
+ *            commits everything.
+ *
+ * @return 0 on success, or the first error returned by the writer.
+ */
+int persist_flush(persist_prio_t min_prio);
+
+/**
+ * @brief Get the number of pending requests.
+ *
+ * @return The number of requests waiting to be committed.
+ */
+size_t persist_pending(void);
+
+/**
+ * @brief Commit every pending request.
+ *
+ * This is what the worker runs on each wakeup. It is exposed to drive the
+ * queue without the worker.
+ *
+ * @return 0 on success, or the first error returned by the writer.
+ */
+int persist_step(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* PERSIST_H */
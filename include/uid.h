@@ -37,6 +37,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -57,13 +59,54 @@ typedef enum {
 typedef void (*uid_update_cb_t)(const uid_id_t id, uid_status_t status,
 		time_t expiry, void *ctx);
 
+/**
+ * @brief Callback invoked once per `uid_update_batch()` call.
+ *
+ * @param[in] nr_updated Number of UIDs inserted or updated.
+ * @param[in] nr_removed Number of UIDs removed.
+ * @param[in] version    List version the store now holds.
+ * @param[in] ctx        User-defined context.
+ */
+typedef void (*uid_batch_cb_t)(size_t nr_updated, size_t nr_removed,
+		uint32_t version, void *ctx);
+
+typedef enum {
+	UID_BATCH_DIFFERENTIAL, /**< Apply entries on top of the store. */
+	UID_BATCH_FULL, /**< Replace the whole store with the entries. */
+} uid_batch_mode_t;
+
+struct uid_batch_entry {
+	uid_id_t id;
+	uid_id_t pid; /**< Ignored for removals. */
+	/** UID_STATUS_UNKNOWN removes the UID, like an entry without
+	 * idTagInfo in a differential SendLocalList. */
+	uid_status_t status;
+	time_t expiry; /**< Ignored for removals. */
+};
+
 struct uid_store;
+struct uid_snapshot;
 struct fs;
 
 struct uid_store_config {
 	struct fs *fs; /**< Filesystem backend to use. */
 	const char *ns; /**< Filesystem namespace for isolation (e.g., "localList", "cache"). */
 	uint16_t capacity; /**< Maximum number of entries in RAM. */
+	/** If set, all cache entries are preallocated in one block of at most
+	 * this many bytes, which may lower the capacity. Otherwise each entry
+	 * is allocated from the heap on demand. */
+	size_t ram_budget;
+	/** Size of the negative lookup Bloom filter in bytes. It lets lookups
+	 * of unknown IDs return without touching flash. 0 to disable. */
+	uint32_t bloom_size;
+	/** Purge records past their expiry in `uid_compact()`. Records with
+	 * no expiry (0) are kept. */
+	bool expire;
+	/** Read-only copy of the store in its own flash partition, looked up
+	 * before the bucket files while it is up to date. It goes stale on
+	 * any change and is rebuilt by `uid_refresh_snapshot()`. NULL to
+	 * disable. */
+	struct uid_snapshot *snapshot;
 };
 
 /**
@@ -107,13 +150,15 @@ int uid_update(struct uid_store *store, const uid_id_t id,
 		const uid_id_t pid, uid_status_t status, time_t expiry);
 
 /**
- * @brief Removes a UID entry from the store (RAM only).
+ * @brief Removes a UID entry from the store (cache + persistent storage).
  *
- * This function explicitly purges the UID from the in-memory cache.
- * It does not affect any persistent storage or remote server state.
+ * This function purges the UID from the in-memory cache and overwrites its
+ * record in flash with a tombstone, which a later compaction reclaims. The
+ * snapshot, if any, is invalidated and rebuilt by the next
+ * @ref uid_refresh_snapshot. Remote server state is not affected.
  *
  * @param[in] store The UID store instance.
- * @param[in] id    The UID to remove from the cache.
+ * @param[in] id    The UID to remove.
  *
  * @return 0 on success, negative value if the UID was not found.
  */
@@ -147,6 +192,97 @@ uid_status_t uid_status(struct uid_store *store,
  */
 int uid_clear(struct uid_store *store);
 
+/**
+ * @brief Updates many UIDs at once, e.g. for SendLocalList.
+ *
+ * Entries are sorted in place by bucket file and each file is merged with a
+ * single read-modify-write pass. Unlike `uid_update()`, nothing is logged per
+ * entry and the update callback is not called. Instead, the batch callback
+ * is called once with the totals. If the same UID appears more than once,
+ * which one is applied is unspecified.
+ *
+ * @param[in] store   The UID store instance.
+ * @param[in] entries Entries to apply. Reordered by the call.
+ * @param[in] n       Number of entries.
+ * @param[in] mode    `UID_BATCH_FULL` clears the store first.
+ *                    `UID_BATCH_DIFFERENTIAL` applies on top of it and is
+ *                    rejected unless @p version is newer than the stored one.
+ * @param[in] version List version to store once all entries are applied.
+ *
+ * @return 0 on success, -ESTALE when a differential update is not newer than
+ *         the stored version, or another negative error code on failure.
+ */
+int uid_update_batch(struct uid_store *store,
+		struct uid_batch_entry *entries, const size_t n,
+		const uid_batch_mode_t mode, const uint32_t version);
+
+/**
+ * @brief Returns the list version set by the last `uid_update_batch()`.
+ *
+ * @param[in] store The UID store instance.
+ *
+ * @return The version, or 0 if none has been stored or after `uid_clear()`.
+ */
+uint32_t uid_version(struct uid_store *store);
+
+/**
+ * @brief Registers a callback to be invoked once per `uid_update_batch()`.
+ *
+ * @param[in] store The UID store instance.
+ * @param[in] cb    The callback function to register.
+ * @param[in] ctx   A user-defined context pointer passed to the callback.
+ *
+ * @return 0 on success, negative value on failure.
+ */
+int uid_register_batch_cb(struct uid_store *store,
+		uid_batch_cb_t cb, void *ctx);
+
+/**
+ * @brief Reclaims flash taken by removed and expired records.
+ *
+ * Buckets with the most removed records are rewritten first. The remaining
+ * time goes to sweeping all buckets in order, which also drops expired
+ * records if enabled and collects the usage reported by `uid_usage()`. Both
+ * stop once @p budget_ms is used up and the sweep resumes from there on the
+ * next call, so it is meant to be called periodically in the background.
+ *
+ * @param[in] store     The UID store instance.
+ * @param[in] budget_ms Time budget for this call in milliseconds. A bucket
+ *                      being rewritten is always finished, so it may be
+ *                      exceeded by the time of one bucket.
+ *
+ * @return 0 on success, negative value on failure.
+ */
+int uid_compact(struct uid_store *store, uint32_t budget_ms);
+
+/**
+ * @brief Returns the flash usage found by the last complete sweep.
+ *
+ * @param[in]  store The UID store instance.
+ * @param[out] live  Bytes taken by live records (can be NULL).
+ * @param[out] dead  Bytes of removed or expired records the sweep found and
+ *                   reclaimed (can be NULL).
+ *
+ * @return 0 on success, -ENODATA if no sweep has completed yet.
+ */
+int uid_usage(struct uid_store *store, size_t *live, size_t *dead);
+
+/**
+ * @brief Rebuilds the snapshot of the store if it has gone stale.
+ *
+ * Building reads every record in the store, so call it from a thread of its
+ * own. Lookups and changes may go on meanwhile on other threads; a change
+ * cancels the build. A build that failed is not retried until the store
+ * changes.
+ *
+ * @param[in] store The UID store instance.
+ *
+ * @return 0 on success, -ENOTSUP if the store has no snapshot, -ECANCELED if
+ *         the store changed while building or other negative error code on
+ *         failure.
+ */
+int uid_refresh_snapshot(struct uid_store *store);
+
 /**
  * @brief Registers a callback to be invoked when a UID is updated.
  *
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef UID_SNAPSHOT_H
+#define UID_SNAPSHOT_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "uid.h"
+
+struct uid_snapshot;
+struct flash;
+
+/* Called once per record during a build. A record starts with its
+ * uid_id_t. */
+typedef int (*uid_snapshot_visit_t)(const void *record, void *ctx);
+/* Calls `visit` on every record of the source and returns 0 on success. */
+typedef int (*uid_snapshot_iter_t)(void *source,
+		uid_snapshot_visit_t visit, void *ctx);
+/* Polled during a build, which gives up with -ECANCELED once it returns
+ * true. */
+typedef bool (*uid_snapshot_cancel_t)(void *source);
+
+/**
+ * @brief Opens the snapshot kept in a dedicated flash partition.
+ *
+ * The partition is memory mapped, so lookups are plain loads from flash
+ * with neither filesystem nor heap involved.
+ *
+ * @param[in] flash Partition holding the snapshot.
+ *
+ * @return Snapshot instance, or NULL if the partition can not be mapped.
+ */
+struct uid_snapshot *uid_snapshot_create(struct flash *flash);
+
+void uid_snapshot_destroy(struct uid_snapshot *snap);
+
+/**
+ * @brief Writes a new snapshot of the records provided by `iter`.
+ *
+ * The records are placed by a minimal perfect hash of their IDs, so a
+ * lookup reads exactly one record. The header goes last, so the snapshot
+ * stays invalid if the build is interrupted.
+ *
+ * @param[in] snap     The snapshot instance.
+ * @param[in] tag      Identifies the snapshot, checked by
+ *                     `uid_snapshot_is_valid()`.
+ * @param[in] rec_size Size of a record in bytes.
+ * @param[in] iter     Iterates the records. Called more than once and
+ *                     expected to yield the same records each time.
+ * @param[in] canceled Polled between sectors erased, chunks written and
+ *                     records placed. NULL if the build can not be
+ *                     canceled.
+ * @param[in] source   Passed to `iter` and `canceled`.
+ *
+ * @return 0 on success, -ENOSPC if the records do not fit the partition,
+ *         -ECANCELED if canceled or other negative error code on failure.
+ */
+int uid_snapshot_build(struct uid_snapshot *snap, uint32_t tag,
+		size_t rec_size, uid_snapshot_iter_t iter,
+		uid_snapshot_cancel_t canceled, void *source);
+
+/**
+ * @brief Erases the snapshot header so that it is no longer used.
+ *
+ * Call it before the source records change, not after, so that a power
+ * loss in between can not leave a stale snapshot behind.
+ *
+ * @param[in] snap The snapshot instance.
+ *
+ * @return 0 on success, negative error code on failure.
+ */
+int uid_snapshot_invalidate(struct uid_snapshot *snap);
+
+bool uid_snapshot_is_valid(const struct uid_snapshot *snap, uint32_t tag);
+
+/**
+ * @brief Looks up a record by ID.
+ *
+ * @param[in]  snap     The snapshot instance.
+ * @param[in]  id       The UID to look up.
+ * @param[out] record   Buffer to copy the record into.
+ * @param[in]  rec_size Size of the buffer, which must match the record size
+ *                      the snapshot was built with.
+ *
+ * @return 0 if found, -ENOENT if not, or -ENODATA if there is no valid
+ *         snapshot.
+ */
+int uid_snapshot_find(const struct uid_snapshot *snap,
+		const uid_id_t id, void *record, size_t rec_size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* UID_SNAPSHOT_H */
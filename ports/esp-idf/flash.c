@@ -30,28 +30,34 @@
  * incidental, special, or consequential, arising from the use of this software.
  */
 
-#include "libmcu/flash.h"
+#include "flash_mmap.h"
 #include <errno.h>
 #include "esp_partition.h"
 #include "libmcu/compiler.h"
 
 #define FS_PARTITION			"fs"
+#define UID_SNAPSHOT_PARTITION		"uidsnap"
+/* Custom data subtype in partitions.csv */
+#define UID_SNAPSHOT_SUBTYPE		0x40
 
 struct flash {
 	struct flash_api api;
+	const char *label;
+	esp_partition_subtype_t subtype;
+
+	const void *map;
+	esp_partition_mmap_handle_t map_handle;
 };
 
-static const esp_partition_t *get_partition(void)
+static const esp_partition_t *get_partition(struct flash *self)
 {
 	return esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
-			ESP_PARTITION_SUBTYPE_DATA_LITTLEFS, FS_PARTITION);
+			self->subtype, self->label);
 }
 
 static int do_erase(struct flash *self, uintptr_t offset, size_t size)
 {
-	unused(self);
-
-	const esp_partition_t *partition = get_partition();
+	const esp_partition_t *partition = get_partition(self);
 
 	if (partition == NULL) {
 		return -ENODEV;
@@ -65,9 +71,7 @@ static int do_erase(struct flash *self, uintptr_t offset, size_t size)
 static int do_write(struct flash *self,
 		uintptr_t offset, const void *data, size_t len)
 {
-	unused(self);
-
-	const esp_partition_t *partition = get_partition();
+	const esp_partition_t *partition = get_partition(self);
 
 	if (partition == NULL) {
 		return -ENODEV;
@@ -80,9 +84,7 @@ static int do_write(struct flash *self,
 
 static int do_read(struct flash *self, uintptr_t offset, void *buf, size_t len)
 {
-	unused(self);
-
-	const esp_partition_t *partition = get_partition();
+	const esp_partition_t *partition = get_partition(self);
 
 	if (partition == NULL) {
 		return -ENODEV;
@@ -99,20 +101,57 @@ static size_t do_size(struct flash *self)
 	return -ENOTSUP;
 }
 
+/* esp_flash invalidates the cache of mapped regions on write, so the
+ * mapping keeps up with later writes. */
+const void *flash_mmap(struct flash *flash, size_t *size)
+{
+	const esp_partition_t *partition = get_partition(flash);
+
+	if (partition == NULL) {
+		return NULL;
+	}
+
+	if (flash->map == NULL && esp_partition_mmap(partition, 0,
+			partition->size, ESP_PARTITION_MMAP_DATA,
+			&flash->map, &flash->map_handle) != ESP_OK) {
+		flash->map = NULL;
+		return NULL;
+	}
+
+	if (size) {
+		*size = partition->size;
+	}
+
+	return flash->map;
+}
+
 struct flash *flash_create(int partition)
 {
-	static struct flash fs_partition = {
-		.api = {
-			.erase = do_erase,
-			.write = do_write,
-			.read = do_read,
-			.size = do_size,
+	static struct flash partitions[] = {
+		[FLASH_PARTITION_FS] = {
+			.label = FS_PARTITION,
+			.subtype = ESP_PARTITION_SUBTYPE_DATA_LITTLEFS,
+		},
+		[FLASH_PARTITION_UID_SNAPSHOT] = {
+			.label = UID_SNAPSHOT_PARTITION,
+			.subtype = (esp_partition_subtype_t)
+				UID_SNAPSHOT_SUBTYPE,
 		},
 	};
 
-	if (partition != 0) {
+	if (partition < 0 || (size_t)partition >=
+			sizeof(partitions) / sizeof(*partitions)) {
 		return NULL;
 	}
 
-	return &fs_partition;
+	struct flash *flash = &partitions[partition];
+
+	flash->api = (struct flash_api) {
+		.erase = do_erase,
+		.write = do_write,
+		.read = do_read,
+		.size = do_size,
+	};
+
+	return flash;
 }
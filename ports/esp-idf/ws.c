@@ -32,6 +32,7 @@
 
 #include "net/server_ws.h"
 #include "net/netmgr.h"
+#include "net/server_rxq.h"
 
 #include <string.h>
 #include <errno.h>
@@ -41,7 +42,7 @@
 #include "libmcu/retry.h"
 #include "libmcu/board.h"
 #include "libmcu/apptmr.h"
-#include "libmcu/ringbuf.h"
+#include "libmcu/metrics.h"
 #include "logger.h"
 
 #define DEFAULT_TIMEOUT_MS		(10U/*sec*/ * 1000)
@@ -56,6 +57,10 @@
 
 #define KEEP_ENABLED
 
+#define WS_OPCODE_CONTINUATION		0x00
+#define WS_OPCODE_BINARY		0x02
+#define WS_OPCODE_CLOSE			0x08
+
 struct ws_server {
 	struct server_api api;
 
@@ -66,7 +71,7 @@ struct ws_server {
 	esp_websocket_client_handle_t handle;
 	struct retry retry;
 	struct apptmr *timer;
-	struct ringbuf *rxq;
+	struct server_rxq *rxq;
 
 	time_t offline; /* the time when the server connection was lost */
 	uint32_t timestamp;
@@ -169,6 +174,37 @@ static void on_net_event(const netmgr_state_t event, void *ctx)
 	}
 }
 
+static void on_receive(struct ws_server *ws,
+		const esp_websocket_event_data_t *data)
+{
+	const size_t len = (size_t)data->data_len;
+	const bool first_chunk = data->payload_offset == 0;
+	const bool last_chunk = data->payload_offset + data->data_len
+		>= data->payload_len;
+	int err = 0;
+
+	/* no compression on this transport, see init() */
+	metrics_increase_by(WsRxPayloadBytes, (int32_t)len);
+	metrics_increase_by(WsRxWireBytes, (int32_t)len);
+
+	/* A message may come in several frames, continuation frames having
+	 * opcode 0, and a frame in several chunks. They are put together in
+	 * the receive queue. */
+	if (data->op_code != WS_OPCODE_CONTINUATION && first_chunk) {
+		err = server_rxq_begin(ws->rxq, (size_t)data->payload_len);
+	}
+	if (!err) {
+		err = server_rxq_append(ws->rxq, data->data_ptr, len);
+	}
+	if (!err && data->fin && last_chunk) {
+		err = server_rxq_end(ws->rxq);
+	}
+
+	if (err && err != -ENOENT) { /* -ENOENT for the rest of a dropped one */
+		error("message dropped: %d", err);
+	}
+}
+
 static void on_ws_event(void *ctx,
 		esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -204,15 +240,11 @@ static void on_ws_event(void *ctx,
 		error("websocket event: %d", event_id);
 		break;
 	case WEBSOCKET_EVENT_DATA:
-		if (data->op_code == 0x08 && data->data_len == 2) {
+		if (data->op_code == WS_OPCODE_CLOSE && data->data_len == 2) {
 			info("Received closed message with code=%d",
 				256 * data->data_ptr[0] + data->data_ptr[1]);
-		} else {
-			if (ringbuf_write(ws->rxq, data->data_ptr,
-					(size_t)data->data_len)
-					!= (size_t)data->data_len) {
-				error("rxq overflow");
-			}
+		} else if (data->op_code <= WS_OPCODE_BINARY) {
+			on_receive(ws, data);
 
 			if (ws->cb) {
 				(*ws->cb)(ws, data->data_ptr, (size_t)
@@ -238,21 +270,34 @@ static int send_data(struct server *srv,
 		return -ENOTCONN;
 	}
 
-	return esp_websocket_client_send_text(ws->handle, data, (int)datasize,
+	const int n = esp_websocket_client_send_text(ws->handle,
+			data, (int)datasize,
 			pdMS_TO_TICKS(ws->param.write_timeout_ms));
+
+	if (n > 0) {
+		metrics_increase_by(WsTxPayloadBytes, n);
+		metrics_increase_by(WsTxWireBytes, n);
+	}
+
+	return n;
 }
 
 static int recv_data(struct server *srv, void *buf, const size_t bufsize)
 {
 	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_read(ws->rxq, buf, bufsize);
+}
 
-	if (ringbuf_length(ws->rxq) == 0) {
-		return -ENODATA;
-	}
-
-	size_t len = ringbuf_read(ws->rxq, 0, buf, bufsize);
+static int peek_data(struct server *srv, const void **msg)
+{
+	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_peek(ws->rxq, msg);
+}
 
-	return (int)len;
+static int consume_data(struct server *srv)
+{
+	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_consume(ws->rxq);
 }
 
 static bool connected(const struct server *srv)
@@ -334,6 +379,14 @@ static int init(struct ws_server *ws)
 		.user_agent = "Pazzk Websocket Client",
 	};
 
+	/* esp_transport_ws drops the RSV1 bit of received frames, so a
+	 * compressed message could not be told from a plain one. The
+	 * extension is not offered until the transport reports it, and the
+	 * connection runs uncompressed meanwhile. */
+	if (ws->param.deflate.enabled) {
+		warn("permessage-deflate not supported; sending uncompressed");
+	}
+
 	if (strlen(ws->param.auth.id) > 0 && strlen(ws->param.auth.pass) > 0) {
 		conf.username = ws->param.auth.id;
 		conf.password = ws->param.auth.pass;
@@ -360,6 +413,8 @@ struct server *ws_create_server(const struct ws_param *param,
 			.disconnect = disconnect_from_server,
 			.send = send_data,
 			.recv = recv_data,
+			.peek = peek_data,
+			.consume = consume_data,
 			.connected = connected,
 			.downtime = downtime,
 		},
@@ -374,7 +429,8 @@ struct server *ws_create_server(const struct ws_param *param,
 		ws.param.tls.cert_len += 1;
 	}
 
-	ws.rxq = ringbuf_create(ws.param.rxq_maxsize);
+	ws.rxq = server_rxq_create(ws.param.rxq_maxsize,
+			ws.param.rxmsg_maxsize? ws.param.rxmsg_maxsize : SIZE_MAX);
 	ws.cb = cb;
 	ws.cb_ctx = cb_ctx;
 
@@ -36,9 +36,13 @@
 #include <termios.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "libmcu/compiler.h"
 #include "libmcu/cli.h"
+#include "libmcu/metrics.h"
+#include "libmcu/board.h"
 
 #include "charger/factory.h"
 #include "charger/ocpp.h"
@@ -52,15 +56,103 @@
 
 #include "ocpp/ocpp.h"
 #include "config.h"
+#include "persist.h"
 #include "uid.h"
+#include "uid_snapshot.h"
+#include "flash_mmap.h"
 #include "logger.h"
 
+/* The same as on the board, so that the simulator runs the UID stores as
+ * the firmware does. See src/app.c. */
+#if !defined(MAX_AUTH_CACHE_SIZE)
+#define MAX_AUTH_CACHE_SIZE		1024
+#endif
+#if !defined(MAX_AUTH_LOCAL_LIST_SIZE)
+#define MAX_AUTH_LOCAL_LIST_SIZE	1024
+#endif
+#if !defined(AUTH_CACHE_RAM_BUDGET)
+#define AUTH_CACHE_RAM_BUDGET		(4U * 1024U)
+#endif
+#if !defined(AUTH_LOCAL_LIST_RAM_BUDGET)
+#define AUTH_LOCAL_LIST_RAM_BUDGET	(2U * 1024U)
+#endif
+#if !defined(AUTH_CACHE_BLOOM_SIZE)
+#define AUTH_CACHE_BLOOM_SIZE		1024
+#endif
+#if !defined(AUTH_LOCAL_LIST_BLOOM_SIZE)
+#define AUTH_LOCAL_LIST_BLOOM_SIZE	8192
+#endif
+#if !defined(UID_GC_INTERVAL_MS)
+#define UID_GC_INTERVAL_MS		60000U
+#endif
+#if !defined(UID_GC_BUDGET_MS)
+#define UID_GC_BUDGET_MS		20U
+#endif
+
 static struct {
 	struct cli cli;
 	struct termios orig_termios;
 	struct app *app;
+
+	struct uid_store *auth_cache;
+	struct uid_store *local_list;
+	uint32_t uid_gc_timestamp;
+
+	pthread_t uid_snapshot_thread;
+	sem_t uid_snapshot_event;
+	bool uid_snapshot_started;
 } m;
 
+static void *refresh_uid_snapshot(void *arg)
+{
+	struct uid_store *store = (struct uid_store *)arg;
+
+	for (;;) {
+		sem_wait(&m.uid_snapshot_event);
+		uid_refresh_snapshot(store);
+	}
+
+	return NULL;
+}
+
+static void start_uid_snapshot_worker(struct uid_store *store)
+{
+	if (!store) {
+		return;
+	}
+
+	sem_init(&m.uid_snapshot_event, 0, 0);
+
+	m.uid_snapshot_started = pthread_create(&m.uid_snapshot_thread, NULL,
+			refresh_uid_snapshot, store) == 0;
+
+	if (!m.uid_snapshot_started) {
+		error("Failed to start the UID snapshot worker");
+	}
+}
+
+static void collect_uid_garbage(void)
+{
+	size_t live;
+	size_t dead;
+
+	uid_compact(m.auth_cache, UID_GC_BUDGET_MS);
+	uid_compact(m.local_list, UID_GC_BUDGET_MS);
+
+	if (m.uid_snapshot_started) {
+		sem_post(&m.uid_snapshot_event);
+	}
+
+	if (uid_usage(m.auth_cache, &live, &dead) == 0) {
+		metrics_set(UIDCacheLiveBytes, METRICS_VALUE(live));
+		metrics_set(UIDCacheDeadBytes, METRICS_VALUE(dead));
+	}
+	if (uid_usage(m.local_list, &live, &dead) == 0) {
+		metrics_set(UIDLocalListLiveBytes, METRICS_VALUE(live));
+		metrics_set(UIDLocalListDeadBytes, METRICS_VALUE(dead));
+	}
+}
+
 static void on_charger_event(struct charger *charger, struct connector *c,
 		charger_event_t event, void *ctx)
 {
@@ -71,8 +163,9 @@ static void on_charger_event(struct charger *charger, struct connector *c,
 		 * them persistent. */
 		const struct ocpp_checkpoint *checkpoint =
 			ocpp_charger_get_checkpoint(charger);
-		config_set_and_save("ocpp.checkpoint",
-				checkpoint, sizeof(*checkpoint));
+		persist_request("ocpp.checkpoint", checkpoint,
+				sizeof(*checkpoint), PERSIST_PRIO_HIGH,
+				NULL, NULL);
 	}
 
 	if (event & OCPP_CHARGER_EVENT_CONFIGURATION_CHANGED) {
@@ -80,7 +173,8 @@ static void on_charger_event(struct charger *charger, struct connector *c,
 		void *p = calloc(1, len);
 		if (p) {
 			ocpp_copy_configuration_to(p, len);
-			config_set_and_save("ocpp.config", p, len);
+			persist_request("ocpp.config", p, len,
+					PERSIST_PRIO_LOW, NULL, NULL);
 			free(p);
 		}
 	}
@@ -128,9 +222,12 @@ static void on_connector_event(struct connector *self,
 	if (event & (CONNECTOR_EVENT_BILLING_STARTED |
 			CONNECTOR_EVENT_BILLING_ENDED)) {
 		/* The transaction ID will be saved or cleared in non-volatile
-		 * memory in case of a power failure */
-		config_set_and_save("ocpp.checkpoint",
-				checkpoint, sizeof(*checkpoint));
+		 * memory in case of a power failure. It should be durable before
+		 * going further as it is for billing. */
+		persist_request("ocpp.checkpoint", checkpoint,
+				sizeof(*checkpoint), PERSIST_PRIO_HIGH,
+				NULL, NULL);
+		persist_flush(PERSIST_PRIO_HIGH);
 	}
 }
 
@@ -138,7 +235,8 @@ static void start_charger(struct app *app)
 {
 	struct charger_param param;
 	struct charger_extension *extension;
-	app->charger = charger_factory_create(&param, &extension, NULL);
+	app->charger = charger_factory_create(&param, &extension,
+			app->fs);
 	charger_init(app->charger, &param, extension);
 	charger_register_event_cb(app->charger, on_charger_event, app->charger);
 
@@ -161,14 +259,25 @@ static void start_charger(struct app *app)
 	conn_param.cache = uid_store_create(&(const struct uid_store_config) {
 		.fs = app->fs,
 		.ns = "cache",
-		.capacity = 1024,
+		.capacity = MAX_AUTH_CACHE_SIZE,
+		.ram_budget = AUTH_CACHE_RAM_BUDGET,
+		.bloom_size = AUTH_CACHE_BLOOM_SIZE,
+		.expire = true,
 	});
 	conn_param.local_list = uid_store_create(&(const struct uid_store_config) {
 		.fs = app->fs,
 		.ns = "localList",
-		.capacity = 1024,
+		.capacity = MAX_AUTH_LOCAL_LIST_SIZE,
+		.ram_budget = AUTH_LOCAL_LIST_RAM_BUDGET,
+		.bloom_size = AUTH_LOCAL_LIST_BLOOM_SIZE,
+		.snapshot = uid_snapshot_create(
+				flash_create(FLASH_PARTITION_UID_SNAPSHOT)),
 	});
 
+	m.auth_cache = conn_param.cache;
+	m.local_list = conn_param.local_list;
+	start_uid_snapshot_worker(m.local_list);
+
 	struct connector *c = connector_factory_create(&conn_param);
 	charger_attach_connector(app->charger, c);
 	connector_register_event_cb(c, on_connector_event, app->charger);
@@ -214,8 +323,15 @@ void app_reboot(void)
 int app_process(uint32_t *next_period_ms)
 {
 #define DEFAULT_STEP_INTERVAL_MS	50
+	const uint32_t now = board_get_time_since_boot_ms();
+
 	charger_process(m.app->charger);
 
+	if (now - m.uid_gc_timestamp >= UID_GC_INTERVAL_MS) {
+		m.uid_gc_timestamp = now;
+		collect_uid_garbage();
+	}
+
 	if (next_period_ms) {
 		*next_period_ms = DEFAULT_STEP_INTERVAL_MS;
 	}
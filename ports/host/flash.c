@@ -30,20 +30,55 @@
  * incidental, special, or consequential, arising from the use of this software.
  */
 
-#include "libmcu/flash.h"
+#include "flash_mmap.h"
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "libmcu/compiler.h"
+#include "logger.h"
 
 #define FAKE_STORAGE_SIZE	(8 * 1024 * 1024)
+#define UID_SNAPSHOT_SIZE	(384 * 1024)
+
+#if !defined(FLASH_IMAGE_DEFAULT_PATH)
+#define FLASH_IMAGE_DEFAULT_PATH	"build/flash.img"
+#endif
+#if !defined(UID_SNAPSHOT_IMAGE_DEFAULT_PATH)
+#define UID_SNAPSHOT_IMAGE_DEFAULT_PATH	"build/uidsnap.img"
+#endif
+/* Path of the image file backing the flash partition. */
+#define FLASH_IMAGE_ENV		"FLASH_IMAGE"
+#define UID_SNAPSHOT_IMAGE_ENV	"UID_SNAPSHOT_IMAGE"
+/* When set to a non-zero value, the image is mapped copy-on-write: the file
+ * is opened read-only and shared among instances while every write stays in
+ * the private pages of the process and is discarded on exit. */
+#define FLASH_SNAPSHOT_ENV	"FLASH_SNAPSHOT"
+/* When set to a non-zero value, an existing image of another size than the
+ * partition is wiped and created anew. Otherwise it is left untouched and
+ * the partition is not mapped. */
+#define FLASH_RECREATE_ENV	"FLASH_RECREATE"
 
 struct flash {
 	struct flash_api api;
-	uint8_t storage[FAKE_STORAGE_SIZE];
+	uint8_t *storage;
+	size_t size;
+
+	const char *path_env;
+	const char *default_path;
+	uint8_t *fallback;
 };
 
 static int do_erase(struct flash *self, uintptr_t offset, size_t size)
 {
+	if (offset + size > self->size) {
+		return -ERANGE;
+	}
+
 	memset(&self->storage[offset], 0xff, size);
 	return 0;
 }
@@ -51,6 +86,10 @@ static int do_erase(struct flash *self, uintptr_t offset, size_t size)
 static int do_write(struct flash *self,
 		uintptr_t offset, const void *data, size_t len)
 {
+	if (offset + len > self->size) {
+		return -ERANGE;
+	}
+
 	const uint8_t *src = (const uint8_t *)data;
 	uint8_t *dst = &self->storage[offset];
 	memcpy(dst, src, len);
@@ -59,6 +98,10 @@ static int do_write(struct flash *self,
 
 static int do_read(struct flash *self, uintptr_t offset, void *buf, size_t len)
 {
+	if (offset + len > self->size) {
+		return -ERANGE;
+	}
+
 	const uint8_t *src = &self->storage[offset];
 	memcpy(buf, src, len);
 	return 0;
@@ -70,20 +113,135 @@ static size_t do_size(struct flash *self)
 	return 0;
 }
 
+static bool is_env_set(const char *name)
+{
+	const char *p = getenv(name);
+	return p && *p != '\0' && strcmp(p, "0") != 0;
+}
+
+static const char *get_image_path(const struct flash *flash)
+{
+	const char *path = getenv(flash->path_env);
+	return path && *path != '\0'? path : flash->default_path;
+}
+
+/* A newly created image is filled with 0xff as if it was erased so that the
+ * filesystem sees a blank chip on its first mount. */
+static int create_image(int fd, size_t size)
+{
+	uint8_t erased[4096];
+
+	memset(erased, 0xff, sizeof(erased));
+
+	if (ftruncate(fd, 0) != 0) {
+		return -errno;
+	}
+
+	for (size_t written = 0; written < size; written += sizeof(erased)) {
+		if (write(fd, erased, sizeof(erased)) != (ssize_t)sizeof(erased)) {
+			return -EIO;
+		}
+	}
+
+	return fsync(fd) == 0? 0 : -errno;
+}
+
+static uint8_t *map_image(const char *path, size_t size, bool snapshot)
+{
+	struct stat st;
+	uint8_t *p = NULL;
+	int fd = open(path, snapshot? O_RDONLY : O_RDWR | O_CREAT, 0600);
+
+	if (fd < 0) {
+		error("Failed to open flash image \"%s\": %d", path, errno);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		goto out;
+	}
+
+	if ((size_t)st.st_size != size) {
+		if (snapshot || (st.st_size && !is_env_set(FLASH_RECREATE_ENV))) {
+			error("Flash image \"%s\" is %ld bytes, not %lu. "
+					"Set %s=1 to recreate it.", path,
+					(long)st.st_size, (unsigned long)size,
+					FLASH_RECREATE_ENV);
+			goto out;
+		}
+		if (create_image(fd, size) != 0) {
+			goto out;
+		}
+		info("Flash image \"%s\" created.", path);
+	}
+
+	p = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+			snapshot? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		error("Failed to map flash image \"%s\": %d", path, errno);
+		p = NULL;
+	}
+out:
+	close(fd);
+	return p;
+}
+
+const void *flash_mmap(struct flash *flash, size_t *size)
+{
+	if (size) {
+		*size = flash->size;
+	}
+
+	return flash->storage;
+}
+
 struct flash *flash_create(int partition)
 {
-	static struct flash fs_partition = {
-		.api = {
+	static uint8_t fs_fallback[FAKE_STORAGE_SIZE];
+	static uint8_t uid_snapshot_fallback[UID_SNAPSHOT_SIZE];
+	static struct flash partitions[] = {
+		[FLASH_PARTITION_FS] = {
+			.size = FAKE_STORAGE_SIZE,
+			.path_env = FLASH_IMAGE_ENV,
+			.default_path = FLASH_IMAGE_DEFAULT_PATH,
+			.fallback = fs_fallback,
+		},
+		[FLASH_PARTITION_UID_SNAPSHOT] = {
+			.size = UID_SNAPSHOT_SIZE,
+			.path_env = UID_SNAPSHOT_IMAGE_ENV,
+			.default_path = UID_SNAPSHOT_IMAGE_DEFAULT_PATH,
+			.fallback = uid_snapshot_fallback,
+		},
+	};
+
+	if (partition < 0 || (size_t)partition >=
+			sizeof(partitions) / sizeof(*partitions)) {
+		return NULL;
+	}
+
+	struct flash *flash = &partitions[partition];
+
+	if (flash->storage == NULL) {
+		const char *path = get_image_path(flash);
+		const bool snapshot = is_env_set(FLASH_SNAPSHOT_ENV);
+
+		flash->api = (struct flash_api) {
 			.erase = do_erase,
 			.write = do_write,
 			.read = do_read,
 			.size = do_size,
-		},
-	};
+		};
 
-	if (partition != 0) {
-		return NULL;
+		if ((flash->storage = map_image(path,
+				flash->size, snapshot)) == NULL) {
+			warn("Falling back to volatile flash in RAM.");
+			flash->storage = flash->fallback;
+			memset(flash->storage, 0xff, flash->size);
+		} else {
+			info("Flash image \"%s\" mapped%s.", path,
+					snapshot? " as snapshot" : "");
+		}
 	}
 
-	return &fs_partition;
+	return flash;
 }
@@ -34,33 +34,46 @@
 
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <libwebsockets.h>
 #include <time.h>
 
 #include "libmcu/compiler.h"
-#include "libmcu/ringbuf.h"
 #include "libmcu/base64.h"
+#include "libmcu/list.h"
+#include "libmcu/metrics.h"
 #include "net/util.h"
+#include "net/server_rxq.h"
 #include "logger.h"
 
 #define DEFAULT_RECONNECT_INTERVAL_SEC	5
+#define DEFAULT_WRITE_TIMEOUT_MS	(10U/*sec*/ * 1000)
+#define LOOP_TICK_INTERVAL_US		LWS_US_PER_SEC
 #if !defined(URL_MAXLEN)
 #define URL_MAXLEN			128
 #endif
+#if !defined(WS_TXBUF_SIZE)
+#define WS_TXBUF_SIZE			4096
+#endif
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+#define DEFLATE_OFFER_MAXLEN		96
+#endif
 
 struct ws_server {
 	struct server_api api;
 	struct ws_param param;
+	struct list link;
 
-	struct lws_context *context;
+	/* Each instance is a vhost of the shared context, so that it keeps
+	 * its own TLS credentials and extensions. */
+	struct lws_vhost *vhost;
 	struct lws *wsi;
 
 	struct lws_context_creation_info ctx_info;
 	struct lws_client_connect_info conn_info;
 
-	struct ringbuf *rxq;
-	pthread_t thread;
+	struct server_rxq *rxq;
 
 	ws_receive_cb_t cb;
 	void *cb_ctx;
@@ -68,11 +81,57 @@ struct ws_server {
 	char host[URL_MAXLEN];
 	char path[URL_MAXLEN];
 	char header[WS_HEADER_MAXLEN];
+	char vhost_name[24];
 
 	time_t last_reconnect;
 	bool is_connected;
+
+	/* requested from other threads and carried out by the loop */
+	bool disconnect_requested;
+	bool delete_requested;
+
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+	struct lws_extension extensions[2];
+	char deflate_offer[DEFLATE_OFFER_MAXLEN];
+#endif
+	/* set while the message in progress goes through the compression, so
+	 * that its wire bytes are counted there instead */
+	bool tx_deflated;
+	bool rx_deflated;
+
+	/* A message to send is left in txbuf for the loop, which writes it
+	 * once the connection gets writable. The sender waits on tx_done until
+	 * then. tx_lock is taken after the loop lock, never before. */
+	pthread_mutex_t tx_lock;
+	pthread_cond_t tx_done;
+	size_t tx_len;
+	int tx_result;
+	bool tx_pending;
+	bool tx_requested; /* a writable callback is on the way */
+	bool tx_writing;
+
+	/* lws_write() needs LWS_PRE bytes of headroom in front of the payload
+	 * for the frame header. */
+	unsigned char txbuf[LWS_PRE + WS_TXBUF_SIZE];
 };
 
+/* All instances are serviced by a single thread on one libwebsockets
+ * context, so that many connections in a process cost no more threads. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	struct lws_context *context;
+	struct list instances;
+	lws_sorted_usec_list_t tick;
+} loop = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct ws_server *get_instance(struct lws *wsi)
+{
+	return (struct ws_server *)lws_vhost_user(lws_get_vhost(wsi));
+}
+
 static void add_basic_auth_header(struct ws_server *ws,
 		struct lws *wsi, void *in, size_t in_len)
 {
@@ -102,31 +161,229 @@ static void add_basic_auth_header(struct ws_server *ws,
 	}
 }
 
+static void on_receive(struct ws_server *ws, struct lws *wsi,
+		const void *data, const size_t datasize)
+{
+	int err = 0;
+
+	metrics_increase_by(WsRxPayloadBytes, (int32_t)datasize);
+	if (!ws->rx_deflated) {
+		metrics_increase_by(WsRxWireBytes, (int32_t)datasize);
+	}
+	if (lws_is_final_fragment(wsi)) {
+		ws->rx_deflated = false;
+	}
+
+	/* A message may come in several frames, and a frame in several
+	 * chunks. They are put together in the receive queue. */
+	if (lws_is_first_fragment(wsi)) {
+		err = server_rxq_begin(ws->rxq,
+				datasize + lws_remaining_packet_payload(wsi));
+	}
+	if (!err) {
+		err = server_rxq_append(ws->rxq, data, datasize);
+	}
+	if (!err && lws_is_final_fragment(wsi)) {
+		err = server_rxq_end(ws->rxq);
+	}
+
+	if (err && err != -ENOENT) { /* -ENOENT for the rest of a dropped one */
+		error("message dropped: %d", err);
+	}
+}
+
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+/* Wraps the permessage-deflate extension of libwebsockets to count the
+ * compressed bytes going in and out. */
+static int on_deflate(struct lws_context *context,
+		const struct lws_extension *ext, struct lws *wsi,
+		enum lws_extension_callback_reasons reason,
+		void *user, void *in, size_t len)
+{
+	struct ws_server *ws = wsi? get_instance(wsi) : NULL;
+	struct lws_ext_pm_deflate_rx_ebufs *pmdrx =
+		(struct lws_ext_pm_deflate_rx_ebufs *)in;
+	int compressed = 0;
+
+	if (reason == LWS_EXT_CB_PAYLOAD_RX) {
+		compressed = pmdrx->eb_in.len;
+	}
+
+	const int rc = lws_extension_callback_pm_deflate(context,
+			ext, wsi, reason, user, in, len);
+
+	if (!ws) {
+		return rc;
+	}
+
+	switch (reason) {
+	case LWS_EXT_CB_PAYLOAD_RX:
+		if ((compressed -= pmdrx->eb_in.len) > 0) { /* consumed */
+			metrics_increase_by(WsRxWireBytes, compressed);
+			ws->rx_deflated = true;
+		}
+		break;
+	case LWS_EXT_CB_PAYLOAD_TX:
+		metrics_increase_by(WsTxWireBytes, pmdrx->eb_out.len);
+		ws->tx_deflated = true;
+		break;
+	default:
+		break;
+	}
+
+	return rc;
+}
+
+static void set_deflate_options(struct ws_server *ws, struct lws *wsi)
+{
+	char val[4];
+
+	if (ws->param.deflate.enabled && ws->param.deflate.mem_level) {
+		snprintf(val, sizeof(val), "%u", ws->param.deflate.mem_level);
+		/* fails if the server declined the extension, which is fine */
+		lws_set_extension_option(wsi,
+				"permessage-deflate", "mem_level", val);
+	}
+}
+
+static void init_deflate(struct ws_server *ws)
+{
+	const unsigned int bits = ws->param.deflate.window_bits?
+		ws->param.deflate.window_bits : 15;
+
+	/* The server is asked to use the same window, which bounds what it
+	 * takes to inflate on this side. */
+	snprintf(ws->deflate_offer, sizeof(ws->deflate_offer),
+			"permessage-deflate; client_max_window_bits=%u; "
+			"server_max_window_bits=%u", bits, bits);
+
+	ws->extensions[0] = (struct lws_extension) {
+		.name = "permessage-deflate",
+		.callback = on_deflate,
+		.client_offer = ws->deflate_offer,
+	};
+}
+#else
+static void set_deflate_options(struct ws_server *ws, struct lws *wsi)
+{
+	unused(ws);
+	unused(wsi);
+}
+
+static void init_deflate(struct ws_server *ws)
+{
+	if (ws->param.deflate.enabled) {
+		warn("libwebsockets built without extensions. "
+				"permessage-deflate disabled.");
+	}
+}
+#endif
+
+/* Called with the tx lock held. */
+static void complete_tx(struct ws_server *ws, int result)
+{
+	if (!ws->tx_pending) {
+		return;
+	}
+
+	ws->tx_pending = false;
+	ws->tx_requested = false;
+	ws->tx_result = result;
+
+	pthread_cond_broadcast(&ws->tx_done);
+}
+
+static void fail_tx(struct ws_server *ws, int err)
+{
+	pthread_mutex_lock(&ws->tx_lock);
+	if (!ws->tx_writing) { /* or left to write_pending() to complete */
+		complete_tx(ws, err);
+	}
+	pthread_mutex_unlock(&ws->tx_lock);
+}
+
+/* Runs in the loop thread on LWS_CALLBACK_CLIENT_WRITEABLE. The tx lock is
+ * released while writing, as a failed write may close the connection and
+ * call back into on_ws_event() before returning. */
+static int write_pending(struct ws_server *ws, struct lws *wsi)
+{
+	pthread_mutex_lock(&ws->tx_lock);
+	if (!ws->tx_pending) {
+		pthread_mutex_unlock(&ws->tx_lock);
+		return 0;
+	}
+	const size_t len = ws->tx_len;
+	ws->tx_writing = true;
+	pthread_mutex_unlock(&ws->tx_lock);
+
+	ws->tx_deflated = false;
+
+	const int n = lws_write(wsi, &ws->txbuf[LWS_PRE], len, LWS_WRITE_TEXT);
+
+	if (n >= 0) {
+		metrics_increase_by(WsTxPayloadBytes, (int32_t)len);
+		if (!ws->tx_deflated) {
+			metrics_increase_by(WsTxWireBytes, (int32_t)len);
+		}
+	}
+
+	pthread_mutex_lock(&ws->tx_lock);
+	ws->tx_writing = false;
+	complete_tx(ws, (n < 0) ? -EIO : n);
+	pthread_mutex_unlock(&ws->tx_lock);
+
+	return (n < 0) ? -1 : 0; /* -1 to have the connection closed */
+}
+
+/* Runs in the loop thread, since lws_callback_on_writable() is not safe to
+ * call from others. */
+static void request_writable(struct ws_server *ws)
+{
+	pthread_mutex_lock(&ws->tx_lock);
+
+	if (ws->tx_pending && !ws->tx_requested) {
+		if (ws->wsi && ws->is_connected) {
+			ws->tx_requested = true;
+			lws_callback_on_writable(ws->wsi);
+		} else { /* queued after the connection was gone */
+			complete_tx(ws, -ENOTCONN);
+		}
+	}
+
+	pthread_mutex_unlock(&ws->tx_lock);
+}
+
 static int on_ws_event(struct lws *wsi, enum lws_callback_reasons reason,
 		void *user, void *in, size_t len)
 {
 	unused(user);
 
-	struct ws_server *ws = (struct ws_server *)
-		lws_context_user(lws_get_context(wsi));
+	struct ws_server *ws = get_instance(wsi);
+
+	if (!ws) {
+		return 0;
+	}
 
 	switch (reason) {
 	case LWS_CALLBACK_CLIENT_ESTABLISHED:
 		ws->is_connected = true;
+		set_deflate_options(ws, wsi);
 		info("connection established");
 		break;
 	case LWS_CALLBACK_CLIENT_RECEIVE:
-		if (ringbuf_write(ws->rxq, in, len) != len) {
-			error("ringbuf_write failed");
-		}
+		on_receive(ws, wsi, in, len);
 
 		if (ws->cb) {
 			ws->cb(ws, in, len, ws->cb_ctx);
 		}
 		break;
+	case LWS_CALLBACK_CLIENT_WRITEABLE:
+		return write_pending(ws, wsi);
 	case LWS_CALLBACK_CLIENT_CLOSED:
 	case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 		ws->is_connected = false;
+		ws->wsi = NULL;
+		fail_tx(ws, -ENOTCONN);
 		info("connection closed");
 		break;
 	case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER:
@@ -147,43 +404,120 @@ static struct lws_protocols protocols[] = {
 	{ 0, },
 };
 
+static void wake_loop(void);
+
+static void get_tx_deadline(const struct ws_server *ws, struct timespec *ts)
+{
+	const uint32_t timeout_ms = ws->param.write_timeout_ms?
+		ws->param.write_timeout_ms : DEFAULT_WRITE_TIMEOUT_MS;
+
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += (time_t)(timeout_ms / 1000);
+	ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+/* The message is written by the loop thread, as libwebsockets does not
+ * allow writing from others. This waits until it is written, so that the
+ * caller may build the next one in txbuf right after. */
 static int send_data(struct server *srv,
 		const void *data, const size_t datasize)
 {
 	struct ws_server *ws = (struct ws_server *)srv;
+	unsigned char *payload = &ws->txbuf[LWS_PRE];
+	struct timespec deadline;
+	int err = 0;
+
+	if (datasize > WS_TXBUF_SIZE) {
+		return -EMSGSIZE;
+	}
+	if (pthread_equal(pthread_self(), loop.thread)) {
+		return -EDEADLK; /* nobody left to write it */
+	}
+
+	pthread_mutex_lock(&ws->tx_lock);
 
 	if (!ws->is_connected) {
-		return -ENOTCONN;
+		err = -ENOTCONN;
+	} else if (ws->tx_pending) {
+		err = -EBUSY;
 	}
 
-	unsigned char buf[LWS_PRE + 4096];
+	if (err) {
+		pthread_mutex_unlock(&ws->tx_lock);
+		return err;
+	}
 
-	if (datasize > sizeof(buf) - LWS_PRE) {
-		return -EMSGSIZE;
+	if (data != payload) { /* not built in place by the caller */
+		memcpy(payload, data, datasize);
 	}
 
-	memcpy(&buf[LWS_PRE], data, datasize);
+	ws->tx_len = datasize;
+	ws->tx_pending = true;
+
+	pthread_mutex_unlock(&ws->tx_lock);
 
-	int n = lws_write(ws->wsi, &buf[LWS_PRE], datasize, LWS_WRITE_TEXT);
-	return (n < 0) ? -EIO : n;
+	wake_loop();
+
+	get_tx_deadline(ws, &deadline);
+
+	pthread_mutex_lock(&ws->tx_lock);
+
+	while (ws->tx_pending && err != ETIMEDOUT) {
+		err = pthread_cond_timedwait(&ws->tx_done,
+				&ws->tx_lock, &deadline);
+	}
+	while (ws->tx_pending && ws->tx_writing) { /* too late to take back */
+		pthread_cond_wait(&ws->tx_done, &ws->tx_lock);
+	}
+
+	if (ws->tx_pending) { /* not even started, so taken back */
+		ws->tx_pending = false;
+		ws->tx_requested = false;
+		err = -ETIMEDOUT;
+	} else {
+		err = ws->tx_result;
+	}
+
+	pthread_mutex_unlock(&ws->tx_lock);
+
+	return err;
 }
 
-static int recv_data(struct server *srv, void *buf, const size_t bufsize)
+static void *get_txbuf(struct server *srv, size_t *bufsize)
 {
 	struct ws_server *ws = (struct ws_server *)srv;
 
-	if (ringbuf_length(ws->rxq) == 0) {
-		return -ENODATA;
+	if (bufsize) {
+		*bufsize = WS_TXBUF_SIZE;
 	}
 
-	size_t len = ringbuf_read(ws->rxq, 0, buf, bufsize);
+	return &ws->txbuf[LWS_PRE];
+}
 
-	return (int)len;
+static int recv_data(struct server *srv, void *buf, const size_t bufsize)
+{
+	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_read(ws->rxq, buf, bufsize);
 }
 
-static int connect_to_server(struct server *srv)
+static int peek_data(struct server *srv, const void **msg)
 {
 	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_peek(ws->rxq, msg);
+}
+
+static int consume_data(struct server *srv)
+{
+	struct ws_server *ws = (struct ws_server *)srv;
+	return server_rxq_consume(ws->rxq);
+}
+
+static struct lws_vhost *create_vhost(struct ws_server *ws)
+{
 	struct lws_context_creation_info *ctxcfg = &ws->ctx_info;
 
 	memset(ctxcfg, 0, sizeof(*ctxcfg));
@@ -191,21 +525,35 @@ static int connect_to_server(struct server *srv)
 	ctxcfg->protocols = protocols;
 	ctxcfg->options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
 	ctxcfg->user = ws;
+	ctxcfg->vhost_name = ws->vhost_name;
 	ctxcfg->client_ssl_key_mem = ws->param.tls.key;
 	ctxcfg->client_ssl_key_mem_len = (unsigned int)ws->param.tls.key_len;
 	ctxcfg->client_ssl_cert_mem = ws->param.tls.cert;
 	ctxcfg->client_ssl_cert_mem_len = (unsigned int)ws->param.tls.cert_len;
 	ctxcfg->client_ssl_ca_mem = ws->param.tls.ca;
 	ctxcfg->client_ssl_ca_mem_len = (unsigned int)ws->param.tls.ca_len;
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+	if (ws->param.deflate.enabled) {
+		ctxcfg->extensions = ws->extensions;
+	}
+#endif
 
-	if (!(ws->context = lws_create_context(ctxcfg))) {
+	return lws_create_vhost(loop.context, ctxcfg);
+}
+
+/* Runs in the loop thread as every call into libwebsockets must. */
+static int open_connection(struct ws_server *ws)
+{
+	if (!ws->vhost && !(ws->vhost = create_vhost(ws))) {
+		error("failed to create vhost");
 		return -ENOMEM;
 	}
 
 	memset(&ws->conn_info, 0, sizeof(ws->conn_info));
 	ws->conn_info.address = ws->host;
 	ws->conn_info.path = ws->path;
-	ws->conn_info.context = ws->context;
+	ws->conn_info.context = loop.context;
+	ws->conn_info.vhost = ws->vhost;
 	ws->conn_info.port = (int)net_get_port_from_url(ws->param.url);
 	ws->conn_info.host = ws->conn_info.address;
 	ws->conn_info.origin = "origin";
@@ -219,8 +567,8 @@ static int connect_to_server(struct server *srv)
 
 	info("connecting to %s:%d%s", ws->host, ws->conn_info.port, ws->path);
 
-	if (!(ws->wsi = lws_client_connect_via_info(&ws->conn_info))) {
-		lws_context_destroy(ws->context);
+	if (!lws_client_connect_via_info(&ws->conn_info)) {
+		ws->wsi = NULL;
 		error("failed to connect");
 		return -EIO;
 	}
@@ -228,12 +576,96 @@ static int connect_to_server(struct server *srv)
 	return 0;
 }
 
+/* Runs in the loop thread. The connection is closed synchronously, so no
+ * callback for it comes afterwards. */
+static void close_connection(struct ws_server *ws)
+{
+	if (ws->wsi) {
+		lws_set_timeout(ws->wsi, PENDING_TIMEOUT_USER_OK,
+				LWS_TO_KILL_SYNC);
+	}
+
+	ws->wsi = NULL;
+	ws->is_connected = false;
+
+	fail_tx(ws, -ENOTCONN);
+}
+
+static void destroy_instance(struct ws_server *ws)
+{
+	close_connection(ws);
+
+	if (ws->vhost) {
+		lws_vhost_destroy(ws->vhost);
+	}
+
+	list_del(&ws->link, &loop.instances);
+	server_rxq_destroy(ws->rxq);
+	pthread_cond_destroy(&ws->tx_done);
+	pthread_mutex_destroy(&ws->tx_lock);
+	free(ws);
+}
+
+static void service_instances(void)
+{
+	const time_t now = time(NULL);
+	struct list *p, *n;
+
+	pthread_mutex_lock(&loop.lock);
+
+	list_for_each_safe(p, n, &loop.instances) {
+		struct ws_server *ws = list_entry(p, struct ws_server, link);
+
+		if (ws->delete_requested) {
+			destroy_instance(ws);
+			continue;
+		}
+
+		if (ws->disconnect_requested) {
+			ws->disconnect_requested = false;
+			close_connection(ws);
+		}
+
+		if (!ws->wsi && now - ws->last_reconnect
+				>= DEFAULT_RECONNECT_INTERVAL_SEC) {
+			ws->last_reconnect = now;
+			open_connection(ws);
+		}
+
+		request_writable(ws);
+	}
+
+	pthread_mutex_unlock(&loop.lock);
+}
+
+static void wake_loop(void)
+{
+	lws_cancel_service(loop.context);
+}
+
+static int connect_to_server(struct server *srv)
+{
+	struct ws_server *ws = (struct ws_server *)srv;
+
+	pthread_mutex_lock(&loop.lock);
+	ws->last_reconnect = 0;
+	pthread_mutex_unlock(&loop.lock);
+
+	wake_loop();
+
+	return 0;
+}
+
 static int disconnect_from_server(struct server *srv)
 {
 	struct ws_server *ws = (struct ws_server *)srv;
 
-	lws_context_destroy(ws->context);
+	pthread_mutex_lock(&loop.lock);
+	ws->disconnect_requested = true;
 	ws->is_connected = false;
+	pthread_mutex_unlock(&loop.lock);
+
+	wake_loop();
 
 	return 0;
 }
@@ -256,57 +688,129 @@ static int disable(struct server *srv)
 	return 0;
 }
 
-static void *ws_thread(void *arg)
+/* Keeps the loop waking up to reconnect even when nothing else happens. */
+static void on_tick(lws_sorted_usec_list_t *sul)
 {
-	struct ws_server *ws = (struct ws_server *)arg;
+	lws_sul_schedule(loop.context, 0, sul, on_tick, LOOP_TICK_INTERVAL_US);
+}
 
-	net_get_host_from_url(ws->param.url, ws->host, sizeof(ws->host));
-	net_get_path_from_url(ws->param.url, ws->path, sizeof(ws->path));
+static void *loop_thread(void *arg)
+{
+	unused(arg);
+
+	lws_sul_schedule(loop.context, 0, &loop.tick, on_tick,
+			LOOP_TICK_INTERVAL_US);
 
 	while (1) {
-		lws_service(ws->context, 0);
+		lws_service(loop.context, 0);
+		service_instances();
+	}
 
-		if (!ws->is_connected) {
-			const time_t now = time(NULL);
+	return NULL;
+}
 
-			if (now - ws->last_reconnect
-					>= DEFAULT_RECONNECT_INTERVAL_SEC) {
-				ws->last_reconnect = now;
-				connect_to_server((struct server *)ws);
-			}
-		}
+/* Called with the loop lock held. */
+static int start_loop(void)
+{
+	struct lws_context_creation_info info;
+
+	if (loop.context) {
+		return 0;
 	}
 
-	return NULL;
+	memset(&info, 0, sizeof(info));
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT |
+		LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
+
+	list_init(&loop.instances);
+
+	if (!(loop.context = lws_create_context(&info))) {
+		return -ENOMEM;
+	}
+
+	if (pthread_create(&loop.thread, NULL, loop_thread, NULL) != 0) {
+		lws_context_destroy(loop.context);
+		loop.context = NULL;
+		return -EAGAIN;
+	}
+
+	return 0;
 }
 
 struct server *ws_create_server(const struct ws_param *param,
 		ws_receive_cb_t cb, void *cb_ctx)
 {
-	static struct ws_server ws = {
-		.api = {
-			.enable = enable,
-			.disable = disable,
-			.connect = connect_to_server,
-			.disconnect = disconnect_from_server,
-			.send = send_data,
-			.recv = recv_data,
-			.connected = connected,
-		},
+	struct ws_server *ws = (struct ws_server *)calloc(1, sizeof(*ws));
+
+	if (!ws) {
+		return NULL;
+	}
+
+	ws->api = (struct server_api) {
+		.enable = enable,
+		.disable = disable,
+		.connect = connect_to_server,
+		.disconnect = disconnect_from_server,
+		.send = send_data,
+		.recv = recv_data,
+		.peek = peek_data,
+		.consume = consume_data,
+		.connected = connected,
+		.txbuf = get_txbuf,
 	};
 
-	memcpy(&ws.param, param, sizeof(*param));
-	ws.rxq = ringbuf_create(ws.param.rxq_maxsize);
-	ws.cb = cb;
-	ws.cb_ctx = cb_ctx;
+	memcpy(&ws->param, param, sizeof(*param));
+	ws->cb = cb;
+	ws->cb_ctx = cb_ctx;
+
+	if (!(ws->rxq = server_rxq_create(ws->param.rxq_maxsize,
+			ws->param.rxmsg_maxsize?
+			ws->param.rxmsg_maxsize : SIZE_MAX))) {
+		free(ws);
+		return NULL;
+	}
+
+	net_get_host_from_url(ws->param.url, ws->host, sizeof(ws->host));
+	net_get_path_from_url(ws->param.url, ws->path, sizeof(ws->path));
+	snprintf(ws->vhost_name, sizeof(ws->vhost_name), "ws%p", (void *)ws);
+
+	init_deflate(ws);
 
-	pthread_create(&ws.thread, NULL, ws_thread, &ws);
+	pthread_mutex_init(&ws->tx_lock, NULL);
+	pthread_cond_init(&ws->tx_done, NULL);
+
+	pthread_mutex_lock(&loop.lock);
+	const int err = start_loop();
+	if (!err) {
+		list_add_tail(&ws->link, &loop.instances);
+	}
+	pthread_mutex_unlock(&loop.lock);
+
+	if (err) {
+		error("failed to start the loop: %d", err);
+		pthread_cond_destroy(&ws->tx_done);
+		pthread_mutex_destroy(&ws->tx_lock);
+		server_rxq_destroy(ws->rxq);
+		free(ws);
+		return NULL;
+	}
 
-	return (struct server *)&ws;
+	wake_loop(); /* to connect right away */
+
+	return (struct server *)ws;
 }
 
 void ws_delete_server(struct ws_server *ws)
 {
-	lws_service(ws->context, 0);
-	unused(ws);
+	if (!ws) {
+		return;
+	}
+
+	pthread_mutex_lock(&loop.lock);
+	ws->delete_requested = true;
+	pthread_mutex_unlock(&loop.lock);
+
+	wake_loop();
 }
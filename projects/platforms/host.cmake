@@ -54,8 +54,11 @@ if (CMAKE_SYSTEM_NAME STREQUAL "Darwin")
 	target_link_libraries(${PROJECT_EXECUTABLE} PRIVATE ${LWS_LIBRARIES})
 else()
 	set(LWS_WITH_CLIENT ON CACHE BOOL "Enable client support")
+	set(LWS_WITH_SERVER ON CACHE BOOL "Enable server support for the bench")
 	set(LWS_WITH_SSL ON CACHE BOOL "Enable SSL support")
 	set(LWS_WITHOUT_TESTAPPS ON CACHE BOOL "Disable test apps")
+	set(LWS_WITHOUT_EXTENSIONS OFF CACHE BOOL "Enable permessage-deflate")
+	set(LWS_WITH_ZLIB ON CACHE BOOL "Enable zlib for permessage-deflate")
 	include(FetchContent)
 	FetchContent_Declare(
 		libwebsockets
@@ -110,3 +113,164 @@ add_custom_command(
 )
 
 add_custom_target(bin ALL DEPENDS ${PROJECT_BIN})
+
+# Host benchmarks, not built by default: cmake --build <dir> -t uid_bench
+set(UID_BENCH uid_bench)
+add_executable(${UID_BENCH} EXCLUDE_FROM_ALL
+	tests/bench/uid_bench.c
+	src/uid.c
+	src/uid_snapshot.c
+	src/fs/lfs.c
+	ports/host/board.c
+)
+target_compile_definitions(${UID_BENCH}
+	PRIVATE
+		${APP_DEFS}
+		# 128MiB, enough for 100k IDs spread over every bucket file
+		LFS_FLASH_SIZE=134217728
+)
+target_include_directories(${UID_BENCH} PRIVATE ${APP_INCS})
+target_link_libraries(${UID_BENCH}
+	PRIVATE
+		warnings
+		libmcu
+		littlefs
+)
+
+set(OCPP_ENCODER_BENCH ocpp_encoder_bench)
+add_executable(${OCPP_ENCODER_BENCH} EXCLUDE_FROM_ALL
+	tests/bench/ocpp_encoder_bench.c
+	src/charger/ocpp/encoder_json.c
+	src/charger/ocpp/registry.c
+	src/charger/ocpp/lock.c
+)
+target_compile_definitions(${OCPP_ENCODER_BENCH} PRIVATE ${APP_DEFS})
+target_include_directories(${OCPP_ENCODER_BENCH}
+	PRIVATE
+		${APP_INCS}
+		${CMAKE_SOURCE_DIR}/src/charger/ocpp
+)
+target_link_libraries(${OCPP_ENCODER_BENCH}
+	PRIVATE
+		warnings
+		libmcu
+		ocpp
+)
+# allocations are counted only where GNU ld can wrap malloc
+if(NOT APPLE)
+	target_compile_definitions(${OCPP_ENCODER_BENCH} PRIVATE BENCH_WRAP_MALLOC)
+	target_link_options(${OCPP_ENCODER_BENCH}
+		PRIVATE -Wl,--wrap=malloc,--wrap=realloc)
+endif()
+
+set(OCPP_DECODER_BENCH ocpp_decoder_bench)
+add_executable(${OCPP_DECODER_BENCH} EXCLUDE_FROM_ALL
+	tests/bench/ocpp_decoder_bench.c
+	src/charger/ocpp/decoder_json.c
+	src/charger/ocpp/registry.c
+	src/charger/ocpp/msgpool.c
+	src/charger/ocpp/lock.c
+)
+target_compile_definitions(${OCPP_DECODER_BENCH}
+	PRIVATE
+		${APP_DEFS}
+		# responses are resolved against the ids the bench itself issued
+		ocpp_get_type_from_idstr=get_type_from_idstr
+)
+target_include_directories(${OCPP_DECODER_BENCH}
+	PRIVATE
+		${APP_INCS}
+		${CMAKE_SOURCE_DIR}/src/charger/ocpp
+)
+target_link_libraries(${OCPP_DECODER_BENCH}
+	PRIVATE
+		warnings
+		libmcu
+		ocpp
+)
+if(NOT APPLE)
+	target_compile_definitions(${OCPP_DECODER_BENCH} PRIVATE BENCH_WRAP_MALLOC)
+	target_link_options(${OCPP_DECODER_BENCH}
+		PRIVATE -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free)
+endif()
+
+# the charger side as in the firmware, talking to a CSMS stand-in in the
+# same process over a loopback WebSocket. GNU ld is needed to take over the
+# transport csms.c creates, so that it can be stamped.
+if(NOT APPLE)
+	set(OCPP_ROUNDTRIP_BENCH ocpp_roundtrip_bench)
+	add_executable(${OCPP_ROUNDTRIP_BENCH} EXCLUDE_FROM_ALL
+		tests/bench/ocpp_roundtrip_bench.c
+		src/charger/ocpp/csms.c
+		src/charger/ocpp/adapter.c
+		src/charger/ocpp/txqueue.c
+		src/charger/ocpp/encoder_json.c
+		src/charger/ocpp/decoder_json.c
+		src/charger/ocpp/registry.c
+		src/charger/ocpp/msgpool.c
+		src/charger/ocpp/lock.c
+		src/net/server_rxq.c
+		src/net/util.c
+		src/board.c
+		ports/host/board.c
+		ports/host/ws.c
+	)
+	target_compile_definitions(${OCPP_ROUNDTRIP_BENCH} PRIVATE ${APP_DEFS})
+	target_include_directories(${OCPP_ROUNDTRIP_BENCH}
+		PRIVATE
+			${APP_INCS}
+			${CMAKE_SOURCE_DIR}/src/charger/ocpp
+	)
+	target_link_libraries(${OCPP_ROUNDTRIP_BENCH}
+		PRIVATE
+			warnings
+			libmcu
+			ocpp
+			cjson
+			websockets_shared
+	)
+	target_link_options(${OCPP_ROUNDTRIP_BENCH}
+		PRIVATE -Wl,--wrap=ws_create_server)
+endif()
+
+# many scripted OCPP-J sessions, one connection each, against a CSMS given
+# on the command line
+set(OCPP_FLEET_BENCH ocpp_fleet_bench)
+add_executable(${OCPP_FLEET_BENCH} EXCLUDE_FROM_ALL
+	tests/bench/ocpp_fleet_bench.c
+	src/charger/ocpp/encoder_json.c
+	src/charger/ocpp/decoder_json.c
+	src/charger/ocpp/registry.c
+	src/charger/ocpp/msgpool.c
+	src/charger/ocpp/lock.c
+	src/net/server_rxq.c
+	src/net/util.c
+	ports/host/ws.c
+)
+target_compile_definitions(${OCPP_FLEET_BENCH}
+	PRIVATE
+		${APP_DEFS}
+		# responses are resolved against the call in flight of a session
+		ocpp_get_type_from_idstr=get_type_from_idstr
+)
+target_include_directories(${OCPP_FLEET_BENCH}
+	PRIVATE
+		${APP_INCS}
+		${CMAKE_SOURCE_DIR}/src/charger/ocpp
+)
+target_link_libraries(${OCPP_FLEET_BENCH}
+	PRIVATE
+		warnings
+		libmcu
+		ocpp
+		cjson
+)
+if (CMAKE_SYSTEM_NAME STREQUAL "Darwin")
+	target_include_directories(${OCPP_FLEET_BENCH}
+		PRIVATE ${LWS_INCLUDE_DIRS})
+	target_link_directories(${OCPP_FLEET_BENCH}
+		PRIVATE ${LWS_LIBRARY_DIRS})
+	target_link_libraries(${OCPP_FLEET_BENCH} PRIVATE ${LWS_LIBRARIES})
+else()
+	target_link_libraries(${OCPP_FLEET_BENCH} PRIVATE websockets_shared)
+endif()
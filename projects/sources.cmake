@@ -33,6 +33,19 @@ set(APP_DEFS
 	LOGGING_MESSAGE_MAXLEN=1500
 )
 
+# Bytes of heap preallocated for the authorization caches. Empty keeps the
+# defaults in src/app.c.
+set(AUTH_CACHE_RAM_BUDGET "" CACHE STRING "RAM budget for the auth cache")
+set(AUTH_LOCAL_LIST_RAM_BUDGET "" CACHE STRING
+	"RAM budget for the local authorization list")
+if (AUTH_CACHE_RAM_BUDGET)
+	list(APPEND APP_DEFS AUTH_CACHE_RAM_BUDGET=${AUTH_CACHE_RAM_BUDGET})
+endif()
+if (AUTH_LOCAL_LIST_RAM_BUDGET)
+	list(APPEND APP_DEFS
+		AUTH_LOCAL_LIST_RAM_BUDGET=${AUTH_LOCAL_LIST_RAM_BUDGET})
+endif()
+
 if (TARGET_PLATFORM STREQUAL "host")
 	list(APPEND APP_DEFS HOST_BUILD)
 endif()
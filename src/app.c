@@ -35,6 +35,9 @@
 #include <string.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "libmcu/cli.h"
 #include "libmcu/adc.h"
@@ -42,8 +45,11 @@
 #include "libmcu/spi.h"
 #include "libmcu/assert.h"
 #include "libmcu/compiler.h"
+#include "libmcu/metrics.h"
+#include "libmcu/board.h"
 
 #include "config.h"
+#include "persist.h"
 #include "exio.h"
 #include "lis2dw12.h"
 #include "tmp102.h"
@@ -66,6 +72,8 @@
 #include "charger/ocpp_connector.h"
 #include "ocpp/ocpp.h"
 #include "uid.h"
+#include "uid_snapshot.h"
+#include "flash_mmap.h"
 #include "logger.h"
 
 static_assert(sizeof(struct metering_energy)
@@ -84,12 +92,51 @@ static_assert((sizeof((struct config_charger *)0)->param) ==
 #if !defined(MAX_AUTH_LOCAL_LIST_SIZE)
 #define MAX_AUTH_LOCAL_LIST_SIZE	1024
 #endif
+/* In bytes. The caches are preallocated within the budget at 60 bytes per
+ * entry, so the defaults hold 68 and 32 IDs in about 6KiB of heap. The local
+ * list is mostly served from its snapshot. Boards with RAM to spare raise
+ * them through the build, e.g. -DAUTH_CACHE_RAM_BUDGET=61440 for all 1024. */
+#if !defined(AUTH_CACHE_RAM_BUDGET)
+#define AUTH_CACHE_RAM_BUDGET		(4U * 1024U)
+#endif
+#if !defined(AUTH_LOCAL_LIST_RAM_BUDGET)
+#define AUTH_LOCAL_LIST_RAM_BUDGET	(2U * 1024U)
+#endif
+/* In bytes. 8 bits per ID keep false positives around 2%. */
+#if !defined(AUTH_CACHE_BLOOM_SIZE)
+#define AUTH_CACHE_BLOOM_SIZE		1024
+#endif
+#if !defined(AUTH_LOCAL_LIST_BLOOM_SIZE)
+#define AUTH_LOCAL_LIST_BLOOM_SIZE	8192
+#endif
+
+/* UID stores are compacted in the background for up to the budget every
+ * interval. */
+#if !defined(UID_GC_INTERVAL_MS)
+#define UID_GC_INTERVAL_MS		60000U
+#endif
+#if !defined(UID_GC_BUDGET_MS)
+#define UID_GC_BUDGET_MS		20U
+#endif
+/* Rebuilding the local list snapshot reads the whole list, so it runs on a
+ * thread of its own rather than the runner. */
+#if !defined(UID_SNAPSHOT_STACK_SIZE_BYTES)
+#define UID_SNAPSHOT_STACK_SIZE_BYTES	4096U
+#endif
 
 static const char *metering_ch1_key = "chg.c1.metering";
 
 static struct {
 	struct app *app;
 	struct cli cli;
+
+	struct uid_store *auth_cache;
+	struct uid_store *local_list;
+	uint32_t uid_gc_timestamp;
+
+	pthread_t uid_snapshot_thread;
+	sem_t uid_snapshot_event;
+	bool uid_snapshot_started;
 } m;
 
 static void on_charger_event(struct charger *charger, struct connector *c,
@@ -102,8 +149,9 @@ static void on_charger_event(struct charger *charger, struct connector *c,
 		 * them persistent. */
 		const struct ocpp_checkpoint *checkpoint =
 			ocpp_charger_get_checkpoint(charger);
-		config_set_and_save("ocpp.checkpoint",
-				checkpoint, sizeof(*checkpoint));
+		persist_request("ocpp.checkpoint", checkpoint,
+				sizeof(*checkpoint), PERSIST_PRIO_HIGH,
+				NULL, NULL);
 	}
 
 	if (event & OCPP_CHARGER_EVENT_CONFIGURATION_CHANGED) {
@@ -111,7 +159,8 @@ static void on_charger_event(struct charger *charger, struct connector *c,
 		void *p = calloc(1, len);
 		if (p) {
 			ocpp_copy_configuration_to(p, len);
-			config_set_and_save("ocpp.config", p, len);
+			persist_request("ocpp.config", p, len,
+					PERSIST_PRIO_LOW, NULL, NULL);
 			free(p);
 		}
 	}
@@ -173,12 +222,28 @@ static void on_connector_event(struct connector *self,
 	if (event & (CONNECTOR_EVENT_BILLING_STARTED |
 			CONNECTOR_EVENT_BILLING_ENDED)) {
 		/* The transaction ID will be saved or cleared in non-volatile
-		 * memory in case of a power failure */
-		config_set_and_save("ocpp.checkpoint",
-				checkpoint, sizeof(*checkpoint));
+		 * memory in case of a power failure. It should be durable before
+		 * going further as it is for billing. */
+		persist_request("ocpp.checkpoint", checkpoint,
+				sizeof(*checkpoint), PERSIST_PRIO_HIGH,
+				NULL, NULL);
+		persist_flush(PERSIST_PRIO_HIGH);
+	}
+}
+
+static void on_metering_saved(const char *key, int err, void *ctx)
+{
+	unused(ctx);
+
+	if (err == 0) {
+		info("metering saved to %s", key);
+	} else if (err != -ECANCELED) {
+		error("metering save to %s failed: %d", key, err);
 	}
 }
 
+/* The energy is queued to be persisted, not yet durable, when it returns
+ * true. The commit result is reported in on_metering_saved(). */
 static bool on_metering_save(const struct metering *metering,
 		const struct metering_energy *energy, void *ctx)
 {
@@ -186,8 +251,9 @@ static bool on_metering_save(const struct metering *metering,
 
 	const char *key = (const char *)ctx;
 
-	if (key && config_set_and_save(key, energy, sizeof(*energy)) == 0) {
-		info("metering save: %lluWh to %s", energy->wh, key);
+	if (key && persist_request(key, energy, sizeof(*energy),
+			PERSIST_PRIO_NORMAL, on_metering_saved, NULL) == 0) {
+		info("metering save queued: %lluWh to %s", energy->wh, key);
 		return true;
 	}
 
@@ -249,7 +315,8 @@ static void start_charger(struct app *app)
 {
 	struct charger_param param;
 	struct charger_extension *extension;
-	app->charger = charger_factory_create(&param, &extension, NULL);
+	app->charger = charger_factory_create(&param, &extension,
+			app->fs);
 	charger_init(app->charger, &param, extension);
 	charger_register_event_cb(app->charger, on_charger_event, app->charger);
 
@@ -289,13 +356,24 @@ static void start_charger(struct app *app)
 		.fs = app->fs,
 		.ns = "cache",
 		.capacity = MAX_AUTH_CACHE_SIZE,
+		.ram_budget = AUTH_CACHE_RAM_BUDGET,
+		.bloom_size = AUTH_CACHE_BLOOM_SIZE,
+		.expire = true,
 	});
 	conn_param.local_list = uid_store_create(&(const struct uid_store_config) {
 		.fs = app->fs,
 		.ns = "localList",
 		.capacity = MAX_AUTH_LOCAL_LIST_SIZE,
+		.ram_budget = AUTH_LOCAL_LIST_RAM_BUDGET,
+		.bloom_size = AUTH_LOCAL_LIST_BLOOM_SIZE,
+		.snapshot = uid_snapshot_create(
+				flash_create(FLASH_PARTITION_UID_SNAPSHOT)),
 	});
 
+	m.auth_cache = conn_param.cache;
+	m.local_list = conn_param.local_list;
+	start_uid_snapshot_worker(m.local_list);
+
 	struct connector *c = connector_factory_create(&conn_param);
 	charger_attach_connector(app->charger, c);
 	connector_register_event_cb(c, on_connector_event, app->charger);
@@ -325,11 +403,77 @@ void app_reboot(void)
 	reboot_gracefully();
 }
 
+static void *refresh_uid_snapshot(void *arg)
+{
+	struct uid_store *store = (struct uid_store *)arg;
+
+	for (;;) {
+		sem_wait(&m.uid_snapshot_event);
+		/* No-op unless the local list has changed since the last
+		 * build, and a change cancels a build in progress. */
+		uid_refresh_snapshot(store);
+	}
+
+	return NULL;
+}
+
+static void start_uid_snapshot_worker(struct uid_store *store)
+{
+	pthread_attr_t attr;
+
+	if (!store) {
+		return;
+	}
+
+	sem_init(&m.uid_snapshot_event, 0, 0);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, UID_SNAPSHOT_STACK_SIZE_BYTES);
+
+	m.uid_snapshot_started = pthread_create(&m.uid_snapshot_thread, &attr,
+			refresh_uid_snapshot, store) == 0;
+
+	pthread_attr_destroy(&attr);
+
+	if (!m.uid_snapshot_started) {
+		error("Failed to start the UID snapshot worker");
+	}
+}
+
+static void collect_uid_garbage(void)
+{
+	size_t live;
+	size_t dead;
+
+	uid_compact(m.auth_cache, UID_GC_BUDGET_MS);
+	uid_compact(m.local_list, UID_GC_BUDGET_MS);
+
+	if (m.uid_snapshot_started) {
+		sem_post(&m.uid_snapshot_event);
+	}
+
+	if (uid_usage(m.auth_cache, &live, &dead) == 0) {
+		metrics_set(UIDCacheLiveBytes, METRICS_VALUE(live));
+		metrics_set(UIDCacheDeadBytes, METRICS_VALUE(dead));
+	}
+	if (uid_usage(m.local_list, &live, &dead) == 0) {
+		metrics_set(UIDLocalListLiveBytes, METRICS_VALUE(live));
+		metrics_set(UIDLocalListDeadBytes, METRICS_VALUE(dead));
+	}
+}
+
 int app_process(uint32_t *next_period_ms)
 {
 #define DEFAULT_STEP_INTERVAL_MS	50
+	const uint32_t now = board_get_time_since_boot_ms();
+
 	charger_process(m.app->charger);
 
+	if (now - m.uid_gc_timestamp >= UID_GC_INTERVAL_MS) {
+		m.uid_gc_timestamp = now;
+		collect_uid_garbage();
+	}
+
 	if (next_period_ms) {
 		*next_period_ms = DEFAULT_STEP_INTERVAL_MS;
 	}
@@ -32,6 +32,7 @@
 
 #include "charger/ocpp.h"
 #include "ocpp/ocpp_connector_internal.h"
+#include "ocpp/ocpp_charger_internal.h"
 #include "charger_internal.h"
 
 #include <string.h>
@@ -39,6 +40,7 @@
 #include <inttypes.h>
 
 #include "ocpp/csms.h"
+#include "ocpp/txqueue.h"
 #include "updater.h"
 #include "config.h"
 #include "libmcu/compiler.h"
@@ -166,6 +168,9 @@ static void proc_csms_up(struct charger *charger,
 	};
 	charger_iterate_connectors(charger, on_each_connector_csms_up, NULL);
 	csms_request(OCPP_MSG_STATUS_NOTIFICATION, &c0, CONNECTOR_0);
+
+	/* transaction messages left unanswered before the reboot */
+	txqueue_replay();
 }
 
 static void proc_remote_reset(struct charger *charger,
@@ -215,6 +220,10 @@ static int ext_init(struct charger *self)
 		error("failed to initialize CSMS: %d", err);
 	}
 
+	if (txqueue_init(((struct ocpp_charger *)self)->fs) < 0) {
+		error("failed to load the transaction message queue");
+	}
+
 	err |= updater_register_event_callback(on_updater_event, self);
 
 	struct charger_support_entry *support = (struct charger_support_entry *)
@@ -40,7 +40,6 @@
 
 #include "libmcu/metrics.h"
 #include "libmcu/board.h"
-#include "libmcu/ringbuf.h"
 #include "libmcu/assert.h"
 #include "libmcu/compiler.h"
 
@@ -48,6 +47,9 @@
 #include "ocpp_connector_internal.h"
 #include "encoder_json.h"
 #include "decoder_json.h"
+#include "registry.h"
+#include "txqueue.h"
+#include "msgpool.h"
 #include "net/server.h"
 #include "config.h"
 #include "logger.h"
@@ -60,30 +62,22 @@ static_assert((sizeof((struct config_ocpp *)0)->checkpoint
 		== sizeof(struct ocpp_checkpoint)),
 		"config_ocpp.checkpoint size mismatch");
 
-#if !defined(ARRAY_COUNT)
-#define ARRAY_COUNT(x)		(sizeof(x) / sizeof((x)[0]))
+#if !defined(OCPP_TXBUF_SIZE)
+#define OCPP_TXBUF_SIZE		4096
 #endif
 
-#define BUFSIZE			2048
-
 typedef int (*message_handler_t)(struct ocpp_connector *c,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec);
 
-struct message_entry {
-	const ocpp_message_t msg_type;
-	const message_handler_t handler;
-};
-
 static struct server *csms;
-static struct ringbuf *rxq;
 
 /* NOTE: The message allocated by this function should be freed by the caller.
  * Free will be done in ocpp event callback function when
  * OCPP_EVENT_MESSAGE_FREE or OCPP_EVENT_MESSAGE_INCOMING event is received. */
 static void *alloc_message(const size_t msg_size)
 {
-	void *p = calloc(1, msg_size);
+	void *p = msgpool_alloc(msg_size);
 
 	if (p) {
 		metrics_increase(OCPPMessageAllocCount);
@@ -122,7 +116,7 @@ static int request_free_if_fail(const ocpp_message_t type,
 			delay_sec, force_or_error, ctx);
 
 	if (err) {
-		free(data);
+		msgpool_free(data);
 		metrics_increase(OCPPPushFailedCount);
 		error("Failed to push message(%d): %s",
 				err, ocpp_stringify_type(type));
@@ -131,6 +125,28 @@ static int request_free_if_fail(const ocpp_message_t type,
 	return err;
 }
 
+/* Transaction messages are kept in flash as well until the CSMS answers, so
+ * that they survive a reboot while the CSMS is unreachable. */
+static int request_durable(const ocpp_message_t type,
+		const struct ocpp_message *req,
+		void *data, const size_t datasize,
+		const uint32_t delay_sec, const bool force_or_error,
+		struct ocpp_connector *c)
+{
+	int err = request_free_if_fail(type, req, data, datasize,
+			delay_sec, force_or_error, c);
+
+	if (!err && !req) {
+		const int rc = txqueue_append(type, c->base.id, data, datasize);
+		if (rc < 0 && rc != -ENODEV) {
+			error("Failed to persist message(%d): %s",
+					rc, ocpp_stringify_type(type));
+		}
+	}
+
+	return err;
+}
+
 static int do_empty(struct ocpp_connector *c,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec)
@@ -338,6 +354,18 @@ static int do_get_configuration(struct ocpp_connector *c,
 			delay_sec, false, c);
 }
 
+/* Measurands set_measurand_value() has a reading for. Any other measurand
+ * would leave an empty value behind, which ends the MeterValue entry in the
+ * encoder and throws the following entries out of step. */
+#define FILLABLE_MEASURANDS	(OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER | \
+				OCPP_MEASURAND_POWER_ACTIVE_IMPORT | \
+				OCPP_MEASURAND_CURRENT_IMPORT | \
+				OCPP_MEASURAND_VOLTAGE | \
+				OCPP_MEASURAND_POWER_FACTOR | \
+				OCPP_MEASURAND_FREQUENCY | \
+				OCPP_MEASURAND_TEMPERATURE | \
+				OCPP_MEASURAND_SOC)
+
 static size_t count_measurands(ocpp_measurand_t measurands)
 {
 	size_t count = 0;
@@ -422,49 +450,134 @@ static void set_measurand_value(struct ocpp_SampledValue *p,
 	}
 }
 
-static int do_metervalue(struct ocpp_connector *c,
-		const ocpp_message_t msg_type, const struct ocpp_message *req,
-		void *ctx, const uint32_t delay_sec)
+static size_t fill_metervalue(struct ocpp_MeterValue *value,
+		const ocpp_measurand_t measurands,
+		const struct session_metering *reading, const time_t timestamp)
 {
-	const ocpp_measurand_t measurands = (ocpp_measurand_t)(uintptr_t)ctx;
 	const size_t n_samples = count_measurands(measurands);
-	const size_t total_size = sizeof(struct ocpp_MeterValues) +
-		sizeof(struct ocpp_MeterValue) +
-		n_samples * sizeof(struct ocpp_SampledValue);
+	struct ocpp_SampledValue *sampledValue =
+		(struct ocpp_SampledValue *)(void *)value->sampledValue;
+
+	value->timestamp = timestamp;
+
+	for (size_t i = 0; i < n_samples; i++) {
+		ocpp_measurand_t measurand =
+			pick_measurand_by_index(measurands, i+1);
+		sampledValue[i].context = reading->context;
+		sampledValue[i].measurand = measurand;
+		sampledValue[i].unit = get_unit_by_measurand(measurand);
+
+		set_measurand_value(&sampledValue[i], measurand, reading);
+	}
+
+	return encoder_json_metervalue_size(n_samples);
+}
+
+static int send_metervalues(struct ocpp_connector *c,
+		const ocpp_message_t msg_type, const struct ocpp_message *req,
+		const uint32_t delay_sec)
+{
+	struct metervalue_batch *batch = &c->metervalues;
+	size_t total_size = sizeof(struct ocpp_MeterValues);
+
+	for (uint8_t i = 0; i < batch->count; i++) {
+		total_size += encoder_json_metervalue_size(
+				count_measurands(batch->samples[i].measurands));
+	}
+
 	struct ocpp_MeterValues *p =
 		(struct ocpp_MeterValues *)alloc_message(total_size);
+	const uint8_t count = batch->count;
+
+	batch->count = 0;
 
 	if (!p) {
 		return -ENOMEM;
 	}
 
-	struct ocpp_MeterValue *value =
-		(struct ocpp_MeterValue *)(void *)p->meterValue;
 	*p = (struct ocpp_MeterValues) {
 		.connectorId = c->base.id,
-		.transactionId = (int)c->session.transaction_id,
+		.transactionId = (int)batch->transaction_id,
 	};
-	*value = (struct ocpp_MeterValue) {
-		.timestamp = c->now,
-	};
-	struct ocpp_SampledValue *sampledValue =
-		(struct ocpp_SampledValue *)(void *)value->sampledValue;
 
-	for (size_t i = 0; i < n_samples; i++) {
-		ocpp_measurand_t measurand =
-			pick_measurand_by_index(measurands, i+1);
-		sampledValue[i].context = c->session.metering.context;
-		sampledValue[i].measurand = measurand;
-		sampledValue[i].unit = get_unit_by_measurand(measurand);
+	uint8_t *pos = (uint8_t *)p->meterValue;
 
-		set_measurand_value(&sampledValue[i],
-				measurand, &c->session.metering);
+	for (uint8_t i = 0; i < count; i++) {
+		pos += fill_metervalue((struct ocpp_MeterValue *)(void *)pos,
+				batch->samples[i].measurands,
+				&batch->samples[i].reading,
+				batch->samples[i].timestamp);
 	}
 
-	return request_free_if_fail(msg_type, req, p, total_size,
+	return request_durable(msg_type, req, p, total_size,
 			delay_sec, false, c);
 }
 
+static bool is_metervalue_batch_due(const struct ocpp_connector *c)
+{
+	const struct metervalue_batch *batch = &c->metervalues;
+
+	if (!batch->count) {
+		return false;
+	} else if (batch->count >= OCPP_METERVALUE_BATCH_MAX) {
+		return true;
+	}
+
+	/* While the CSMS is unreachable, the request would only wait in the
+	 * queue. Keep filling the batch instead to queue fewer messages. */
+	if (!csms || !server_connected(csms)) {
+		return false;
+	}
+
+	return c->now - batch->samples[0].timestamp >=
+		(time_t)OCPP_METERVALUE_BATCH_AGE_SEC;
+}
+
+/* Samples are not sent one by one but batched per connector, so that
+ * periodic and clock-aligned samples go out as MeterValue entries of a
+ * single request. A batch is sent once it is full, once its oldest sample
+ * gets OCPP_METERVALUE_BATCH_AGE_SEC old while the CSMS is reachable, or
+ * before a sample of another transaction is added. A request without
+ * measurands adds no sample but gives a pending batch the chance to go.
+ * Measurands without a reading are left out, so that every entry is sized
+ * by the sampled values it actually carries.
+ *
+ * A batch is persisted only once it is sent. Up to
+ * OCPP_METERVALUE_BATCH_MAX - 1 samples still pending are lost on reboot,
+ * which is accepted: the energy register is reported again by the next
+ * sample and by StopTransaction. */
+static int do_metervalue(struct ocpp_connector *c,
+		const ocpp_message_t msg_type, const struct ocpp_message *req,
+		void *ctx, const uint32_t delay_sec)
+{
+	const ocpp_measurand_t measurands = (ocpp_measurand_t)
+		((uintptr_t)ctx & FILLABLE_MEASURANDS);
+	struct metervalue_batch *batch = &c->metervalues;
+	int err = 0;
+
+	if (batch->count &&
+			batch->transaction_id != c->session.transaction_id) {
+		err = send_metervalues(c, msg_type, req, delay_sec);
+	}
+
+	if (measurands) {
+		if (!batch->count) {
+			batch->transaction_id = c->session.transaction_id;
+		}
+
+		batch->samples[batch->count].reading = c->session.metering;
+		batch->samples[batch->count].measurands = measurands;
+		batch->samples[batch->count].timestamp = c->now;
+		batch->count++;
+	}
+
+	if (is_metervalue_batch_due(c)) {
+		err = send_metervalues(c, msg_type, req, delay_sec);
+	}
+
+	return err;
+}
+
 static int do_remote_start_stop(struct ocpp_connector *c,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec)
@@ -527,7 +640,7 @@ static int do_starttransaction(struct ocpp_connector *c,
 	};
 	memcpy(p->idTag, c->session.auth.current.uid, sizeof(p->idTag));
 
-	return request_free_if_fail(msg_type, req, p, sizeof(*p),
+	return request_durable(msg_type, req, p, sizeof(*p),
 			delay_sec, true, c);
 }
 
@@ -572,6 +685,11 @@ static int do_stoptransaction(struct ocpp_connector *c,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec)
 {
+	/* samples of the transaction go ahead of its end */
+	if (c->metervalues.count) {
+		send_metervalues(c, OCPP_MSG_METER_VALUES, NULL, 0);
+	}
+
 	struct ocpp_StopTransaction *p =
 		(struct ocpp_StopTransaction *)alloc_message(sizeof(*p));
 
@@ -592,7 +710,7 @@ static int do_stoptransaction(struct ocpp_connector *c,
 		memcpy(p->idTag, c->session.auth.current.uid, sizeof(p->idTag));
 	}
 
-	return request_free_if_fail(msg_type, req, p, sizeof(*p),
+	return request_durable(msg_type, req, p, sizeof(*p),
 			delay_sec, true, c);
 }
 
@@ -616,62 +734,45 @@ static int do_unlock(struct ocpp_connector *c,
 			delay_sec, false, c);
 }
 
-static const struct message_entry requests[] = {
-	{ OCPP_MSG_AUTHORIZE,                do_authorize },
-	{ OCPP_MSG_BOOTNOTIFICATION,         do_bootnotification },
-	{ OCPP_MSG_DATA_TRANSFER,            do_datatransfer },
-	{ OCPP_MSG_DIAGNOSTICS_NOTIFICATION, do_diagnostic_status_noti },
-	{ OCPP_MSG_FIRMWARE_NOTIFICATION,    do_fw_status_noti },
-	{ OCPP_MSG_HEARTBEAT,                do_empty },
-	{ OCPP_MSG_METER_VALUES,             do_metervalue },
-	{ OCPP_MSG_START_TRANSACTION,        do_starttransaction },
-	{ OCPP_MSG_STATUS_NOTIFICATION,      do_statusnotification },
-	{ OCPP_MSG_STOP_TRANSACTION,         do_stoptransaction },
+static const message_handler_t requests[OCPP_MSG_MAX] = {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	\
+	[OCPP_MSG_##type] = req,
+#include "messages.def"
+#undef OCPP_MESSAGE
 };
 
-static const struct message_entry responses[] = {
-	{ OCPP_MSG_CHANGE_AVAILABILITY,      do_change_availability },
-	{ OCPP_MSG_CHANGE_CONFIGURATION,     do_change_configuration },
-	{ OCPP_MSG_CLEAR_CACHE,              do_clear_cache },
-	{ OCPP_MSG_GET_CONFIGURATION,        do_get_configuration },
-	{ OCPP_MSG_REMOTE_START_TRANSACTION, do_remote_start_stop },
-	{ OCPP_MSG_REMOTE_STOP_TRANSACTION,  do_remote_start_stop },
-	{ OCPP_MSG_RESET,                    do_reset },
-	{ OCPP_MSG_UNLOCK_CONNECTOR,         do_unlock },
-	{ OCPP_MSG_UPDATE_FIRMWARE,          do_empty },
+static const message_handler_t responses[OCPP_MSG_MAX] = {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	\
+	[OCPP_MSG_##type] = resp,
+#include "messages.def"
+#undef OCPP_MESSAGE
 };
 
 static int push(struct ocpp_connector *connector,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec,
-		const struct message_entry *handlers,
-		const size_t handlers_count)
+		const message_handler_t handlers[OCPP_MSG_MAX])
 {
-	for (size_t i = 0; i < handlers_count; i++) {
-		if (handlers[i].msg_type == msg_type) {
-			return (*handlers[i].handler)(connector,
-					msg_type, req, ctx, delay_sec);
-		}
+	if ((size_t)msg_type >= OCPP_MSG_MAX || !handlers[msg_type]) {
+		error("Unknown message type: %s", ocpp_stringify_type(msg_type));
+		return -ENOENT;
 	}
 
-	error("Unknown message type: %s", ocpp_stringify_type(msg_type));
-	return -ENOENT;
+	return (*handlers[msg_type])(connector, msg_type, req, ctx, delay_sec);
 }
 
 static int push_request(struct ocpp_connector *connector,
 		const ocpp_message_t msg_type, void *ctx,
 		const uint32_t delay_sec)
 {
-	return push(connector, msg_type, NULL,
-			ctx, delay_sec, requests, ARRAY_COUNT(requests));
+	return push(connector, msg_type, NULL, ctx, delay_sec, requests);
 }
 
 static int push_responses(struct ocpp_connector *connector,
 		const ocpp_message_t msg_type, const struct ocpp_message *req,
 		void *ctx, const uint32_t delay_sec)
 {
-	return push(connector, msg_type, req,
-			ctx, delay_sec, responses, ARRAY_COUNT(responses));
+	return push(connector, msg_type, req, ctx, delay_sec, responses);
 }
 
 /* A time-based message ID is used by default rather than a UUID.
@@ -704,16 +805,34 @@ void ocpp_generate_message_id(void *buf, size_t bufsize)
 #endif
 }
 
+/* Frames are encoded straight into the transport's own TX buffer when it
+ * has one, so that no copy is made on the way out. Otherwise the local buffer
+ * is used. */
+static char *get_txbuf(size_t *bufsize)
+{
+	static char txbuf[OCPP_TXBUF_SIZE];
+	char *p = (char *)server_txbuf(csms, bufsize);
+
+	if (!p) {
+		p = txbuf;
+		*bufsize = sizeof(txbuf);
+	}
+
+	return p;
+}
+
 int ocpp_send(const struct ocpp_message *msg)
 {
-	size_t json_len = 0;
-	char *json = encoder_json_encode(msg, &json_len);
+	size_t bufsize = 0;
+	char *json = get_txbuf(&bufsize);
+	const int json_len = encoder_json_encode(msg, json, bufsize);
 
-	if (!json || !json_len) {
-		return -ENOMEM;
+	if (json_len < 0) {
+		metrics_increase(OCPPMessageEncodeFailCount);
+		return json_len;
 	}
 
-	int err = server_send(csms, json, json_len);
+	int err = server_send(csms, json, (size_t)json_len);
 
 	if (err < 0) {
 		warn("Failed to send message(%d): %s, %s",
@@ -721,44 +840,36 @@ int ocpp_send(const struct ocpp_message *msg)
 	} else { /* success */
 		err = 0;
 		metrics_increase(OCPPMessageSentCount);
-		debug("%.*s", (int)json_len, json);
+		debug("%.*s", json_len, json);
 	}
 
-	encoder_json_free(json);
-
 	return err;
 }
 
 int ocpp_recv(struct ocpp_message *msg)
 {
-	static uint8_t buf[BUFSIZE];
-	size_t cap = ringbuf_capacity(rxq) - ringbuf_length(rxq);
+	const void *json;
+	const int len = server_peek(csms, &json);
 
-	while (cap > sizeof(buf)) {
-		int len = server_recv(csms, buf, sizeof(buf));
-		if (len <= 0) {
-			break;
-		}
-
-		ringbuf_write(rxq, buf, (size_t)len);
-		cap -= (size_t)len;
-	}
-
-	const size_t len = ringbuf_peek(rxq, 0, buf, sizeof(buf));
-	if (len == 0) {
+	if (len < 0) {
 		return -ENOENT;
 	}
 
+	/* The message is decoded where the transport received it. It is a
+	 * whole WebSocket message, so anything left after the first frame
+	 * is dropped along with it. */
 	size_t decoded_len = 0;
-	int err = decoder_json_decode(msg, (char *)buf, len, &decoded_len);
-	ringbuf_consume(rxq, decoded_len);
+	int err = decoder_json_decode(msg, (const char *)json, (size_t)len,
+			&decoded_len);
 
 	if (!err || err == -ENOTSUP) {
-		debug("%.*s", (int)decoded_len, buf);
+		debug("%.*s", (int)decoded_len, (const char *)json);
 	} else {
-		warn("Received %zu bytes, decoded %zu bytes", len, decoded_len);
+		warn("Received %d bytes, decoded %zu bytes", len, decoded_len);
 	}
 
+	server_consume(csms);
+
 	return err;
 }
 
@@ -782,11 +893,12 @@ int adapter_push_response(struct ocpp_connector *connector,
 	return push_responses(connector, msg_type, req, ctx, 0);
 }
 
-void adapter_init(struct server *server, size_t rxqueue_size)
+void adapter_init(struct server *server)
 {
 	csms = server;
-	rxq = ringbuf_create(rxqueue_size);
-	assert(csms && rxq);
+	assert(csms);
+
+	registry_init();
 
 	assert(sizeof(((struct config_ocpp *)0)->config) ==
 			ocpp_compute_configuration_size());
@@ -41,7 +41,7 @@ extern "C" {
 #include "ocpp/ocpp.h"
 
 struct server;
-void adapter_init(struct server *server, size_t rxqueue_size);
+void adapter_init(struct server *server);
 int adapter_push_request(struct ocpp_connector *connector,
 		const ocpp_message_t msg_type, void *ctx);
 int adapter_push_request_defer(struct ocpp_connector *connector,
@@ -47,10 +47,30 @@
 #include "net/util.h"
 #include "adapter.h"
 #include "handler.h"
+#include "txqueue.h"
+#include "msgpool.h"
 #include "config.h"
 #include "logger.h"
 
-#define RXQUEUE_SIZE			4096
+#define RXQUEUE_SIZE			8192
+/* Incoming messages larger than this are dropped by the transport. */
+#if !defined(OCPP_RXMSG_MAXSIZE)
+#define OCPP_RXMSG_MAXSIZE		4096
+#endif
+/* permessage-deflate on the CSMS connection. A 1 KiB window with memory
+ * level 4 takes about 20 KiB of zlib state instead of the 300 KiB or so at
+ * the defaults, and still covers the measurand names and units repeated
+ * in every MeterValues. It takes effect on the host port only, as the
+ * esp-idf port does not compress yet. */
+#if !defined(OCPP_WS_DEFLATE)
+#define OCPP_WS_DEFLATE			1
+#endif
+#if !defined(OCPP_WS_DEFLATE_WINDOW_BITS)
+#define OCPP_WS_DEFLATE_WINDOW_BITS	10
+#endif
+#if !defined(OCPP_WS_DEFLATE_MEM_LEVEL)
+#define OCPP_WS_DEFLATE_MEM_LEVEL	4
+#endif
 
 #define DEFAULT_WS_PING_INTERVAL_SEC	300
 #define DEFAULT_TX_TIMEOUT_MS		8000
@@ -75,6 +95,12 @@ static int initialize_server(void)
 		.header = "Sec-WebSocket-Protocol: ocpp1.6\r\n",
 		.write_timeout_ms = DEFAULT_TX_TIMEOUT_MS,
 		.rxq_maxsize = RXQUEUE_SIZE,
+		.rxmsg_maxsize = OCPP_RXMSG_MAXSIZE,
+		.deflate = {
+			.enabled = OCPP_WS_DEFLATE,
+			.window_bits = OCPP_WS_DEFLATE_WINDOW_BITS,
+			.mem_level = OCPP_WS_DEFLATE_MEM_LEVEL,
+		},
 		.ping_interval_sec = DEFAULT_WS_PING_INTERVAL_SEC,
 	};
 	const char *evse_id = board_name();
@@ -119,13 +145,18 @@ static void on_ocpp_event(ocpp_event_t event_type,
 			debug("no payload(%d): %s", event_type,
 					ocpp_stringify_type(message->type));
 		}
-		handler_process(charger, message);
+		/* replayed requests belong to no connector anymore */
+		if (!txqueue_settle(message)) {
+			handler_process(charger, message);
+		}
+	} else {
+		txqueue_release(message->payload.fmt.data);
 	}
 
         /* NOTE: incoming messages must be freed too because it is allocated by
          * decoder. */
 	if (message->payload.fmt.data) {
-		free(message->payload.fmt.data);
+		msgpool_free((void *)(uintptr_t)message->payload.fmt.data);
 		metrics_increase(OCPPMessageFreeCount);
 	}
 }
@@ -191,7 +222,7 @@ int csms_init(void *ctx)
 	int err = initialize_server();
 
 	if (!err) {
-		adapter_init(csms, RXQUEUE_SIZE);
+		adapter_init(csms);
 		err = ocpp_init(on_ocpp_event, ctx);
 
 		const size_t len = ocpp_compute_configuration_size();
@@ -31,13 +31,14 @@
  */
 
 #include "decoder_json.h"
+#include "registry.h"
+#include "msgpool.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
 
-#include "cJSON.h"
 #include "libmcu/metrics.h"
 #include "libmcu/timext.h"
 #include "ocpp/strconv.h"
@@ -51,19 +52,486 @@
 #define ARRAY_COUNT(x)		(sizeof(x) / sizeof((x)[0]))
 #endif
 
-typedef int (*decoder_handler_t)(struct ocpp_message *msg, cJSON *json);
+#if !defined(DECODER_JSON_MAX_TOKENS)
+#define DECODER_JSON_MAX_TOKENS	128
+#endif
+#if !defined(DECODER_JSON_MAX_DEPTH)
+#define DECODER_JSON_MAX_DEPTH	8
+#endif
+
+#define ENUMSTR_MAXLEN		32
+#define TIMESTR_MAXLEN		32
+#define NUMSTR_MAXLEN		24
+
+typedef enum {
+	JSON_OBJECT,
+	JSON_ARRAY,
+	JSON_STRING,
+	JSON_PRIMITIVE,
+} json_type_t;
+
+/* Tokens point into the receive buffer, which is never written to. String
+ * tokens span the raw characters between the quotes, so escapes are only
+ * resolved when a value is copied out. */
+struct json_token {
+	uint8_t type;
+	uint16_t size; /* members of an object or elements of an array */
+	uint16_t next; /* index of the first token after this subtree */
+	uint32_t start;
+	uint32_t end;
+};
 
-struct decoder_entry {
-	const ocpp_message_t msg_type;
-	const decoder_handler_t handler;
+struct json_doc {
+	const char *js;
+	const struct json_token *tokens;
 };
 
+struct tokenizer {
+	const char *js;
+	size_t len;
+	size_t pos;
+	struct json_token *tokens;
+	uint16_t ntokens;
+	uint8_t depth;
+};
+
+typedef int (*decoder_handler_t)(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload);
+
+static struct json_token tokens[DECODER_JSON_MAX_TOKENS];
+
+static int parse_value(struct tokenizer *t);
+
+static bool is_whitespace(const char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_delimiter(const char c)
+{
+	return is_whitespace(c) || c == ',' || c == ']' || c == '}' || c == ':';
+}
+
+static int hex_to_int(const char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+static void skip_whitespace(struct tokenizer *t)
+{
+	while (t->pos < t->len && is_whitespace(t->js[t->pos])) {
+		t->pos++;
+	}
+}
+
+static int alloc_token(struct tokenizer *t, const json_type_t type)
+{
+	if (t->ntokens >= DECODER_JSON_MAX_TOKENS) {
+		return -ENOBUFS;
+	}
+
+	t->tokens[t->ntokens] = (struct json_token) {
+		.type = (uint8_t)type,
+		.start = (uint32_t)t->pos,
+	};
+
+	return t->ntokens++;
+}
+
+static void close_token(struct tokenizer *t, const int index)
+{
+	t->tokens[index].end = (uint32_t)t->pos;
+	t->tokens[index].next = t->ntokens;
+}
+
+static int skip_escape(struct tokenizer *t)
+{
+	if (++t->pos >= t->len) {
+		return -EBADMSG;
+	}
+
+	switch (t->js[t->pos]) {
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+		break;
+	case 'u':
+		for (int i = 0; i < 4; i++) {
+			if (++t->pos >= t->len || hex_to_int(t->js[t->pos]) < 0) {
+				return -EBADMSG;
+			}
+		}
+		break;
+	default:
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+static int parse_string(struct tokenizer *t)
+{
+	t->pos++; /* opening quote */
+
+	const int index = alloc_token(t, JSON_STRING);
+
+	if (index < 0) {
+		return index;
+	}
+
+	for (; t->pos < t->len; t->pos++) {
+		const uint8_t c = (uint8_t)t->js[t->pos];
+
+		if (c == '"') {
+			close_token(t, index);
+			t->pos++;
+			return index;
+		} else if (c < 0x20 || (c == '\\' && skip_escape(t) < 0)) {
+			break;
+		}
+	}
+
+	return -EBADMSG;
+}
+
+static bool is_valid_primitive(const char *str, const size_t len)
+{
+	if (len == 4 && (!memcmp(str, "true", 4) || !memcmp(str, "null", 4))) {
+		return true;
+	} else if (len == 5 && !memcmp(str, "false", 5)) {
+		return true;
+	}
+
+	return str[0] == '-' || (str[0] >= '0' && str[0] <= '9');
+}
+
+static int parse_primitive(struct tokenizer *t)
+{
+	const int index = alloc_token(t, JSON_PRIMITIVE);
+
+	if (index < 0) {
+		return index;
+	}
+
+	while (t->pos < t->len && !is_delimiter(t->js[t->pos])) {
+		if ((uint8_t)t->js[t->pos] < 0x20) {
+			return -EBADMSG;
+		}
+		t->pos++;
+	}
+
+	const struct json_token *tok = &t->tokens[index];
+
+	if (t->pos == tok->start ||
+			!is_valid_primitive(&t->js[tok->start],
+					t->pos - tok->start)) {
+		return -EBADMSG;
+	}
+
+	close_token(t, index);
+
+	return index;
+}
+
+static int parse_member_key(struct tokenizer *t)
+{
+	skip_whitespace(t);
+
+	if (t->pos >= t->len || t->js[t->pos] != '"') {
+		return -EBADMSG;
+	}
+
+	const int err = parse_string(t);
+
+	if (err < 0) {
+		return err;
+	}
+
+	skip_whitespace(t);
+
+	if (t->pos >= t->len || t->js[t->pos] != ':') {
+		return -EBADMSG;
+	}
+
+	t->pos++;
+
+	return 0;
+}
+
+static int parse_container(struct tokenizer *t, const json_type_t type,
+		const char closing)
+{
+	if (++t->depth > DECODER_JSON_MAX_DEPTH) {
+		return -EBADMSG;
+	}
+
+	const int index = alloc_token(t, type);
+	int err;
+
+	if (index < 0) {
+		return index;
+	}
+
+	t->pos++; /* opening bracket */
+	skip_whitespace(t);
+
+	if (t->pos < t->len && t->js[t->pos] == closing) {
+		t->pos++;
+		goto out;
+	}
+
+	while (1) {
+		if (type == JSON_OBJECT && (err = parse_member_key(t)) < 0) {
+			return err;
+		}
+		if ((err = parse_value(t)) < 0) {
+			return err;
+		}
+
+		t->tokens[index].size++;
+		skip_whitespace(t);
+
+		if (t->pos >= t->len) {
+			return -EBADMSG;
+		}
+
+		const char c = t->js[t->pos++];
+
+		if (c == closing) {
+			break;
+		} else if (c != ',') {
+			return -EBADMSG;
+		}
+	}
+out:
+	close_token(t, index);
+	t->depth--;
+
+	return index;
+}
+
+static int parse_value(struct tokenizer *t)
+{
+	skip_whitespace(t);
+
+	if (t->pos >= t->len) {
+		return -EBADMSG;
+	}
+
+	switch (t->js[t->pos]) {
+	case '{':
+		return parse_container(t, JSON_OBJECT, '}');
+	case '[':
+		return parse_container(t, JSON_ARRAY, ']');
+	case '"':
+		return parse_string(t);
+	default:
+		return parse_primitive(t);
+	}
+}
+
+static int find_member(const struct json_doc *doc, const int obj,
+		const char *key)
+{
+	if (obj < 0 || doc->tokens[obj].type != JSON_OBJECT) {
+		return -ENOENT;
+	}
+
+	const size_t keylen = strlen(key);
+
+	for (int i = obj + 1; i < doc->tokens[obj].next;
+			i = doc->tokens[i + 1].next) {
+		const struct json_token *tok = &doc->tokens[i];
+
+		if (tok->end - tok->start == keylen &&
+				!memcmp(&doc->js[tok->start], key, keylen)) {
+			return i + 1;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int get_element(const struct json_doc *doc, const int arr,
+		const uint16_t nth)
+{
+	if (arr < 0 || doc->tokens[arr].type != JSON_ARRAY ||
+			nth >= doc->tokens[arr].size) {
+		return -ENOENT;
+	}
+
+	int i = arr + 1;
+
+	for (uint16_t n = 0; n < nth; n++) {
+		i = doc->tokens[i].next;
+	}
+
+	return i;
+}
+
+static uint32_t read_hex4(const char *p)
+{
+	uint32_t v = 0;
+
+	for (int i = 0; i < 4; i++) {
+		v = (v << 4) | (uint32_t)hex_to_int(p[i]);
+	}
+
+	return v;
+}
+
+static size_t encode_utf8(uint32_t cp, char *out)
+{
+	if (cp < 0x80) {
+		out[0] = (char)cp;
+		return 1;
+	} else if (cp < 0x800) {
+		out[0] = (char)(0xc0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3f));
+		return 2;
+	} else if (cp < 0x10000) {
+		out[0] = (char)(0xe0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+
+	out[0] = (char)(0xf0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/* The escape has already been validated by the tokenizer. */
+static const char *unescape(const char *p, const char *end,
+		char *out, size_t *outlen)
+{
+	uint32_t cp;
+
+	switch (*p++) {
+	case 'b': out[0] = '\b'; break;
+	case 'f': out[0] = '\f'; break;
+	case 'n': out[0] = '\n'; break;
+	case 'r': out[0] = '\r'; break;
+	case 't': out[0] = '\t'; break;
+	case 'u':
+		cp = read_hex4(p);
+		p += 4;
+
+		if (cp >= 0xd800 && cp <= 0xdbff && end - p >= 6 &&
+				p[0] == '\\' && p[1] == 'u') {
+			const uint32_t lo = read_hex4(&p[2]);
+			if (lo >= 0xdc00 && lo <= 0xdfff) {
+				cp = 0x10000 + ((cp - 0xd800) << 10)
+					+ (lo - 0xdc00);
+				p += 6;
+			}
+		}
+
+		*outlen = encode_utf8(cp, out);
+		return p;
+	default: out[0] = p[-1]; break;
+	}
+
+	*outlen = 1;
+	return p;
+}
+
+/* Returns the length of the string copied, or -ENOBUFS when it does not fit
+ * in the buffer along with the terminating NUL. */
+static int get_string(const struct json_doc *doc, const int index,
+		char *buf, const size_t bufsize)
+{
+	if (index < 0 || doc->tokens[index].type != JSON_STRING) {
+		return -EBADMSG;
+	}
+
+	const char *p = &doc->js[doc->tokens[index].start];
+	const char *end = &doc->js[doc->tokens[index].end];
+	size_t len = 0;
+
+	while (p < end) {
+		const char *run = p;
+		const char *esc = (const char *)memchr(p, '\\',
+				(size_t)(end - p));
+		const size_t run_len = (size_t)((esc? esc : end) - run);
+		char tmp[4];
+		size_t n = 0;
+
+		p = esc? unescape(esc + 1, end, tmp, &n) : end;
+
+		if (len + run_len + n >= bufsize) {
+			return -ENOBUFS;
+		}
+
+		memcpy(&buf[len], run, run_len);
+		memcpy(&buf[len + run_len], tmp, n);
+		len += run_len + n;
+	}
+
+	buf[len] = '\0';
+
+	return (int)len;
+}
+
+static int get_int(const struct json_doc *doc, const int index, int *value)
+{
+	char str[NUMSTR_MAXLEN];
+	char *endptr;
+
+	if (index < 0 || doc->tokens[index].type != JSON_PRIMITIVE) {
+		return -EBADMSG;
+	}
+
+	const size_t len = doc->tokens[index].end - doc->tokens[index].start;
+
+	if (len >= sizeof(str)) {
+		return -EBADMSG;
+	}
+
+	memcpy(str, &doc->js[doc->tokens[index].start], len);
+	str[len] = '\0';
+
+	const double t = strtod(str, &endptr);
+
+	if (endptr == str || *endptr != '\0') {
+		return -EBADMSG;
+	}
+
+	*value = (int)t;
+
+	return 0;
+}
+
+static int get_time(const struct json_doc *doc, const int index,
+		time_t *value)
+{
+	char str[TIMESTR_MAXLEN];
+	const int err = get_string(doc, index, str, sizeof(str));
+
+	if (err < 0) {
+		return err;
+	}
+
+	*value = iso8601_convert_to_time(str);
+
+	return 0;
+}
+
 /* NOTE: The message allocated by this function should be freed by the caller.
  * Free will be done in ocpp event callback function when
  * OCPP_EVENT_MESSAGE_FREE or OCPP_EVENT_MESSAGE_INCOMING event is received. */
 static void *create_message(struct ocpp_message *msg, size_t msgsize)
 {
-	void *p = calloc(1, msgsize);
+	void *p = msgpool_alloc(msgsize);
 
 	msg->payload.fmt.data = p;
 	msg->payload.size = msgsize;
@@ -77,25 +545,44 @@ static void *create_message(struct ocpp_message *msg, size_t msgsize)
 	return p;
 }
 
-static int do_error(struct ocpp_message *msg, cJSON *json)
+/* Undoes create_message() when the payload turns out to be malformed after
+ * the message has been allocated. */
+static int reject_message(struct ocpp_message *msg)
+{
+	msgpool_free((void *)(uintptr_t)msg->payload.fmt.data);
+	msg->payload.fmt.data = NULL;
+	msg->payload.size = 0;
+
+	metrics_increase(OCPPMessageFreeCount);
+	metrics_increase(OCPPMessageFormatInvalidCount);
+
+	return -EBADMSG;
+}
+
+static int do_error(struct ocpp_message *msg, const struct json_doc *doc,
+		int payload)
 {
 	unused(msg);
-	unused(json);
+	unused(doc);
+	unused(payload);
 	return -ENOTSUP;
 }
 
-static int do_empty(struct ocpp_message *msg, cJSON *json)
+static int do_empty(struct ocpp_message *msg, const struct json_doc *doc,
+		int payload)
 {
 	unused(msg);
-	unused(json);
+	unused(doc);
+	unused(payload);
 	return 0;
 }
 
-static int do_current_time(struct ocpp_message *msg, cJSON *json)
+static int do_current_time(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *datetime = cJSON_GetObjectItem(json, "currentTime");
+	const int datetime = find_member(doc, payload, "currentTime");
 
-	if (!datetime) {
+	if (datetime < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -107,52 +594,73 @@ static int do_current_time(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	p->currentTime = iso8601_convert_to_time(cJSON_GetStringValue(datetime));
+	if (get_time(doc, datetime, &p->currentTime) < 0) {
+		return reject_message(msg);
+	}
 
 	return 0;
 }
 
-static int do_authorize(struct ocpp_message *msg, cJSON *json)
+/* The status is returned as a string as its type differs by message. */
+static int get_id_tag_info(const struct json_doc *doc, const int id,
+		char *status, const size_t status_size,
+		char *parent, const size_t parent_size, time_t *expiry)
 {
-	const cJSON *id = cJSON_GetObjectItem(json, "idTagInfo");
-	const cJSON *status = cJSON_GetObjectItem(id, "status");
-	const cJSON *expiry = cJSON_GetObjectItem(id, "expiryDate");
-	const cJSON *pid = cJSON_GetObjectItem(id, "parentIdTag");
+	const int status_index = find_member(doc, id, "status");
+	const int expiry_index = find_member(doc, id, "expiryDate");
+	const int pid_index = find_member(doc, id, "parentIdTag");
+
+	if (get_string(doc, status_index, status, status_size) < 0 ||
+			(pid_index >= 0 && get_string(doc, pid_index,
+					parent, parent_size) < 0) ||
+			(expiry_index >= 0 &&
+			 get_time(doc, expiry_index, expiry) < 0)) {
+		return -EBADMSG;
+	}
+
+	return 0;
+}
 
-	if (!id || !status) {
+static int do_authorize(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
+{
+	const int id = find_member(doc, payload, "idTagInfo");
+
+	if (id < 0 || find_member(doc, id, "status") < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
 
 	struct ocpp_Authorize_conf *p = (struct ocpp_Authorize_conf *)
 		create_message(msg, sizeof(*p));
+	char str[ENUMSTR_MAXLEN];
 
 	if (!p) {
 		return -ENOMEM;
 	}
 
-	p->idTagInfo.status =
-		ocpp_get_auth_status_from_string(cJSON_GetStringValue(status));
-
-	if (pid) {
-		strcpy(p->idTagInfo.parentIdTag, cJSON_GetStringValue(pid));
+	if (get_id_tag_info(doc, id, str, sizeof(str),
+			p->idTagInfo.parentIdTag,
+			sizeof(p->idTagInfo.parentIdTag),
+			&p->idTagInfo.expiryDate) < 0) {
+		return reject_message(msg);
 	}
 
-	if (expiry) {
-		p->idTagInfo.expiryDate = iso8601_convert_to_time(
-			cJSON_GetStringValue(expiry));
-	}
+	p->idTagInfo.status = ocpp_get_auth_status_from_string(str);
 
 	return 0;
 }
 
-static int do_bootnotification(struct ocpp_message *msg, cJSON *json)
+static int do_bootnotification(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *datetime = cJSON_GetObjectItem(json, "currentTime");
-	const cJSON *interval = cJSON_GetObjectItem(json, "interval");
-	const cJSON *status = cJSON_GetObjectItem(json, "status");
+	const int datetime = find_member(doc, payload, "currentTime");
+	const int interval = find_member(doc, payload, "interval");
+	const int status = find_member(doc, payload, "status");
+	char str[ENUMSTR_MAXLEN];
+	int t;
 
-	if (!datetime || !interval || !status) {
+	if (datetime < 0 || interval < 0 || status < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -165,28 +673,37 @@ static int do_bootnotification(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	p->currentTime = iso8601_convert_to_time(cJSON_GetStringValue(datetime));
-	double t = cJSON_GetNumberValue(interval);
-	p->interval = (int)t;
-	p->status = ocpp_get_boot_status_from_string(cJSON_GetStringValue(status));
+	if (get_time(doc, datetime, &p->currentTime) < 0 ||
+			get_int(doc, interval, &t) < 0 ||
+			get_string(doc, status, str, sizeof(str)) < 0) {
+		return reject_message(msg);
+	}
+
+	p->interval = t;
+	p->status = ocpp_get_boot_status_from_string(str);
 
 	return 0;
 }
 
-static int do_change_availability(struct ocpp_message *msg, cJSON *json)
+static int do_change_availability(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *connector = cJSON_GetObjectItem(json, "connectorId");
-	const cJSON *type = cJSON_GetObjectItem(json, "type");
+	const int connector = find_member(doc, payload, "connectorId");
+	const int type = find_member(doc, payload, "type");
+	char str[ENUMSTR_MAXLEN];
 	ocpp_availability_t value;
+	int connector_id;
 
-	if (!connector || !type) {
+	if (connector < 0 || type < 0 ||
+			get_int(doc, connector, &connector_id) < 0 ||
+			get_string(doc, type, str, sizeof(str)) < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
 
-	if (strcmp(cJSON_GetStringValue(type), "Inoperative") == 0) {
+	if (strcmp(str, "Inoperative") == 0) {
 		value = OCPP_INOPERATIVE;
-	} else if (strcmp(cJSON_GetStringValue(type), "Operative") == 0) {
+	} else if (strcmp(str, "Operative") == 0) {
 		value = OCPP_OPERATIVE;
 	} else {
 		return -EBADMSG;
@@ -199,19 +716,19 @@ static int do_change_availability(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	double t = cJSON_GetNumberValue(connector);
-	p->connectorId = (int)t;
+	p->connectorId = connector_id;
 	p->type = value;
 
 	return 0;
 }
 
-static int do_change_configuration(struct ocpp_message *msg, cJSON *json)
+static int do_change_configuration(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *key = cJSON_GetObjectItem(json, "key");
-	const cJSON *value = cJSON_GetObjectItem(json, "value");
+	const int key = find_member(doc, payload, "key");
+	const int value = find_member(doc, payload, "value");
 
-	if (!key || !value) {
+	if (key < 0 || value < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -223,26 +740,31 @@ static int do_change_configuration(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	strcpy(p->key, cJSON_GetStringValue(key));
-	strcpy(p->value, cJSON_GetStringValue(value));
+	if (get_string(doc, key, p->key, sizeof(p->key)) < 0 ||
+			get_string(doc, value, p->value, sizeof(p->value)) < 0) {
+		return reject_message(msg);
+	}
 
 	return 0;
 }
 
-static int do_get_configuration(struct ocpp_message *msg, cJSON *json)
+static int do_get_configuration(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *keys = cJSON_GetObjectItem(json, "key");
-	const int nkeys = keys? cJSON_GetArraySize(keys) : 0;
-	const cJSON *key;
+	const int keys = find_member(doc, payload, "key");
 	size_t keys_len = 0;
-	size_t i = 0;
+	size_t len = 0;
 
-	if (nkeys == 0) {
+	if (keys < 0 || doc->tokens[keys].type != JSON_ARRAY ||
+			doc->tokens[keys].size == 0) {
 		return 0;
 	}
 
-	cJSON_ArrayForEach(key, keys) {
-		keys_len += strlen(cJSON_GetStringValue(key)) + 1/*comma*/;
+	/* the raw length is an upper bound of the unescaped one */
+	for (int i = keys + 1; i < doc->tokens[keys].next;
+			i = doc->tokens[i].next) {
+		keys_len += doc->tokens[i].end - doc->tokens[i].start
+			+ 1/*comma*/;
 	}
 
 	struct ocpp_GetConfiguration *p = (struct ocpp_GetConfiguration *)
@@ -252,24 +774,32 @@ static int do_get_configuration(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	cJSON_ArrayForEach(key, keys) {
-		int written = snprintf(&p->keys[i], keys_len - i, "%s%s",
-				i? "," : "", cJSON_GetStringValue(key));
-		if (written > 0) {
-			i += (size_t)written;
+	for (int i = keys + 1; i < doc->tokens[keys].next;
+			i = doc->tokens[i].next) {
+		if (len) {
+			p->keys[len++] = ',';
 		}
+
+		const int n = get_string(doc, i, &p->keys[len], keys_len + 1 - len);
+
+		if (n < 0) {
+			return reject_message(msg);
+		}
+
+		len += (size_t)n;
 	}
 
 	return 0;
 }
 
-static int do_remote_start(struct ocpp_message *msg, cJSON *json)
+static int do_remote_start(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *cid = cJSON_GetObjectItem(json, "connectorId");
-	const cJSON *uid = cJSON_GetObjectItem(json, "idTag");
-	const cJSON *profile = cJSON_GetObjectItem(json, "chargingProfile");
+	const int cid = find_member(doc, payload, "connectorId");
+	const int uid = find_member(doc, payload, "idTag");
+	const int profile = find_member(doc, payload, "chargingProfile");
 
-	if (!uid) {
+	if (uid < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -282,24 +812,32 @@ static int do_remote_start(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	strcpy(p->idTag, cJSON_GetStringValue(uid));
+	if (get_string(doc, uid, p->idTag, sizeof(p->idTag)) < 0) {
+		return reject_message(msg);
+	}
 
-	if (cid) {
-		double t = cJSON_GetNumberValue(cid);
-		p->connectorId = (int)t;
+	if (cid >= 0) {
+		int t;
+		if (get_int(doc, cid, &t) < 0) {
+			return reject_message(msg);
+		}
+		p->connectorId = t;
 	}
-	if (profile) {
+
+	if (profile >= 0) {
 		/* TODO: parse charging profile */
 	}
 
 	return 0;
 }
 
-static int do_remote_stop(struct ocpp_message *msg, cJSON *json)
+static int do_remote_stop(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *tid = cJSON_GetObjectItem(json, "transactionId");
+	const int tid = find_member(doc, payload, "transactionId");
+	int transaction_id;
 
-	if (!tid) {
+	if (tid < 0 || get_int(doc, tid, &transaction_id) < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -312,17 +850,18 @@ static int do_remote_stop(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	double t = cJSON_GetNumberValue(tid);
-	p->transactionId = (int)t;
+	p->transactionId = transaction_id;
 
 	return 0;
 }
 
-static int do_reset(struct ocpp_message *msg, cJSON *json)
+static int do_reset(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *type = cJSON_GetObjectItem(json, "type");
+	const int type = find_member(doc, payload, "type");
+	char str[ENUMSTR_MAXLEN];
 
-	if (!type) {
+	if (type < 0 || get_string(doc, type, str, sizeof(str)) < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -334,7 +873,7 @@ static int do_reset(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	if (strcmp(cJSON_GetStringValue(type), "Hard") == 0) {
+	if (strcmp(str, "Hard") == 0) {
 		p->type = OCPP_RESET_HARD;
 	} else {
 		p->type = OCPP_RESET_SOFT;
@@ -343,15 +882,16 @@ static int do_reset(struct ocpp_message *msg, cJSON *json)
 	return 0;
 }
 
-static int do_start_transaction(struct ocpp_message *msg, cJSON *json)
+static int do_start_transaction(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *uid = cJSON_GetObjectItem(json, "idTagInfo");
-	const cJSON *tid = cJSON_GetObjectItem(json, "transactionId");
-	const cJSON *status = cJSON_GetObjectItem(uid, "status");
-	const cJSON *expiry = cJSON_GetObjectItem(uid, "expiryDate");
-	const cJSON *pid = cJSON_GetObjectItem(uid, "parentIdTag");
+	const int uid = find_member(doc, payload, "idTagInfo");
+	const int tid = find_member(doc, payload, "transactionId");
+	char str[ENUMSTR_MAXLEN];
+	int t;
 
-	if (!uid || !tid || !status) {
+	if (uid < 0 || tid < 0 || find_member(doc, uid, "status") < 0 ||
+			get_int(doc, tid, &t) < 0) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -359,35 +899,38 @@ static int do_start_transaction(struct ocpp_message *msg, cJSON *json)
 	struct ocpp_StartTransaction_conf *p =
 		(struct ocpp_StartTransaction_conf *)
 		create_message(msg, sizeof(*p));
-	const char *s = cJSON_GetStringValue(status);
 
 	if (!p) {
 		return -ENOMEM;
 	}
 
-	p->idTagInfo.status = ocpp_get_auth_status_from_string(s);
-	double t = cJSON_GetNumberValue(tid);
-	p->transactionId = (int)t;
-
-	if (expiry) {
-		p->idTagInfo.expiryDate = iso8601_convert_to_time(
-			cJSON_GetStringValue(expiry));
-	}
-	if (pid) {
-		strcpy(p->idTagInfo.parentIdTag, cJSON_GetStringValue(pid));
+	if (get_id_tag_info(doc, uid, str, sizeof(str),
+			p->idTagInfo.parentIdTag,
+			sizeof(p->idTagInfo.parentIdTag),
+			&p->idTagInfo.expiryDate) < 0) {
+		return reject_message(msg);
 	}
 
+	p->idTagInfo.status = ocpp_get_auth_status_from_string(str);
+	p->transactionId = t;
+
 	return 0;
 }
 
-static int do_updatefirmware(struct ocpp_message *msg, cJSON *json)
+static int do_updatefirmware(struct ocpp_message *msg,
+		const struct json_doc *doc, int payload)
 {
-	const cJSON *location = cJSON_GetObjectItem(json, "location");
-	const cJSON *retries = cJSON_GetObjectItem(json, "retries");
-	const cJSON *due = cJSON_GetObjectItem(json, "retrieveDate");
-	const cJSON *interval = cJSON_GetObjectItem(json, "retryInterval");
-
-	if (!location || !due) {
+	const int location = find_member(doc, payload, "location");
+	const int retries = find_member(doc, payload, "retries");
+	const int due = find_member(doc, payload, "retrieveDate");
+	const int interval = find_member(doc, payload, "retryInterval");
+	int retry_interval = 0;
+	int nr_retries = 0;
+
+	if (location < 0 || due < 0 ||
+			(interval >= 0 &&
+			 get_int(doc, interval, &retry_interval) < 0) ||
+			(retries >= 0 && get_int(doc, retries, &nr_retries) < 0)) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	}
@@ -399,106 +942,109 @@ static int do_updatefirmware(struct ocpp_message *msg, cJSON *json)
 		return -ENOMEM;
 	}
 
-	strcpy(p->url, cJSON_GetStringValue(location));
-	p->retrieveDate = iso8601_convert_to_time(cJSON_GetStringValue(due));
-
-	if (interval) {
-		double t = cJSON_GetNumberValue(interval);
-		p->retryInterval = (int)t;
-	}
-	if (retries) {
-		double t = cJSON_GetNumberValue(retries);
-		p->retries = (int)t;
+	if (get_string(doc, location, p->url, sizeof(p->url)) < 0 ||
+			get_time(doc, due, &p->retrieveDate) < 0) {
+		return reject_message(msg);
 	}
 
+	p->retryInterval = retry_interval;
+	p->retries = nr_retries;
+
 	return 0;
 }
 
-static struct decoder_entry decoders[] = {
-	{ OCPP_MSG_AUTHORIZE,                do_authorize },
-	{ OCPP_MSG_BOOTNOTIFICATION,         do_bootnotification },
-	{ OCPP_MSG_CHANGE_AVAILABILITY,      do_change_availability },
-	{ OCPP_MSG_CHANGE_CONFIGURATION,     do_change_configuration },
-	{ OCPP_MSG_CLEAR_CACHE,              do_empty },
-	{ OCPP_MSG_DIAGNOSTICS_NOTIFICATION, do_empty },
-	{ OCPP_MSG_FIRMWARE_NOTIFICATION,    do_empty },
-	{ OCPP_MSG_GET_CONFIGURATION,        do_get_configuration },
-	{ OCPP_MSG_HEARTBEAT,                do_current_time },
-	{ OCPP_MSG_METER_VALUES,             do_empty },
-	{ OCPP_MSG_REMOTE_START_TRANSACTION, do_remote_start },
-	{ OCPP_MSG_REMOTE_STOP_TRANSACTION,  do_remote_stop },
-	{ OCPP_MSG_RESET,                    do_reset },
-	{ OCPP_MSG_START_TRANSACTION,        do_start_transaction },
-	{ OCPP_MSG_STATUS_NOTIFICATION,      do_empty },
-	{ OCPP_MSG_STOP_TRANSACTION,         do_empty },
-	{ OCPP_MSG_UPDATE_FIRMWARE,          do_updatefirmware },
+static const decoder_handler_t decoders[OCPP_MSG_MAX] = {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	\
+	[OCPP_MSG_##type] = dec,
+#include "messages.def"
+#undef OCPP_MESSAGE
 };
 
 static decoder_handler_t decoder(ocpp_message_t msgtype)
 {
-	for (size_t i = 0; i < ARRAY_COUNT(decoders); i++) {
-		if (decoders[i].msg_type == msgtype) {
-			return decoders[i].handler;
-		}
+	if ((size_t)msgtype < ARRAY_COUNT(decoders) && decoders[msgtype]) {
+		return decoders[msgtype];
 	}
 
 	error("No decoder found for %s", ocpp_stringify_type(msgtype));
 	return &do_error;
 }
 
-static int decode(struct ocpp_message *msg, cJSON *json)
+static int decode(struct ocpp_message *msg, const struct json_doc *doc)
 {
-	const int narr = cJSON_GetArraySize(json);
+	const uint16_t narr = doc->tokens[0].size;
 
-	if (narr < 3) {
+	if (doc->tokens[0].type != JSON_ARRAY || narr < 3) {
 		return -EPROTO;
 	}
 
-	const double t = cJSON_GetNumberValue(cJSON_GetArrayItem(json, 0));
-	const ocpp_message_role_t role = (ocpp_message_role_t)t;
-	const char *id = cJSON_GetStringValue(cJSON_GetArrayItem(json, 1));
-	cJSON *payload = cJSON_GetArrayItem(json, narr - 1);
+	char id[sizeof(msg->id)];
+	char typestr[ENUMSTR_MAXLEN];
+	int role;
+
+	if (get_int(doc, get_element(doc, 0, 0), &role) < 0 ||
+			get_string(doc, get_element(doc, 0, 1),
+					id, sizeof(id)) < 0) {
+		metrics_increase(OCPPMessageFormatInvalidCount);
+		return -EBADMSG;
+	}
+
+	const int payload = get_element(doc, 0, (uint16_t)(narr - 1));
 	ocpp_message_t type = ocpp_get_type_from_idstr(id);
 
-	if (role < OCPP_MSG_ROLE_CALL || role > OCPP_MSG_ROLE_CALLERROR ||
-			(role == OCPP_MSG_ROLE_CALL && payload == NULL)) {
+	if (role < OCPP_MSG_ROLE_CALL || role > OCPP_MSG_ROLE_CALLERROR) {
 		metrics_increase(OCPPMessageFormatInvalidCount);
 		return -EBADMSG;
 	} else if (role == OCPP_MSG_ROLE_CALL) {
-		const char *typestr =
-			cJSON_GetStringValue(cJSON_GetArrayItem(json, 2));
-		type = ocpp_get_type_from_string(typestr);
+		const int len = get_string(doc, get_element(doc, 0, 2),
+				typestr, sizeof(typestr));
+
+		if (len < 0) {
+			metrics_increase(OCPPMessageFormatInvalidCount);
+			return -EBADMSG;
+		}
+		type = registry_find_type(typestr, (size_t)len);
 	}
 
 	*msg = (struct ocpp_message) {
-		.role = role,
+		.role = (ocpp_message_role_t)role,
 		.type = type,
 	};
-	memcpy(msg->id, id, MIN(sizeof(msg->id), strlen(id)));
+	memcpy(msg->id, id, sizeof(msg->id));
 
-	return (*decoder(type))(msg, payload);
+	return (*decoder(type))(msg, doc, payload);
 }
 
 int decoder_json_decode(struct ocpp_message *msg, const char *json_str,
 		const size_t json_strlen, size_t *decoded_len)
 {
-	const char *pnext;
-	cJSON *json = cJSON_ParseWithLengthOpts(json_str,
-			json_strlen, &pnext, false);
+	struct tokenizer t = {
+		.js = json_str,
+		.len = json_strlen,
+		.tokens = tokens,
+	};
 	size_t consumed = json_strlen; /* drop the message if failed */
 	int err = -EINVAL;
 
-	if (!json || !json_strlen) {
-		if (!json_strlen) {
+	if (!json_str || !json_strlen) {
+		if (json_str) {
 			err = -ENOMSG;
 		}
 		goto out;
 	}
 
-	consumed = (size_t)(pnext - json_str);
-	err = decode(msg, json);
+	/* Only the first frame is taken. Any frame that follows it in the
+	 * buffer is left for the next call. */
+	if (parse_value(&t) < 0) {
+		goto out;
+	}
+
+	consumed = t.pos;
+	err = decode(msg, &(const struct json_doc) {
+		.js = json_str,
+		.tokens = tokens,
+	});
 out:
-	cJSON_Delete(json);
 	if (decoded_len) {
 		*decoded_len = consumed;
 	}
@@ -31,12 +31,13 @@
  */
 
 #include "encoder_json.h"
+#include "registry.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include "cJSON.h"
 #include "ocpp/strconv.h"
 #include "libmcu/timext.h"
 #include "libmcu/strext.h"
@@ -44,183 +45,309 @@
 #include "logger.h"
 #include "ocpp/type.h"
 
-#define MSG_IDSTR_MAXLEN		64
-
 #if !defined(ARRAY_COUNT)
 #define ARRAY_COUNT(x)			(sizeof(x) / sizeof((x)[0]))
 #endif
 
-typedef bool (*encoder_handler_t)(const struct ocpp_message *msg, cJSON *json);
-
-struct encoder_entry {
-	const ocpp_message_t msg_type;
-	const encoder_handler_t handler;
+/* Frames are written straight into the caller's buffer. A write that does not
+ * fit latches -ENOBUFS and every following write is dropped, so handlers do
+ * not need to check each field. */
+struct json_writer {
+	char *buf;
+	size_t cap;
+	size_t len;
+	bool need_comma;
+	int err;
 };
 
+typedef void (*encoder_handler_t)(const struct ocpp_message *msg,
+		struct json_writer *w);
+
 struct configuration_ctx {
-	cJSON *known;
-	cJSON *unknown;
-	int unknown_count;
+	struct json_writer *w;
+	const char *name;
+	bool unknown;
+	bool opened;
 };
 
-static bool do_empty(const struct ocpp_message *msg, cJSON *json)
+static const char hexdigits[] = "0123456789abcdef";
+
+static void write_char(struct json_writer *w, char c)
+{
+	if (w->err) {
+		return;
+	}
+
+	/* one byte is kept for the terminating NUL */
+	if (w->len + 1 >= w->cap) {
+		w->err = -ENOBUFS;
+		return;
+	}
+
+	w->buf[w->len++] = c;
+}
+
+static void write_bytes(struct json_writer *w, const char *str, size_t len)
+{
+	if (w->err) {
+		return;
+	}
+
+	if (w->len + len >= w->cap) {
+		w->err = -ENOBUFS;
+		return;
+	}
+
+	memcpy(&w->buf[w->len], str, len);
+	w->len += len;
+}
+
+static void write_raw(struct json_writer *w, const char *str)
+{
+	write_bytes(w, str, strlen(str));
+}
+
+static bool is_escape_needed(const uint8_t c)
+{
+	return c == '"' || c == '\\' || c < 0x20;
+}
+
+/* Runs of characters that need no escaping are copied at once. */
+static void write_escaped(struct json_writer *w, const char *str)
+{
+	write_char(w, '"');
+
+	while (*str) {
+		size_t n = 0;
+
+		while (str[n] && !is_escape_needed((uint8_t)str[n])) {
+			n++;
+		}
+
+		write_bytes(w, str, n);
+		str += n;
+
+		if (*str) {
+			const uint8_t c = (uint8_t)*str++;
+
+			if (c == '"' || c == '\\') {
+				write_char(w, '\\');
+				write_char(w, (char)c);
+			} else {
+				write_raw(w, "\\u00");
+				write_char(w, hexdigits[c >> 4]);
+				write_char(w, hexdigits[c & 0xf]);
+			}
+		}
+	}
+
+	write_char(w, '"');
+}
+
+static void write_separator(struct json_writer *w)
+{
+	if (w->need_comma) {
+		write_char(w, ',');
+	}
+	w->need_comma = false;
+}
+
+static void open_container(struct json_writer *w, char c)
+{
+	write_separator(w);
+	write_char(w, c);
+}
+
+static void close_container(struct json_writer *w, char c)
+{
+	write_char(w, c);
+	w->need_comma = true;
+}
+
+static void write_key(struct json_writer *w, const char *key)
+{
+	write_separator(w);
+	write_escaped(w, key);
+	write_char(w, ':');
+}
+
+static void put_string(struct json_writer *w, const char *str)
+{
+	write_separator(w);
+	write_escaped(w, str? str : "");
+	w->need_comma = true;
+}
+
+static void put_int(struct json_writer *w, const int64_t value)
+{
+	char tmp[24];
+	snprintf(tmp, sizeof(tmp), "%" PRId64, value);
+
+	write_separator(w);
+	write_raw(w, tmp);
+	w->need_comma = true;
+}
+
+static void add_string(struct json_writer *w, const char *key, const char *str)
+{
+	write_key(w, key);
+	put_string(w, str);
+}
+
+static void add_int(struct json_writer *w, const char *key, const int64_t value)
+{
+	write_key(w, key);
+	put_int(w, value);
+}
+
+static void add_bool(struct json_writer *w, const char *key, const bool value)
+{
+	write_key(w, key);
+	write_raw(w, value? "true" : "false");
+	w->need_comma = true;
+}
+
+static void add_timestamp(struct json_writer *w, const char *key,
+		const time_t timestamp)
+{
+	char tstr[32] = { 0, };
+	iso8601_convert_to_string(timestamp, tstr, sizeof(tstr));
+	add_string(w, key, tstr);
+}
+
+static void do_empty(const struct ocpp_message *msg, struct json_writer *w)
 {
 	(void)msg;
-	(void)json;
-	return true;
+	(void)w;
 }
 
-static bool do_authorize(const struct ocpp_message *msg, cJSON *json)
+static void do_authorize(const struct ocpp_message *msg, struct json_writer *w)
 {
 	const struct ocpp_Authorize *p =
 		(const struct ocpp_Authorize *)msg->payload.fmt.request;
 
-	return cJSON_AddItemToObject(json,
-			"idTag", cJSON_CreateString(p->idTag));
+	add_string(w, "idTag", p->idTag);
 }
 
-static bool do_bootnotification(const struct ocpp_message *msg, cJSON *json)
+static void do_bootnotification(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_BootNotification *p =
 		(const struct ocpp_BootNotification *)msg->payload.fmt.request;
-	int expected_ok = 2;
-	int ok = 0;
 
-	ok += cJSON_AddItemToObject(json, "chargePointModel",
-			cJSON_CreateString(p->chargePointModel));
-	ok += cJSON_AddItemToObject(json, "chargePointVendor",
-			cJSON_CreateString(p->chargePointVendor));
+	add_string(w, "chargePointModel", p->chargePointModel);
+	add_string(w, "chargePointVendor", p->chargePointVendor);
 
-	if (strlen(p->firmwareVersion) > 0) {
-		ok += cJSON_AddItemToObject(json, "firmwareVersion",
-				cJSON_CreateString(p->firmwareVersion));
-		expected_ok++;
+	if (p->firmwareVersion[0] != '\0') {
+		add_string(w, "firmwareVersion", p->firmwareVersion);
 	}
-	if (strlen(p->chargePointSerialNumber) > 0) {
-		ok += cJSON_AddItemToObject(json, "chargePointSerialNumber",
-				cJSON_CreateString(p->chargePointSerialNumber));
-		expected_ok++;
+	if (p->chargePointSerialNumber[0] != '\0') {
+		add_string(w, "chargePointSerialNumber",
+				p->chargePointSerialNumber);
 	}
-
-	if (ok != expected_ok) {
-		return false;
-	}
-
-	return true;
 }
 
-static bool do_change_availability(const struct ocpp_message *msg, cJSON *json)
+static void do_change_availability(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_ChangeAvailability_conf *p =
 		(const struct ocpp_ChangeAvailability_conf *)
 		msg->payload.fmt.response;
 
-	if (!cJSON_AddItemToObject(json, "status", cJSON_CreateString(
-			ocpp_stringify_availability_status(p->status)))) {
-		return false;
-	}
-
-	return true;
+	add_string(w, "status", ocpp_stringify_availability_status(p->status));
 }
 
-static bool do_change_configuration(const struct ocpp_message *msg, cJSON *json)
+static void do_change_configuration(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_ChangeConfiguration_conf *p =
 		(const struct ocpp_ChangeConfiguration_conf *)
 		msg->payload.fmt.response;
 
-	if (!cJSON_AddItemToObject(json, "status", cJSON_CreateString(
-			ocpp_stringify_config_status(p->status)))) {
-		return false;
-	}
-
-	return true;
+	add_string(w, "status", ocpp_stringify_config_status(p->status));
 }
 
-static bool do_clear_cache(const struct ocpp_message *msg, cJSON *json)
+static void do_clear_cache(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_ClearCache_conf *p =
 		(const struct ocpp_ClearCache_conf *)msg->payload.fmt.response;
 
-	if (!cJSON_AddItemToObject(json, "status", cJSON_CreateString(
-			ocpp_stringify_remote_status(p->status)))) {
-		return false;
-	}
-
-	return true;
+	add_string(w, "status", ocpp_stringify_remote_status(p->status));
 }
 
-static bool do_diagnostic_noti(const struct ocpp_message *msg, cJSON *json)
+static void do_diagnostic_noti(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_DiagnosticsStatusNotification *p =
 		(const struct ocpp_DiagnosticsStatusNotification *)
 		msg->payload.fmt.request;
 
-	const char *str = ocpp_stringify_comm_status(p->status);
-	cJSON_AddItemToObject(json, "status", cJSON_CreateString(str));
-
-	return true;
+	add_string(w, "status", ocpp_stringify_comm_status(p->status));
 }
 
-static bool do_fw_staus_noti(const struct ocpp_message *msg, cJSON *json)
+static void do_fw_status_noti(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_FirmwareStatusNotification *p =
 		(const struct ocpp_FirmwareStatusNotification *)
 		msg->payload.fmt.request;
 
-	const char *str = ocpp_stringify_comm_status(p->status);
-	cJSON_AddItemToObject(json, "status", cJSON_CreateString(str));
+	add_string(w, "status", ocpp_stringify_comm_status(p->status));
+}
 
-	return true;
+/* The array is opened on the first entry so that an empty list is left out
+ * of the payload altogether. */
+static void open_configuration_list(struct configuration_ctx *ctx)
+{
+	if (!ctx->opened) {
+		write_key(ctx->w, ctx->name);
+		open_container(ctx->w, '[');
+		ctx->opened = true;
+	}
 }
 
-static bool pack_configuration(const char *key, cJSON *known, cJSON *unknown)
+static void pack_configuration(const char *key, struct configuration_ctx *ctx)
 {
 #define CFGVAL_STR_MAXLEN		256
 	const size_t value_size = ocpp_get_configuration_size(key);
-	uint8_t value[value_size];
-	bool readonly;
-	cJSON *obj;
-	char buf[CFGVAL_STR_MAXLEN];
 
 	if (value_size == 0) {
-		cJSON_AddItemToArray(unknown, cJSON_CreateString(key));
-		return false;
+		if (ctx->unknown) {
+			open_configuration_list(ctx);
+			put_string(ctx->w, key);
+		}
+		return;
 	}
 
-	if (!ocpp_is_configuration_readable(key) ||
-			(obj = cJSON_CreateObject()) == NULL) {
-		return false;
+	if (ctx->unknown || !ocpp_is_configuration_readable(key)) {
+		return;
 	}
 
-	ocpp_get_configuration(key, value, value_size, &readonly);
+	uint8_t value[value_size];
+	char buf[CFGVAL_STR_MAXLEN];
+	bool readonly = false;
 
-	cJSON_AddItemToArray(known, obj);
-	cJSON_AddItemToObject(obj, "key", cJSON_CreateString(key));
-	cJSON_AddItemToObject(obj, "readonly", cJSON_CreateBool(readonly));
-	cJSON_AddItemToObject(obj, "value", cJSON_CreateString(
-		ocpp_stringify_configuration_value(key, buf, sizeof(buf))));
+	ocpp_get_configuration(key, value, value_size, &readonly);
 
-	return true;
+	open_configuration_list(ctx);
+	open_container(ctx->w, '{');
+	add_string(ctx->w, "key", key);
+	add_bool(ctx->w, "readonly", readonly);
+	add_string(ctx->w, "value",
+		ocpp_stringify_configuration_value(key, buf, sizeof(buf)));
+	close_container(ctx->w, '}');
 }
 
-static int pack_all_configurations(cJSON *known, cJSON *unknown, int max_count)
+static void pack_all_configurations(struct configuration_ctx *ctx)
 {
-	unused(max_count);
-	int count = 0;
-
 	for (size_t i = 0; i < ocpp_count_configurations(); i++) {
 		const char *key;
 
-		if (!(key = ocpp_get_configuration_keystr_from_index((int)i))) {
-			continue;
+		if ((key = ocpp_get_configuration_keystr_from_index((int)i))) {
+			pack_configuration(key, ctx);
 		}
-
-		count++;
-		pack_configuration(key, known, unknown);
 	}
-
-	return count;
 }
 
 static void on_each_conf_key(const char *chunk, size_t chunk_len, void *ctx)
@@ -231,427 +358,286 @@ static void on_each_conf_key(const char *chunk, size_t chunk_len, void *ctx)
 	strncpy(key, chunk, chunk_len);
 	strtrim(key, ' ');
 
-	if (chunk_len && !pack_configuration(key, p->known, p->unknown)) {
-		p->unknown_count++;
+	if (chunk_len) {
+		pack_configuration(key, p);
 	}
 }
 
-static int pack_configurations(const char *keys, cJSON *known, cJSON *unknown,
-		int max_count, int *unknown_count)
+static void pack_configurations(const char *keys, struct configuration_ctx *ctx)
 {
-	unused(unknown_count);
-	struct configuration_ctx ctx = {
-		.known = known,
-		.unknown = unknown,
-		.unknown_count = 0,
-	};
-
-	int count = (int)strchunk(keys, ',', on_each_conf_key, &ctx);
-
-	if (!count) {
-		count = pack_all_configurations(known, unknown, max_count);
+	if (!strchunk(keys, ',', on_each_conf_key, ctx)) {
+		pack_all_configurations(ctx);
 	}
 
-	return count;
+	if (ctx->opened) {
+		close_container(ctx->w, ']');
+	}
 }
 
-static bool do_get_configuration(const struct ocpp_message *msg, cJSON *json)
+/* The requested keys are walked twice, known ones first and then unknown
+ * ones, as the two lists can not be interleaved in a single pass. */
+static void do_get_configuration(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const char *keystr = (const char *)msg->payload.fmt.data;
-	int unknown_count = 0;
-	int max_count = 0;
-	cJSON *known;
-	cJSON *unknown;
-
-	if ((known = cJSON_CreateArray()) == NULL) {
-		return false;
-	}
-	if ((unknown = cJSON_CreateArray()) == NULL) {
-		cJSON_Delete(known);
-		return false;
-	}
-
-	ocpp_get_configuration("GetConfigurationMaxKeys",
-			&max_count, sizeof(max_count), NULL);
-
-	int count = pack_configurations(keystr,
-			known, unknown, max_count, &unknown_count);
-
-	if (count - unknown_count > 0) {
-		cJSON_AddItemToObject(json, "configurationKey", known);
-	} else {
-		cJSON_Delete(known);
-	}
 
-	if (unknown_count) {
-		cJSON_AddItemToObject(json, "unknownKey", unknown);
-	} else {
-		cJSON_Delete(unknown);
-	}
-
-	return true;
+	pack_configurations(keystr, &(struct configuration_ctx) {
+		.w = w,
+		.name = "configurationKey",
+	});
+	pack_configurations(keystr, &(struct configuration_ctx) {
+		.w = w,
+		.name = "unknownKey",
+		.unknown = true,
+	});
 }
 
-static cJSON *create_sample_value(const struct ocpp_SampledValue *sample)
+static void pack_sample_value(struct json_writer *w,
+		const struct ocpp_SampledValue *sample)
 {
-	cJSON *value = cJSON_CreateObject();
-
-	if (!value) {
-		return NULL;
-	}
+	open_container(w, '{');
 
-	cJSON_AddItemToObject(value, "value", cJSON_CreateString(sample->value));
+	add_string(w, "value", sample->value);
 
 	if (sample->context) {
-		cJSON_AddItemToObject(value, "context", cJSON_CreateString(
-				ocpp_stringify_context(sample->context)));
+		add_string(w, "context",
+				ocpp_stringify_context(sample->context));
 	}
 	if (sample->measurand) {
-		cJSON_AddItemToObject(value, "measurand", cJSON_CreateString(
-				ocpp_stringify_measurand(sample->measurand)));
+		add_string(w, "measurand",
+				ocpp_stringify_measurand(sample->measurand));
 	}
 	if (sample->unit) {
-		cJSON_AddItemToObject(value, "unit", cJSON_CreateString(
-				ocpp_stringify_unit(sample->unit)));
+		add_string(w, "unit", ocpp_stringify_unit(sample->unit));
 	}
 
-	return value;
+	close_container(w, '}');
 }
 
-static cJSON *create_meter_value(const struct ocpp_MeterValue *meter,
-		size_t n)
+static void pack_meter_value(struct json_writer *w,
+		const struct ocpp_MeterValue *meter, size_t n)
 {
-	cJSON *value = cJSON_CreateObject();
+	const struct ocpp_SampledValue *sampleValue =
+		(const struct ocpp_SampledValue *)(const void *)
+		meter->sampledValue;
 
-	if (!value) {
-		return NULL;
+	open_container(w, '{');
+	add_timestamp(w, "timestamp", meter->timestamp);
+
+	write_key(w, "sampledValue");
+	open_container(w, '[');
+	for (size_t i = 0; i < n; i++) {
+		pack_sample_value(w, &sampleValue[i]);
 	}
+	close_container(w, ']');
 
+	close_container(w, '}');
+}
+
+/* An empty value, which is never sent, ends the entry. The last entry may
+ * also end with the payload. */
+static size_t count_sampled_values(const struct ocpp_MeterValue *meter,
+		size_t room)
+{
 	const struct ocpp_SampledValue *sampleValue =
 		(const struct ocpp_SampledValue *)(const void *)
 		meter->sampledValue;
+	const size_t offset = (size_t)((const uint8_t *)sampleValue -
+			(const uint8_t *)meter);
+	size_t n = 0;
 
-	char tstr[32] = { 0, };
-	iso8601_convert_to_string(meter->timestamp, tstr, sizeof(tstr));
-	cJSON_AddItemToObject(value, "timestamp", cJSON_CreateString(tstr));
-
-	cJSON *samples = cJSON_CreateArray();
-	if (samples) {
-		cJSON_AddItemToObject(value, "sampledValue", samples);
-
-		for (size_t i = 0; i < n; i++) {
-			cJSON *sample = create_sample_value(&sampleValue[i]);
-			if (sample) {
-				cJSON_AddItemToArray(samples, sample);
-			}
-		}
+	while (offset + (n + 1) * sizeof(*sampleValue) <= room &&
+			sampleValue[n].value[0]) {
+		n++;
 	}
 
-	return value;
+	return n;
 }
 
-static bool do_meter_value(const struct ocpp_message *msg, cJSON *json)
+static void do_meter_value(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_MeterValues *p =
 		(const struct ocpp_MeterValues *)msg->payload.fmt.request;
-        /* FIXME: deal with multiple meter values and sampled values. only one
-         * meter value with multiple sampled values supported at the moment. */
-        const size_t n = (msg->payload.size -
-			sizeof(*p) - sizeof(struct ocpp_MeterValue))
-		/ sizeof(struct ocpp_SampledValue);
-	int expected_ok = 1;
-	int ok = 0;
-
-	ok += cJSON_AddItemToObject(json, "connectorId",
-			cJSON_CreateNumber(p->connectorId));
+	const uint8_t *entries = (const uint8_t *)p->meterValue;
+	const size_t size = msg->payload.size -
+		(size_t)(entries - (const uint8_t *)p);
+
+	add_int(w, "connectorId", p->connectorId);
 	if (p->transactionId) {
-		ok += cJSON_AddItemToObject(json, "transactionId",
-				cJSON_CreateNumber(p->transactionId));
-		expected_ok++;
+		add_int(w, "transactionId", p->transactionId);
 	}
 
-	cJSON *values = cJSON_CreateArray();
+	write_key(w, "meterValue");
+	open_container(w, '[');
 
-	if (values) {
-		ok += cJSON_AddItemToObject(json, "meterValue", values);
-		expected_ok++;
+	for (size_t off = 0; off + sizeof(struct ocpp_MeterValue) <= size;) {
 		const struct ocpp_MeterValue *meterValue =
 			(const struct ocpp_MeterValue *)(const void *)
-			p->meterValue;
-		cJSON *value = create_meter_value(meterValue, n);
-		if (value) {
-			ok += cJSON_AddItemToArray(values, value);
-			expected_ok++;
-		}
-	}
+			&entries[off];
+		const size_t n = count_sampled_values(meterValue, size - off);
 
-	if (ok != expected_ok) {
-		return false;
+		pack_meter_value(w, meterValue, n);
+		off += encoder_json_metervalue_size(n);
 	}
 
-	return true;
+	close_container(w, ']');
 }
 
-static bool do_remote_start_stop(const struct ocpp_message *msg, cJSON *json)
+static void do_remote_start_stop(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_RemoteStartTransaction_conf *p =
 		(const struct ocpp_RemoteStartTransaction_conf *)
 		msg->payload.fmt.response;
 
-	if (!cJSON_AddItemToObject(json, "status", cJSON_CreateString(
-			ocpp_stringify_remote_status(p->status)))) {
-		return false;
-	}
-
-	return true;
+	add_string(w, "status", ocpp_stringify_remote_status(p->status));
 }
 
-static bool do_reset(const struct ocpp_message *msg, cJSON *json)
+static void do_reset(const struct ocpp_message *msg, struct json_writer *w)
 {
 	const struct ocpp_Reset_conf *p = (const struct ocpp_Reset_conf *)
 		msg->payload.fmt.response;
 
-	if (!cJSON_AddItemToObject(json, "status", cJSON_CreateString(
-			ocpp_stringify_remote_status(p->status)))) {
-		return false;
-	}
-
-	return true;
+	add_string(w, "status", ocpp_stringify_remote_status(p->status));
 }
 
-static bool do_start_transaction(const struct ocpp_message *msg, cJSON *json)
+static void do_start_transaction(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_StartTransaction *p =
 		(const struct ocpp_StartTransaction *)msg->payload.fmt.request;
-	int expected_ok = 4;
-	int ok = 0;
-	char tstr[32] = { 0, };
-
-	ok += cJSON_AddItemToObject(json, "connectorId",
-			cJSON_CreateNumber(p->connectorId));
-	ok += cJSON_AddItemToObject(json, "meterStart",
-			cJSON_CreateNumber((double)p->meterStart));
-	ok += cJSON_AddItemToObject(json, "idTag",
-			cJSON_CreateString(p->idTag));
 
-	iso8601_convert_to_string(p->timestamp, tstr, sizeof(tstr));
-	ok += cJSON_AddItemToObject(json, "timestamp", cJSON_CreateString(tstr));
+	add_int(w, "connectorId", p->connectorId);
+	add_int(w, "meterStart", (int64_t)p->meterStart);
+	add_string(w, "idTag", p->idTag);
+	add_timestamp(w, "timestamp", p->timestamp);
 
 	if (p->reservationId) {
-		ok += cJSON_AddItemToObject(json, "reservationId",
-				cJSON_CreateNumber(p->reservationId));
-		expected_ok++;
+		add_int(w, "reservationId", p->reservationId);
 	}
-
-	if (ok != expected_ok) {
-		return false;
-	}
-
-	return true;
 }
 
-static bool do_statusnotification(const struct ocpp_message *msg, cJSON *json)
+static void do_statusnotification(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_StatusNotification *p =
 		(const struct ocpp_StatusNotification *)
 		msg->payload.fmt.request;
-	int expected_ok = 3;
-	int ok = 0;
-
-	ok += cJSON_AddItemToObject(json, "connectorId",
-			cJSON_CreateNumber(p->connectorId));
-	ok += cJSON_AddItemToObject(json, "errorCode",
-			cJSON_CreateString(ocpp_stringify_error(p->errorCode)));
-	ok += cJSON_AddItemToObject(json, "status",
-			cJSON_CreateString(ocpp_stringify_status(p->status)));
-
-	if (strlen(p->info) > 0) {
-		ok += cJSON_AddItemToObject(json, "info",
-				cJSON_CreateString(p->info));
-		expected_ok++;
-	}
-	if (strlen(p->vendorId) > 0) {
-		ok += cJSON_AddItemToObject(json, "vendorId",
-				cJSON_CreateString(p->vendorId));
-		expected_ok++;
-	}
-	if (strlen(p->vendorErrorCode) > 0) {
-		ok += cJSON_AddItemToObject(json, "vendorErrorCode",
-				cJSON_CreateString(p->vendorErrorCode));
-		expected_ok++;
+
+	add_int(w, "connectorId", p->connectorId);
+	add_string(w, "errorCode", ocpp_stringify_error(p->errorCode));
+	add_string(w, "status", ocpp_stringify_status(p->status));
+
+	if (p->info[0] != '\0') {
+		add_string(w, "info", p->info);
 	}
-	if (p->timestamp) {
-		char tstr[32] = { 0, };
-		iso8601_convert_to_string(p->timestamp, tstr, sizeof(tstr));
-		ok += cJSON_AddItemToObject(json, "timestamp",
-				cJSON_CreateString(tstr));
-		expected_ok++;
+	if (p->vendorId[0] != '\0') {
+		add_string(w, "vendorId", p->vendorId);
 	}
-
-	if (ok != expected_ok) {
-		return false;
+	if (p->vendorErrorCode[0] != '\0') {
+		add_string(w, "vendorErrorCode", p->vendorErrorCode);
+	}
+	if (p->timestamp) {
+		add_timestamp(w, "timestamp", p->timestamp);
 	}
-
-	return true;
 }
 
-static bool do_stop_transaction(const struct ocpp_message *msg, cJSON *json)
+static void do_stop_transaction(const struct ocpp_message *msg,
+		struct json_writer *w)
 {
 	const struct ocpp_StopTransaction *p =
 		(const struct ocpp_StopTransaction *)msg->payload.fmt.request;
-	int expected_ok = 4;
-	int ok = 0;
-	char tstr[32] = { 0, };
-
-	ok += cJSON_AddItemToObject(json, "transactionId",
-			cJSON_CreateNumber(p->transactionId));
-	ok += cJSON_AddItemToObject(json, "meterStop",
-			cJSON_CreateNumber((double)p->meterStop));
-	ok += cJSON_AddItemToObject(json, "reason", cJSON_CreateString(
-			ocpp_stringify_stop_reason(p->reason)));
 
-	iso8601_convert_to_string(p->timestamp, tstr, sizeof(tstr));
-	ok += cJSON_AddItemToObject(json, "timestamp", cJSON_CreateString(tstr));
+	add_int(w, "transactionId", p->transactionId);
+	add_int(w, "meterStop", (int64_t)p->meterStop);
+	add_string(w, "reason", ocpp_stringify_stop_reason(p->reason));
+	add_timestamp(w, "timestamp", p->timestamp);
 
 	if (p->idTag[0] != '\0') {
-		ok += cJSON_AddItemToObject(json, "idTag",
-				cJSON_CreateString(p->idTag));
-		expected_ok++;
+		add_string(w, "idTag", p->idTag);
 	}
 
 	/* TODO: implemet transactionData */
+}
 
-	if (ok != expected_ok) {
-		return false;
-	}
-
-	return true;
-}
-
-static struct encoder_entry encoders[] = {
-	{ OCPP_MSG_AUTHORIZE,                do_authorize },
-	{ OCPP_MSG_BOOTNOTIFICATION,         do_bootnotification },
-	{ OCPP_MSG_CHANGE_AVAILABILITY,      do_change_availability },
-	{ OCPP_MSG_CHANGE_CONFIGURATION,     do_change_configuration },
-	{ OCPP_MSG_CLEAR_CACHE,              do_clear_cache },
-	{ OCPP_MSG_DIAGNOSTICS_NOTIFICATION, do_diagnostic_noti },
-	{ OCPP_MSG_FIRMWARE_NOTIFICATION,    do_fw_staus_noti },
-	{ OCPP_MSG_GET_CONFIGURATION,        do_get_configuration },
-	{ OCPP_MSG_HEARTBEAT,                do_empty },
-	{ OCPP_MSG_METER_VALUES,             do_meter_value },
-	{ OCPP_MSG_REMOTE_START_TRANSACTION, do_remote_start_stop },
-	{ OCPP_MSG_REMOTE_STOP_TRANSACTION,  do_remote_start_stop },
-	{ OCPP_MSG_RESET,                    do_reset },
-	{ OCPP_MSG_START_TRANSACTION,        do_start_transaction },
-	{ OCPP_MSG_STATUS_NOTIFICATION,      do_statusnotification },
-	{ OCPP_MSG_STOP_TRANSACTION,         do_stop_transaction },
-	{ OCPP_MSG_UPDATE_FIRMWARE,          do_empty },
+static const encoder_handler_t encoders[OCPP_MSG_MAX] = {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	\
+	[OCPP_MSG_##type] = enc,
+#include "messages.def"
+#undef OCPP_MESSAGE
 };
 
-static bool encode(const struct ocpp_message *msg, cJSON *json)
+static encoder_handler_t get_encoder(const struct ocpp_message *msg)
 {
 	if (msg->role == OCPP_MSG_ROLE_CALLERROR) {
-		return do_empty(msg, json);
-	}
-
-	for (size_t i = 0; i < ARRAY_COUNT(encoders); i++) {
-		if (encoders[i].msg_type == msg->type) {
-			return encoders[i].handler(msg, json);
-		}
+		return do_empty;
+	} else if ((size_t)msg->type >= ARRAY_COUNT(encoders)) {
+		return NULL;
 	}
 
-	error("No encoder found for message type %s",
-			ocpp_stringify_type(msg->type));
-	return false;
+	return encoders[msg->type];
 }
 
-static cJSON *create_message_header(const ocpp_message_role_t role,
-		const char *id, const ocpp_message_t type)
+static void write_message_header(struct json_writer *w,
+		const struct ocpp_message *msg)
 {
-	int expected_ok = 2;
-	int ok = 0;
-	cJSON *json = cJSON_CreateArray();
-
-	if (json) {
-		ok += cJSON_AddItemToArray(json, cJSON_CreateNumber(role));
-		ok += cJSON_AddItemToArray(json, cJSON_CreateString(id));
-
-		if (role == OCPP_MSG_ROLE_CALL) {
-			const char *typestr = ocpp_stringify_type(type);
-			char buf[MSG_IDSTR_MAXLEN] = { 0, };
-			snprintf(buf, sizeof(buf), "%s", typestr);
-
-			ok += cJSON_AddItemToArray(json,
-					cJSON_CreateString(buf));
-			expected_ok++;
-		} else if (role == OCPP_MSG_ROLE_CALLERROR) {
-			ok += cJSON_AddItemToArray(json,
-					cJSON_CreateString("NotImplemented"));
-			ok += cJSON_AddItemToArray(json,
-					cJSON_CreateString(""));
-			expected_ok += 2;
-		}
+	put_int(w, msg->role);
+	put_string(w, msg->id);
 
-		if (ok != expected_ok) {
-			cJSON_Delete(json);
-			json = NULL;
-			error("Failed to create message header");
-		}
+	if (msg->role == OCPP_MSG_ROLE_CALL) {
+		put_string(w, registry_get_action(msg->type));
+	} else if (msg->role == OCPP_MSG_ROLE_CALLERROR) {
+		put_string(w, "NotImplemented");
+		put_string(w, "");
 	}
-
-	return json;
 }
 
-static cJSON *create_json_container(const struct ocpp_message *msg,
-		cJSON **body)
+int encoder_json_encode(const struct ocpp_message *msg,
+		char *buf, size_t bufsize)
 {
-	cJSON *json = create_message_header(msg->role, msg->id, msg->type);
-	cJSON *payload = cJSON_CreateObject();
+	encoder_handler_t handler;
 
-	if (json && payload && cJSON_AddItemToArray(json, payload)) {
-		*body = payload;
-		return json;
+	if (!msg || !buf || !bufsize) {
+		error("Invalid message");
+		return -EINVAL;
 	}
 
-	cJSON_Delete(payload); /* safe to free null pointer */
-	cJSON_Delete(json);
-	error("Failed to create JSON container for %s",
-			ocpp_stringify_type(msg->type));
-
-	return NULL;
-}
-
-char *encoder_json_encode(const struct ocpp_message *msg, size_t *msglen)
-{
-	size_t len = 0;
-	char *text = NULL;
-	cJSON *payload = NULL;
-	cJSON *json;
-
-	if (!msg) {
-		error("Invalid message");
-		return NULL;
+	if (!(handler = get_encoder(msg))) {
+		error("No encoder found for message type %s",
+				ocpp_stringify_type(msg->type));
+		return -ENOTSUP;
 	}
 
-	if ((json = create_json_container(msg, &payload)) && payload &&
-			encode(msg, payload)) {
-		text = cJSON_PrintUnformatted(json);
+	struct json_writer w = {
+		.buf = buf,
+		.cap = bufsize,
+	};
 
-		if (text) {
-			len = strlen(text);
-		}
-	}
+	open_container(&w, '[');
+	write_message_header(&w, msg);
+	open_container(&w, '{');
+	(*handler)(msg, &w);
+	close_container(&w, '}');
+	close_container(&w, ']');
 
-	if (text && msglen) {
-		*msglen = len;
+	if (w.err) {
+		error("Failed to encode %s: %zu bytes not enough",
+				ocpp_stringify_type(msg->type), bufsize);
+		buf[0] = '\0';
+		return w.err;
 	}
 
-	cJSON_Delete(json); /* safe to free null pointer */
+	buf[w.len] = '\0';
 
-	return text;
+	return (int)w.len;
 }
 
-void encoder_json_free(char *json)
+size_t encoder_json_metervalue_size(size_t nsamples)
 {
-	cJSON_free(json);
+	const size_t align = _Alignof(struct ocpp_MeterValue);
+	const size_t size = sizeof(struct ocpp_MeterValue) +
+		(nsamples + 1) * sizeof(struct ocpp_SampledValue);
+
+	return (size + align - 1) / align * align;
 }
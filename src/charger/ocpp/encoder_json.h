@@ -39,8 +39,36 @@ extern "C" {
 
 #include "ocpp/ocpp.h"
 
-char *encoder_json_encode(const struct ocpp_message *msg, size_t *msglen);
-void encoder_json_free(char *json);
+/**
+ * @brief Encode a message as an OCPP-J frame into the given buffer.
+ *
+ * No memory is allocated. The frame is NUL-terminated, so @p bufsize must
+ * leave room for one extra byte.
+ *
+ * @param[in] msg Message to encode.
+ * @param[out] buf Buffer where the frame is written.
+ * @param[in] bufsize Size of the buffer, in bytes.
+ *
+ * @return Length of the frame on success, -EINVAL on invalid arguments,
+ *         -ENOTSUP if the message type has no encoder, or -ENOBUFS if the
+ *         frame does not fit in the buffer.
+ */
+int encoder_json_encode(const struct ocpp_message *msg,
+		char *buf, size_t bufsize);
+
+/**
+ * @brief Size of a MeterValue entry in a MeterValues request.
+ *
+ * A MeterValues request may carry several MeterValue entries. They follow
+ * struct ocpp_MeterValues back to back, each a struct ocpp_MeterValue with
+ * its sampled values and then a zeroed sampled value marking the end of the
+ * entry, padded for the next entry to be aligned.
+ *
+ * @param[in] nsamples Number of sampled values in the entry.
+ *
+ * @return Size of the entry, in bytes.
+ */
+size_t encoder_json_metervalue_size(size_t nsamples);
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,185 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "msgpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "libmcu/metrics.h"
+
+/* Payloads are freed from the OCPP event callback long after they are
+ * allocated, with MeterValues of varying sizes in between, which fragments
+ * the heap over time. Blocks of a few fixed sizes are set aside instead.
+ *
+ * Classes are listed in increasing size. Each class name needs its
+ * OCPPPool<name>Peak and OCPPPool<name>FailCount metrics. */
+#if !defined(OCPP_MSGPOOL_CLASSES)
+#define OCPP_MSGPOOL_CLASSES(X)			\
+	X(Small,		64,	16)		\
+	X(Medium,		256,	8)		\
+	X(Large,		768,	4)		\
+	X(Huge,			2048,	2)
+#endif
+
+#if !defined(ARRAY_COUNT)
+#define ARRAY_COUNT(x)		(sizeof(x) / sizeof((x)[0]))
+#endif
+
+struct pool_class {
+	uint8_t *base;
+	size_t blksize;
+	uint16_t nblks;
+
+	uint16_t next; /* blocks never handed out start from here */
+	uint16_t used;
+	void *freelist; /* linked through the first bytes of the free blocks */
+
+	uint16_t peak_key;
+	uint16_t fail_key;
+};
+
+#define DEFINE_BLOCKS(name, size, count)				\
+	static union {							\
+		max_align_t align;					\
+		uint8_t bytes[size];					\
+	} name##_blocks[count];
+OCPP_MSGPOOL_CLASSES(DEFINE_BLOCKS)
+#undef DEFINE_BLOCKS
+
+#define DEFINE_CLASS(name, size, count)				\
+	{								\
+		.base = (uint8_t *)name##_blocks,			\
+		.blksize = sizeof(name##_blocks[0]),			\
+		.nblks = count,						\
+		.peak_key = OCPPPool##name##Peak,			\
+		.fail_key = OCPPPool##name##FailCount,			\
+	},
+static struct pool_class classes[] = {
+	OCPP_MSGPOOL_CLASSES(DEFINE_CLASS)
+};
+#undef DEFINE_CLASS
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *take_block(struct pool_class *c)
+{
+	void *p = c->freelist;
+
+	if (p) {
+		memcpy(&c->freelist, p, sizeof(c->freelist));
+	} else if (c->next < c->nblks) {
+		p = &c->base[c->next++ * c->blksize];
+	} else {
+		return NULL;
+	}
+
+	c->used++;
+	metrics_set_if_max(c->peak_key, METRICS_VALUE(c->used));
+
+	return p;
+}
+
+static void put_block(struct pool_class *c, void *p)
+{
+	memcpy(p, &c->freelist, sizeof(c->freelist));
+	c->freelist = p;
+	c->used--;
+}
+
+static struct pool_class *find_class_by_block(const void *p)
+{
+	const uint8_t *addr = (const uint8_t *)p;
+
+	for (size_t i = 0; i < ARRAY_COUNT(classes); i++) {
+		struct pool_class *c = &classes[i];
+
+		if (addr >= c->base && addr < &c->base[c->nblks * c->blksize]) {
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+void *msgpool_alloc(const size_t size)
+{
+	bool fit = false;
+	void *p = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+
+	for (size_t i = 0; i < ARRAY_COUNT(classes) && !p; i++) {
+		struct pool_class *c = &classes[i];
+
+		if (size > c->blksize) {
+			continue;
+		}
+
+		if ((p = take_block(c)) == NULL && !fit) {
+			metrics_increase(c->fail_key);
+		}
+
+		fit = true;
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+
+	if (p) {
+		memset(p, 0, size);
+	} else if ((p = calloc(1, size)) != NULL) {
+		metrics_increase(OCPPPoolHeapFallbackCount);
+	}
+
+	return p;
+}
+
+void msgpool_free(void *p)
+{
+	if (!p) {
+		return;
+	}
+
+	struct pool_class *c = find_class_by_block(p);
+
+	if (!c) {
+		free(p);
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	put_block(c, p);
+	pthread_mutex_unlock(&pool_lock);
+}
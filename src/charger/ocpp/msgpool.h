@@ -0,0 +1,68 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef OCPP_MSGPOOL_H
+#define OCPP_MSGPOOL_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * @brief Allocate a zero-filled message payload.
+ *
+ * The payload comes from the smallest size class it fits in, or from a
+ * larger one if that is exhausted. When no class has a free block, it falls
+ * back to the heap.
+ *
+ * @param[in] size Size of the payload, in bytes.
+ *
+ * @return Pointer to the payload, or NULL if out of memory.
+ */
+void *msgpool_alloc(const size_t size);
+
+/**
+ * @brief Free a payload allocated by @ref msgpool_alloc.
+ *
+ * Payloads allocated from the heap by other means are freed as well.
+ *
+ * @param[in] p Payload to free. NULL is ignored.
+ */
+void msgpool_free(void *p);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* OCPP_MSGPOOL_H */
@@ -141,7 +141,6 @@ bool ocpp_charger_is_checkpoint_equal(const struct charger *charger,
 
 struct charger *ocpp_charger_create(void *ctx)
 {
-	unused(ctx);
 	struct ocpp_charger *ocpp_charger =
 		(struct ocpp_charger *)calloc(1, sizeof(*ocpp_charger));
 
@@ -155,6 +154,8 @@ struct charger *ocpp_charger_create(void *ctx)
 		return NULL;
 	}
 
+	ocpp_charger->fs = (struct fs *)ctx;
+
 	return &ocpp_charger->base;
 }
 
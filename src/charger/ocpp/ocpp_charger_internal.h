@@ -40,11 +40,14 @@ extern "C" {
 #include "charger/ocpp.h"
 #include "../charger_internal.h"
 
+struct fs;
+
 struct ocpp_charger {
 	struct charger base;
 	struct ocpp_checkpoint checkpoint;
 	struct msgq *msgq;
 	ocpp_charger_reboot_t reboot_required;
+	struct fs *fs; /* for the transaction message queue */
 
 	bool remote_request; /* set when remote reset requested */
 };
@@ -570,6 +570,11 @@ static int process(struct connector *self)
 
 	dispatch_event(self, CONNECTOR_EVENT_NONE);
 
+	/* no new sample, only to let a pending batch go once it is due */
+	if (oc->metervalues.count) {
+		csms_request(OCPP_MSG_METER_VALUES, oc, 0);
+	}
+
 	return 0;
 }
 
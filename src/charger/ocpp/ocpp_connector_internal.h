@@ -69,6 +69,28 @@ struct session_metering {
 	ocpp_reading_context_t context;
 };
 
+#if !defined(OCPP_METERVALUE_BATCH_MAX)
+#define OCPP_METERVALUE_BATCH_MAX		4
+#endif
+
+/* A pending MeterValues batch is sent once its oldest sample gets this old.
+ * Zero sends every sample right away. */
+#if !defined(OCPP_METERVALUE_BATCH_AGE_SEC)
+#define OCPP_METERVALUE_BATCH_AGE_SEC		60
+#endif
+
+/* Samples waiting to be sent together in a single MeterValues request. See
+ * do_metervalue() in adapter.c for when a batch is sent. */
+struct metervalue_batch {
+	struct {
+		struct session_metering reading;
+		ocpp_measurand_t measurands;
+		time_t timestamp;
+	} samples[OCPP_METERVALUE_BATCH_MAX];
+	ocpp_transaction_id_t transaction_id;
+	uint8_t count;
+};
+
 struct charging_session {
 	ocpp_transaction_id_t transaction_id;
 	uint32_t reservation_id;
@@ -113,6 +135,9 @@ struct ocpp_connector {
 	struct msgq *evtq;
 	struct charging_session session;
 	struct charger_ocpp_info ocpp_info;
+	/* kept apart from the session so that samples taken before the
+	 * session is cleared are still sent */
+	struct metervalue_batch metervalues;
 
 	struct {
 		ocpp_session_result_cb_t cb;
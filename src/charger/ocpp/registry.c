@@ -0,0 +1,139 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "registry.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "libmcu/assert.h"
+
+#if !defined(ARRAY_COUNT)
+#define ARRAY_COUNT(x)			(sizeof(x) / sizeof((x)[0]))
+#endif
+
+/* The seed is chosen for the actions in messages.def to land in distinct
+ * slots, so a lookup takes a single probe. A new action colliding with
+ * others still works with a few more probes, but it is worth searching for
+ * another seed. */
+#define ACTION_HASH_SEED		0x811ca22fu
+#define ACTION_HASH_PRIME		16777619u
+#define ACTION_TABLE_BITS		5
+#define ACTION_TABLE_SIZE		(1u << ACTION_TABLE_BITS)
+
+struct action {
+	const char *str;
+	uint8_t len;
+};
+
+enum {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	REGISTERED_##type,
+#include "messages.def"
+#undef OCPP_MESSAGE
+	REGISTERED_MAX,
+};
+
+static const struct action actions[OCPP_MSG_MAX] = {
+#define OCPP_MESSAGE(type, action, enc, dec, req, resp)	\
+	[OCPP_MSG_##type] = { action, sizeof(action) - 1 },
+#include "messages.def"
+#undef OCPP_MESSAGE
+};
+
+/* A slot holds the message type plus one, where zero means an empty
+ * slot. */
+static uint8_t action_table[ACTION_TABLE_SIZE];
+static_assert(ACTION_TABLE_SIZE >= REGISTERED_MAX, "action table too small");
+static_assert(OCPP_MSG_MAX < UINT8_MAX, "action table too narrow");
+
+static uint32_t hash_action(const char *action, size_t len)
+{
+	uint32_t hash = ACTION_HASH_SEED;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)action[i];
+		hash *= ACTION_HASH_PRIME;
+	}
+
+	/* the upper bits are better mixed than the lower ones in FNV-1a */
+	return hash >> (32 - ACTION_TABLE_BITS);
+}
+
+ocpp_message_t registry_find_type(const char *action, size_t len)
+{
+	uint32_t slot = hash_action(action, len);
+
+	for (uint32_t i = 0; i < ACTION_TABLE_SIZE; i++) {
+		if (!action_table[slot]) {
+			break;
+		}
+
+		const size_t type = (size_t)action_table[slot] - 1;
+
+		if (actions[type].len == len &&
+				memcmp(actions[type].str, action, len) == 0) {
+			return (ocpp_message_t)type;
+		}
+
+		slot = (slot + 1) & (ACTION_TABLE_SIZE - 1);
+	}
+
+	return OCPP_MSG_MAX;
+}
+
+const char *registry_get_action(ocpp_message_t type)
+{
+	if ((size_t)type >= ARRAY_COUNT(actions)) {
+		return NULL;
+	}
+
+	return actions[type].str;
+}
+
+void registry_init(void)
+{
+	memset(action_table, 0, sizeof(action_table));
+
+	for (size_t i = 0; i < ARRAY_COUNT(actions); i++) {
+		if (!actions[i].str) {
+			continue;
+		}
+
+		uint32_t slot = hash_action(actions[i].str, actions[i].len);
+
+		while (action_table[slot]) {
+			slot = (slot + 1) & (ACTION_TABLE_SIZE - 1);
+		}
+
+		action_table[slot] = (uint8_t)(i + 1);
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef OCPP_REGISTRY_PRIVATE_H
+#define OCPP_REGISTRY_PRIVATE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "ocpp/ocpp.h"
+
+/**
+ * @brief Build the action lookup table from messages.def.
+ *
+ * Must be called once before registry_find_type().
+ */
+void registry_init(void);
+
+/**
+ * @brief Look up the message type of an action string.
+ *
+ * @param[in] action Action string, not necessarily NUL-terminated.
+ * @param[in] len Length of the action string, in bytes.
+ *
+ * @return Message type, or OCPP_MSG_MAX if the action is not registered.
+ */
+ocpp_message_t registry_find_type(const char *action, size_t len);
+
+/**
+ * @brief Get the action string of a message type.
+ *
+ * @param[in] type Message type.
+ *
+ * @return Action string, or NULL if the type is not registered.
+ */
+const char *registry_get_action(ocpp_message_t type);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* OCPP_REGISTRY_PRIVATE_H */
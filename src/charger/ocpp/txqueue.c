@@ -0,0 +1,792 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "txqueue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "libmcu/crc32.h"
+#include "libmcu/metrics.h"
+#include "libmcu/board.h"
+#include "libmcu/assert.h"
+
+#include "charger/ocpp_checkpoint.h"
+#include "msgpool.h"
+#include "logger.h"
+
+#define FILEPATH		"ocpp/txq"
+/* Payloads are stored as the raw request structs of the OCPP library. Bump
+ * it whenever their layout changes, so that old records are dropped rather
+ * than replayed garbled. */
+#define RECORD_VERSION		1
+
+/* Upper bound of the queue file. Compaction keeps the file within it, and
+ * records get evicted once the pending ones alone do not fit anymore. */
+#if !defined(OCPP_TXQUEUE_FLASH_BUDGET)
+#define OCPP_TXQUEUE_FLASH_BUDGET	16384
+#endif
+#if !defined(OCPP_TXQUEUE_MAX_RECORDS)
+#define OCPP_TXQUEUE_MAX_RECORDS	32
+#endif
+/* Replayed requests handed over to the OCPP queue ahead of their answers */
+#if !defined(OCPP_TXQUEUE_REPLAY_WINDOW)
+#define OCPP_TXQUEUE_REPLAY_WINDOW	2
+#endif
+
+typedef enum {
+	RECORD_DATA			= 1,
+	RECORD_ACK			= 2,
+} record_kind_t;
+
+/* A record is a header followed by the payload. An ACK record refers to the
+ * DATA record of the same sequence number, carrying the transaction ID that
+ * the CSMS assigned when it is for a StartTransaction. */
+struct record_header {
+	uint32_t seq;
+	uint16_t len; /* of the payload following the header */
+	uint8_t version;
+	uint8_t kind;
+	uint8_t type;
+	uint8_t connector;
+	uint16_t reserved;
+	uint32_t crc; /* of the payload */
+	uint32_t hcrc; /* of the header up to this field */
+};
+static_assert(sizeof(struct record_header) == 20,
+		"struct record_header must be 20 bytes");
+
+typedef enum {
+	ENTRY_REPLAY			= 0x01, /* to be sent by the replay */
+	ENTRY_INFLIGHT			= 0x02, /* replayed, not answered yet */
+} entry_flag_t;
+
+struct entry {
+	const void *data; /* payload in the OCPP queue if any */
+	uint32_t seq;
+	uint32_t offset; /* of the record in the file */
+	uint32_t crc;
+	/* assigned by the CSMS after the record was written */
+	ocpp_transaction_id_t tid;
+	uint16_t len;
+	uint8_t type;
+	uint8_t connector;
+	uint8_t flags;
+};
+
+static struct {
+	struct fs *fs;
+
+	struct entry entries[OCPP_TXQUEUE_MAX_RECORDS]; /* in sequence order */
+	uint8_t count;
+	uint32_t seq; /* for the next record */
+
+	size_t filesize;
+	size_t live; /* bytes of the DATA records still pending */
+
+	struct {
+		bool running;
+		uint8_t inflight;
+		uint32_t count;
+		uint32_t started_ms;
+	} replay;
+} m;
+
+static uint32_t compute_header_crc(const struct record_header *hdr)
+{
+	return crc32_cksum((const uint8_t *)hdr,
+			offsetof(struct record_header, hcrc));
+}
+
+static void fill_header(struct record_header *hdr, const record_kind_t kind,
+		const uint32_t seq, const uint8_t type, const uint8_t connector,
+		const void *data, const uint16_t len)
+{
+	*hdr = (struct record_header) {
+		.seq = seq,
+		.len = len,
+		.version = RECORD_VERSION,
+		.kind = (uint8_t)kind,
+		.type = type,
+		.connector = connector,
+		.crc = len? crc32_cksum((const uint8_t *)data, len) : 0,
+	};
+	hdr->hcrc = compute_header_crc(hdr);
+}
+
+static bool is_header_valid(const struct record_header *hdr,
+		const size_t remaining)
+{
+	return hdr->hcrc == compute_header_crc(hdr) &&
+		hdr->version == RECORD_VERSION &&
+		(hdr->kind == RECORD_DATA || hdr->kind == RECORD_ACK) &&
+		hdr->type < OCPP_MSG_MAX &&
+		sizeof(*hdr) + hdr->len <= remaining;
+}
+
+static int append_record(const struct record_header *hdr, const void *data)
+{
+	const struct fs_iovec iov[] = {
+		{ .data = hdr, .datasize = sizeof(*hdr), },
+		{ .data = data, .datasize = hdr->len, },
+	};
+	const int err = fs_append_batch(m.fs, FILEPATH,
+			iov, hdr->len? 2 : 1);
+
+	if (err < 0) {
+		return err;
+	}
+
+	m.filesize += sizeof(*hdr) + hdr->len;
+
+	return 0;
+}
+
+static int read_payload(const struct entry *e, void *buf)
+{
+	const int err = fs_read(m.fs, FILEPATH, e->offset +
+			sizeof(struct record_header), buf, e->len);
+
+	if (err < 0) {
+		return err;
+	} else if ((size_t)err != e->len ||
+			crc32_cksum((const uint8_t *)buf, e->len) != e->crc) {
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+/* Requests recorded before StartTransaction got answered carry no transaction
+ * ID. It is filled in on the way out, once the CSMS has assigned one. */
+static bool patch_tid(const struct entry *e, uint8_t *payload)
+{
+	size_t offset;
+	int tid;
+
+	if (!e->tid) {
+		return false;
+	} else if (e->type == OCPP_MSG_METER_VALUES) {
+		offset = offsetof(struct ocpp_MeterValues, transactionId);
+	} else if (e->type == OCPP_MSG_STOP_TRANSACTION) {
+		offset = offsetof(struct ocpp_StopTransaction, transactionId);
+	} else {
+		return false;
+	}
+
+	if (offset + sizeof(tid) > e->len) {
+		return false;
+	}
+
+	memcpy(&tid, &payload[offset], sizeof(tid));
+	if (tid) {
+		return false;
+	}
+
+	tid = (int)e->tid;
+	memcpy(&payload[offset], &tid, sizeof(tid));
+
+	return true;
+}
+
+/* The transaction ID applies to the requests of the same connector up to the
+ * next StartTransaction. */
+static void assign_tid(const size_t index, const ocpp_transaction_id_t tid)
+{
+	const uint8_t connector = m.entries[index].connector;
+
+	for (size_t i = index + 1; i < m.count; i++) {
+		struct entry *e = &m.entries[i];
+
+		if (e->connector != connector) {
+			continue;
+		} else if (e->type == OCPP_MSG_START_TRANSACTION) {
+			break;
+		}
+
+		if (!e->tid) {
+			e->tid = tid;
+		}
+	}
+}
+
+static int find_by_seq(const uint32_t seq)
+{
+	for (uint8_t i = 0; i < m.count; i++) {
+		if (m.entries[i].seq == seq) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int find_by_data(const void *data)
+{
+	if (!data) {
+		return -EINVAL;
+	}
+
+	for (uint8_t i = 0; i < m.count; i++) {
+		if (m.entries[i].data == data) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static void remove_entry(const size_t index)
+{
+	m.live -= sizeof(struct record_header) + m.entries[index].len;
+	m.count--;
+	memmove(&m.entries[index], &m.entries[index + 1],
+			(m.count - index) * sizeof(m.entries[0]));
+}
+
+static void update_metrics(void)
+{
+	metrics_set(OCPPTxQueueDepth, METRICS_VALUE(m.count));
+	metrics_set(OCPPTxQueueBytes, METRICS_VALUE(m.filesize));
+}
+
+static void erase_file(void)
+{
+	const int err = fs_delete(m.fs, FILEPATH);
+
+	if (err < 0 && err != -ENOENT) {
+		error("failed to delete %s: %d", FILEPATH, err);
+	}
+
+	m.filesize = 0;
+}
+
+/* Rewrite the file with the pending records only, reading one payload after
+ * another into a single buffer. The entries get their new offsets only once
+ * the file is committed. */
+static int compact(void)
+{
+	uint32_t offsets[OCPP_TXQUEUE_MAX_RECORDS];
+	uint32_t crcs[OCPP_TXQUEUE_MAX_RECORDS];
+	uint8_t *buf;
+	size_t pos = 0;
+	int err = 0;
+
+	if (!m.count) {
+		erase_file();
+		return 0;
+	} else if ((buf = (uint8_t *)malloc(m.live)) == NULL) {
+		return -ENOMEM;
+	}
+
+	for (uint8_t i = 0; i < m.count; i++) {
+		struct entry *e = &m.entries[i];
+		struct record_header hdr;
+		uint8_t *payload = &buf[pos + sizeof(hdr)];
+
+		offsets[i] = UINT32_MAX;
+		crcs[i] = 0;
+
+		if (read_payload(e, payload) < 0) {
+			metrics_increase(OCPPTxQueueCorruptCount);
+			continue;
+		}
+
+		patch_tid(e, payload);
+		fill_header(&hdr, RECORD_DATA, e->seq, e->type, e->connector,
+				payload, e->len);
+		memcpy(&buf[pos], &hdr, sizeof(hdr));
+
+		offsets[i] = (uint32_t)pos;
+		crcs[i] = hdr.crc;
+		pos += sizeof(hdr) + e->len;
+	}
+
+	const struct fs_iovec iov = {
+		.data = buf,
+		.datasize = pos,
+	};
+
+	if (pos && (err = fs_replace(m.fs, FILEPATH, &iov, 1)) >= 0) {
+		for (uint8_t i = 0; i < m.count; i++) {
+			m.entries[i].offset = offsets[i];
+			m.entries[i].crc = crcs[i];
+		}
+		m.filesize = pos;
+		err = 0;
+	}
+
+	free(buf);
+
+	/* unreadable records can not be replayed anyway */
+	for (uint8_t i = m.count; i > 0; i--) {
+		if (offsets[i - 1] == UINT32_MAX) {
+			remove_entry(i - 1);
+		}
+	}
+
+	if (!m.count) {
+		erase_file();
+		err = 0;
+	}
+
+	return err;
+}
+
+/* MeterValues are the least critical for billing as StartTransaction and
+ * StopTransaction carry the meter readings too. */
+static int evict(void)
+{
+	int victim = -ENOSPC;
+
+	for (uint8_t i = 0; i < m.count; i++) {
+		const struct entry *e = &m.entries[i];
+
+		if (e->flags & ENTRY_INFLIGHT) {
+			continue;
+		} else if (e->type == OCPP_MSG_METER_VALUES) {
+			victim = i;
+			break;
+		} else if (victim < 0) {
+			victim = i;
+		}
+	}
+
+	if (victim < 0) {
+		return victim;
+	}
+
+	warn("%s #%"PRIu32" evicted", ocpp_stringify_type((ocpp_message_t)
+			m.entries[victim].type), m.entries[victim].seq);
+	metrics_increase(OCPPTxQueueEvictionCount);
+	remove_entry((size_t)victim);
+
+	return 0;
+}
+
+static int make_room(const size_t recsize)
+{
+	while (m.count >= OCPP_TXQUEUE_MAX_RECORDS ||
+			m.live + recsize > OCPP_TXQUEUE_FLASH_BUDGET) {
+		int err = evict();
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	if (m.filesize + recsize > OCPP_TXQUEUE_FLASH_BUDGET) {
+		return compact();
+	}
+
+	return 0;
+}
+
+static void finish_replay(void)
+{
+	const uint32_t elapsed_ms =
+		board_get_time_since_boot_ms() - m.replay.started_ms;
+
+	m.replay.running = false;
+
+	if (m.replay.count) {
+		/* messages per minute */
+		metrics_set(OCPPTxQueueReplayRate, METRICS_VALUE(
+				(uint64_t)m.replay.count * 60000u /
+				(elapsed_ms? elapsed_ms : 1)));
+		info("%"PRIu32" transaction message(s) replayed in %"PRIu32
+				" ms",
+				m.replay.count, elapsed_ms);
+	}
+}
+
+static int replay_entry(struct entry *e)
+{
+	uint8_t *p = (uint8_t *)msgpool_alloc(e->len);
+	int err;
+
+	if (!p) {
+		metrics_increase(OCPPMessageAllocFailCount);
+		return -ENOMEM;
+	}
+
+	metrics_increase(OCPPMessageAllocCount);
+
+	if ((err = read_payload(e, p)) < 0) {
+		msgpool_free(p);
+		metrics_increase(OCPPMessageFreeCount);
+		return err;
+	}
+
+	patch_tid(e, p);
+
+	/* NOTE: The payload is freed in the OCPP event callback like the ones
+	 * of the adapter. */
+	if ((err = ocpp_push_request_force((ocpp_message_t)e->type,
+			p, e->len, NULL)) < 0) {
+		msgpool_free(p);
+		metrics_increase(OCPPMessageFreeCount);
+		return err;
+	}
+
+	e->data = p;
+	e->flags = ENTRY_INFLIGHT;
+	m.replay.inflight++;
+
+	return 0;
+}
+
+/* Keeps up to OCPP_TXQUEUE_REPLAY_WINDOW requests in the OCPP queue so that
+ * the next one goes out as soon as the previous one is answered. A
+ * StartTransaction in flight holds back the rest, which may need the
+ * transaction ID it brings. */
+static void replay_next(void)
+{
+	while (m.replay.running &&
+			m.replay.inflight < OCPP_TXQUEUE_REPLAY_WINDOW) {
+		struct entry *e = NULL;
+
+		for (uint8_t i = 0; i < m.count; i++) {
+			if (m.entries[i].flags & ENTRY_INFLIGHT) {
+				if (m.entries[i].type ==
+						OCPP_MSG_START_TRANSACTION) {
+					return;
+				}
+			} else if (m.entries[i].flags & ENTRY_REPLAY) {
+				e = &m.entries[i];
+				break;
+			}
+		}
+
+		if (!e) {
+			if (!m.replay.inflight) {
+				finish_replay();
+			}
+			return;
+		}
+
+		const int err = replay_entry(e);
+
+		if (err == -EBADMSG) {
+			error("%s #%"PRIu32" corrupted", ocpp_stringify_type(
+					(ocpp_message_t)e->type), e->seq);
+			metrics_increase(OCPPTxQueueCorruptCount);
+			remove_entry((size_t)(e - m.entries));
+		} else if (err < 0) {
+			/* resumed on the next call of txqueue_replay() */
+			error("replay paused: %d", err);
+			m.replay.running = false;
+		}
+	}
+}
+
+static void settle(const size_t index, const struct ocpp_message *resp)
+{
+	const struct entry e = m.entries[index];
+	ocpp_transaction_id_t tid = 0;
+	struct record_header hdr;
+
+	if (e.type == OCPP_MSG_START_TRANSACTION &&
+			resp->role == OCPP_MSG_ROLE_CALLRESULT &&
+			resp->payload.fmt.response) {
+		const struct ocpp_StartTransaction_conf *p =
+			(const struct ocpp_StartTransaction_conf *)
+			resp->payload.fmt.response;
+		tid = (ocpp_transaction_id_t)p->transactionId;
+		assign_tid(index, tid);
+	}
+
+	remove_entry(index);
+
+	if (!m.count) {
+		erase_file();
+		return;
+	}
+
+	fill_header(&hdr, RECORD_ACK, e.seq, e.type, e.connector,
+			&tid, tid? sizeof(tid) : 0);
+
+	int err = make_room(sizeof(hdr) + hdr.len);
+
+	if (!err) {
+		err = append_record(&hdr, &tid);
+	}
+
+	if (err < 0) { /* it will be sent once more after reboot */
+		error("failed to write ack #%"PRIu32": %d", hdr.seq, err);
+	}
+}
+
+static int load_record(const struct record_header *hdr, const size_t offset)
+{
+	uint8_t *payload = NULL;
+
+	if (hdr->len) {
+		if ((payload = (uint8_t *)malloc(hdr->len)) == NULL) {
+			return -ENOMEM;
+		}
+
+		const int err = fs_read(m.fs, FILEPATH,
+				offset + sizeof(*hdr), payload, hdr->len);
+
+		if (err != (int)hdr->len ||
+				crc32_cksum(payload, hdr->len) != hdr->crc) {
+			free(payload);
+			return -EBADMSG;
+		}
+	}
+
+	if (hdr->kind == RECORD_DATA) {
+		if (m.count >= OCPP_TXQUEUE_MAX_RECORDS) {
+			evict();
+		}
+
+		m.entries[m.count++] = (struct entry) {
+			.seq = hdr->seq,
+			.offset = (uint32_t)offset,
+			.crc = hdr->crc,
+			.len = hdr->len,
+			.type = hdr->type,
+			.connector = hdr->connector,
+			.flags = ENTRY_REPLAY,
+		};
+		m.live += sizeof(*hdr) + hdr->len;
+	} else {
+		const int index = find_by_seq(hdr->seq);
+		ocpp_transaction_id_t tid = 0;
+
+		if (payload && hdr->len == sizeof(tid)) {
+			memcpy(&tid, payload, sizeof(tid));
+		}
+
+		if (index >= 0) {
+			if (tid) {
+				assign_tid((size_t)index, tid);
+			}
+			remove_entry((size_t)index);
+		}
+	}
+
+	free(payload);
+
+	return 0;
+}
+
+static int load(void)
+{
+	size_t size = 0;
+	size_t offset = 0;
+
+	if (fs_size(m.fs, FILEPATH, &size) < 0 || !size) {
+		return 0;
+	}
+
+	while (offset + sizeof(struct record_header) <= size) {
+		struct record_header hdr;
+		int err = fs_read(m.fs, FILEPATH, offset, &hdr, sizeof(hdr));
+
+		if (err != (int)sizeof(hdr) ||
+				!is_header_valid(&hdr, size - offset)) {
+			break;
+		} else if ((err = load_record(&hdr, offset)) == -ENOMEM) {
+			return err;
+		} else if (err < 0) {
+			break;
+		}
+
+		if (hdr.seq >= m.seq) {
+			m.seq = hdr.seq + 1;
+		}
+
+		offset += sizeof(hdr) + hdr.len;
+	}
+
+	m.filesize = size;
+
+	if (offset < size) {
+		warn("%zu bytes of torn records dropped", size - offset);
+		metrics_increase(OCPPTxQueueCorruptCount);
+	}
+
+	info("%u transaction message(s) pending", m.count);
+
+	/* Leave the pending DATA records only, which also gets rid of a torn
+	 * tail that would hide the records appended after it. */
+	return m.live == size? 0 : compact();
+}
+
+int txqueue_append(const ocpp_message_t type, const int connector_id,
+		const void *data, const size_t datasize)
+{
+	const size_t recsize = sizeof(struct record_header) + datasize;
+	struct record_header hdr;
+	int err;
+
+	if (!m.fs) {
+		return -ENODEV;
+	} else if (!txqueue_is_durable(type) || !data ||
+			connector_id < 0 || connector_id > UINT8_MAX) {
+		return -EINVAL;
+	} else if (datasize > UINT16_MAX ||
+			recsize > OCPP_TXQUEUE_FLASH_BUDGET) {
+		return -EFBIG;
+	}
+
+	if ((err = make_room(recsize)) < 0) {
+		return err;
+	}
+
+	fill_header(&hdr, RECORD_DATA, m.seq, (uint8_t)type,
+			(uint8_t)connector_id, data, (uint16_t)datasize);
+
+	const uint32_t offset = (uint32_t)m.filesize;
+
+	if ((err = append_record(&hdr, data)) < 0) {
+		return err;
+	}
+
+	m.entries[m.count++] = (struct entry) {
+		.data = data,
+		.seq = m.seq++,
+		.offset = offset,
+		.crc = hdr.crc,
+		.len = hdr.len,
+		.type = hdr.type,
+		.connector = hdr.connector,
+	};
+	m.live += recsize;
+
+	update_metrics();
+
+	return 0;
+}
+
+bool txqueue_settle(const struct ocpp_message *resp)
+{
+	if (!m.fs || !m.count || (resp->role != OCPP_MSG_ROLE_CALLRESULT &&
+			resp->role != OCPP_MSG_ROLE_CALLERROR)) {
+		return false;
+	}
+
+	const struct ocpp_message *req = ocpp_get_message_by_id(resp->id);
+	const int index = req? find_by_data(req->payload.fmt.data) : -ENOENT;
+
+	if (index < 0) {
+		return false;
+	}
+
+	const bool replayed = (m.entries[index].flags & ENTRY_INFLIGHT) != 0;
+
+	settle((size_t)index, resp);
+
+	if (replayed) {
+		m.replay.inflight--;
+		m.replay.count++;
+		metrics_increase(OCPPTxQueueReplayCount);
+		replay_next();
+	}
+
+	update_metrics();
+
+	return replayed;
+}
+
+void txqueue_release(const void *data)
+{
+	const int index = find_by_data(data);
+
+	if (index < 0) {
+		return;
+	}
+
+	struct entry *e = &m.entries[index];
+
+	if (e->flags & ENTRY_INFLIGHT) {
+		m.replay.inflight--;
+		m.replay.running = false;
+	}
+
+	e->data = NULL;
+	e->flags = ENTRY_REPLAY;
+}
+
+int txqueue_replay(void)
+{
+	if (!m.fs) {
+		return -ENODEV;
+	} else if (m.replay.running) {
+		return -EALREADY;
+	}
+
+	m.replay.running = true;
+	m.replay.count = 0;
+	m.replay.started_ms = board_get_time_since_boot_ms();
+
+	replay_next();
+
+	return 0;
+}
+
+size_t txqueue_depth(void)
+{
+	return m.count;
+}
+
+bool txqueue_is_durable(const ocpp_message_t type)
+{
+	return type == OCPP_MSG_START_TRANSACTION ||
+		type == OCPP_MSG_METER_VALUES ||
+		type == OCPP_MSG_STOP_TRANSACTION;
+}
+
+int txqueue_init(struct fs *fs)
+{
+	memset(&m, 0, sizeof(m));
+
+	if (!fs) {
+		return -EINVAL;
+	}
+
+	m.fs = fs;
+
+	const int err = load();
+
+	update_metrics();
+
+	return err;
+}
+
+void txqueue_deinit(void)
+{
+	memset(&m, 0, sizeof(m));
+}
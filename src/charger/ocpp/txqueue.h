@@ -0,0 +1,128 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef OCPP_TXQUEUE_H
+#define OCPP_TXQUEUE_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ocpp/ocpp.h"
+#include "fs/fs.h"
+
+/**
+ * @brief Load the transaction messages left unconfirmed before the reboot.
+ *
+ * The queue keeps StartTransaction, MeterValues and StopTransaction requests
+ * in flash until the CSMS answers them. Corrupted records at the tail of the
+ * file, torn by a power loss, are dropped.
+ *
+ * @param[in] fs Filesystem the queue file lives in.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int txqueue_init(struct fs *fs);
+
+/**
+ * @brief Release the memory held by the queue. The file is kept.
+ */
+void txqueue_deinit(void);
+
+/**
+ * @brief Check if messages of the type are kept in the queue.
+ *
+ * @param[in] type Message type.
+ *
+ * @return true for transaction related requests, false otherwise.
+ */
+bool txqueue_is_durable(const ocpp_message_t type);
+
+/**
+ * @brief Persist a request that has just been pushed to the OCPP queue.
+ *
+ * The oldest MeterValues are evicted first when the flash budget runs out,
+ * then the oldest records of any type.
+ *
+ * @param[in] type Message type.
+ * @param[in] connector_id Connector the message belongs to.
+ * @param[in] data Payload pushed to the OCPP queue.
+ * @param[in] datasize Size of the payload, in bytes.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int txqueue_append(const ocpp_message_t type, const int connector_id,
+		const void *data, const size_t datasize);
+
+/**
+ * @brief Mark the request of a CALLRESULT or CALLERROR as delivered.
+ *
+ * @param[in] resp Incoming message.
+ *
+ * @return true if the request was a replayed one, which no one but the queue
+ *         is waiting for, false otherwise.
+ */
+bool txqueue_settle(const struct ocpp_message *resp);
+
+/**
+ * @brief Let the queue know that the OCPP queue dropped a payload.
+ *
+ * A request dropped without an answer is sent again on the next replay.
+ *
+ * @param[in] data Payload being freed.
+ */
+void txqueue_release(const void *data);
+
+/**
+ * @brief Start sending the messages left from before the reboot.
+ *
+ * Messages go out in sequence order, a few of them in flight at a time. It
+ * should be called once the CSMS has accepted the BootNotification.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int txqueue_replay(void);
+
+/**
+ * @brief Get the number of messages waiting for an answer from the CSMS.
+ *
+ * @return Number of messages in the queue.
+ */
+size_t txqueue_depth(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* OCPP_TXQUEUE_H */
@@ -43,6 +43,10 @@
 #include "libmcu/timext.h"
 #include "libmcu/pki.h"
 
+#if !defined(CONFIG_IMPORT_MAXLEN)
+#define CONFIG_IMPORT_MAXLEN		4096
+#endif
+
 struct ctx {
 	const struct cli_io *io;
 };
@@ -250,6 +254,48 @@ out_free:
 	free(buf);
 }
 
+static int on_export(const void *data, size_t datasize, void *ctx)
+{
+	const struct cli_io *io = (const struct cli_io *)ctx;
+	return (int)io->write(data, datasize);
+}
+
+static void do_export(const struct cmd *cmd,
+		int argc, const char *argv[], void *ctx)
+{
+	unused(argc);
+	unused(argv);
+	unused(cmd);
+	struct ctx *p = (struct ctx *)ctx;
+
+	config_export_json(on_export, (void *)(uintptr_t)p->io);
+	println(p->io, "");
+}
+
+static void do_import(const struct cmd *cmd,
+		int argc, const char *argv[], void *ctx)
+{
+	unused(argc);
+	unused(argv);
+	unused(cmd);
+	struct ctx *p = (struct ctx *)ctx;
+	char *buf = (char *)malloc(CONFIG_IMPORT_MAXLEN);
+
+	if (!buf) {
+		println(p->io, "Failed to allocate buf");
+		return;
+	}
+
+	const size_t len = read_until_eot(p->io,
+			buf, CONFIG_IMPORT_MAXLEN, 10000);
+	const int err = config_update_json(buf, len);
+
+	println(p->io, "");
+	println(p->io, err? "Failed to import." : "Configuration imported.");
+
+	free(buf);
+}
+
 static void do_read_set(const struct cmd *cmd,
 		int argc, const char *argv[], void *ctx)
 {
@@ -499,6 +545,8 @@ static void do_reset_id(const struct cmd *cmd,
 static const struct cmd cmds[] = {
 	{ "show",  NULL,               "config show",  2, 2, do_show },
 	{ "save",  NULL,               "config save",  2, 2, do_save },
+	{ "export", NULL,              "config export", 2, 2, do_export },
+	{ "import", NULL,              "config import", 2, 2, do_import },
 	{ "set",   "x509.ca",          "config set",   3, 3, do_read_set },
 	{ "set",   "x509.cert",        "config set",   3, 3, do_read_set },
 	{ "set",   "mac",              "config set",   3, 4, do_set_mac },
@@ -32,9 +32,13 @@
 
 #include "config.h"
 #include "config_default.h"
+#include "config_journal.h"
 
 #include <string.h>
+#include <stdio.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "libmcu/kvstore.h"
 #include "libmcu/metrics.h"
@@ -45,9 +49,48 @@
 
 #define NAMESPACE			"config"
 #define BASIC_CONFIG_KEY		"basic"
+#define JOURNAL_KEY_MAXLEN		8
+
+/* The seed is chosen for the keys in config.def and custom_config_map to
+ * land in distinct slots. A new key colliding with others still works
+ * with a few more probes, but it is worth searching for another seed. */
+#define CONFIG_KEY_HASH_SEED		0x811c9f29u
+#define CONFIG_KEY_HASH_PRIME		16777619u
+#define CONFIG_KEY_TABLE_BITS		6
+#define CONFIG_KEY_TABLE_SIZE		(1u << CONFIG_KEY_TABLE_BITS)
+
+#define CONFIG_ENTRY(key, field, type, count, ro)	{ key,		\
+		offsetof(struct config, field),				\
+		sizeof(((struct config *)0)->field),			\
+		CONFIG_VALUE_TYPE(type, count), ro }
+
+#define CONFIG_VALUE_TYPE(type, count)	_Generic((type)0,		\
+		bool: CONFIG_VALUE_BOOL,				\
+		char: CONFIG_VALUE_STR,					\
+		default: (count) > 1? CONFIG_VALUE_BYTES : CONFIG_VALUE_UINT)
+
+/* Readers hold a generation only for a copy. One spare generation is for
+ * the next update while the other two are possibly being read. */
+#if !defined(CONFIG_SNAPSHOT_MAX)
+#define CONFIG_SNAPSHOT_MAX		3
+#endif
+#if !defined(CONFIG_SUBSCRIBER_MAX)
+#define CONFIG_SUBSCRIBER_MAX		8
+#endif
+
+#if !defined(CONFIG_JSON_KEY_MAXLEN)
+#define CONFIG_JSON_KEY_MAXLEN		32
+#endif
+#if !defined(CONFIG_JSON_EXPORT_BUFSIZE)
+#define CONFIG_JSON_EXPORT_BUFSIZE	64
+#endif
 
-#define CONFIG_ENTRY(key, field, ro)	{ key, offsetof(struct config, field), \
-		sizeof(((struct config *)0)->field), ro }
+#if !defined(MIN)
+#define MIN(a, b)			(((a) > (b))? (b) : (a))
+#endif
+#if !defined(MAX)
+#define MAX(a, b)			(((a) > (b))? (a) : (b))
+#endif
 
 #if !defined(ARRAY_COUNT)
 #define ARRAY_COUNT(x)			(sizeof(x) / sizeof((x)[0]))
@@ -58,12 +101,22 @@ typedef enum {
 	RFW, /* read-only but reset to factory default permitted */
 	W, /* write-only */
 	RW, /* read-write */
+	RWS, /* read-write state of this very device, not to be cloned */
 } readonly_config_t;
 
+/* How a value is represented in JSON. Byte arrays go as hex strings. */
+typedef enum {
+	CONFIG_VALUE_UINT,
+	CONFIG_VALUE_BOOL,
+	CONFIG_VALUE_STR,
+	CONFIG_VALUE_BYTES,
+} config_value_t;
+
 struct config_entry {
 	const char *key;
 	const size_t offset;
 	const size_t size;
+	const config_value_t type;
 	const readonly_config_t permission;
 };
 
@@ -72,47 +125,68 @@ struct config_custom_entry {
 	const size_t size;
 };
 
+struct journal_range {
+	uint16_t offset;
+	uint8_t len;
+};
+
+struct config_subscriber {
+	const char *key; /* prefix. NULL for all keys */
+	config_change_cb_t cb;
+	void *ctx;
+};
+
+/* Writers work on basic under the lock and publish a copy of it as a new
+ * generation. Readers never take the lock: they pin the current generation
+ * by its reader count and copy out of it. */
 struct config_mgr {
 	struct kvstore *nvs;
 	struct config basic;
+	struct config staged; /* shadow copy for bulk updates */
 	config_save_cb_t save_cb;
 	void *save_cb_ctx;
 	bool dirty;
+
+	struct {
+		uint32_t base_crc;
+		uint32_t seq;
+		uint8_t count; /* records appended since the last compaction */
+
+		struct journal_range pending[CONFIG_JOURNAL_PENDING_MAX];
+		uint8_t npending;
+		/* pending changes do not fit in the journal */
+		bool overflow;
+	} journal;
+
+	struct {
+		struct config gen[CONFIG_SNAPSHOT_MAX];
+		atomic_uint readers[CONFIG_SNAPSHOT_MAX];
+		atomic_uint current;
+		atomic_uint_least32_t generation;
+	} snapshot;
+
+	struct config_subscriber subscribers[CONFIG_SUBSCRIBER_MAX];
+
+	pthread_mutex_t lock;
 };
 
 typedef void (*iterate_cb_t)(const struct config_entry *entry, void *ctx);
 
 static const struct config_entry config_map[] = {
-	CONFIG_ENTRY("version",             version,                   R),
-	CONFIG_ENTRY("crc",                 crc,                       R),
-	CONFIG_ENTRY("device.id",           device_id,                 RFW),
-	CONFIG_ENTRY("device.name",         device_name,               RW),
-	CONFIG_ENTRY("device.mode",         device_mode,               RW),
-	CONFIG_ENTRY("log.mode",            log_mode,                  RW),
-	CONFIG_ENTRY("log.level",           log_level,                 RW),
-	CONFIG_ENTRY("dfu.reboot_manually", dfu_reboot_manually,       RW),
-
-	CONFIG_ENTRY("chg.mode",        charger.mode,                  RW),
-	CONFIG_ENTRY("chg.param",       charger.param,                 RW),
-	CONFIG_ENTRY("chg.count",       charger.connector_count,       RW),
-	CONFIG_ENTRY("chg.c1.cp",       charger.connector[0].pilot,    RW),
-	CONFIG_ENTRY("chg.c1.metering", charger.connector[0].metering, RW),
-	CONFIG_ENTRY("chg.c1.plc_mac",  charger.connector[0].plc_mac,  RW),
-
-	CONFIG_ENTRY("net.mac",         net.mac,                       RW),
-	CONFIG_ENTRY("net.health",      net.health_check_interval,     RW),
-	CONFIG_ENTRY("net.server.url",  net.server_url,                RW),
-	CONFIG_ENTRY("net.server.id",   net.server_id,                 RW),
-	CONFIG_ENTRY("net.server.pass", net.server_pass,               RW),
-	CONFIG_ENTRY("net.server.ping", net.ping_interval,             RW),
-	CONFIG_ENTRY("net.opt",         net.opt,                       RW),
-
-	CONFIG_ENTRY("ocpp.version",    ocpp.version,                  RW),
-	CONFIG_ENTRY("ocpp.config",     ocpp.config,                   RW),
-	CONFIG_ENTRY("ocpp.checkpoint", ocpp.checkpoint,               RW),
-	CONFIG_ENTRY("ocpp.vendor",     ocpp.vendor,                   RFW),
-	CONFIG_ENTRY("ocpp.model",      ocpp.model,                    RFW),
+#define CONFIG_DEFINE(id, key, field, type, count, perm)	\
+	CONFIG_ENTRY(key, field, type, count, perm),
+#include "config.def"
+#undef CONFIG_DEFINE
 };
+static_assert(ARRAY_COUNT(config_map) == CONFIG_KEY_MAX,
+		"config_map does not match config.def");
+
+#define CONFIG_DEFINE(id, key, field, type, count, perm)		\
+	static_assert(sizeof(type) * (count) ==				\
+			sizeof(((struct config *)0)->field),		\
+			"type mismatch in config.def: " key);
+#include "config.def"
+#undef CONFIG_DEFINE
 
 /* This custom configuration is not part of the basic configuration. Each
  * configuration is stored in a separate key-value pair. */
@@ -124,16 +198,91 @@ static const struct config_custom_entry custom_config_map[] = {
 	{ "mtr.cal.ch1",     METERING_CALIBRATION_TOTAL_SIZE },
 };
 
+/* Basic entries come first followed by custom ones. A slot holds the
+ * index of the entry plus one, where zero means an empty slot. */
+static uint8_t key_table[CONFIG_KEY_TABLE_SIZE];
+static_assert(CONFIG_KEY_TABLE_SIZE >= ARRAY_COUNT(config_map)
+		+ ARRAY_COUNT(custom_config_map), "key table too small");
+static_assert(CONFIG_KEY_TABLE_SIZE <= UINT8_MAX, "key table too large");
+
 static struct config_mgr mgr;
 
+static void lock_writer(void)
+{
+	pthread_mutex_lock(&mgr.lock);
+}
+
+static void unlock_writer(void)
+{
+	pthread_mutex_unlock(&mgr.lock);
+}
+
+/* Called with the lock held. Returns true if a new generation has been
+ * published, which means the configuration has changed. */
+static bool publish_snapshot(void)
+{
+	const unsigned int cur = atomic_load(&mgr.snapshot.current);
+	unsigned int next = cur;
+
+	if (memcmp(&mgr.snapshot.gen[cur], &mgr.basic, sizeof(mgr.basic))
+			== 0) {
+		return false;
+	}
+
+	/* A reader that pins a retired generation backs off as soon as it
+	 * sees the generation is no longer current. So one with no readers
+	 * can be reused safely. */
+	do {
+		next = (next + 1) % CONFIG_SNAPSHOT_MAX;
+	} while (next == cur || atomic_load(&mgr.snapshot.readers[next]));
+
+	memcpy(&mgr.snapshot.gen[next], &mgr.basic, sizeof(mgr.basic));
+	atomic_store(&mgr.snapshot.current, next);
+	atomic_fetch_add(&mgr.snapshot.generation, 1);
+
+	return true;
+}
+
+static bool match_subscriber(const struct config_subscriber *sub,
+		const char *key)
+{
+	return sub->cb && (!key || !sub->key ||
+			strncmp(key, sub->key, strlen(sub->key)) == 0);
+}
+
+/* Called without the lock so that subscribers can access the config. */
+static void notify_change(const char *key)
+{
+	struct config_subscriber subscribers[CONFIG_SUBSCRIBER_MAX];
+
+	lock_writer();
+	memcpy(subscribers, mgr.subscribers, sizeof(subscribers));
+	unlock_writer();
+
+	for (size_t i = 0; i < CONFIG_SUBSCRIBER_MAX; i++) {
+		if (match_subscriber(&subscribers[i], key)) {
+			(*subscribers[i].cb)(key, subscribers[i].ctx);
+		}
+	}
+}
+
 static void mark_dirty(void)
 {
 	mgr.dirty = true;
 }
 
+/* for changes that can not be tracked in the journal */
+static void mark_dirty_all(void)
+{
+	mark_dirty();
+	mgr.journal.overflow = true;
+}
+
 static void clear_dirty(void)
 {
 	mgr.dirty = false;
+	mgr.journal.npending = 0;
+	mgr.journal.overflow = false;
 }
 
 static bool is_dirty(void)
@@ -141,25 +290,87 @@ static bool is_dirty(void)
 	return mgr.dirty;
 }
 
-static const struct config_entry *find_config_entry(const char *key)
+static uint32_t hash_key(const char *key)
 {
-	for (size_t i = 0; i < ARRAY_COUNT(config_map); i++) {
-		if (strcmp(config_map[i].key, key) == 0) {
-			return &config_map[i];
+	uint32_t hash = CONFIG_KEY_HASH_SEED;
+
+	while (*key) {
+		hash ^= (uint8_t)*key++;
+		hash *= CONFIG_KEY_HASH_PRIME;
+	}
+
+	/* the upper bits are better mixed than the lower ones in FNV-1a */
+	return hash >> (32 - CONFIG_KEY_TABLE_BITS);
+}
+
+static const char *get_key_by_index(size_t index)
+{
+	if (index < ARRAY_COUNT(config_map)) {
+		return config_map[index].key;
+	}
+	return custom_config_map[index - ARRAY_COUNT(config_map)].key;
+}
+
+static void build_key_table(void)
+{
+	const size_t n = ARRAY_COUNT(config_map)
+		+ ARRAY_COUNT(custom_config_map);
+
+	memset(key_table, 0, sizeof(key_table));
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t slot = hash_key(get_key_by_index(i));
+
+		while (key_table[slot]) {
+			slot = (slot + 1) & (CONFIG_KEY_TABLE_SIZE - 1);
+		}
+
+		key_table[slot] = (uint8_t)(i + 1);
+	}
+}
+
+static int lookup_key(const char *key)
+{
+	uint32_t slot = hash_key(key);
+
+	for (uint32_t i = 0; i < CONFIG_KEY_TABLE_SIZE; i++) {
+		if (!key_table[slot]) {
+			break;
+		}
+
+		const size_t index = (size_t)key_table[slot] - 1;
+
+		if (strcmp(get_key_by_index(index), key) == 0) {
+			return (int)index;
 		}
+
+		slot = (slot + 1) & (CONFIG_KEY_TABLE_SIZE - 1);
 	}
-	return NULL;
+
+	return -ENOENT;
+}
+
+static const struct config_entry *find_config_entry(const char *key)
+{
+	const int index = lookup_key(key);
+
+	if (index < 0 || (size_t)index >= ARRAY_COUNT(config_map)) {
+		return NULL;
+	}
+
+	return &config_map[index];
 }
 
 static const struct config_custom_entry *
 find_custom_config_entry(const char *key)
 {
-	for (size_t i = 0; i < ARRAY_COUNT(custom_config_map); i++) {
-		if (strcmp(custom_config_map[i].key, key) == 0) {
-			return &custom_config_map[i];
-		}
+	const int index = lookup_key(key);
+
+	if (index < (int)ARRAY_COUNT(config_map)) {
+		return NULL;
 	}
-	return NULL;
+
+	return &custom_config_map[(size_t)index - ARRAY_COUNT(config_map)];
 }
 
 static uint32_t compute_crc(const struct config *cfg)
@@ -219,12 +430,118 @@ static int write_custom_config(const char *key,
 	return 0;
 }
 
-static int save_basic_config(struct config *cfg)
+static uint32_t compute_record_crc(const struct journal_record *rec)
 {
-	if (!is_dirty()) {
-		return 0;
+	return crc32_cksum((const uint8_t *)rec,
+			sizeof(*rec) - sizeof(rec->crc));
+}
+
+static void get_journal_key(char *buf, size_t bufsize, uint8_t slot)
+{
+	snprintf(buf, bufsize, "j%02u", (unsigned int)slot);
+}
+
+static bool merge_range(struct journal_range *range,
+		size_t offset, size_t len)
+{
+	const size_t start = MIN(range->offset, offset);
+	const size_t end = MAX((size_t)range->offset + range->len,
+			offset + len);
+
+	if (offset > (size_t)range->offset + range->len ||
+			range->offset > offset + len ||
+			end - start > CONFIG_JOURNAL_VALUE_MAXLEN) {
+		return false;
+	}
+
+	range->offset = (uint16_t)start;
+	range->len = (uint8_t)(end - start);
+
+	return true;
+}
+
+/* Only the bytes that actually changed get journaled, so a single item
+ * update in a large field like ocpp.config still fits in a record. */
+static void track_change(size_t offset,
+		const uint8_t *cur, const uint8_t *next, size_t size)
+{
+	size_t first = 0;
+	size_t last = size;
+
+	while (first < size && cur[first] == next[first]) {
+		first++;
+	}
+	while (last > first && cur[last-1] == next[last-1]) {
+		last--;
+	}
+
+	if (first == last || mgr.journal.overflow) {
+		return;
+	}
+
+	const size_t len = last - first;
+	offset += first;
+
+	if (len > CONFIG_JOURNAL_VALUE_MAXLEN) {
+		mgr.journal.overflow = true;
+		return;
+	}
+
+	for (uint8_t i = 0; i < mgr.journal.npending; i++) {
+		if (merge_range(&mgr.journal.pending[i], offset, len)) {
+			return;
+		}
+	}
+
+	if (mgr.journal.npending >= CONFIG_JOURNAL_PENDING_MAX) {
+		mgr.journal.overflow = true;
+		return;
+	}
+
+	mgr.journal.pending[mgr.journal.npending++] = (struct journal_range) {
+		.offset = (uint16_t)offset,
+		.len = (uint8_t)len,
+	};
+}
+
+static int append_journal(const struct config *cfg)
+{
+	if (mgr.journal.overflow || mgr.journal.npending == 0 ||
+			mgr.journal.count + mgr.journal.npending
+				> CONFIG_JOURNAL_SLOTS) {
+		return -ENOSPC;
+	}
+
+	for (uint8_t i = 0; i < mgr.journal.npending; i++) {
+		const struct journal_range *range = &mgr.journal.pending[i];
+		struct journal_record rec = {
+			.seq = mgr.journal.seq,
+			.base_crc = mgr.journal.base_crc,
+			.offset = range->offset,
+			.len = range->len,
+		};
+		char key[JOURNAL_KEY_MAXLEN];
+
+		memcpy(rec.value, (const uint8_t *)cfg + range->offset,
+				range->len);
+		rec.crc = compute_record_crc(&rec);
+		get_journal_key(key, sizeof(key), mgr.journal.count);
+
+		if (kvstore_write(mgr.nvs, key, &rec, sizeof(rec)) < 0) {
+			metrics_increase(ConfigSaveErrorCount);
+			return -EIO;
+		}
+
+		mgr.journal.seq++;
+		mgr.journal.count++;
+		metrics_increase(ConfigJournalAppendCount);
 	}
 
+	return 0;
+}
+
+static int compact_journal(struct config *cfg)
+{
 	cfg->crc = compute_crc(cfg);
 
 	if (kvstore_write(mgr.nvs, BASIC_CONFIG_KEY, cfg, sizeof(*cfg)) < 0) {
@@ -232,6 +549,72 @@ static int save_basic_config(struct config *cfg)
 		return -EIO;
 	}
 
+	mgr.journal.base_crc = cfg->crc;
+
+	if (mgr.journal.count) {
+		/* Replay stops at the first missing slot. It keeps stale
+		 * records from being applied when the new blob happens to
+		 * have the same CRC as the previous one. */
+		char key[JOURNAL_KEY_MAXLEN];
+		get_journal_key(key, sizeof(key), 0);
+		kvstore_clear(mgr.nvs, key);
+		mgr.journal.count = 0;
+		metrics_increase(ConfigJournalCompactionCount);
+	}
+
+	return 0;
+}
+
+static bool is_record_valid(const struct journal_record *rec,
+		uint8_t slot, uint32_t expected_seq)
+{
+	return rec->crc == compute_record_crc(rec) &&
+		rec->base_crc == mgr.journal.base_crc &&
+		(slot == 0 || rec->seq == expected_seq) &&
+		rec->len <= CONFIG_JOURNAL_VALUE_MAXLEN &&
+		(size_t)rec->offset + rec->len
+			<= sizeof(struct config) - sizeof(uint32_t);
+}
+
+static void replay_journal(struct config *cfg)
+{
+	struct journal_record rec;
+
+	for (uint8_t slot = 0; slot < CONFIG_JOURNAL_SLOTS; slot++) {
+		char key[JOURNAL_KEY_MAXLEN];
+		get_journal_key(key, sizeof(key), slot);
+
+		/* A missing key reads 0 bytes on some kvstores, which would
+		 * leave the record of the previous slot in place. */
+		if (kvstore_read(mgr.nvs, key, &rec, sizeof(rec))
+				!= (int)sizeof(rec) ||
+				!is_record_valid(&rec, slot, mgr.journal.seq)) {
+			break;
+		}
+
+		memcpy((uint8_t *)cfg + rec.offset, rec.value, rec.len);
+		mgr.journal.seq = rec.seq + 1;
+		mgr.journal.count++;
+		metrics_increase(ConfigJournalReplayCount);
+	}
+
+	if (mgr.journal.count) {
+		info("%u journal record(s) replayed", mgr.journal.count);
+	}
+}
+
+static int save_basic_config(struct config *cfg)
+{
+	int err;
+
+	if (!is_dirty()) {
+		return 0;
+	}
+
+	if (append_journal(cfg) < 0 && (err = compact_journal(cfg)) < 0) {
+		return err;
+	}
+
 	clear_dirty();
 
 	if (mgr.save_cb) {
@@ -325,7 +708,7 @@ static void migrate_config(struct config *cfg)
 	}
 
 	cfg->version = CONFIG_VERSION;
-	mark_dirty();
+	mark_dirty_all();
 
 	if (save_basic_config(cfg) == 0) {
 		metrics_increase(ConfigMigrationCount);
@@ -353,22 +736,24 @@ static void load_config(struct config *cfg)
 	if (cfg->crc != compute_crc(cfg)) {
 		apply_defaults(cfg);
 		if (!err) { /* flash corruption */
-			mark_dirty();
+			mark_dirty_all();
 		}
+		/* There is no base blob for journal records to be written
+		 * against, so the first save has to write the whole blob. */
+		mgr.journal.overflow = true;
 		warn("CRC mismatch detected. Applying defaults.");
+		return;
 	}
+
+	mgr.journal.base_crc = cfg->crc;
+	replay_journal(cfg);
 }
 
-static int set_config(const char *key, const void *data, size_t datasize)
+static int set_config_entry(const struct config_entry *entry,
+		const void *data, size_t datasize)
 {
-	const struct config_entry *entry = find_config_entry(key);
-
-	if (!entry) {
-		return write_custom_config(key, data, datasize);
-	}
-
 	if (entry->permission <= RFW) {
-		error("Read-only key: %s", key);
+		error("Read-only key: %s", entry->key);
 		return -EPERM;
 	}
 
@@ -379,6 +764,9 @@ static int set_config(const char *key, const void *data, size_t datasize)
 	}
 
 	if (memcmp((uint8_t *)&mgr.basic + entry->offset, data, datasize)) {
+		track_change(entry->offset, (uint8_t *)&mgr.basic
+				+ entry->offset, (const uint8_t *)data,
+				datasize);
 		memcpy((uint8_t *)&mgr.basic + entry->offset, data, datasize);
 		mark_dirty();
 	}
@@ -386,19 +774,169 @@ static int set_config(const char *key, const void *data, size_t datasize)
 	return 0;
 }
 
+static int set_config(const char *key, const void *data, size_t datasize)
+{
+	const struct config_entry *entry = find_config_entry(key);
+
+	if (!entry) {
+		return write_custom_config(key, data, datasize);
+	}
+
+	return set_config_entry(entry, data, datasize);
+}
+
+static int get_config_entry(const struct config_entry *entry,
+		void *buf, size_t bufsize)
+{
+	if (bufsize < entry->size) {
+		metrics_increase(ConfigSizeMismatchCount);
+		error("Data size mismatch: %zu < %zu", bufsize, entry->size);
+		return -ENOMEM;
+	}
+
+	const struct config *snapshot = config_snapshot_acquire();
+	memcpy(buf, (const uint8_t *)snapshot + entry->offset, entry->size);
+	config_snapshot_release(snapshot);
+
+	return 0;
+}
+
+static int update_config_entry(const struct config_entry *entry,
+		const void *data, size_t datasize)
+{
+	lock_writer();
+	const int err = set_config_entry(entry, data, datasize);
+	const bool changed = publish_snapshot();
+	unlock_writer();
+
+	if (changed) {
+		notify_change(entry->key);
+	}
+
+	return err;
+}
+
+static int update_config(const char *key,
+		const void *data, size_t datasize, bool save)
+{
+	lock_writer();
+
+	int err = set_config(key, data, datasize);
+
+	if (err == 0 && save) {
+		err = save_basic_config(&mgr.basic);
+	}
+
+	const bool changed = publish_snapshot() ||
+		(err == 0 && find_custom_config_entry(key));
+
+	unlock_writer();
+
+	if (changed) {
+		notify_change(key);
+	}
+
+	return err;
+}
+
+const struct config *config_snapshot_acquire(void)
+{
+	unsigned int index;
+
+	for (;;) {
+		index = atomic_load(&mgr.snapshot.current);
+		atomic_fetch_add(&mgr.snapshot.readers[index], 1);
+
+		if (atomic_load(&mgr.snapshot.current) == index) {
+			break;
+		}
+
+		/* a new generation has been published in the meantime */
+		atomic_fetch_sub(&mgr.snapshot.readers[index], 1);
+	}
+
+	return &mgr.snapshot.gen[index];
+}
+
+void config_snapshot_release(const struct config *snapshot)
+{
+	const size_t index = (size_t)(snapshot - mgr.snapshot.gen);
+	atomic_fetch_sub(&mgr.snapshot.readers[index], 1);
+}
+
+uint32_t config_generation(void)
+{
+	return (uint32_t)atomic_load(&mgr.snapshot.generation);
+}
+
+int config_subscribe(const char *key, config_change_cb_t cb, void *ctx)
+{
+	int err = -ENOSPC;
+
+	if (cb == NULL) {
+		return -EINVAL;
+	}
+
+	lock_writer();
+
+	for (size_t i = 0; i < CONFIG_SUBSCRIBER_MAX; i++) {
+		struct config_subscriber *sub = &mgr.subscribers[i];
+
+		if (sub->cb == NULL) {
+			*sub = (struct config_subscriber) {
+				.key = key,
+				.cb = cb,
+				.ctx = ctx,
+			};
+			err = 0;
+			break;
+		}
+	}
+
+	unlock_writer();
+
+	return err;
+}
+
+int config_unsubscribe(config_change_cb_t cb, void *ctx)
+{
+	int err = -ENOENT;
+
+	lock_writer();
+
+	for (size_t i = 0; i < CONFIG_SUBSCRIBER_MAX; i++) {
+		struct config_subscriber *sub = &mgr.subscribers[i];
+
+		if (sub->cb == cb && sub->ctx == ctx) {
+			memset(sub, 0, sizeof(*sub));
+			err = 0;
+		}
+	}
+
+	unlock_writer();
+
+	return err;
+}
+
 bool config_is_zeroed(const char *key)
 {
-	const uint8_t *cfg = (const uint8_t *)&mgr.basic;
 	const struct config_entry *entry = find_config_entry(key);
 
 	if (!entry) {
 		return false;
 	}
 
-	uint8_t zero[entry->size];
-	memset(zero, 0, entry->size);
+	const struct config *snapshot = config_snapshot_acquire();
+	const uint8_t *p = (const uint8_t *)snapshot + entry->offset;
+	bool zeroed = true;
+
+	for (size_t i = 0; i < entry->size && zeroed; i++) {
+		zeroed = p[i] == 0;
+	}
+
+	config_snapshot_release(snapshot);
 
-	return memcmp(cfg + entry->offset, zero, entry->size) == 0;
+	return zeroed;
 }
 
 int config_get(const char *key, void *buf, size_t bufsize)
@@ -409,72 +947,595 @@ int config_get(const char *key, void *buf, size_t bufsize)
 		return read_custom_config(key, buf, bufsize);
 	}
 
-	if (bufsize < entry->size) {
-		metrics_increase(ConfigSizeMismatchCount);
-		error("Data size mismatch: %zu < %zu", bufsize, entry->size);
-		return -ENOMEM;
-	}
-
-	memcpy(buf, (uint8_t *)&mgr.basic + entry->offset, entry->size);
-
-	return 0;
+	return get_config_entry(entry, buf, bufsize);
 }
 
 int config_set(const char *key, const void *data, size_t datasize)
 {
-	return set_config(key, data, datasize);
+	return update_config(key, data, datasize, false);
 }
 
 int config_read_all(struct config *cfg)
 {
-	memcpy(cfg, &mgr.basic, sizeof(*cfg));
+	const struct config *snapshot = config_snapshot_acquire();
+	memcpy(cfg, snapshot, sizeof(*cfg));
+	config_snapshot_release(snapshot);
 	return 0;
 }
 
 int config_write_all(const struct config *cfg)
 {
+	lock_writer();
 	memcpy(&mgr.basic, cfg, sizeof(*cfg));
-	mark_dirty();
+	mark_dirty_all();
+	const bool changed = publish_snapshot();
+	unlock_writer();
+
+	if (changed) {
+		notify_change(NULL);
+	}
+
 	return 0;
 }
 
 int config_save(void)
 {
-	return save_basic_config(&mgr.basic);
+	lock_writer();
+	const int err = save_basic_config(&mgr.basic);
+	publish_snapshot(); /* only the crc may have changed */
+	unlock_writer();
+
+	return err;
 }
 
 int config_set_and_save(const char *key, const void *data, size_t datasize)
 {
-	int err = set_config(key, data, datasize);
+	return update_config(key, data, datasize, true);
+}
 
-	if (err == 0) {
-		err = save_basic_config(&mgr.basic);
+int config_reset(const char *key)
+{
+	lock_writer();
+	const bool found = apply_default(&mgr.basic, key);
+	if (found) {
+		mark_dirty_all();
 	}
+	const bool changed = publish_snapshot();
+	unlock_writer();
 
-	return err;
+	if (!found) {
+		return -ENOENT;
+	}
+
+	if (changed || (key && find_custom_config_entry(key))) {
+		notify_change(key);
+	}
+
+	return 0;
 }
 
-int config_reset(const char *key)
+static const char hexdigits[] = "0123456789abcdef";
+
+struct json_reader {
+	const char *p;
+	const char *end;
+};
+
+struct json_writer {
+	char buf[CONFIG_JSON_EXPORT_BUFSIZE];
+	size_t len;
+	size_t total;
+	config_json_writer_t fn;
+	void *ctx;
+	int err;
+};
+
+static void skip_whitespace(struct json_reader *r)
 {
-	if (apply_default(&mgr.basic, key)) {
-		mark_dirty();
-		return 0;
+	while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' ||
+			*r->p == '\n' || *r->p == '\r')) {
+		r->p++;
 	}
+}
 
-	return -ENOENT;
+static int next_token(struct json_reader *r)
+{
+	skip_whitespace(r);
+
+	if (r->p >= r->end) {
+		return -1;
+	}
+
+	return (uint8_t)*r->p++;
+}
+
+static bool consume_token(struct json_reader *r, char c)
+{
+	skip_whitespace(r);
+
+	if (r->p < r->end && *r->p == c) {
+		r->p++;
+		return true;
+	}
+
+	return false;
+}
+
+static int hex_to_int(int c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+
+	return -1;
+}
+
+/* Only ASCII is accepted for \u escapes as no value is wider than a byte. */
+static int read_escaped_char(struct json_reader *r)
+{
+	if (r->p >= r->end) {
+		return -EINVAL;
+	}
+
+	const char c = *r->p++;
+
+	switch (c) {
+	case '"': /* fall through */
+	case '\\': /* fall through */
+	case '/':
+		return c;
+	case 'b':
+		return '\b';
+	case 'f':
+		return '\f';
+	case 'n':
+		return '\n';
+	case 'r':
+		return '\r';
+	case 't':
+		return '\t';
+	case 'u':
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	int value = 0;
+
+	for (int i = 0; i < 4; i++) {
+		const int digit = r->p < r->end? hex_to_int(*r->p++) : -1;
+		if (digit < 0) {
+			return -EINVAL;
+		}
+		value = (value << 4) | digit;
+	}
+
+	return value < 0x80? value : -EINVAL;
+}
+
+/* Decodes a string into buf, padding the rest with nulls. A string as long
+ * as buf is taken without a terminator, the same as a field of struct
+ * config can be filled up and gets exported. */
+static int read_string(struct json_reader *r, char *buf, size_t bufsize)
+{
+	size_t len = 0;
+
+	if (!consume_token(r, '"')) {
+		return -EINVAL;
+	}
+
+	while (r->p < r->end && *r->p != '"') {
+		int c = (uint8_t)*r->p++;
+
+		if (c < 0x20) {
+			return -EINVAL;
+		} else if (c == '\\' && (c = read_escaped_char(r)) < 0) {
+			return c;
+		}
+
+		if (len >= bufsize) {
+			return -ENOMEM;
+		}
+
+		buf[len++] = (char)c;
+	}
+
+	if (r->p >= r->end) {
+		return -EINVAL;
+	}
+
+	r->p++; /* closing quote */
+	memset(&buf[len], 0, bufsize - len);
+
+	return 0;
+}
+
+static int read_hex_string(struct json_reader *r, uint8_t *buf, size_t bufsize)
+{
+	size_t len = 0;
+
+	if (!consume_token(r, '"')) {
+		return -EINVAL;
+	}
+
+	while (r->p + 1 < r->end && *r->p != '"') {
+		const int hi = hex_to_int(*r->p++);
+		const int lo = hex_to_int(*r->p++);
+
+		if (hi < 0 || lo < 0) {
+			return -EINVAL;
+		} else if (len >= bufsize) {
+			return -ENOMEM;
+		}
+
+		buf[len++] = (uint8_t)((hi << 4) | lo);
+	}
+
+	if (r->p >= r->end || *r->p != '"') {
+		return -EINVAL;
+	}
+
+	r->p++;
+	memset(&buf[len], 0, bufsize - len);
+
+	return 0;
+}
+
+static int read_uint(struct json_reader *r, uint8_t *buf, size_t bufsize)
+{
+	uint32_t value = 0;
+	size_t digits = 0;
+
+	skip_whitespace(r);
+
+	while (r->p < r->end && *r->p >= '0' && *r->p <= '9') {
+		const uint32_t digit = (uint32_t)(*r->p++ - '0');
+
+		if (value > (UINT32_MAX - digit) / 10) {
+			return -ERANGE;
+		}
+
+		value = value * 10 + digit;
+		digits++;
+	}
+
+	if (!digits) {
+		return -EINVAL;
+	}
+
+	if (bufsize == sizeof(uint8_t) && value <= UINT8_MAX) {
+		*buf = (uint8_t)value;
+	} else if (bufsize == sizeof(uint32_t)) {
+		memcpy(buf, &value, sizeof(value));
+	} else {
+		return -ERANGE;
+	}
+
+	return 0;
+}
+
+static bool consume_literal(struct json_reader *r, const char *literal)
+{
+	const size_t len = strlen(literal);
+
+	skip_whitespace(r);
+
+	if ((size_t)(r->end - r->p) < len || memcmp(r->p, literal, len)) {
+		return false;
+	}
+
+	r->p += len;
+
+	return true;
+}
+
+static int read_bool(struct json_reader *r, uint8_t *buf)
+{
+	if (consume_literal(r, "true")) {
+		*buf = true;
+	} else if (consume_literal(r, "false")) {
+		*buf = false;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int read_value(struct json_reader *r, const struct config_entry *entry,
+		struct config *cfg)
+{
+	uint8_t *dst = (uint8_t *)cfg + entry->offset;
+
+	switch (entry->type) {
+	case CONFIG_VALUE_UINT:
+		return read_uint(r, dst, entry->size);
+	case CONFIG_VALUE_BOOL:
+		return read_bool(r, dst);
+	case CONFIG_VALUE_STR:
+		return read_string(r, (char *)dst, entry->size);
+	case CONFIG_VALUE_BYTES:
+		return read_hex_string(r, dst, entry->size);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int read_member(struct json_reader *r, struct config *cfg)
+{
+	char key[CONFIG_JSON_KEY_MAXLEN+1] = { 0, };
+	const struct config_entry *entry;
+	int err;
+
+	if ((err = read_string(r, key, CONFIG_JSON_KEY_MAXLEN)) < 0) {
+		return err == -ENOMEM? -ENOENT : err;
+	}
+
+	if (!consume_token(r, ':')) {
+		return -EINVAL;
+	}
+
+	/* Custom configs are stored separately and can not be part of the
+	 * single write. */
+	if ((entry = find_config_entry(key)) == NULL) {
+		error("Unknown key: %s", key);
+		return -ENOENT;
+	}
+
+	if (entry->permission <= RFW) {
+		error("Read-only key: %s", key);
+		return -EPERM;
+	} else if (entry->permission == RWS) {
+		error("Device state key: %s", key);
+		return -EPERM;
+	}
+
+	return read_value(r, entry, cfg);
+}
+
+static int parse_json(struct json_reader *r, struct config *cfg)
+{
+	int err;
+	int c;
+
+	if (!consume_token(r, '{')) {
+		return -EINVAL;
+	}
+
+	if (!consume_token(r, '}')) {
+		do {
+			if ((err = read_member(r, cfg)) < 0) {
+				return err;
+			}
+		} while ((c = next_token(r)) == ',');
+
+		if (c != '}') {
+			return -EINVAL;
+		}
+	}
+
+	/* a null terminator counted in the length is tolerated */
+	if (consume_token(r, '\0')) {
+		skip_whitespace(r);
+	}
+
+	return r->p == r->end? 0 : -EINVAL;
+}
+
+static void flush_json(struct json_writer *w)
+{
+	if (!w->err && w->len) {
+		const int err = (*w->fn)(w->buf, w->len, w->ctx);
+		if (err < 0) {
+			w->err = err;
+		}
+		w->total += w->len;
+	}
+
+	w->len = 0;
+}
+
+static void write_char(struct json_writer *w, char c)
+{
+	if (w->len >= sizeof(w->buf)) {
+		flush_json(w);
+	}
+
+	w->buf[w->len++] = c;
+}
+
+static void write_raw(struct json_writer *w, const char *str)
+{
+	while (*str) {
+		write_char(w, *str++);
+	}
+}
+
+static void write_string(struct json_writer *w, const char *str, size_t maxlen)
+{
+
+	write_char(w, '"');
+
+	for (size_t i = 0; i < maxlen && str[i]; i++) {
+		const uint8_t c = (uint8_t)str[i];
+
+		if (c == '"' || c == '\\') {
+			write_char(w, '\\');
+			write_char(w, (char)c);
+		} else if (c < 0x20) {
+			write_raw(w, "\\u00");
+			write_char(w, hexdigits[c >> 4]);
+			write_char(w, hexdigits[c & 0xf]);
+		} else {
+			write_char(w, (char)c);
+		}
+	}
+
+	write_char(w, '"');
+}
+
+static void write_value(struct json_writer *w,
+		const struct config_entry *entry, const struct config *cfg)
+{
+	const uint8_t *src = (const uint8_t *)cfg + entry->offset;
+	char tmp[12];
+
+	switch (entry->type) {
+	case CONFIG_VALUE_UINT: {
+		uint32_t value = *src;
+		if (entry->size == sizeof(uint32_t)) {
+			memcpy(&value, src, sizeof(value));
+		}
+		snprintf(tmp, sizeof(tmp), "%lu", (unsigned long)value);
+		write_raw(w, tmp);
+		} break;
+	case CONFIG_VALUE_BOOL:
+		write_raw(w, *src? "true" : "false");
+		break;
+	case CONFIG_VALUE_STR:
+		write_string(w, (const char *)src, entry->size);
+		break;
+	case CONFIG_VALUE_BYTES:
+		write_char(w, '"');
+		for (size_t i = 0; i < entry->size; i++) {
+			write_char(w, hexdigits[src[i] >> 4]);
+			write_char(w, hexdigits[src[i] & 0xf]);
+		}
+		write_char(w, '"');
+		break;
+	default:
+		write_raw(w, "null");
+		break;
+	}
 }
 
 int config_update_json(const char *json, size_t json_len)
 {
-	/* TODO: Implement this function. */
-	(void)json;
-	(void)json_len;
-	return -ENOTSUP;
+	struct json_reader reader = {
+		.p = json,
+		.end = json + json_len,
+	};
+	int err;
+
+	if (json == NULL) {
+		return -EINVAL;
+	}
+
+	lock_writer();
+
+	memcpy(&mgr.staged, &mgr.basic, sizeof(mgr.staged));
+
+	if ((err = parse_json(&reader, &mgr.staged)) < 0) {
+		unlock_writer();
+		metrics_increase(ConfigImportErrorCount);
+		error("JSON rejected at %ld: %d", (long)(reader.p - json), err);
+		return err;
+	}
+
+	if (memcmp(&mgr.staged, &mgr.basic, sizeof(mgr.staged)) == 0) {
+		unlock_writer();
+		return 0;
+	}
+
+	/* All or nothing. The whole blob goes out in a single write with a
+	 * fresh CRC rather than as journal records one by one. */
+	memcpy(&mgr.basic, &mgr.staged, sizeof(mgr.basic));
+	mark_dirty_all();
+
+	err = save_basic_config(&mgr.basic);
+	publish_snapshot();
+
+	unlock_writer();
+
+	notify_change(NULL);
+
+	return err;
+}
+
+int config_export_json(config_json_writer_t writer, void *ctx)
+{
+	struct json_writer w = {
+		.fn = writer,
+		.ctx = ctx,
+	};
+	bool first = true;
+
+	if (writer == NULL) {
+		return -EINVAL;
+	}
+
+	const struct config *snapshot = config_snapshot_acquire();
+
+	write_char(&w, '{');
+
+	for (size_t i = 0; i < ARRAY_COUNT(config_map) && !w.err; i++) {
+		const struct config_entry *entry = &config_map[i];
+
+		/* only what can be imported back. Write-only ones like the
+		 * server password are not to be read out, and the state of
+		 * this device is not to be cloned onto others. */
+		if (entry->permission != RW) {
+			continue;
+		}
+
+		if (!first) {
+			write_char(&w, ',');
+		}
+
+		write_string(&w, entry->key, strlen(entry->key));
+		write_char(&w, ':');
+		write_value(&w, entry, snapshot);
+		first = false;
+	}
+
+	write_char(&w, '}');
+	flush_json(&w);
+
+	config_snapshot_release(snapshot);
+
+	return w.err? w.err : (int)w.total;
+}
+
+#define CONFIG_DEFINE(id, key, field, type, count, perm)		\
+int config_get_##id(type *value)					\
+{									\
+	return get_config_entry(&config_map[CONFIG_KEY_##id],		\
+			value, sizeof(type) * (count));			\
+}									\
+int config_set_##id(const type *value)					\
+{									\
+	return update_config_entry(&config_map[CONFIG_KEY_##id],	\
+			value, sizeof(type) * (count));			\
+}
+#include "config.def"
+#undef CONFIG_DEFINE
+
+static void initialize_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	/* recursive as the save callback is called with the lock held */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mgr.lock, &attr);
+	pthread_mutexattr_destroy(&attr);
 }
 
 int config_init(struct kvstore *nvs, config_save_cb_t cb, void *cb_ctx)
 {
 	memset(&mgr, 0, sizeof(mgr));
+	build_key_table();
+	initialize_lock();
+
+	atomic_store(&mgr.snapshot.current, 0);
+	atomic_store(&mgr.snapshot.generation, 0);
+	for (size_t i = 0; i < CONFIG_SNAPSHOT_MAX; i++) {
+		atomic_store(&mgr.snapshot.readers[i], 0);
+	}
 
 	int err = kvstore_open(nvs, NAMESPACE);
 	mgr.nvs = nvs;
@@ -487,6 +1548,7 @@ int config_init(struct kvstore *nvs, config_save_cb_t cb, void *cb_ctx)
 	}
 
 	load_config(&mgr.basic);
+	memcpy(&mgr.snapshot.gen[0], &mgr.basic, sizeof(mgr.basic));
 
 	return err;
 }
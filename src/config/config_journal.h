@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2024 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#ifndef CONFIG_JOURNAL_H
+#define CONFIG_JOURNAL_H
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "libmcu/compiler.h"
+
+/* Small updates to the basic configuration are appended to a journal of
+ * fixed slots instead of rewriting the whole blob. The journal gets
+ * compacted into the blob once it fills up. */
+#if !defined(CONFIG_JOURNAL_SLOTS)
+#define CONFIG_JOURNAL_SLOTS		16
+#endif
+#if !defined(CONFIG_JOURNAL_VALUE_MAXLEN)
+#define CONFIG_JOURNAL_VALUE_MAXLEN	24
+#endif
+#if !defined(CONFIG_JOURNAL_PENDING_MAX)
+#define CONFIG_JOURNAL_PENDING_MAX	4
+#endif
+
+/* A record is valid only on top of the base blob it was written against,
+ * which is identified by the CRC of the blob. Records left over from before
+ * a compaction are therefore ignored without erasing them. */
+struct journal_record {
+	uint32_t seq;
+	uint32_t base_crc;
+	uint16_t offset; /* in struct config */
+	uint8_t len;
+	uint8_t value[CONFIG_JOURNAL_VALUE_MAXLEN];
+	uint32_t crc; /* keep this field at the end */
+} LIBMCU_PACKED;
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* CONFIG_JOURNAL_H */
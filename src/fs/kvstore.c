@@ -30,48 +30,440 @@
  * incidental, special, or consequential, arising from the use of this software.
  */
 
+
 #include "fs/kvstore.h"
+
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+
 #include "libmcu/compiler.h"
+#include "libmcu/list.h"
+#include "libmcu/board.h"
+#include "libmcu/metrics.h"
+
+#define NAMESPACE_MAXLEN	(FS_FILENAME_MAX / 2)
+
+#if !defined(MIN)
+#define MIN(a, b)		(((a) > (b))? (b) : (a))
+#endif
+
+struct entry {
+	struct list link;
+	char path[FS_FILENAME_MAX+1];
+	bool dirty;
+	size_t size;
+	uint8_t value[];
+};
+
+struct cache {
+	struct list entries; /* least recently used first */
+	size_t capacity;
+	size_t used;
+
+	uint32_t flush_interval_ms;
+	uint32_t dirty_since;
+	bool dirty;
+
+	pthread_mutex_t lock;
+};
 
 struct kvstore {
 	struct kvstore_api api;
 	struct fs *fs;
+	char ns[NAMESPACE_MAXLEN+1];
+
+	struct cache cache;
 };
 
+static int get_path(const struct kvstore *self, const char *key,
+		char *buf, const size_t bufsize)
+{
+	int len;
+
+	if (self->ns[0] != '\0') {
+		len = snprintf(buf, bufsize, "%s/%s", self->ns, key);
+	} else {
+		len = snprintf(buf, bufsize, "%s", key);
+	}
+
+	if (len < 0 || (size_t)len >= bufsize) {
+		return -ENAMETOOLONG;
+	}
+
+	return 0;
+}
+
+static bool is_cached(const struct kvstore *self)
+{
+	return self->cache.capacity > 0;
+}
+
+static struct entry *find_entry(struct kvstore *self, const char *path)
+{
+	struct list *p;
+
+	list_for_each(p, &self->cache.entries) {
+		struct entry *entry = list_entry(p, struct entry, link);
+		if (strcmp(entry->path, path) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void touch_entry(struct kvstore *self, struct entry *entry)
+{
+	list_del(&entry->link, &self->cache.entries);
+	list_add_tail(&entry->link, &self->cache.entries);
+}
+
+static void remove_entry(struct kvstore *self, struct entry *entry)
+{
+	list_del(&entry->link, &self->cache.entries);
+	self->cache.used -= entry->size;
+	free(entry);
+}
+
+static int flush_entries(struct kvstore *self)
+{
+	struct list *p;
+	int first_err = 0;
+
+	list_for_each(p, &self->cache.entries) {
+		struct entry *entry = list_entry(p, struct entry, link);
+
+		if (!entry->dirty) {
+			continue;
+		}
+
+		const int err = fs_write(self->fs, entry->path, 0,
+				entry->value, entry->size);
+
+		if (err < 0) {
+			first_err = first_err? first_err : err;
+			continue;
+		}
+
+		entry->dirty = false;
+		metrics_increase(KVStoreFlushCount);
+	}
+
+	self->cache.dirty = first_err != 0;
+
+	return first_err;
+}
+
+static void flush_if_expired(struct kvstore *self)
+{
+	const uint32_t now = board_get_time_since_boot_ms();
+
+	if (self->cache.dirty && self->cache.flush_interval_ms &&
+			now - self->cache.dirty_since
+				>= self->cache.flush_interval_ms) {
+		flush_entries(self);
+	}
+}
+
+/* Clean entries are dropped first in LRU order. Dirty ones get committed
+ * only when nothing else can be dropped, and only if @p flush is set. */
+static int make_room(struct kvstore *self, const size_t size, bool flush)
+{
+	while (self->cache.used + size > self->cache.capacity) {
+		struct entry *victim = NULL;
+		struct list *p;
+
+		list_for_each(p, &self->cache.entries) {
+			struct entry *entry =
+				list_entry(p, struct entry, link);
+			if (!entry->dirty) {
+				victim = entry;
+				break;
+			}
+		}
+
+		if (victim) {
+			remove_entry(self, victim);
+			continue;
+		} else if (!flush) {
+			return -ENOSPC;
+		}
+
+		const int err = flush_entries(self);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int write_cache(struct kvstore *self, const char *path,
+		const void *value, const size_t size)
+{
+	struct entry *entry = find_entry(self, path);
+	int err;
+
+	if (entry && entry->size == size) {
+		if (memcmp(entry->value, value, size) == 0) {
+			metrics_increase(KVStoreCoalescedWriteCount);
+			touch_entry(self, entry);
+			return (int)size;
+		}
+	} else {
+		if (entry) {
+			remove_entry(self, entry);
+		}
+		if ((err = make_room(self, size, true)) < 0) {
+			return err;
+		}
+		if ((entry = (struct entry *)malloc(sizeof(*entry) + size))
+				== NULL) {
+			metrics_increase(OOM);
+			return -ENOMEM;
+		}
+
+		strcpy(entry->path, path);
+		entry->size = size;
+		entry->dirty = false;
+		self->cache.used += size;
+		list_add_tail(&entry->link, &self->cache.entries);
+	}
+
+	if (entry->dirty) {
+		metrics_increase(KVStoreCoalescedWriteCount);
+	}
+
+	memcpy(entry->value, value, size);
+	entry->dirty = true;
+	touch_entry(self, entry);
+
+	if (!self->cache.dirty) {
+		self->cache.dirty = true;
+		self->cache.dirty_since = board_get_time_since_boot_ms();
+	}
+
+	return (int)size;
+}
+
 static int do_write(struct kvstore *self,
 		char const *key, void const *value, size_t size)
 {
-	return fs_write(self->fs, key, 0, value, size);
+	char path[FS_FILENAME_MAX+1];
+	int err;
+
+	if ((err = get_path(self, key, path, sizeof(path))) < 0) {
+		return err;
+	}
+
+	if (!is_cached(self)) {
+		return fs_write(self->fs, path, 0, value, size);
+	}
+
+	pthread_mutex_lock(&self->cache.lock);
+
+	if (size > self->cache.capacity) {
+		struct entry *entry = find_entry(self, path);
+		if (entry) {
+			remove_entry(self, entry);
+		}
+		err = fs_write(self->fs, path, 0, value, size);
+	} else {
+		err = write_cache(self, path, value, size);
+	}
+
+	flush_if_expired(self);
+
+	pthread_mutex_unlock(&self->cache.lock);
+
+	return err;
+}
+
+/* Whether the whole value is in the buffer rather than the head of it. */
+static bool is_whole(struct kvstore *self, const char *path,
+		const int len, const size_t bufsize)
+{
+	size_t filesize;
+
+	if ((size_t)len < bufsize) {
+		return true;
+	}
+
+	return ((const struct fs_api *)self->fs)->size &&
+		fs_size(self->fs, path, &filesize) == 0 &&
+		filesize == (size_t)len;
+}
+
+/* Values written before namespaces were supported are at the root. One is
+ * moved into its namespace on its first read, so it is looked up at the
+ * root only until then. */
+static int migrate(struct kvstore *self, const char *key, const char *path,
+		void *buf, const size_t bufsize)
+{
+	const int len = fs_read(self->fs, key, 0, buf, bufsize);
+
+	if (len < 0 || !is_whole(self, key, len, bufsize)) {
+		return len;
+	}
+
+	if (fs_write(self->fs, path, 0, buf, (size_t)len) == len &&
+			fs_delete(self->fs, key) == 0) {
+		metrics_increase(KVStoreMigrationCount);
+	}
+
+	return len;
+}
+
+static int read_fs(struct kvstore *self, const char *key, const char *path,
+		void *buf, const size_t bufsize)
+{
+	const int err = fs_read(self->fs, path, 0, buf, bufsize);
+
+	if (err == -ENOENT && self->ns[0] != '\0') {
+		return migrate(self, key, path, buf, bufsize);
+	}
+
+	return err;
+}
+
+/* A value read from the filesystem is kept as a clean entry so that the
+ * next read is served from RAM. The read is one byte larger than the
+ * caller's buffer to tell whether the whole value fits. Dirty entries are
+ * never committed just to make room for it. */
+static int read_and_fill(struct kvstore *self, const char *key,
+		const char *path, void *buf, const size_t size)
+{
+	struct entry *entry;
+	int len;
+
+	if (size >= self->cache.capacity || make_room(self, size, false) < 0 ||
+			(entry = (struct entry *)malloc(sizeof(*entry) +
+					size + 1)) == NULL) {
+		return read_fs(self, key, path, buf, size);
+	}
+
+	if ((len = read_fs(self, key, path, entry->value, size + 1)) < 0) {
+		free(entry);
+		return len;
+	}
+
+	memcpy(buf, entry->value, MIN((size_t)len, size));
+
+	if ((size_t)len > size) {
+		free(entry);
+		return (int)size;
+	}
+
+	strcpy(entry->path, path);
+	entry->size = (size_t)len;
+	entry->dirty = false;
+	self->cache.used += entry->size;
+	list_add_tail(&entry->link, &self->cache.entries);
+
+	return len;
 }
 
 static int do_read(struct kvstore *self,
 			char const *key, void *buf, size_t size)
 {
-	return fs_read(self->fs, key, 0, buf, size);
+	char path[FS_FILENAME_MAX+1];
+	struct entry *entry;
+	int err;
+
+	if ((err = get_path(self, key, path, sizeof(path))) < 0) {
+		return err;
+	}
+
+	if (!is_cached(self)) {
+		return read_fs(self, key, path, buf, size);
+	}
+
+	pthread_mutex_lock(&self->cache.lock);
+
+	if ((entry = find_entry(self, path)) != NULL) {
+		err = (int)MIN(entry->size, size);
+		memcpy(buf, entry->value, (size_t)err);
+		touch_entry(self, entry);
+		metrics_increase(KVStoreCacheHitCount);
+	} else {
+		err = read_and_fill(self, key, path, buf, size);
+	}
+
+	flush_if_expired(self);
+
+	pthread_mutex_unlock(&self->cache.lock);
+
+	return err;
 }
 
 static int do_erase(struct kvstore *self, char const *key)
 {
-	return fs_delete(self->fs, key);
+	char path[FS_FILENAME_MAX+1];
+	bool was_dirty = false;
+	int err;
+
+	if ((err = get_path(self, key, path, sizeof(path))) < 0) {
+		return err;
+	}
+
+	if (is_cached(self)) {
+		pthread_mutex_lock(&self->cache.lock);
+		struct entry *entry = find_entry(self, path);
+		if (entry) {
+			was_dirty = entry->dirty;
+			remove_entry(self, entry);
+		}
+		pthread_mutex_unlock(&self->cache.lock);
+	}
+
+	err = fs_delete(self->fs, path);
+
+	/* A value which has never been committed is not in the filesystem. */
+	return (err == -ENOENT && was_dirty)? 0 : err;
 }
 
 static int do_open(struct kvstore *self, char const *ns)
 {
-	unused(self);
-	unused(ns);
+	if (ns && strlen(ns) > NAMESPACE_MAXLEN) {
+		return -ENAMETOOLONG;
+	}
+
+	strcpy(self->ns, ns? ns : "");
+
 	return 0;
 }
 
 static void do_close(struct kvstore *self)
 {
-	unused(self);
+	fs_kvstore_flush(self);
 }
 
-struct kvstore *fs_kvstore_create(struct fs *fs)
+int fs_kvstore_flush(struct kvstore *kvstore)
+{
+	int err = 0;
+
+	if (kvstore && is_cached(kvstore)) {
+		pthread_mutex_lock(&kvstore->cache.lock);
+		err = flush_entries(kvstore);
+		pthread_mutex_unlock(&kvstore->cache.lock);
+	}
+
+	return err;
+}
+
+struct kvstore *fs_kvstore_create_cached(struct fs *fs,
+		size_t cache_size, uint32_t flush_interval_ms)
 {
 	struct kvstore *fs_kvstore =
-		(struct kvstore *)malloc(sizeof(*fs_kvstore));
+		(struct kvstore *)calloc(1, sizeof(*fs_kvstore));
+
+	if (!fs_kvstore) {
+		return NULL;
+	}
 
 	fs_kvstore->api = (struct kvstore_api) {
 		.write = do_write,
@@ -83,10 +475,35 @@ struct kvstore *fs_kvstore_create(struct fs *fs)
 
 	fs_kvstore->fs = fs;
 
+	list_init(&fs_kvstore->cache.entries);
+	fs_kvstore->cache.capacity = cache_size;
+	fs_kvstore->cache.flush_interval_ms = flush_interval_ms;
+	pthread_mutex_init(&fs_kvstore->cache.lock, NULL);
+
 	return fs_kvstore;
 }
 
+struct kvstore *fs_kvstore_create(struct fs *fs)
+{
+	return fs_kvstore_create_cached(fs, 0, 0);
+}
+
 void fs_kvstore_destroy(struct kvstore *kvstore)
 {
+	struct list *p;
+	struct list *n;
+
+	if (!kvstore) {
+		return;
+	}
+
+	fs_kvstore_flush(kvstore);
+
+	list_for_each_safe(p, n, &kvstore->cache.entries) {
+		struct entry *entry = list_entry(p, struct entry, link);
+		remove_entry(kvstore, entry);
+	}
+
+	pthread_mutex_destroy(&kvstore->cache.lock);
 	free(kvstore);
 }
@@ -32,6 +32,8 @@
 
 #include "fs/fs.h"
 #include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <pthread.h>
 #if defined(__clang__)
 #pragma clang diagnostic push
@@ -50,7 +52,9 @@
 #include "libmcu/metrics.h"
 #include "libmcu/board.h"
 
+#if !defined(LFS_FLASH_SIZE)
 #define LFS_FLASH_SIZE			(8 * 1024/*MiB*/ * 1024/*KiB*/)
+#endif
 #define LFS_FLASH_SECTOR_SIZE		(4 * 1024/*KiB*/)
 #define LFS_FLASH_PAGE_SIZE		256
 
@@ -62,42 +66,47 @@ struct fs {
 	struct fs_api api;
 	struct flash *flash;
 	lfs_t lfs;
+	/* lfs doesn't hard-copy the cfg, but dereferences it. The instance
+	 * is found through its context in the block device callbacks. */
+	struct lfs_config cfg;
 #if defined(LFS_THREADSAFE)
 	pthread_mutex_t mutex;
 #endif
 };
 
-static struct fs fs;
-
 #if defined(LFS_THREADSAFE)
 static int lock_fs(const struct lfs_config *cfg)
 {
-	(void)cfg;
-	return pthread_mutex_lock(&fs.mutex);
+	struct fs *fs = (struct fs *)cfg->context;
+	return pthread_mutex_lock(&fs->mutex);
 }
 
 static int unlock_fs(const struct lfs_config *cfg)
 {
-	(void)cfg;
-	return pthread_mutex_unlock(&fs.mutex);
+	struct fs *fs = (struct fs *)cfg->context;
+	return pthread_mutex_unlock(&fs->mutex);
 }
 #endif
 
 static int read_block(const struct lfs_config *c, lfs_block_t block,
 		lfs_off_t off, void *buffer, lfs_size_t size)
 {
-	return flash_read(fs.flash, block * c->block_size + off, buffer, size);
+	struct fs *fs = (struct fs *)c->context;
+	return flash_read(fs->flash, block * c->block_size + off, buffer, size);
 }
 
 static int write_block(const struct lfs_config *c, lfs_block_t block,
 		lfs_off_t off, const void *buffer, lfs_size_t size)
 {
-	return flash_write(fs.flash, block * c->block_size + off, buffer, size);
+	struct fs *fs = (struct fs *)c->context;
+	return flash_write(fs->flash, block * c->block_size + off,
+			buffer, size);
 }
 
 static int erase_block(const struct lfs_config *c, lfs_block_t block)
 {
-	return flash_erase(fs.flash, block * c->block_size, c->block_size);
+	struct fs *fs = (struct fs *)c->context;
+	return flash_erase(fs->flash, block * c->block_size, c->block_size);
 }
 
 static int sync_fs(const struct lfs_config *c)
@@ -152,10 +161,13 @@ static int create_directory(lfs_t *fs_handle, const char *filepath)
 	return 0;
 }
 
-static int write_core(struct fs *self,
-		const char *filepath, const size_t offset,
-		const void *data, const size_t datasize, const int flags)
+static int write_core(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt,
+		const int flags)
 {
+	/* segments go back to back when appending or replacing */
+	const bool append = (flags & (LFS_O_APPEND | LFS_O_TRUNC)) != 0;
+	lfs_ssize_t total = 0;
 	lfs_file_t file;
 
 	int err = create_directory(&self->lfs, filepath);
@@ -169,43 +181,94 @@ static int write_core(struct fs *self,
 		goto out;
 	}
 
-	if (offset) {
-		if ((err = lfs_file_seek(&self->lfs, &file,
-				(lfs_soff_t)offset, LFS_SEEK_SET)) < 0) {
-			goto out;
+	/* All segments go through the same open file so that littlefs commits
+	 * the metadata only once on close. */
+	for (size_t i = 0; i < iovcnt; i++) {
+		if (!append && (i || iov[i].offset)) {
+			if ((err = lfs_file_seek(&self->lfs, &file,
+					(lfs_soff_t)iov[i].offset,
+					LFS_SEEK_SET)) < 0) {
+				break;
+			}
+			err = 0;
 		}
+
+		const lfs_ssize_t written = lfs_file_write(&self->lfs, &file,
+				iov[i].data, (lfs_size_t)iov[i].datasize);
+		if (written < 0) {
+			err = written;
+			break;
+		}
+
+		total += written;
 	}
 
-	err = lfs_file_write(&self->lfs, &file, data, (lfs_size_t)datasize);
-	err |= lfs_file_close(&self->lfs, &file);
+	const int close_err = lfs_file_close(&self->lfs, &file);
+	if (!err) {
+		err = close_err? close_err : (int)total;
+	}
 
 out:
 	metrics_increase(FileSystemWriteCount);
 	return err;
 }
 
-static int do_write(struct fs *self, const char *filepath, const size_t offset,
-		const void *data, const size_t datasize)
+static int do_writev(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt)
 {
 	const uint32_t t0 = board_get_time_since_boot_ms();
-	int err = write_core(self, filepath, offset, data, datasize,
+	int err = write_core(self, filepath, iov, iovcnt,
 			LFS_O_RDWR | LFS_O_CREAT);
 	metrics_set_if_max(FileSystemWriteTimeMax,
 			METRICS_VALUE(board_get_time_since_boot_ms() - t0));
 	return err;
 }
 
-static int do_append(struct fs *self,
-		const char *filepath, const void *data, const size_t datasize)
+static int do_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt)
 {
 	const uint32_t t0 = board_get_time_since_boot_ms();
-	int err = write_core(self, filepath, 0, data, datasize,
+	int err = write_core(self, filepath, iov, iovcnt,
 			LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
 	metrics_set_if_max(FileSystemWriteTimeMax,
 			METRICS_VALUE(board_get_time_since_boot_ms() - t0));
 	return err;
 }
 
+/* littlefs commits the truncation together with the new content on close,
+ * so the old content survives a power loss in the middle. */
+static int do_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt)
+{
+	const uint32_t t0 = board_get_time_since_boot_ms();
+	int err = write_core(self, filepath, iov, iovcnt,
+			LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+	metrics_set_if_max(FileSystemWriteTimeMax,
+			METRICS_VALUE(board_get_time_since_boot_ms() - t0));
+	return err;
+}
+
+static int do_write(struct fs *self, const char *filepath, const size_t offset,
+		const void *data, const size_t datasize)
+{
+	const struct fs_iovec iov = {
+		.offset = offset,
+		.data = data,
+		.datasize = datasize,
+	};
+	return do_writev(self, filepath, &iov, 1);
+}
+
+static int do_append(struct fs *self,
+		const char *filepath, const void *data, const size_t datasize)
+{
+	const struct fs_iovec iov = {
+		.data = data,
+		.datasize = datasize,
+	};
+	return do_append_batch(self, filepath, &iov, 1);
+}
+
 static int do_read(struct fs *self, const char *filepath, const size_t offset,
 		void *buf, const size_t bufsize)
 {
@@ -330,9 +393,8 @@ static int do_usage(struct fs *self, size_t *used, size_t *total)
 
 static int do_mount(struct fs *self)
 {
-	/* keep it static as lfs doesn't hard-copy the cfg,
-	 * but dereferences it. */
-	static const struct lfs_config cfg = {
+	self->cfg = (struct lfs_config) {
+		.context = self,
 		.read = read_block,
 		.prog = write_block,
 		.erase = erase_block,
@@ -351,12 +413,12 @@ static int do_mount(struct fs *self)
 		.block_cycles = 500,
 	};
 
-	int err = lfs_mount(&self->lfs, &cfg);
+	int err = lfs_mount(&self->lfs, &self->cfg);
 
 	if (err) { /* This should only happen on the first boot. */
 		info("Formatting LFS...");
-		err = lfs_format(&self->lfs, &cfg);
-		err |= lfs_mount(&self->lfs, &cfg);
+		err = lfs_format(&self->lfs, &self->cfg);
+		err |= lfs_mount(&self->lfs, &self->cfg);
 	}
 
 	if (err) {
@@ -375,15 +437,22 @@ static int do_unmount(struct fs *self)
 
 struct fs *fs_create(struct flash *flash)
 {
-	memset(&fs, 0, sizeof(fs));
+	struct fs *fs = (struct fs *)calloc(1, sizeof(*fs));
+
+	if (!fs) {
+		return NULL;
+	}
 
-	fs.flash = flash;
-	fs.api = (struct fs_api) {
+	fs->flash = flash;
+	fs->api = (struct fs_api) {
 		.mount = do_mount,
 		.unmount = do_unmount,
 		.read = do_read,
 		.write = do_write,
 		.append = do_append,
+		.writev = do_writev,
+		.append_batch = do_append_batch,
+		.replace = do_replace,
 		.erase = do_delete,
 		.size = do_size,
 		.dir = do_dir,
@@ -391,8 +460,20 @@ struct fs *fs_create(struct flash *flash)
 	};
 
 #if defined(LFS_THREADSAFE)
-	pthread_mutex_init(&fs.mutex, NULL);
+	pthread_mutex_init(&fs->mutex, NULL);
 #endif
 
-	return &fs;
+	return fs;
+}
+
+void fs_destroy(struct fs *fs)
+{
+	if (!fs) {
+		return;
+	}
+
+#if defined(LFS_THREADSAFE)
+	pthread_mutex_destroy(&fs->mutex);
+#endif
+	free(fs);
 }
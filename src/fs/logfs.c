@@ -108,12 +108,12 @@ static void add_list(struct logfs *self, const time_t ts, const size_t logsize)
 	add_list_sorted(file, &self->log_list);
 }
 
-static int add_file(struct fs *fs, const char *basedir,
-		const time_t ts, const void *data, const size_t datasize)
+static int add_file(struct fs *fs, const char *basedir, const time_t ts,
+		const struct fs_iovec *iov, const size_t iovcnt)
 {
 	char filepath[FS_FILENAME_MAX+1];
 	get_filepath(ts, basedir, filepath, sizeof(filepath));
-	return fs_append(fs, filepath, data, datasize);
+	return fs_append_batch(fs, filepath, iov, iovcnt);
 }
 
 static int delete_file(struct fs *fs, const char *basedir, const time_t ts)
@@ -242,15 +242,34 @@ static void flush_logcache(struct logfs *self,
 	reclaim(self, bytes_to_append);
 
 	while (ringbuf_length(self->cache.buffer) > 0) {
+		/* A wrapped cache is made of two contiguous regions. Both are
+		 * appended with a single commit. */
+		struct fs_iovec iov[2];
+		const size_t cached = ringbuf_length(self->cache.buffer);
+		size_t offset = 0;
+		size_t n = 0;
 		int err;
-		size_t len;
-		const void *p;
 
-		if ((p = ringbuf_peek_pointer(self->cache.buffer,
-				0, &len)) == NULL || len == 0) {
+		for (; n < sizeof(iov) / sizeof(*iov) && offset < cached; n++) {
+			size_t len;
+			const void *p = ringbuf_peek_pointer(self->cache.buffer,
+					offset, &len);
+
+			if (p == NULL || len == 0) {
+				break;
+			}
+
+			iov[n] = (struct fs_iovec) {
+				.data = p,
+				.datasize = len,
+			};
+			offset += len;
+		}
+
+		if (n == 0) {
 			return; /* will retry on next flush */
 		}
-		if ((err = add_file(self->fs, self->base_path, ts, p, len))
+		if ((err = add_file(self->fs, self->base_path, ts, iov, n))
 				< 0) {
 			return;
 		}
@@ -138,7 +138,9 @@ static void set_level(struct logger *logger, logging_t level)
 
 	logger->level = level;
 	logging_set_level_global(level);
-	config_set("log.level", &level, sizeof(level));
+
+	const uint8_t saved_level = (uint8_t)level;
+	config_set_log_level(&saved_level);
 }
 
 static void set_writer(struct logger *logger, log_writer_t writer)
@@ -166,7 +168,24 @@ static void set_writer(struct logger *logger, log_writer_t writer)
 	}
 
 	logger->writer.enabled = writer;
-	config_set("log.mode", &writer, sizeof(writer));
+	config_set_log_mode(&writer);
+}
+
+/* Picks up changes made by others than the logger itself, e.g. a bulk
+ * import. */
+static void on_config_change(const char *key, void *ctx)
+{
+	struct logger *logger = (struct logger *)ctx;
+	uint8_t level = (uint8_t)logger->level;
+	log_writer_t writer = logger->writer.enabled;
+
+	unused(key);
+
+	config_get_log_mode(&writer);
+	config_get_log_level(&level);
+
+	set_writer(logger, writer);
+	set_level(logger, (logging_t)level);
 }
 
 void logger_set_level(logging_t level)
@@ -191,11 +210,13 @@ log_writer_t logger_get_writer(void)
 
 void logger_init(struct logfs *fs)
 {
-	logging_t level = LOGGING_TYPE_DEBUG;
+	uint8_t saved_level = LOGGING_TYPE_DEBUG;
 	log_writer_t writer = LOG_WRITER_ALL;
 
-	config_get("log.mode", &writer, sizeof(writer));
-	config_get("log.level", &level, sizeof(level));
+	config_get_log_mode(&writer);
+	config_get_log_level(&saved_level);
+
+	const logging_t level = (logging_t)saved_level;
 
 	memset(&m, 0, sizeof(m));
 	m.fs = fs;
@@ -206,6 +227,8 @@ void logger_init(struct logfs *fs)
 	set_writer(&m, writer);
 	set_level(&m, level);
 
+	config_subscribe("log.", on_config_change, &m);
+
 	info("logging to %s at %s level",
 			writer == LOG_WRITER_ALL? "console & file" :
 			writer == LOG_WRITER_CONSOLE? "console" :
@@ -47,6 +47,7 @@
 #include "logger.h"
 #include "exio.h"
 #include "config.h"
+#include "persist.h"
 #include "periph.h"
 #include "buzzer.h"
 #include "usrinp.h"
@@ -63,6 +64,10 @@
 #define METRIC_PERIOD_MS		(60U/*min*/ * 60/*sec*/ * 1000)
 #define METRIC_STORAGE_MAXLEN		720 /* 30-day worth of data */
 #define METRIC_PREFIX			"metrics"
+#define METRIC_CACHE_SIZE		4096U
+/* metricfs updates its index on every save. Committing only every few
+ * periods trades a few hours of metrics on power loss for flash wear. */
+#define METRIC_FLUSH_INTERVAL_MS	(METRIC_PERIOD_MS * 6)
 
 #define RUNNER_WDT_TIMEOUT_MS		(10U/*sec*/ * 1000)
 #define CLEANUP_TIMEOUT_MS		(2U/*sec*/ * 1000)
@@ -202,6 +207,17 @@ static void on_config_save(void *ctx)
 	info("Config saved in NVS.");
 }
 
+static void on_cleanup_persist(void *ctx)
+{
+	unused(ctx);
+	persist_flush(PERSIST_PRIO_LOW);
+}
+
+static void on_cleanup_kvstore(void *ctx)
+{
+	fs_kvstore_flush((struct kvstore *)ctx);
+}
+
 static void on_watchdog_timeout(struct wdt *wdt, void *ctx)
 {
 	unused(ctx);
@@ -266,10 +282,15 @@ int main(int argc, char *argv[])
 	cleanup_init();
 	wdt_init(on_watchdog_periodic, NULL);
 	config_init(nvs_kvstore_new(), on_config_save, NULL);
+	persist_init(config_set_and_save);
+	persist_start();
+	cleanup_register(0, on_cleanup_persist, NULL);
 
 	app.fs = fs_create(flash_create(0));
 	fs_mount(app.fs);
-	app.kvstore = fs_kvstore_create(app.fs);
+	app.kvstore = fs_kvstore_create_cached(app.fs,
+			METRIC_CACHE_SIZE, METRIC_FLUSH_INTERVAL_MS);
+	cleanup_register(0, on_cleanup_kvstore, app.kvstore);
 	app.mfs = metricfs_create(app.kvstore,
 			METRIC_PREFIX, METRIC_STORAGE_MAXLEN);
 	app.logfs = logfs_create(app.fs, LOGGER_FS_BASE_PATH,
@@ -293,8 +314,7 @@ int main(int argc, char *argv[])
 
 	periph_init(periph);
 
-	config_get("net.health", &network_healthchk_interval_ms,
-			sizeof(network_healthchk_interval_ms));
+	config_get_net_health(&network_healthchk_interval_ms);
 	netmgr_init(network_healthchk_interval_ms);
 	updater_init();
 	updater_set_runner(run_network_updater, NULL);
@@ -0,0 +1,290 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2024 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "net/server_rxq.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#if !defined(MIN)
+#define MIN(a, b)		((a) > (b)? (b) : (a))
+#endif
+
+#define HDRSIZE			sizeof(uint32_t)
+/* A record never wraps around the end of the storage. When it does not fit
+ * there, it goes to the front and the rest of the storage is skipped,
+ * marked with this length if there is room for a header. */
+#define PADDING			UINT32_MAX
+
+struct server_rxq {
+	pthread_mutex_t lock;
+
+	size_t capacity;
+	size_t msg_maxlen;
+
+	size_t head; /* the oldest record */
+	size_t tail; /* where the next record goes */
+	size_t used; /* bytes of complete records, including padding */
+
+	struct {
+		size_t start; /* the header of the open record */
+		size_t pad; /* skipped in front of it to keep it contiguous */
+		size_t len;
+		size_t limit;
+		bool open;
+	} w;
+
+	uint8_t buf[];
+};
+
+static uint32_t get_len(const struct server_rxq *self, const size_t pos)
+{
+	uint32_t len;
+	memcpy(&len, &self->buf[pos], sizeof(len));
+	return len;
+}
+
+static void set_len(struct server_rxq *self, const size_t pos,
+		const uint32_t len)
+{
+	memcpy(&self->buf[pos], &len, sizeof(len));
+}
+
+static void skip_padding(struct server_rxq *self)
+{
+	const size_t rest = self->capacity - self->head;
+
+	if (self->used && (rest < HDRSIZE ||
+			get_len(self, self->head) == PADDING)) {
+		self->head = 0;
+		self->used -= rest;
+	}
+}
+
+static int reserve(struct server_rxq *self, const size_t needed)
+{
+	size_t start = self->tail;
+	size_t pad = 0;
+	size_t room;
+
+	if (self->used == 0) {
+		self->head = self->tail = start = 0;
+	}
+
+	if (self->used == 0 || self->tail > self->head) {
+		room = self->capacity - self->tail;
+
+		if (needed > room) {
+			pad = room;
+			start = 0;
+			room = self->head;
+		}
+	} else { /* wrapped around, or full if tail == head */
+		room = self->head - self->tail;
+	}
+
+	if (needed > room) {
+		return -ENOSPC;
+	}
+
+	self->w.start = start;
+	self->w.pad = pad;
+	self->w.limit = MIN(room - HDRSIZE, self->msg_maxlen);
+
+	return 0;
+}
+
+int server_rxq_begin(struct server_rxq *self, const size_t sizehint)
+{
+	int err = -EMSGSIZE;
+
+	pthread_mutex_lock(&self->lock);
+
+	self->w.open = false;
+	self->w.len = 0;
+
+	if (sizehint <= self->msg_maxlen &&
+			(err = reserve(self, HDRSIZE + sizehint)) == 0) {
+		self->w.open = true;
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return err;
+}
+
+int server_rxq_append(struct server_rxq *self,
+		const void *data, const size_t datasize)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&self->lock);
+
+	if (!self->w.open) {
+		err = -ENOENT;
+	} else if (datasize > self->w.limit - self->w.len) {
+		err = self->w.len + datasize > self->msg_maxlen?
+			-EMSGSIZE : -ENOSPC;
+		self->w.open = false;
+	} else {
+		memcpy(&self->buf[self->w.start + HDRSIZE + self->w.len],
+				data, datasize);
+		self->w.len += datasize;
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return err;
+}
+
+int server_rxq_end(struct server_rxq *self)
+{
+	int err = -ENOENT;
+
+	pthread_mutex_lock(&self->lock);
+
+	if (self->w.open) {
+		const size_t recsize = HDRSIZE + self->w.len;
+
+		set_len(self, self->w.start, (uint32_t)self->w.len);
+		if (self->w.pad >= HDRSIZE) {
+			set_len(self, self->capacity - self->w.pad, PADDING);
+		}
+
+		self->used += self->w.pad + recsize;
+		self->tail = self->w.start + recsize;
+		if (self->tail == self->capacity) {
+			self->tail = 0;
+		}
+
+		self->w.open = false;
+		err = 0;
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return err;
+}
+
+int server_rxq_peek(struct server_rxq *self, const void **msg)
+{
+	int len = -ENODATA;
+
+	pthread_mutex_lock(&self->lock);
+
+	skip_padding(self);
+
+	if (self->used) {
+		len = (int)get_len(self, self->head);
+		*msg = &self->buf[self->head + HDRSIZE];
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return len;
+}
+
+int server_rxq_consume(struct server_rxq *self)
+{
+	int err = -ENODATA;
+
+	pthread_mutex_lock(&self->lock);
+
+	skip_padding(self);
+
+	if (self->used) {
+		const size_t recsize = HDRSIZE + get_len(self, self->head);
+
+		self->head += recsize;
+		self->used -= recsize;
+		skip_padding(self);
+		err = 0;
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return err;
+}
+
+int server_rxq_read(struct server_rxq *self, void *buf, const size_t bufsize)
+{
+	const void *msg;
+	int len = server_rxq_peek(self, &msg);
+
+	if (len < 0) {
+		return len;
+	}
+
+	if ((size_t)len > bufsize) {
+		len = -EMSGSIZE;
+	} else {
+		memcpy(buf, msg, (size_t)len);
+	}
+
+	server_rxq_consume(self);
+
+	return len;
+}
+
+struct server_rxq *server_rxq_create(const size_t capacity,
+		const size_t msg_maxlen)
+{
+	if (capacity <= HDRSIZE || capacity > INT32_MAX) {
+		return NULL;
+	}
+
+	struct server_rxq *rxq = (struct server_rxq *)
+		malloc(sizeof(*rxq) + capacity);
+
+	if (rxq) {
+		memset(rxq, 0, sizeof(*rxq));
+		rxq->capacity = capacity;
+		rxq->msg_maxlen = MIN(msg_maxlen, capacity - HDRSIZE);
+		pthread_mutex_init(&rxq->lock, NULL);
+	}
+
+	return rxq;
+}
+
+void server_rxq_destroy(struct server_rxq *self)
+{
+	if (!self) {
+		return;
+	}
+
+	pthread_mutex_destroy(&self->lock);
+	free(self);
+}
@@ -0,0 +1,365 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+
+#include "persist.h"
+
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "libmcu/board.h"
+#include "libmcu/metrics.h"
+#include "logger.h"
+
+#define STACK_SIZE_BYTES	4096U
+
+struct job {
+	char key[PERSIST_KEY_MAXLEN];
+	uint8_t data[PERSIST_DATA_MAXLEN];
+	size_t datasize;
+	persist_prio_t prio;
+	uint32_t seq;
+	uint32_t t_requested;
+
+	persist_done_cb_t cb;
+	void *cb_ctx;
+
+	bool used;
+	bool committing;
+};
+
+struct persist {
+	persist_writer_t writer;
+
+	struct job jobs[PERSIST_QUEUE_MAX];
+	size_t pending;
+	uint32_t seq;
+
+	pthread_mutex_t lock; /* protects the queue */
+	pthread_mutex_t commit_lock; /* serializes commits */
+	sem_t event;
+	pthread_t thread;
+	bool started;
+	bool terminated;
+};
+
+static struct persist m;
+
+static struct job *find_job(struct persist *self, const char *key)
+{
+	for (size_t i = 0; i < PERSIST_QUEUE_MAX; i++) {
+		struct job *job = &self->jobs[i];
+		if (job->used && !job->committing &&
+				strcmp(job->key, key) == 0) {
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static struct job *alloc_job(struct persist *self)
+{
+	for (size_t i = 0; i < PERSIST_QUEUE_MAX; i++) {
+		struct job *job = &self->jobs[i];
+		if (!job->used) {
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static bool is_prior(const struct job *a, const struct job *b)
+{
+	if (a->prio != b->prio) {
+		return a->prio > b->prio;
+	}
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static struct job *dequeue(struct persist *self, persist_prio_t min_prio)
+{
+	struct job *next = NULL;
+
+	pthread_mutex_lock(&self->lock);
+
+	for (size_t i = 0; i < PERSIST_QUEUE_MAX; i++) {
+		struct job *job = &self->jobs[i];
+		if (job->used && !job->committing && job->prio >= min_prio &&
+				(!next || is_prior(job, next))) {
+			next = job;
+		}
+	}
+
+	if (next) {
+		/* The slot stays taken while being committed, but a new request
+		 * for the same key gets a slot of its own. */
+		next->committing = true;
+		self->pending--;
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return next;
+}
+
+static void release(struct persist *self, struct job *job)
+{
+	pthread_mutex_lock(&self->lock);
+	memset(job, 0, sizeof(*job));
+	pthread_mutex_unlock(&self->lock);
+}
+
+static int commit(struct persist *self, struct job *job)
+{
+	const uint32_t t0 = board_get_time_since_boot_ms();
+	const int err = (*self->writer)(job->key, job->data, job->datasize);
+	const uint32_t t1 = board_get_time_since_boot_ms();
+
+	metrics_set_if_max(PersistCommitTimeMax, METRICS_VALUE(t1 - t0));
+	metrics_set_if_min(PersistCommitTimeMin, METRICS_VALUE(t1 - t0));
+	metrics_set_if_max(PersistLatencyMax,
+			METRICS_VALUE(t1 - job->t_requested));
+
+	if (err) {
+		metrics_increase(PersistCommitErrorCount);
+		error("Failed to persist \"%s\": %d", job->key, err);
+	}
+
+	return err;
+}
+
+/* The commit lock is held for each write only. The completion callback is
+ * called without it, and with the slot already released, so that it may
+ * request or flush again. */
+static int drain(struct persist *self, persist_prio_t min_prio)
+{
+	int first_err = 0;
+
+	for (;;) {
+		char key[PERSIST_KEY_MAXLEN];
+		persist_done_cb_t cb;
+		void *cb_ctx;
+		struct job *job;
+		int err;
+
+		pthread_mutex_lock(&self->commit_lock);
+
+		if ((job = dequeue(self, min_prio)) == NULL) {
+			pthread_mutex_unlock(&self->commit_lock);
+			break;
+		}
+
+		err = commit(self, job);
+
+		pthread_mutex_unlock(&self->commit_lock);
+
+		strcpy(key, job->key);
+		cb = job->cb;
+		cb_ctx = job->cb_ctx;
+		release(self, job);
+
+		if (cb) {
+			(*cb)(key, err, cb_ctx);
+		}
+
+		if (err && !first_err) {
+			first_err = err;
+		}
+	}
+
+	return first_err;
+}
+
+static void *worker(void *arg)
+{
+	struct persist *self = (struct persist *)arg;
+
+	while (!self->terminated) {
+		sem_wait(&self->event);
+		persist_step();
+	}
+
+	return NULL;
+}
+
+int persist_request(const char *key, const void *data, size_t datasize,
+		persist_prio_t prio, persist_done_cb_t cb, void *cb_ctx)
+{
+	persist_done_cb_t superseded_cb = NULL;
+	void *superseded_ctx = NULL;
+	struct job *job;
+
+	if (!key || !data || strlen(key) >= PERSIST_KEY_MAXLEN) {
+		return -EINVAL;
+	}
+
+	if (datasize > PERSIST_DATA_MAXLEN) {
+		metrics_increase(PersistOversizeCount);
+		goto sync;
+	}
+
+	pthread_mutex_lock(&m.lock);
+
+	if ((job = find_job(&m, key)) != NULL) {
+		superseded_cb = job->cb;
+		superseded_ctx = job->cb_ctx;
+		if (prio > job->prio) {
+			job->prio = prio;
+		}
+		metrics_increase(PersistCoalescedCount);
+	} else if ((job = alloc_job(&m)) != NULL) {
+		strcpy(job->key, key);
+		job->prio = prio;
+		job->seq = m.seq++;
+		job->t_requested = board_get_time_since_boot_ms();
+		job->used = true;
+		m.pending++;
+	} else {
+		pthread_mutex_unlock(&m.lock);
+		metrics_increase(PersistQueueFullCount);
+		goto sync;
+	}
+
+	memcpy(job->data, data, datasize);
+	job->datasize = datasize;
+	job->cb = cb;
+	job->cb_ctx = cb_ctx;
+
+	metrics_set_if_max(PersistQueueDepthMax, METRICS_VALUE(m.pending));
+
+	pthread_mutex_unlock(&m.lock);
+
+	if (superseded_cb) {
+		(*superseded_cb)(key, -ECANCELED, superseded_ctx);
+	}
+
+	sem_post(&m.event);
+
+	return 0;
+
+sync:
+	/* Keep the order with the queued ones by flushing them first. */
+	persist_flush(PERSIST_PRIO_LOW);
+
+	pthread_mutex_lock(&m.commit_lock);
+	const int err = (*m.writer)(key, data, datasize);
+	pthread_mutex_unlock(&m.commit_lock);
+
+	if (err) {
+		metrics_increase(PersistCommitErrorCount);
+		error("Failed to persist \"%s\": %d", key, err);
+	}
+
+	if (cb) {
+		(*cb)(key, err, cb_ctx);
+	}
+
+	return err;
+}
+
+int persist_flush(persist_prio_t min_prio)
+{
+	return drain(&m, min_prio);
+}
+
+int persist_step(void)
+{
+	return drain(&m, PERSIST_PRIO_LOW);
+}
+
+size_t persist_pending(void)
+{
+	pthread_mutex_lock(&m.lock);
+	const size_t pending = m.pending;
+	pthread_mutex_unlock(&m.lock);
+
+	return pending;
+}
+
+int persist_init(persist_writer_t writer)
+{
+	if (!writer) {
+		return -EINVAL;
+	}
+
+	memset(&m, 0, sizeof(m));
+
+	m.writer = writer;
+	pthread_mutex_init(&m.lock, NULL);
+	pthread_mutex_init(&m.commit_lock, NULL);
+	sem_init(&m.event, 0, 0);
+
+	return 0;
+}
+
+int persist_start(void)
+{
+	pthread_attr_t attr;
+
+	if (m.started) {
+		return -EALREADY;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, STACK_SIZE_BYTES);
+
+	const int err = pthread_create(&m.thread, &attr, worker, &m);
+
+	pthread_attr_destroy(&attr);
+
+	if (err) {
+		return -err;
+	}
+
+	m.started = true;
+
+	return 0;
+}
+
+void persist_deinit(void)
+{
+	m.terminated = true;
+
+	if (m.started) {
+		sem_post(&m.event);
+		pthread_join(m.thread, NULL);
+	}
+
+	drain(&m, PERSIST_PRIO_LOW);
+
+	sem_destroy(&m.event);
+	pthread_mutex_destroy(&m.commit_lock);
+	pthread_mutex_destroy(&m.lock);
+}
@@ -36,17 +36,52 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "libmcu/compiler.h"
 #include "libmcu/hexdump.h"
 #include "libmcu/metrics.h"
 #include "libmcu/board.h"
 #include "fs/fs.h"
+#include "uid_snapshot.h"
 #include "logger.h"
 
 #define STORAGE_ROOT		"uid"
 #define FILENAME_MAXLEN		16
 #define FILEPATH_MAXLEN		16
+#define VERSION_FILENAME	"version"
+#define FORMAT_FILENAME		"format"
+
+/* Layout of the bucket files, stamped in the format file. Format 1 appended
+ * records unsorted and zeroed deleted ones; format 2 keeps them sorted by
+ * ID. Bump it whenever the layout changes. */
+#define UID_FORMAT		2
+
+/* Records in a bucket file are kept sorted by ID, so a lookup is a binary
+ * search. Once the range narrows down to this many records, they are read
+ * at once rather than one by one. */
+#if !defined(UID_READ_CHUNK_RECORDS)
+#define UID_READ_CHUNK_RECORDS	8
+#endif
+
+/* Cache entries sharing a set are evicted in LRU order. */
+#if !defined(UID_CACHE_WAYS)
+#define UID_CACHE_WAYS		4
+#endif
+/* Buckets known to have tombstones, compacted the most fragmented first */
+#if !defined(UID_GC_CANDIDATES)
+#define UID_GC_CANDIDATES	16
+#endif
+/* Number of probes per ID in the Bloom filter */
+#if !defined(UID_BLOOM_HASHES)
+#define UID_BLOOM_HASHES	4
+#endif
+
+#if !defined(MIN)
+#define MIN(a, b)		(((a) > (b))? (b) : (a))
+#endif
 
 struct uid {
 	uid_id_t id;
@@ -65,19 +100,96 @@ struct cache_entry {
 	struct uid_record record;
 };
 
+/* A free slab entry links to the next free one in place. */
+union slab_entry {
+	struct cache_entry entry;
+	union slab_entry *next;
+};
+
+/* A negative lookup filter over all the IDs stored in flash. It is only
+ * trusted once built from what is actually in flash, so a failed rebuild
+ * leaves every lookup to go to flash as before. */
+struct bloom {
+	uint8_t *bits;
+	uint32_t nbits;
+	bool valid;
+};
+
+struct fragment {
+	uint16_t bucket; /* id[0] << 8 | id[1] */
+	uint16_t dead;
+};
+
+/* Incremental garbage collection state. The sweep walks the buckets in
+ * name order across calls, resuming from the cursor. */
+struct gc {
+	struct fragment candidates[UID_GC_CANDIDATES];
+
+	uint32_t cursor; /* next bucket to sweep */
+	uint32_t t0;
+	uint32_t budget_ms;
+	bool stopped;
+
+	size_t live; /* bytes of the sweep in progress */
+	size_t dead;
+	size_t last_live; /* bytes of the last complete sweep */
+	size_t last_dead;
+	bool swept;
+};
+
 struct uid_store {
 	struct fs *fs;
 	const char *ns;
 	uid_update_cb_t cb;
 	void *cb_ctx;
 
+	/* nr_sets * ways entries, each set ordered from MRU to LRU with
+	 * unused ways at the end. */
 	struct cache_entry **cache;
 	uint16_t capacity;
+	uint16_t nr_sets;
+	uint16_t ways;
+
+	/* Entries preallocated right after the cache in the same block when
+	 * a RAM budget is given, instead of one heap block each. */
+	struct {
+		union slab_entry *mem;
+		union slab_entry *free;
+	} slab;
+
+	struct bloom bloom;
+	struct gc gc;
+	bool expire;
+
+	uid_batch_cb_t batch_cb;
+	void *batch_cb_ctx;
+	uint32_t version;
+	bool version_loaded;
+
+	/* The snapshot is built on another thread while lookups and changes
+	 * go on. change_lock keeps changes to flash and builds apart, and a
+	 * change cancels a build in progress rather than waiting for it. */
+	struct uid_snapshot *snapshot;
+	atomic_bool snapshot_valid;
+	atomic_bool snapshot_cancel;
+	pthread_mutex_t change_lock;
+	uint32_t generation; /* bumped on every change */
+	uint32_t failed_generation;
+	int build_err;
+
+	char dir[FILEPATH_MAXLEN];
+};
 
+struct walk {
+	struct uid_store *store;
+	int (*file)(struct walk *walk, const char *filepath);
+	uid_snapshot_visit_t visit;
+	void *ctx;
+	int err;
 	char dir[FILEPATH_MAXLEN];
 };
 
-static uint32_t hash_uid(const uid_id_t id, uint16_t cap)
+static uint32_t hash_uid(const uid_id_t id)
 {
 	uint32_t h = 2166136261u;
 
@@ -85,13 +197,67 @@ static uint32_t hash_uid(const uid_id_t id, uint16_t cap)
 		h = (h ^ id[i]) * 16777619u;
 	}
 
-	return h % (uint32_t)cap;
+	return h;
+}
+
+/* Double hashing: probe i is h1 + i * h2 where h2 is derived from h1 and
+ * forced odd. */
+static uint32_t get_bloom_bit(const struct bloom *bloom,
+		const uint32_t h, const uint32_t i)
+{
+	const uint32_t h2 = (((h >> 16) | (h << 16)) * 0x45d9f3bu) | 1u;
+	return (h + i * h2) % bloom->nbits;
+}
+
+static void bloom_add(struct bloom *bloom, const uint32_t h)
+{
+	if (!bloom->bits) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < UID_BLOOM_HASHES; i++) {
+		const uint32_t bit = get_bloom_bit(bloom, h, i);
+		bloom->bits[bit / 8] = (uint8_t)(bloom->bits[bit / 8] |
+				(1u << (bit % 8)));
+	}
+}
+
+static bool bloom_may_contain(const struct bloom *bloom, const uint32_t h)
+{
+	if (!bloom->bits || !bloom->valid) {
+		return true;
+	}
+
+	for (uint32_t i = 0; i < UID_BLOOM_HASHES; i++) {
+		const uint32_t bit = get_bloom_bit(bloom, h, i);
+		if (!(bloom->bits[bit / 8] & (1u << (bit % 8)))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void bloom_reset(struct bloom *bloom)
+{
+	if (bloom->bits) {
+		memset(bloom->bits, 0, bloom->nbits / 8);
+	}
+	bloom->valid = false;
 }
 
-static struct cache_entry *new_entry(void)
+static struct cache_entry *new_entry(struct uid_store *store)
 {
-	struct cache_entry *entry =
-		(struct cache_entry *)calloc(1, sizeof(*entry));
+	struct cache_entry *entry = NULL;
+
+	if (store->slab.mem) {
+		if (store->slab.free) {
+			entry = &store->slab.free->entry;
+			store->slab.free = store->slab.free->next;
+		}
+	} else {
+		entry = (struct cache_entry *)calloc(1, sizeof(*entry));
+	}
 
 	if (!entry) {
 		error("Failed to allocate memory for UID cache.");
@@ -102,123 +268,1019 @@ static struct cache_entry *new_entry(void)
 	return entry;
 }
 
-static void free_entry(struct cache_entry *entry)
+static void free_entry(struct uid_store *store, struct cache_entry *entry)
 {
 	debug("Freeing cache entry at %p", entry);
-	free(entry);
+
+	if (store->slab.mem) {
+		const size_t i = (size_t)((const uint8_t *)entry -
+				(const uint8_t *)store->slab.mem) /
+			sizeof(*store->slab.mem);
+		union slab_entry *p = &store->slab.mem[i];
+		p->next = store->slab.free;
+		store->slab.free = p;
+	} else {
+		free(entry);
+	}
+}
+
+static void init_slab(struct uid_store *store)
+{
+	store->slab.mem = (union slab_entry *)&store->cache[store->capacity];
+	store->slab.free = NULL;
+
+	for (uint16_t i = store->capacity; i > 0; i--) {
+		store->slab.mem[i - 1].next = store->slab.free;
+		store->slab.free = &store->slab.mem[i - 1];
+	}
+}
+
+static struct cache_entry **get_set(struct uid_store *store, const uint32_t h)
+{
+	return &store->cache[(h % store->nr_sets) * store->ways];
+}
+
+static int find_way(const struct uid_store *store,
+		struct cache_entry * const *set, const uid_id_t id)
+{
+	for (uint16_t i = 0; i < store->ways && set[i]; i++) {
+		if (memcmp(set[i]->record.uid.id, id, sizeof(uid_id_t)) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Makes the way the most recently used one in the set. */
+static struct cache_entry *promote_way(struct cache_entry **set,
+		const uint16_t way)
+{
+	struct cache_entry *entry = set[way];
+
+	memmove(&set[1], &set[0], way * sizeof(*set));
+	set[0] = entry;
+
+	return entry;
+}
+
+/* Takes an unused way or, if the set is full, the least recently used one
+ * and promotes it with its record cleared. */
+static struct cache_entry *claim_way(struct uid_store *store,
+		struct cache_entry **set)
+{
+	uint16_t way = (uint16_t)(store->ways - 1);
+
+	for (uint16_t i = 0; i < store->ways; i++) {
+		if (!set[i]) {
+			way = i;
+			break;
+		}
+	}
+
+	if (set[way]) {
+		metrics_increase(UIDCacheEvictionCount);
+	} else if ((set[way] = new_entry(store)) == NULL) {
+		return NULL;
+	}
+
+	memset(&set[way]->record, 0, sizeof(set[way]->record));
+
+	return promote_way(set, way);
+}
+
+static void drop_way(struct uid_store *store,
+		struct cache_entry **set, const uint16_t way)
+{
+	free_entry(store, set[way]);
+	memmove(&set[way], &set[way + 1],
+			(size_t)(store->ways - way - 1) * sizeof(*set));
+	set[store->ways - 1] = NULL;
+}
+
+static void drop_cache(struct uid_store *store)
+{
+	for (uint32_t i = 0; i < store->capacity; i++) {
+		if (store->cache[i]) {
+			free_entry(store, store->cache[i]);
+			store->cache[i] = NULL;
+		}
+	}
+}
+
+static void get_filepath(char *filepath, size_t maxlen,
+		const char *ns, const char *dir, const char *filename)
+{
+	size_t len = 0;
+	int t = snprintf(filepath, maxlen, "%s/%s", STORAGE_ROOT, ns);
+
+	if (t > 0 && dir && strlen(dir)) {
+		len += (size_t)t;
+		t = snprintf(filepath + len, maxlen - len, "/%s", dir);
+	}
+
+	if (t > 0 && filename && strlen(filename)) {
+		len += (size_t)t;
+		t = snprintf(filepath + len, maxlen - len, "/%s", filename);
+	}
+}
+
+static void get_filename(char *filepath, size_t maxlen,
+		const char *ns, const uid_id_t id)
+{
+	snprintf(filepath, maxlen, "%s/%s/%02X/%02X.bin",
+			STORAGE_ROOT, ns, id[0], id[1]);
+}
+
+/* Deleted records are left in place as tombstones with their IDs intact to
+ * keep the file sorted. */
+static bool is_tombstone(const struct uid_record *record)
+{
+	return record->uid.status == UID_STATUS_UNKNOWN;
+}
+
+static int compare_id(const uid_id_t a, const uid_id_t b)
+{
+	return memcmp(a, b, sizeof(uid_id_t));
+}
+
+static int compare_record(const void *a, const void *b)
+{
+	return compare_id(((const struct uid_record *)a)->uid.id,
+			((const struct uid_record *)b)->uid.id);
+}
+
+/* On a miss, pos is where the ID would be inserted. */
+static int search_file(struct uid_store *store, const char *filepath,
+		const size_t nr_records, const uid_id_t id,
+		struct uid_record *record, size_t *pos)
+{
+	struct uid_record chunk[UID_READ_CHUNK_RECORDS];
+	size_t lo = 0;
+	size_t hi = nr_records;
+	uint32_t reads = 0;
+	int err = -ENOENT;
+
+	while (hi - lo > UID_READ_CHUNK_RECORDS) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		reads++;
+		if (fs_read(store->fs, filepath, mid * sizeof(*record),
+				record, sizeof(*record)) != sizeof(*record)) {
+			err = -EIO;
+			goto out;
+		}
+
+		const int cmp = compare_id(record->uid.id, id);
+
+		if (cmp == 0) {
+			*pos = mid;
+			err = 0;
+			goto out;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*pos = hi;
+
+	if (hi > lo) {
+		const size_t len = (hi - lo) * sizeof(chunk[0]);
+
+		reads++;
+		if (fs_read(store->fs, filepath, lo * sizeof(chunk[0]),
+				chunk, len) != (int)len) {
+			err = -EIO;
+			goto out;
+		}
+
+		for (size_t i = 0; i < hi - lo; i++) {
+			const int cmp = compare_id(chunk[i].uid.id, id);
+
+			if (cmp >= 0) {
+				*pos = lo + i;
+				if (cmp == 0) {
+					*record = chunk[i];
+					err = 0;
+				}
+				break;
+			}
+		}
+	}
+
+out:
+	metrics_set_if_max(UIDLookupReadsMax, METRICS_VALUE(reads));
+	return err;
+}
+
+static int get_nr_records(struct uid_store *store, const char *filepath,
+		size_t *nr_records)
+{
+	size_t filesize;
+
+	if (fs_size(store->fs, filepath, &filesize) < 0) {
+		*nr_records = 0;
+		return -ENOENT;
+	}
+
+	*nr_records = filesize / sizeof(struct uid_record);
+
+	return 0;
+}
+
+/* Tombstones are returned as well. */
+static int read_entry_from_file(struct uid_store *store,
+		const uid_id_t id, struct uid_record *record, size_t *offset)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	size_t nr_records;
+	size_t pos;
+
+	get_filename(filepath, sizeof(filepath), store->ns, id);
+
+	if (get_nr_records(store, filepath, &nr_records) < 0 ||
+			search_file(store, filepath, nr_records, id,
+					record, &pos) < 0) {
+		return -ENOENT;
+	}
+
+	if (offset) {
+		*offset = pos * sizeof(*record);
+	}
+
+	return 0;
+}
+
+/* The tail gets shifted by one record starting from the end not to
+ * overwrite what is yet to be moved. The last chunk goes out together with
+ * the new record in a single commit, which is the only write for small
+ * files. */
+static int insert_entry_into_file(struct uid_store *store,
+		const char *filepath, const size_t nr_records, const size_t pos,
+		const struct uid_record *record)
+{
+	struct uid_record chunk[UID_READ_CHUNK_RECORDS];
+	const size_t recsize = sizeof(*record);
+	size_t end = nr_records;
+
+	if (pos >= nr_records) {
+		return fs_append(store->fs, filepath, record, recsize);
+	}
+
+	while (end > pos) {
+		const size_t n = MIN(end - pos, (size_t)UID_READ_CHUNK_RECORDS);
+		const size_t start = end - n;
+		int err;
+
+		if (fs_read(store->fs, filepath, start * recsize,
+				chunk, n * recsize) != (int)(n * recsize)) {
+			return -EIO;
+		}
+
+		if (start == pos) {
+			const struct fs_iovec iov[] = {
+				{ .offset = pos * recsize,
+					.data = record,
+					.datasize = recsize },
+				{ .offset = (pos + 1) * recsize,
+					.data = chunk,
+					.datasize = n * recsize },
+			};
+			return fs_writev(store->fs, filepath, iov, 2);
+		}
+
+		if ((err = fs_write(store->fs, filepath, (start + 1) * recsize,
+				chunk, n * recsize)) < 0) {
+			return err;
+		}
+
+		end = start;
+	}
+
+	return 0;
+}
+
+static int save_entry_into_file(struct uid_store *store,
+		const struct uid_record *record)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	struct uid_record found;
+	size_t nr_records;
+	size_t pos = 0;
+
+	get_filename(filepath, sizeof(filepath), store->ns, record->uid.id);
+
+	debug("Saving UID to file: %s", filepath);
+
+	if (get_nr_records(store, filepath, &nr_records) == 0 &&
+			search_file(store, filepath, nr_records,
+					record->uid.id, &found, &pos) == 0) {
+		return fs_write(store->fs, filepath, pos * sizeof(*record),
+				record, sizeof(*record));
+	}
+
+	return insert_entry_into_file(store, filepath, nr_records, pos, record);
+}
+
+static uint16_t get_bucket(const uid_id_t id)
+{
+	return (uint16_t)(id[0] << 8 | id[1]);
+}
+
+/* Keeps track of the buckets with the most tombstones. When the table is
+ * full, the least fragmented one gives way. */
+static void note_fragment(struct uid_store *store,
+		const uid_id_t id, const size_t nr_dead)
+{
+	struct fragment *candidates = store->gc.candidates;
+	const uint16_t bucket = get_bucket(id);
+	struct fragment *least = &candidates[0];
+
+	for (size_t i = 0; i < UID_GC_CANDIDATES; i++) {
+		if (candidates[i].dead && candidates[i].bucket == bucket) {
+			candidates[i].dead = (uint16_t)MIN(
+					candidates[i].dead + nr_dead,
+					(size_t)UINT16_MAX);
+			return;
+		}
+		if (candidates[i].dead < least->dead) {
+			least = &candidates[i];
+		}
+	}
+
+	if (least->dead < nr_dead) {
+		least->bucket = bucket;
+		least->dead = (uint16_t)MIN(nr_dead, (size_t)UINT16_MAX);
+	}
+}
+
+static int remove_entry_from_file(struct uid_store *store, const uid_id_t id)
+{
+	struct uid_record tombstone;
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	size_t offset;
+
+	get_filename(filepath, sizeof(filepath), store->ns, id);
+
+	if (read_entry_from_file(store, id, &tombstone, &offset) == 0 &&
+			!is_tombstone(&tombstone)) {
+		memset(&tombstone, 0, sizeof(tombstone));
+		memcpy(tombstone.uid.id, id, sizeof(uid_id_t));
+		note_fragment(store, id, 1);
+		return fs_write(store->fs,
+				filepath, offset, &tombstone, sizeof(tombstone));
+	}
+
+	return -ENOENT;
+}
+
+static void on_clear_dir(struct fs *fs, const fs_file_t type,
+		const char *filename, void *ctx)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	struct uid_store *store = (struct uid_store *)ctx;
+
+	if (!strlen(store->dir) && !strcmp(filename, FORMAT_FILENAME)) {
+		return; /* an empty store is in the current format too */
+	} else if (type == FS_FILE_TYPE_DIR) {
+		const size_t len = strlen(store->dir);
+		strncat(store->dir, filename, sizeof(store->dir) - 1);
+		get_filepath(filepath, sizeof(filepath),
+				store->ns, store->dir, NULL);
+		info("recursive delete: %s", filepath);
+		fs_dir(store->fs, filepath, on_clear_dir, store);
+		store->dir[len] = '\0';
+	}
+
+	get_filepath(filepath, sizeof(filepath),
+			store->ns, store->dir, filename);
+	debug("deleting file: %s", filepath);
+
+	if (fs_delete(fs, filepath) < 0) {
+		error("Failed to delete file: %s", filepath);
+	}
 }
 
-static void get_filepath(char *filepath, size_t maxlen,
-		const char *ns, const char *dir, const char *filename)
-{
-	size_t len = 0;
-	int t = snprintf(filepath, maxlen, "%s/%s", STORAGE_ROOT, ns);
+static int visit_file(struct walk *walk, const char *filepath)
+{
+	struct uid_record chunk[UID_READ_CHUNK_RECORDS];
+	struct uid_store *store = walk->store;
+	size_t nr_records;
+	int err;
+
+	if (atomic_load(&store->snapshot_cancel)) {
+		return -ECANCELED;
+	} else if (get_nr_records(store, filepath, &nr_records) < 0) {
+		return -ENOENT;
+	}
+
+	for (size_t i = 0; i < nr_records; i += UID_READ_CHUNK_RECORDS) {
+		const size_t n = MIN(nr_records - i,
+				(size_t)UID_READ_CHUNK_RECORDS);
+		const size_t len = n * sizeof(chunk[0]);
+
+		if (atomic_load(&store->snapshot_cancel)) {
+			return -ECANCELED;
+		} else if (fs_read(store->fs, filepath, i * sizeof(chunk[0]),
+				chunk, len) != (int)len) {
+			return -EIO;
+		}
+
+		for (size_t j = 0; j < n; j++) {
+			if (is_tombstone(&chunk[j])) {
+				continue;
+			} else if ((err = (*walk->visit)(&chunk[j].uid,
+					walk->ctx)) < 0) {
+				return err;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void on_walk_dir(struct fs *fs, const fs_file_t type,
+		const char *filename, void *ctx)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	struct walk *walk = (struct walk *)ctx;
+	struct uid_store *store = walk->store;
+	int err;
+
+	if (walk->err < 0) {
+		return;
+	} else if (type == FS_FILE_TYPE_DIR) {
+		const size_t len = strlen(walk->dir);
+		strncat(walk->dir, filename, sizeof(walk->dir) - len - 1);
+		get_filepath(filepath, sizeof(filepath),
+				store->ns, walk->dir, NULL);
+		if ((err = fs_dir(fs, filepath, on_walk_dir, walk)) < 0) {
+			walk->err = err;
+		}
+		walk->dir[len] = '\0';
+		return;
+	} else if (!strlen(walk->dir)) { /* not a bucket, e.g. version */
+		return;
+	}
+
+	get_filepath(filepath, sizeof(filepath),
+			store->ns, walk->dir, filename);
+
+	if ((err = (*walk->file)(walk, filepath)) < 0) {
+		if (err != -ECANCELED) {
+			error("Failed to walk %s: %d", filepath, err);
+		}
+		walk->err = err;
+	}
+}
+
+/* Calls walk->file on every bucket file in flash. */
+static int walk_buckets(struct walk *walk)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	struct uid_store *store = walk->store;
+
+	get_filepath(filepath, sizeof(filepath), store->ns, NULL, NULL);
+
+	const int err = fs_dir(store->fs, filepath, on_walk_dir, walk);
+
+	if (err < 0 && err != -ENOENT) {
+		return err;
+	}
+
+	return walk->err;
+}
+
+/* Calls visit on every live record in flash, bucket by bucket. */
+static int walk_records(void *source, uid_snapshot_visit_t visit, void *ctx)
+{
+	struct walk walk = {
+		.store = (struct uid_store *)source,
+		.file = visit_file,
+		.visit = visit,
+		.ctx = ctx,
+	};
+
+	return walk_buckets(&walk);
+}
+
+/* Drops tombstones, including the zeroed records of format 1, and sorts
+ * the rest. A bucket already in order is left untouched. */
+static int sort_bucket_file(struct walk *walk, const char *filepath)
+{
+	struct uid_store *store = walk->store;
+	const size_t recsize = sizeof(struct uid_record);
+	struct uid_record *buf;
+	size_t nr_records;
+	size_t nr_live = 0;
+	bool sorted = true;
+	int err = 0;
+
+	if (get_nr_records(store, filepath, &nr_records) < 0) {
+		return -ENOENT;
+	} else if (!nr_records) {
+		return 0;
+	}
+
+	if ((buf = (struct uid_record *)malloc(nr_records * recsize)) == NULL) {
+		return -ENOMEM;
+	}
+
+	if (fs_read(store->fs, filepath, 0, buf, nr_records * recsize)
+			!= (int)(nr_records * recsize)) {
+		err = -EIO;
+		goto out;
+	}
+
+	for (size_t i = 0; i < nr_records; i++) {
+		if (is_tombstone(&buf[i])) {
+			continue;
+		} else if (nr_live &&
+				compare_record(&buf[nr_live - 1], &buf[i]) >= 0) {
+			sorted = false;
+		}
+
+		buf[nr_live++] = buf[i];
+	}
+
+	if (sorted && nr_live == nr_records) {
+		goto out;
+	}
+
+	qsort(buf, nr_live, recsize, compare_record);
+
+	if (nr_live) {
+		const struct fs_iovec iov = {
+			.data = buf,
+			.datasize = nr_live * recsize,
+		};
+		err = fs_replace(store->fs, filepath, &iov, 1);
+	} else {
+		err = fs_delete(store->fs, filepath);
+	}
+
+	if (err >= 0) {
+		err = 0;
+		info("%s sorted: %u/%u record(s) kept", filepath,
+				(unsigned int)nr_live, (unsigned int)nr_records);
+	}
+
+out:
+	free(buf);
+	return err;
+}
+
+static int add_record_to_bloom(const void *record, void *ctx)
+{
+	const struct uid *uid = (const struct uid *)record;
+	struct uid_store *store = (struct uid_store *)ctx;
+
+	bloom_add(&store->bloom, hash_uid(uid->id));
+
+	return 0;
+}
+
+static void rebuild_bloom(struct uid_store *store)
+{
+	if (!store->bloom.bits) {
+		return;
+	}
+
+	bloom_reset(&store->bloom);
+	store->bloom.valid =
+		walk_records(store, add_record_to_bloom, store) >= 0;
+
+	info("bloom filter for %s %s", store->ns,
+			store->bloom.valid? "built" : "disabled");
+}
+
+static void invalidate_snapshot(struct uid_store *store)
+{
+	if (atomic_exchange(&store->snapshot_valid, false) &&
+			uid_snapshot_invalidate(store->snapshot) < 0) {
+		error("Failed to invalidate %s snapshot", store->ns);
+	}
+}
+
+/* Called before a bucket file is rewritten with the same records, and
+ * end_change() once it is. A snapshot build in progress is canceled, as it
+ * reads the files by offset. */
+static void begin_rewrite(struct uid_store *store)
+{
+	atomic_store(&store->snapshot_cancel, true);
+	pthread_mutex_lock(&store->change_lock);
+	atomic_store(&store->snapshot_cancel, false);
+}
+
+/* Called before the records in flash change, and end_change() once they
+ * have. Erasing the snapshot is done only once, on the first change after
+ * a rebuild. */
+static void begin_change(struct uid_store *store)
+{
+	begin_rewrite(store);
+
+	store->generation++;
+	invalidate_snapshot(store);
+}
+
+static void end_change(struct uid_store *store)
+{
+	pthread_mutex_unlock(&store->change_lock);
+}
+
+static uint32_t load_version(struct uid_store *store)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	uint32_t version = 0;
+
+	if (!store->version_loaded) {
+		get_filepath(filepath, sizeof(filepath),
+				store->ns, NULL, VERSION_FILENAME);
+		if (fs_read(store->fs, filepath, 0, &version, sizeof(version))
+				!= sizeof(version)) {
+			version = 0;
+		}
+		store->version = version;
+		store->version_loaded = true;
+	}
+
+	return store->version;
+}
+
+static int save_version(struct uid_store *store, const uint32_t version)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+
+	get_filepath(filepath, sizeof(filepath),
+			store->ns, NULL, VERSION_FILENAME);
+
+	const int err = fs_write(store->fs, filepath, 0,
+			&version, sizeof(version));
+
+	if (err >= 0) {
+		store->version = version;
+		store->version_loaded = true;
+	}
+
+	return err;
+}
+
+/* A snapshot built for another list version, e.g. left over from before
+ * the store was cleared or reformatted, does not match. */
+static uint32_t get_snapshot_tag(struct uid_store *store)
+{
+	const uint32_t version = load_version(store);
+	uint32_t h = 2166136261u;
+
+	for (const char *p = store->ns; *p; p++) {
+		h ^= (uint8_t)*p;
+		h *= 16777619u;
+	}
+	for (size_t i = 0; i < sizeof(version); i++) {
+		h ^= (uint8_t)(version >> (i * 8));
+		h *= 16777619u;
+	}
+
+	return h ^ (uint32_t)sizeof(struct uid);
+}
+
+static int compare_batch_entry(const void *a, const void *b)
+{
+	return compare_id(((const struct uid_batch_entry *)a)->id,
+			((const struct uid_batch_entry *)b)->id);
+}
+
+static bool is_same_bucket(const uid_id_t a, const uid_id_t b)
+{
+	return a[0] == b[0] && a[1] == b[1];
+}
+
+/* A removal becomes a tombstone. */
+static void get_record_from_batch_entry(struct uid_record *record,
+		const struct uid_batch_entry *entry)
+{
+	memset(record, 0, sizeof(*record));
+	memcpy(record->uid.id, entry->id, sizeof(uid_id_t));
+
+	if (entry->status != UID_STATUS_UNKNOWN) {
+		memcpy(record->uid.pid, entry->pid, sizeof(uid_id_t));
+		record->uid.expiry = entry->expiry;
+		record->uid.status = entry->status;
+	}
+}
+
+static void apply_to_cache(struct uid_store *store,
+		const struct uid_record *record)
+{
+	const uint32_t h = hash_uid(record->uid.id);
+	struct cache_entry **set = get_set(store, h);
+	const int way = find_way(store, set, record->uid.id);
+
+	if (is_tombstone(record)) {
+		if (way >= 0) {
+			drop_way(store, set, (uint16_t)way);
+		}
+		return;
+	}
+
+	bloom_add(&store->bloom, h);
+
+	if (way >= 0) {
+		set[way]->record = *record;
+	}
+}
+
+/* Entries must be sorted and belong to the same bucket. The file is loaded
+ * behind the room reserved for the entries and merged forward into the same
+ * buffer, which never overtakes the records yet to be merged. The file
+ * only grows as removals are kept as tombstones, so the result is written
+ * back over it in one go. */
+static int merge_bucket(struct uid_store *store,
+		const struct uid_batch_entry *entries, const size_t n,
+		size_t *nr_updated, size_t *nr_removed)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	const size_t recsize = sizeof(struct uid_record);
+	struct uid_record *buf;
+	size_t nr_old;
+	size_t i = 0, j = 0, o = 0;
+	size_t nr_dead = 0;
+	bool changed = false;
+	int err = 0;
+
+	get_filename(filepath, sizeof(filepath), store->ns, entries[0].id);
+	get_nr_records(store, filepath, &nr_old);
+
+	if ((buf = (struct uid_record *)malloc((nr_old + n) * recsize))
+			== NULL) {
+		return -ENOMEM;
+	}
+
+	if (nr_old && fs_read(store->fs, filepath, 0, &buf[n],
+			nr_old * recsize) != (int)(nr_old * recsize)) {
+		err = -EIO;
+		goto out;
+	}
+
+	while (i < n || j < nr_old) {
+		/* the last one wins among duplicates */
+		while (i + 1 < n && compare_id(entries[i].id,
+				entries[i + 1].id) == 0) {
+			i++;
+		}
+
+		const int cmp = i >= n? -1 : j >= nr_old? 1 :
+			compare_id(buf[n + j].uid.id, entries[i].id);
+
+		if (cmp < 0) {
+			buf[o++] = buf[n + j++];
+			continue;
+		}
+
+		const bool removal = entries[i].status == UID_STATUS_UNKNOWN;
+		const bool existing = cmp == 0 && !is_tombstone(&buf[n + j]);
+
+		if (cmp == 0) {
+			j++;
+		}
+
+		if (removal && !existing) {
+			if (cmp == 0) { /* keep the tombstone as it is */
+				buf[o] = buf[n + j - 1];
+				o++;
+			}
+			i++;
+			continue;
+		}
+
+		get_record_from_batch_entry(&buf[o], &entries[i++]);
+		apply_to_cache(store, &buf[o++]);
+
+		changed = true;
+		if (removal) {
+			nr_dead++;
+			(*nr_removed)++;
+		} else {
+			(*nr_updated)++;
+		}
+	}
 
-	if (t > 0 && dir && strlen(dir)) {
-		len += (size_t)t;
-		t = snprintf(filepath + len, maxlen - len, "/%s", dir);
+	if (changed && (err = fs_write(store->fs, filepath, 0,
+			buf, o * recsize)) > 0) {
+		err = 0;
 	}
 
-	if (t > 0 && filename && strlen(filename)) {
-		len += (size_t)t;
-		t = snprintf(filepath + len, maxlen - len, "/%s", filename);
+	if (nr_dead && err == 0) {
+		note_fragment(store, entries[0].id, nr_dead);
 	}
+
+out:
+	free(buf);
+	return err;
 }
 
-static void get_filename(char *filepath, size_t maxlen,
-		const char *ns, const uid_id_t id)
+static bool is_expired(const struct uid_store *store,
+		const struct uid_record *record, const time_t now)
 {
-	snprintf(filepath, maxlen, "%s/%s/%02X/%02X.bin",
-			STORAGE_ROOT, ns, id[0], id[1]);
+	return store->expire && record->uid.expiry &&
+		record->uid.expiry <= now;
 }
 
-static int read_entry_from_file(struct uid_store *store,
-		const uid_id_t id, struct uid_record *record, size_t *offset)
+static bool is_gc_budget_exhausted(const struct uid_store *store)
+{
+	return board_get_time_since_boot_ms() - store->gc.t0 >=
+		store->gc.budget_ms;
+}
+
+/* Rewrites the bucket without tombstones and, if enabled, expired records.
+ * A bucket left with nothing is deleted. */
+static int compact_bucket(struct uid_store *store, const uint16_t bucket,
+		size_t *live, size_t *dead)
 {
 	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
-	size_t filesize;
+	const size_t recsize = sizeof(struct uid_record);
+	const uid_id_t id = { (uint8_t)(bucket >> 8), (uint8_t)bucket, };
+	const time_t now = time(NULL);
+	struct uid_record *buf;
+	size_t nr_records;
+	size_t nr_live = 0;
+	size_t nr_expired = 0;
+	int err = 0;
 
 	get_filename(filepath, sizeof(filepath), store->ns, id);
 
-	if (fs_size(store->fs, filepath, &filesize) < 0) {
-		return -ENOENT;
+	if (get_nr_records(store, filepath, &nr_records) < 0 || !nr_records) {
+		return 0;
 	}
 
-	for (size_t i = 0; i < filesize / sizeof(*record); i++) {
-		if (fs_read(store->fs, filepath, i * sizeof(*record),
-				record, sizeof(*record)) == sizeof(*record)) {
-			if (memcmp(record->uid.id, id, sizeof(uid_id_t)) == 0) {
-				if (offset) {
-					*offset = i * sizeof(*record);
-				}
-				return 0;
+	if ((buf = (struct uid_record *)malloc(nr_records * recsize)) == NULL) {
+		return -ENOMEM;
+	}
+
+	if (fs_read(store->fs, filepath, 0, buf, nr_records * recsize)
+			!= (int)(nr_records * recsize)) {
+		err = -EIO;
+		goto out;
+	}
+
+	for (size_t i = 0; i < nr_records; i++) {
+		if (is_tombstone(&buf[i])) {
+			continue;
+		} else if (is_expired(store, &buf[i], now)) {
+			struct cache_entry **set =
+				get_set(store, hash_uid(buf[i].uid.id));
+			const int way = find_way(store, set, buf[i].uid.id);
+			if (way >= 0) {
+				drop_way(store, set, (uint16_t)way);
 			}
+			nr_expired++;
+			continue;
 		}
+
+		buf[nr_live++] = buf[i];
 	}
 
-	return -ENOENT;
-}
+	if (live) {
+		*live += nr_live * recsize;
+	}
+	if (dead) {
+		*dead += (nr_records - nr_live) * recsize;
+	}
 
-static int save_entry_into_file(struct uid_store *store,
-		const struct uid_record *record)
-{
-	struct uid_record dummy;
-	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
-	size_t offset;
+	if (nr_live == nr_records) {
+		goto out;
+	} else if (nr_expired) {
+		begin_change(store);
+	} else { /* only tombstones reclaimed, which the snapshot has not */
+		begin_rewrite(store);
+	}
 
-	get_filename(filepath, sizeof(filepath), store->ns, record->uid.id);
+	if (nr_live) {
+		const struct fs_iovec iov = {
+			.data = buf,
+			.datasize = nr_live * recsize,
+		};
+		err = fs_replace(store->fs, filepath, &iov, 1);
+	} else {
+		err = fs_delete(store->fs, filepath);
+	}
 
-	debug("Saving UID to file: %s", filepath);
+	end_change(store);
 
-	if (read_entry_from_file(store, record->uid.id, &dummy, &offset) == 0) {
-		return fs_write(store->fs,
-				filepath, offset, record, sizeof(*record));
+	if (err >= 0) {
+		err = 0;
+		metrics_increase(UIDCompactionCount);
+		debug("%s compacted: %u/%u record(s) reclaimed", filepath,
+				(unsigned int)(nr_records - nr_live),
+				(unsigned int)nr_records);
+		metrics_increase_by(UIDExpiredCount, (int32_t)nr_expired);
 	}
 
-	return fs_append(store->fs, filepath, record, sizeof(*record));
+out:
+	free(buf);
+	return err;
 }
 
-/* FIXME: this will introduce internal fragmentation in flash */
-static int remove_entry_from_file(struct uid_store *store, const uid_id_t id)
+static void compact_fragments(struct uid_store *store)
 {
-	struct uid_record dummy;
-	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
-	size_t offset;
+	while (!is_gc_budget_exhausted(store)) {
+		struct fragment *most = NULL;
 
-	get_filename(filepath, sizeof(filepath), store->ns, id);
+		for (size_t i = 0; i < UID_GC_CANDIDATES; i++) {
+			struct fragment *p = &store->gc.candidates[i];
+			if (p->dead && (!most || p->dead > most->dead)) {
+				most = p;
+			}
+		}
 
-	if (read_entry_from_file(store, id, &dummy, &offset) == 0) {
-		memset(&dummy, 0, sizeof(dummy));
-		return fs_write(store->fs,
-				filepath, offset, &dummy, sizeof(dummy));
+		if (!most) {
+			break;
+		}
+
+		most->dead = 0;
+
+		if (compact_bucket(store, most->bucket, NULL, NULL) < 0) {
+			error("Failed to compact bucket %04X", most->bucket);
+		}
 	}
+}
 
-	return -ENOENT;
+static int parse_hex_byte(const char *str)
+{
+	char *end;
+	const unsigned long v = strtoul(str, &end, 16);
+
+	return (end - str == 2 && v <= 0xff)? (int)v : -EINVAL;
 }
 
-static void on_clear_dir(struct fs *fs, const fs_file_t type,
+static void on_sweep_dir(struct fs *fs, const fs_file_t type,
 		const char *filename, void *ctx)
 {
 	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
 	struct uid_store *store = (struct uid_store *)ctx;
+	struct gc *gc = &store->gc;
 
 	if (type == FS_FILE_TYPE_DIR) {
+		const int hi = parse_hex_byte(filename);
+
+		if (hi < 0 || (uint32_t)hi < (gc->cursor >> 8) || gc->stopped) {
+			return;
+		}
+
 		const size_t len = strlen(store->dir);
-		strncat(store->dir, filename, sizeof(store->dir) - 1);
+		strncat(store->dir, filename, sizeof(store->dir) - len - 1);
 		get_filepath(filepath, sizeof(filepath),
 				store->ns, store->dir, NULL);
-		info("recursive delete: %s", filepath);
-		fs_dir(store->fs, filepath, on_clear_dir, store);
+		fs_dir(fs, filepath, on_sweep_dir, store);
 		store->dir[len] = '\0';
+		return;
 	}
 
-	get_filepath(filepath, sizeof(filepath),
-			store->ns, store->dir, filename);
-	debug("deleting file: %s", filepath);
+	const int hi = parse_hex_byte(store->dir);
+	const int lo = parse_hex_byte(filename);
 
-	if (fs_delete(fs, filepath) < 0) {
-		error("Failed to delete file: %s", filepath);
+	if (hi < 0 || lo < 0) { /* not a bucket, e.g. version */
+		return;
+	}
+
+	const uint32_t bucket = (uint32_t)(hi << 8 | lo);
+
+	if (bucket < gc->cursor || gc->stopped) {
+		return;
+	} else if (is_gc_budget_exhausted(store)) {
+		gc->stopped = true;
+		return;
+	}
+
+	if (compact_bucket(store, (uint16_t)bucket, &gc->live, &gc->dead) < 0) {
+		error("Failed to compact bucket %04X", bucket);
+	}
+
+	gc->cursor = bucket + 1;
+}
+
+static void sweep(struct uid_store *store)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	struct gc *gc = &store->gc;
+
+	gc->stopped = false;
+	get_filepath(filepath, sizeof(filepath), store->ns, NULL, NULL);
+	memset(store->dir, 0, sizeof(store->dir));
+
+	const int err = fs_dir(store->fs, filepath, on_sweep_dir, store);
+
+	if (gc->stopped || (err < 0 && err != -ENOENT)) {
+		return;
 	}
+
+	gc->last_live = gc->live;
+	gc->last_dead = gc->dead;
+	gc->live = gc->dead = 0;
+	gc->cursor = 0;
+	gc->swept = true;
 }
 
 uid_status_t uid_status(struct uid_store *store,
@@ -229,49 +1291,63 @@ uid_status_t uid_status(struct uid_store *store,
 	}
 
 	const uint32_t t0 = board_get_time_since_boot_ms();
-	const uint32_t h = hash_uid(id, store->capacity);
-	struct cache_entry *entry = store->cache[h];
+	const uint32_t h = hash_uid(id);
+	struct cache_entry **set = get_set(store, h);
+	const int way = find_way(store, set, id);
+	struct uid_record record;
 
-	if (entry && memcmp(entry->record.uid.id, id, sizeof(uid_id_t)) == 0) {
-		if (expiry) {
-			*expiry = entry->record.uid.expiry;
-		}
-		if (pid) {
-			memcpy(pid, entry->record.uid.pid, sizeof(uid_id_t));
-		}
-		return entry->record.uid.status;
+	if (way >= 0) {
+		metrics_increase(UIDCacheHitCount);
+		record = promote_way(set, (uint16_t)way)->record;
+		goto out;
 	}
 
-	if (!entry) {
-		if (!(entry = new_entry())) {
+	metrics_increase(UIDCacheMissCount);
+
+	/* The snapshot holds every record, so a miss there is final. */
+	if (atomic_load(&store->snapshot_valid)) {
+		if (uid_snapshot_find(store->snapshot, id,
+				&record.uid, sizeof(record.uid)) < 0) {
 			return UID_STATUS_NO_ENTRY;
 		}
+		goto out;
 	}
 
-	if (read_entry_from_file(store, id, &entry->record, NULL) == 0) {
-		const uint32_t elapsed = board_get_time_since_boot_ms() - t0;
-		metrics_set_if_max(UIDStatusTimeMax, METRICS_VALUE(elapsed));
-		metrics_set_if_min(UIDStatusTimeMin, METRICS_VALUE(elapsed));
+	if (!bloom_may_contain(&store->bloom, h)) {
+		return UID_STATUS_NO_ENTRY;
+	}
 
-		char buf[sizeof(uid_id_t)*2+1];
-		hexdump(buf, sizeof(buf), id, sizeof(uid_id_t));
-		info("cache miss: %s", buf);
+	if (read_entry_from_file(store, id, &record, NULL) < 0 ||
+			is_tombstone(&record)) {
+		if (store->bloom.valid) {
+			metrics_increase(UIDBloomFalsePositiveCount);
+		}
+		return UID_STATUS_NO_ENTRY;
+	}
 
-		store->cache[h] = entry;
+	const uint32_t elapsed = board_get_time_since_boot_ms() - t0;
+	metrics_set_if_max(UIDStatusTimeMax, METRICS_VALUE(elapsed));
+	metrics_set_if_min(UIDStatusTimeMin, METRICS_VALUE(elapsed));
 
-		if (expiry) {
-			*expiry = entry->record.uid.expiry;
-		}
-		if (pid) {
-			memcpy(pid, entry->record.uid.pid, sizeof(uid_id_t));
-		}
+	char buf[sizeof(uid_id_t)*2+1];
+	hexdump(buf, sizeof(buf), id, sizeof(uid_id_t));
+	info("cache miss: %s", buf);
 
-		return entry->record.uid.status;
+	struct cache_entry *entry = claim_way(store, set);
+
+	if (entry) {
+		entry->record = record;
 	}
 
-	free_entry(entry);
+out:
+	if (expiry) {
+		*expiry = record.uid.expiry;
+	}
+	if (pid) {
+		memcpy(pid, record.uid.pid, sizeof(uid_id_t));
+	}
 
-	return UID_STATUS_NO_ENTRY;
+	return record.uid.status;
 }
 
 int uid_update(struct uid_store *store, const uid_id_t id,
@@ -282,14 +1358,14 @@ int uid_update(struct uid_store *store, const uid_id_t id,
 	}
 
 	const uint32_t t0 = board_get_time_since_boot_ms();
-	const uint32_t h = hash_uid(id, store->capacity);
-	struct cache_entry *entry = store->cache[h];
+	const uint32_t h = hash_uid(id);
+	struct cache_entry **set = get_set(store, h);
+	const int way = find_way(store, set, id);
+	struct cache_entry *entry = way >= 0?
+		promote_way(set, (uint16_t)way) : claim_way(store, set);
 
 	if (!entry) {
-		if ((entry = new_entry()) == NULL) {
-			return -ENOMEM;
-		}
-		store->cache[h] = entry;
+		return -ENOMEM;
 	}
 
 	memcpy(entry->record.uid.id, id, sizeof(uid_id_t));
@@ -299,11 +1375,17 @@ int uid_update(struct uid_store *store, const uid_id_t id,
 	entry->record.uid.status = status;
 	entry->record.uid.expiry = expiry;
 
-	if (save_entry_into_file(store, &entry->record) < 0) {
+	begin_change(store);
+	const int err = save_entry_into_file(store, &entry->record);
+	end_change(store);
+
+	if (err < 0) {
 		error("Failed to save UID to flash.");
 		return -EIO;
 	}
 
+	bloom_add(&store->bloom, h);
+
 	const uint32_t elapsed = board_get_time_since_boot_ms() - t0;
 	metrics_set_if_max(UIDUpdateTimeMax, METRICS_VALUE(elapsed));
 	metrics_set_if_min(UIDUpdateTimeMin, METRICS_VALUE(elapsed));
@@ -325,15 +1407,16 @@ int uid_delete(struct uid_store *store, const uid_id_t id)
 		return -EINVAL;
 	}
 
-	const uint32_t h = hash_uid(id, store->capacity);
-	struct cache_entry *entry = store->cache[h];
+	struct cache_entry **set = get_set(store, hash_uid(id));
+	const int way = find_way(store, set, id);
 
-	if (entry && memcmp(entry->record.uid.id, id, sizeof(uid_id_t)) == 0) {
-		free_entry(entry);
-		store->cache[h] = NULL;
+	if (way >= 0) {
+		drop_way(store, set, (uint16_t)way);
 	}
 
-	int err = remove_entry_from_file(store, id);
+	begin_change(store);
+	const int err = remove_entry_from_file(store, id);
+	end_change(store);
 
 	if (err >= 0) {
 		char buf[sizeof(uid_id_t)*2+1];
@@ -344,20 +1427,11 @@ int uid_delete(struct uid_store *store, const uid_id_t id)
 	return err >= 0? 0 : err;
 }
 
-int uid_clear(struct uid_store *store)
+static int clear_store(struct uid_store *store)
 {
-	if (!store) {
-		return -EINVAL;
-	}
-
 	const uint32_t t0 = board_get_time_since_boot_ms();
 
-	for (uint16_t i = 0; i < store->capacity; i++) {
-		if (store->cache[i]) {
-			free_entry(store->cache[i]);
-			store->cache[i] = NULL;
-		}
-	}
+	drop_cache(store);
 
 	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
 	get_filepath(filepath, sizeof(filepath), store->ns, NULL, NULL);
@@ -366,6 +1440,12 @@ int uid_clear(struct uid_store *store)
 	info("Clearing UID store: %s", filepath);
 	int err = fs_dir(store->fs, filepath, on_clear_dir, store);
 
+	bloom_reset(&store->bloom);
+	store->bloom.valid = err >= 0 || err == -ENOENT;
+	store->version = 0;
+	store->version_loaded = store->bloom.valid;
+	memset(&store->gc, 0, sizeof(store->gc));
+
 	const uint32_t elapsed = board_get_time_since_boot_ms() - t0;
 	metrics_set_if_max(UIDClearTimeMax, METRICS_VALUE(elapsed));
 	metrics_set_if_min(UIDClearTimeMin, METRICS_VALUE(elapsed));
@@ -373,6 +1453,183 @@ int uid_clear(struct uid_store *store)
 	return err;
 }
 
+int uid_clear(struct uid_store *store)
+{
+	if (!store) {
+		return -EINVAL;
+	}
+
+	begin_change(store);
+	const int err = clear_store(store);
+	end_change(store);
+
+	return err;
+}
+
+int uid_update_batch(struct uid_store *store,
+		struct uid_batch_entry *entries, const size_t n,
+		const uid_batch_mode_t mode, const uint32_t version)
+{
+	if (!store || (n && !entries)) {
+		return -EINVAL;
+	}
+
+	if (mode == UID_BATCH_DIFFERENTIAL && version <= load_version(store)) {
+		return -ESTALE;
+	}
+
+	const uint32_t t0 = board_get_time_since_boot_ms();
+	size_t nr_updated = 0;
+	size_t nr_removed = 0;
+	size_t nr_buckets = 0;
+	int err = 0;
+
+	begin_change(store);
+
+	if (mode == UID_BATCH_FULL && (err = clear_store(store)) < 0 &&
+			err != -ENOENT) {
+		end_change(store);
+		return err;
+	}
+
+	if (n) {
+		qsort(entries, n, sizeof(*entries), compare_batch_entry);
+	}
+
+	for (size_t i = 0, j; i < n; i = j) {
+		for (j = i + 1; j < n; j++) {
+			if (!is_same_bucket(entries[i].id, entries[j].id)) {
+				break;
+			}
+		}
+
+		if ((err = merge_bucket(store, &entries[i], j - i,
+				&nr_updated, &nr_removed)) < 0) {
+			error("Failed to merge UID bucket: %d", err);
+			break;
+		}
+
+		nr_buckets++;
+	}
+
+	if (err >= 0 && (err = save_version(store, version)) > 0) {
+		err = 0;
+	}
+
+	end_change(store);
+
+	const uint32_t elapsed = board_get_time_since_boot_ms() - t0;
+	metrics_set_if_max(UIDBatchTimeMax, METRICS_VALUE(elapsed));
+
+	info("%u UID(s) updated and %u removed over %u file(s), version %u",
+			(unsigned int)nr_updated, (unsigned int)nr_removed,
+			(unsigned int)nr_buckets, (unsigned int)version);
+
+	if (store->batch_cb) {
+		(*store->batch_cb)(nr_updated, nr_removed,
+				version, store->batch_cb_ctx);
+	}
+
+	return err;
+}
+
+uint32_t uid_version(struct uid_store *store)
+{
+	return store? load_version(store) : 0;
+}
+
+int uid_register_batch_cb(struct uid_store *store,
+		uid_batch_cb_t cb, void *ctx)
+{
+	store->batch_cb = cb;
+	store->batch_cb_ctx = ctx;
+	return 0;
+}
+
+int uid_compact(struct uid_store *store, const uint32_t budget_ms)
+{
+	if (!store) {
+		return -EINVAL;
+	}
+
+	store->gc.t0 = board_get_time_since_boot_ms();
+	store->gc.budget_ms = budget_ms;
+
+	compact_fragments(store);
+
+	if (!is_gc_budget_exhausted(store)) {
+		sweep(store);
+	}
+
+	return 0;
+}
+
+int uid_usage(struct uid_store *store, size_t *live, size_t *dead)
+{
+	if (!store) {
+		return -EINVAL;
+	} else if (!store->gc.swept) {
+		return -ENODATA;
+	}
+
+	if (live) {
+		*live = store->gc.last_live;
+	}
+	if (dead) {
+		*dead = store->gc.last_dead;
+	}
+
+	return 0;
+}
+
+/* A change waits for the build to give up, so it is polled often enough
+ * that neither the erase nor the write of the partition holds it up. */
+static bool is_build_canceled(void *source)
+{
+	struct uid_store *store = (struct uid_store *)source;
+	return atomic_load(&store->snapshot_cancel);
+}
+
+int uid_refresh_snapshot(struct uid_store *store)
+{
+	if (!store) {
+		return -EINVAL;
+	} else if (!store->snapshot) {
+		return -ENOTSUP;
+	}
+
+	pthread_mutex_lock(&store->change_lock);
+
+	int err = 0;
+
+	if (atomic_load(&store->snapshot_valid)) {
+		goto out;
+	} else if (store->build_err && store->failed_generation ==
+			store->generation) { /* no use retrying until changed */
+		err = store->build_err;
+		goto out;
+	}
+
+	err = uid_snapshot_build(store->snapshot,
+			get_snapshot_tag(store), sizeof(struct uid),
+			walk_records, is_build_canceled, store);
+
+	if (err == -ECANCELED) {
+		info("%s snapshot build canceled by a change", store->ns);
+	} else if (err < 0) {
+		error("Failed to build %s snapshot: %d", store->ns, err);
+		store->build_err = err;
+		store->failed_generation = store->generation;
+	} else {
+		store->build_err = 0;
+		atomic_store(&store->snapshot_valid, true);
+	}
+
+out:
+	pthread_mutex_unlock(&store->change_lock);
+	return err;
+}
+
 int uid_register_update_cb(struct uid_store *store,
 		uid_update_cb_t cb, void *ctx)
 {
@@ -399,24 +1656,120 @@ const char *uid_stringify_status(uid_status_t status)
 	}
 }
 
+/* Brings bucket files written in an older format up to UID_FORMAT. A store
+ * that cannot be converted, or is stamped with a format newer than this
+ * one, is cleared. Returns 1 if the store was not already in UID_FORMAT. */
+static int convert_format(struct uid_store *store)
+{
+	char filepath[FILEPATH_MAXLEN + FILENAME_MAXLEN];
+	const uint32_t current = UID_FORMAT;
+	uint32_t format = 0;
+	int err = 0;
+
+	get_filepath(filepath, sizeof(filepath),
+			store->ns, NULL, FORMAT_FILENAME);
+
+	if (fs_read(store->fs, filepath, 0, &format, sizeof(format))
+			!= sizeof(format)) {
+		format = 0;
+	}
+
+	if (format == current) {
+		return 0;
+	} else if (format < current) {
+		struct walk walk = {
+			.store = store,
+			.file = sort_bucket_file,
+		};
+		err = walk_buckets(&walk);
+	}
+
+	if (format > current || err < 0) {
+		error("Clearing %s in format %u: %d",
+				store->ns, (unsigned int)format, err);
+		if ((err = clear_store(store)) == -ENOENT) {
+			err = 0;
+		}
+	}
+
+	if (err < 0 || (err = fs_write(store->fs, filepath, 0,
+			&current, sizeof(current))) < 0) {
+		error("Failed to convert %s to format %u: %d",
+				store->ns, (unsigned int)current, err);
+		return err;
+	}
+
+	info("%s converted from format %u to %u", store->ns,
+			(unsigned int)format, (unsigned int)current);
+
+	return 1;
+}
+
 struct uid_store *uid_store_create(const struct uid_store_config *config)
 {
-	if (!config || !config->fs || !config->ns) {
+	if (!config || !config->fs || !config->ns || !config->capacity) {
 		return NULL;
 	}
 
 	struct uid_store *store = (struct uid_store *)calloc(1, sizeof(*store));
 
-	if (store) {
-		store->fs = config->fs;
-		store->ns = config->ns;
-		store->capacity = config->capacity;
+	if (!store) {
+		return NULL;
+	}
+
+	store->fs = config->fs;
+	store->ns = config->ns;
+	store->expire = config->expire;
+
+	const size_t entry_cost = sizeof(struct cache_entry *) +
+		(config->ram_budget? sizeof(union slab_entry) : 0);
+	const size_t capacity = config->ram_budget?
+		MIN(config->capacity, config->ram_budget / entry_cost) :
+		config->capacity;
+
+	store->ways = (uint16_t)MIN(capacity, (size_t)UID_CACHE_WAYS);
+	store->nr_sets = store->ways? (uint16_t)(capacity / store->ways) : 0;
+	store->capacity = (uint16_t)(store->nr_sets * store->ways);
+
+	if (store->capacity) {
 		store->cache = (struct cache_entry **)calloc(1,
-			config->capacity * sizeof(struct cache_entry *));
-		if (!store->cache) {
-			error("Failed to allocate memory for UID cache.");
-			free(store);
-			store = NULL;
+				store->capacity * entry_cost);
+	}
+
+	if (store->cache && config->ram_budget) {
+		init_slab(store);
+		info("%s cache: %u entries preallocated in %u bytes",
+				store->ns, (unsigned int)store->capacity,
+				(unsigned int)(store->capacity * entry_cost));
+	}
+
+	if (config->bloom_size) {
+		store->bloom.nbits = config->bloom_size * 8;
+		store->bloom.bits = (uint8_t *)calloc(1, config->bloom_size);
+	}
+
+	if (!store->cache || (config->bloom_size && !store->bloom.bits)) {
+		error("Failed to allocate memory for UID cache.");
+		free(store->bloom.bits);
+		free(store->cache);
+		free(store);
+		return NULL;
+	}
+
+	pthread_mutex_init(&store->change_lock, NULL);
+
+	const int converted = convert_format(store);
+	rebuild_bloom(store);
+
+	/* A store that had to be converted may not be what the snapshot was
+	 * built from. */
+	if ((store->snapshot = config->snapshot) != NULL &&
+			uid_snapshot_is_valid(store->snapshot,
+					get_snapshot_tag(store))) {
+		if (converted) {
+			uid_snapshot_invalidate(store->snapshot);
+		} else {
+			atomic_store(&store->snapshot_valid, true);
 		}
 	}
 
@@ -426,11 +1779,9 @@ struct uid_store *uid_store_create(const struct uid_store_config *config)
 void uid_store_destroy(struct uid_store *store)
 {
 	if (store) {
-		for (uint16_t i = 0; i < store->capacity; i++) {
-			if (store->cache[i]) {
-				free_entry(store->cache[i]);
-			}
-		}
+		drop_cache(store);
+		pthread_mutex_destroy(&store->change_lock);
+		free(store->bloom.bits);
 		free(store->cache);
 		free(store);
 	}
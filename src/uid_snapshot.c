@@ -0,0 +1,583 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "uid_snapshot.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "libmcu/compiler.h"
+#include "libmcu/board.h"
+#include "flash_mmap.h"
+#include "logger.h"
+
+#define SNAPSHOT_MAGIC			0x50534455u /* "UDSP" */
+
+/* Erase unit of the partition. Invalidating erases the first one only. */
+#if !defined(UID_SNAPSHOT_SECTOR_SIZE)
+#define UID_SNAPSHOT_SECTOR_SIZE	4096
+#endif
+/* Average number of records per hash bucket. Higher saves flash for the
+ * displacement table but takes longer to build. */
+#if !defined(UID_SNAPSHOT_BUCKET_LOAD)
+#define UID_SNAPSHOT_BUCKET_LOAD	2
+#endif
+/* Displacements tried per bucket before giving up on a seed */
+#if !defined(UID_SNAPSHOT_MAX_DISPLACEMENTS)
+#define UID_SNAPSHOT_MAX_DISPLACEMENTS	65536
+#endif
+#if !defined(UID_SNAPSHOT_MAX_SEEDS)
+#define UID_SNAPSHOT_MAX_SEEDS		8
+#endif
+
+/* The partition starts with the header, followed by the displacement of
+ * each bucket and then the records in slot order:
+ *
+ *   | header | int32_t g[nr_buckets] | record[nr_records] |
+ *
+ * A record hashes to a bucket, and the displacement of the bucket tells
+ * the slot: a negative one is the slot itself, -(slot + 1), as buckets of
+ * a single record are placed directly. The header is written last, so an
+ * erased or half-written partition has no valid magic. */
+struct header {
+	uint32_t magic;
+	uint32_t tag;
+	uint32_t nr_records;
+	uint32_t nr_buckets;
+	uint32_t rec_size;
+	uint32_t seed;
+	uint32_t reserved[2];
+};
+
+struct uid_snapshot {
+	struct flash *flash;
+	const uint8_t *map;
+	size_t size;
+};
+
+struct key {
+	uint32_t h1; /* picks the bucket */
+	uint32_t h2; /* picks the slot */
+	uint32_t bucket;
+};
+
+struct group {
+	uint32_t start; /* index of the first key of the bucket */
+	uint32_t size;
+};
+
+struct builder {
+	struct uid_snapshot *snap;
+	uid_snapshot_cancel_t canceled;
+	void *source;
+	uint32_t seed;
+	uint32_t nr_buckets;
+	uint32_t nr_records;
+	size_t rec_size;
+
+	struct key *keys;
+	uint32_t nr_keys;
+	int32_t *g;
+	uint8_t *taken;
+	int err;
+};
+
+static uint32_t mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
+
+static uint32_t hash_id(const uid_id_t id, const uint32_t basis)
+{
+	uint32_t h = basis;
+
+	for (size_t i = 0; i < sizeof(uid_id_t); i++) {
+		h ^= id[i];
+		h *= 16777619u;
+	}
+
+	return mix(h);
+}
+
+static void get_key(struct key *key, const uid_id_t id)
+{
+	key->h1 = hash_id(id, 2166136261u);
+	key->h2 = hash_id(id, 0x811c9dc5u ^ 0x5bd1e995u);
+}
+
+static uint32_t get_bucket(const struct key *key,
+		const uint32_t seed, const uint32_t nr_buckets)
+{
+	return mix(key->h1 ^ seed) % nr_buckets;
+}
+
+static uint32_t get_slot(const struct key *key, const int32_t d,
+		const uint32_t seed, const uint32_t nr_records)
+{
+	if (d < 0) {
+		return (uint32_t)-(d + 1);
+	}
+
+	return mix(key->h2 ^ (seed + (uint32_t)d * 0x9e3779b9u)) % nr_records;
+}
+
+static uint32_t get_nr_buckets(const uint32_t nr_records)
+{
+	return nr_records / UID_SNAPSHOT_BUCKET_LOAD + 1;
+}
+
+static size_t get_records_offset(const uint32_t nr_buckets)
+{
+	return sizeof(struct header) + nr_buckets * sizeof(int32_t);
+}
+
+static size_t align_up(const size_t size)
+{
+	return (size + UID_SNAPSHOT_SECTOR_SIZE - 1) /
+		UID_SNAPSHOT_SECTOR_SIZE * UID_SNAPSHOT_SECTOR_SIZE;
+}
+
+static bool is_taken(const uint8_t *taken, const uint32_t slot)
+{
+	return (taken[slot / 8] & (1u << (slot % 8))) != 0;
+}
+
+static void set_taken(uint8_t *taken, const uint32_t slot, const bool on)
+{
+	if (on) {
+		taken[slot / 8] = (uint8_t)(taken[slot / 8] | (1u << (slot % 8)));
+	} else {
+		taken[slot / 8] = (uint8_t)(taken[slot / 8] & ~(1u << (slot % 8)));
+	}
+}
+
+static bool read_header(const struct uid_snapshot *snap, struct header *hdr)
+{
+	memcpy(hdr, snap->map, sizeof(*hdr));
+
+	return hdr->magic == SNAPSHOT_MAGIC && hdr->rec_size &&
+		hdr->nr_buckets == get_nr_buckets(hdr->nr_records) &&
+		get_records_offset(hdr->nr_buckets) +
+			(size_t)hdr->nr_records * hdr->rec_size <= snap->size;
+}
+
+static bool is_canceled(const struct builder *builder)
+{
+	return builder->canceled && (*builder->canceled)(builder->source);
+}
+
+/* Erases sector by sector, so that a cancel is not held up by the whole
+ * partition erase. */
+static int erase(struct builder *builder, size_t offset, size_t size)
+{
+	for (size_t i = 0; i < size; i += UID_SNAPSHOT_SECTOR_SIZE) {
+		int err;
+
+		if (is_canceled(builder)) {
+			return -ECANCELED;
+		} else if ((err = flash_erase(builder->snap->flash, offset + i,
+				UID_SNAPSHOT_SECTOR_SIZE)) < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int write_table(struct builder *builder)
+{
+	const uint8_t *p = (const uint8_t *)builder->g;
+	const size_t size = builder->nr_buckets * sizeof(*builder->g);
+
+	for (size_t i = 0; i < size; i += UID_SNAPSHOT_SECTOR_SIZE) {
+		const size_t len = MIN(size - i, (size_t)UID_SNAPSHOT_SECTOR_SIZE);
+		int err;
+
+		if (is_canceled(builder)) {
+			return -ECANCELED;
+		} else if ((err = flash_write(builder->snap->flash,
+				sizeof(struct header) + i, &p[i], len)) < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int count_record(const void *record, void *ctx)
+{
+	unused(record);
+	struct builder *builder = (struct builder *)ctx;
+	builder->nr_records++;
+	return 0;
+}
+
+static int add_key(const void *record, void *ctx)
+{
+	struct builder *builder = (struct builder *)ctx;
+
+	if (builder->nr_keys >= builder->nr_records) {
+		return -EAGAIN;
+	}
+
+	get_key(&builder->keys[builder->nr_keys++],
+			(const uint8_t *)record);
+
+	return 0;
+}
+
+static int compare_key(const void *a, const void *b)
+{
+	const struct key *x = (const struct key *)a;
+	const struct key *y = (const struct key *)b;
+	return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+}
+
+static int compare_group(const void *a, const void *b)
+{
+	const struct group *x = (const struct group *)a;
+	const struct group *y = (const struct group *)b;
+
+	if (x->size != y->size) {
+		return (x->size < y->size) - (x->size > y->size);
+	}
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static bool place_group(struct builder *builder, const struct group *group)
+{
+	const struct key *keys = &builder->keys[group->start];
+	const uint32_t bucket = keys[0].bucket;
+
+	for (int32_t d = 0; d < UID_SNAPSHOT_MAX_DISPLACEMENTS; d++) {
+		uint32_t i;
+
+		for (i = 0; i < group->size; i++) {
+			const uint32_t slot = get_slot(&keys[i], d,
+					builder->seed, builder->nr_records);
+			if (is_taken(builder->taken, slot)) {
+				break;
+			}
+			set_taken(builder->taken, slot, true);
+		}
+
+		if (i == group->size) {
+			builder->g[bucket] = d;
+			return true;
+		}
+
+		while (i--) {
+			set_taken(builder->taken, get_slot(&keys[i], d,
+					builder->seed, builder->nr_records),
+					false);
+		}
+	}
+
+	return false;
+}
+
+/* Hash and displace: the buckets of more records go first while the table
+ * is still sparse, and single ones just fill the holes left over. */
+static bool place_keys(struct builder *builder, struct group *groups)
+{
+	const uint32_t n = builder->nr_records;
+	uint32_t nr_groups = 0;
+
+	for (uint32_t i = 0; i < n; i++) {
+		builder->keys[i].bucket = get_bucket(&builder->keys[i],
+				builder->seed, builder->nr_buckets);
+	}
+
+	qsort(builder->keys, n, sizeof(*builder->keys), compare_key);
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (!i || builder->keys[i].bucket != builder->keys[i-1].bucket) {
+			groups[nr_groups++] = (struct group) { .start = i, };
+		}
+		groups[nr_groups - 1].size++;
+	}
+
+	qsort(groups, nr_groups, sizeof(*groups), compare_group);
+
+	memset(builder->g, 0, builder->nr_buckets * sizeof(*builder->g));
+	memset(builder->taken, 0, (n + 7) / 8);
+
+	uint32_t free_slot = 0;
+
+	for (uint32_t i = 0; i < nr_groups; i++) {
+		if (groups[i].size > 1) {
+			if (!place_group(builder, &groups[i])) {
+				return false;
+			}
+			continue;
+		}
+
+		while (is_taken(builder->taken, free_slot)) {
+			free_slot++;
+		}
+
+		set_taken(builder->taken, free_slot, true);
+		builder->g[builder->keys[groups[i].start].bucket] =
+			-(int32_t)free_slot - 1;
+	}
+
+	return true;
+}
+
+static int write_record(const void *record, void *ctx)
+{
+	struct builder *builder = (struct builder *)ctx;
+	struct key key;
+
+	get_key(&key, (const uint8_t *)record);
+
+	const uint32_t bucket = get_bucket(&key,
+			builder->seed, builder->nr_buckets);
+	const uint32_t slot = get_slot(&key, builder->g[bucket],
+			builder->seed, builder->nr_records);
+	const size_t offset = get_records_offset(builder->nr_buckets) +
+		slot * builder->rec_size;
+
+	if (builder->nr_keys++ >= builder->nr_records) {
+		return -EAGAIN;
+	} else if (is_canceled(builder)) {
+		return -ECANCELED;
+	}
+
+	return flash_write(builder->snap->flash, offset,
+			record, builder->rec_size);
+}
+
+static int build(struct builder *builder, uid_snapshot_iter_t iter,
+		void *source)
+{
+	const uint32_t n = builder->nr_records;
+	struct group *groups = NULL;
+	int err;
+
+	builder->keys = (struct key *)malloc(n * sizeof(*builder->keys));
+	builder->g = (int32_t *)malloc(builder->nr_buckets *
+			sizeof(*builder->g));
+	builder->taken = (uint8_t *)malloc((n + 7) / 8);
+	groups = (struct group *)malloc(n * sizeof(*groups));
+
+	if (!builder->keys || !builder->g || !builder->taken || !groups) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if ((err = (*iter)(source, add_key, builder)) < 0) {
+		goto out;
+	} else if (builder->nr_keys != n) {
+		err = -EAGAIN;
+		goto out;
+	}
+
+	for (builder->seed = 0; builder->seed < UID_SNAPSHOT_MAX_SEEDS;
+			builder->seed++) {
+		if (is_canceled(builder)) {
+			err = -ECANCELED;
+			goto out;
+		} else if (place_keys(builder, groups)) {
+			break;
+		}
+	}
+
+	if (builder->seed >= UID_SNAPSHOT_MAX_SEEDS) {
+		err = -EDEADLK;
+		goto out;
+	}
+
+	if ((err = write_table(builder)) < 0) {
+		goto out;
+	}
+
+	builder->nr_keys = 0;
+	if ((err = (*iter)(source, write_record, builder)) >= 0 &&
+			builder->nr_keys != n) {
+		err = -EAGAIN;
+	}
+
+out:
+	free(groups);
+	free(builder->taken);
+	free(builder->g);
+	free(builder->keys);
+	return err;
+}
+
+int uid_snapshot_build(struct uid_snapshot *snap, uint32_t tag,
+		size_t rec_size, uid_snapshot_iter_t iter,
+		uid_snapshot_cancel_t canceled, void *source)
+{
+	if (!snap || !iter || rec_size < sizeof(uid_id_t)) {
+		return -EINVAL;
+	}
+
+	const uint32_t t0 = board_get_time_since_boot_ms();
+	struct builder builder = {
+		.snap = snap,
+		.canceled = canceled,
+		.source = source,
+		.rec_size = rec_size,
+	};
+	int err;
+
+	if ((err = uid_snapshot_invalidate(snap)) < 0 ||
+			(err = (*iter)(source, count_record, &builder)) < 0) {
+		return err;
+	}
+
+	builder.nr_buckets = get_nr_buckets(builder.nr_records);
+
+	const size_t size = get_records_offset(builder.nr_buckets) +
+		builder.nr_records * rec_size;
+
+	if (size > snap->size) {
+		return -ENOSPC;
+	}
+
+	/* The first sector is already erased by the invalidation. */
+	if (size > UID_SNAPSHOT_SECTOR_SIZE && (err = erase(&builder,
+			UID_SNAPSHOT_SECTOR_SIZE, align_up(size)
+			- UID_SNAPSHOT_SECTOR_SIZE)) < 0) {
+		return err;
+	}
+
+	if (builder.nr_records && (err = build(&builder, iter, source)) < 0) {
+		return err;
+	}
+
+	const struct header hdr = {
+		.magic = SNAPSHOT_MAGIC,
+		.tag = tag,
+		.nr_records = builder.nr_records,
+		.nr_buckets = builder.nr_buckets,
+		.rec_size = (uint32_t)rec_size,
+		.seed = builder.seed,
+	};
+
+	if ((err = flash_write(snap->flash, 0, &hdr, sizeof(hdr))) < 0) {
+		return err;
+	}
+
+	info("UID snapshot of %u record(s), %u bytes, built in %u ms",
+			(unsigned int)builder.nr_records, (unsigned int)size,
+			(unsigned int)(board_get_time_since_boot_ms() - t0));
+
+	return 0;
+}
+
+int uid_snapshot_invalidate(struct uid_snapshot *snap)
+{
+	if (!snap) {
+		return -EINVAL;
+	}
+
+	return flash_erase(snap->flash, 0, UID_SNAPSHOT_SECTOR_SIZE);
+}
+
+bool uid_snapshot_is_valid(const struct uid_snapshot *snap, uint32_t tag)
+{
+	struct header hdr;
+	return snap && read_header(snap, &hdr) && hdr.tag == tag;
+}
+
+int uid_snapshot_find(const struct uid_snapshot *snap,
+		const uid_id_t id, void *record, size_t rec_size)
+{
+	struct header hdr;
+	struct key key;
+	int32_t d;
+
+	if (!snap || !read_header(snap, &hdr) || hdr.rec_size != rec_size) {
+		return -ENODATA;
+	} else if (!hdr.nr_records) {
+		return -ENOENT;
+	}
+
+	get_key(&key, id);
+
+	const uint32_t bucket = get_bucket(&key, hdr.seed, hdr.nr_buckets);
+	memcpy(&d, &snap->map[sizeof(hdr) + bucket * sizeof(d)], sizeof(d));
+
+	const uint32_t slot = get_slot(&key, d, hdr.seed, hdr.nr_records);
+
+	if (slot >= hdr.nr_records) {
+		return -ENODATA;
+	}
+
+	const uint8_t *p = &snap->map[get_records_offset(hdr.nr_buckets) +
+		slot * rec_size];
+
+	if (memcmp(p, id, sizeof(uid_id_t)) != 0) {
+		return -ENOENT;
+	}
+
+	memcpy(record, p, rec_size);
+
+	return 0;
+}
+
+struct uid_snapshot *uid_snapshot_create(struct flash *flash)
+{
+	struct uid_snapshot *snap;
+	const void *map;
+	size_t size;
+
+	if (!flash || (map = flash_mmap(flash, &size)) == NULL ||
+			size < UID_SNAPSHOT_SECTOR_SIZE) {
+		return NULL;
+	}
+
+	if ((snap = (struct uid_snapshot *)calloc(1, sizeof(*snap))) == NULL) {
+		return NULL;
+	}
+
+	snap->flash = flash;
+	snap->map = (const uint8_t *)map;
+	snap->size = size;
+
+	return snap;
+}
+
+void uid_snapshot_destroy(struct uid_snapshot *snap)
+{
+	free(snap);
+}
@@ -0,0 +1,345 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+/* Host benchmark of the OCPP-J decoder.
+ *
+ * Each incoming message type is decoded by the tokenizing decoder. One JSON
+ * object per message type is printed to stdout:
+ *
+ *   ocpp_decoder_bench [-i iterations]
+ *
+ * Times are the median per message in nanoseconds and include the payload
+ * handed over to the OCPP core. Heap usage is tracked by wrapping the
+ * allocator when built with BENCH_WRAP_MALLOC, and not at all otherwise.
+ *
+ * Responses are matched to their requests by message ID in the OCPP core.
+ * The lookup is redirected to get_type_from_idstr() below, so responses can
+ * be decoded without any request in flight. */
+
+#include "decoder_json.h"
+#include "registry.h"
+#include "msgpool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(BENCH_WRAP_MALLOC)
+#include <malloc.h>
+#endif
+
+#include "ocpp/ocpp.h"
+
+#define DEFAULT_ITERATIONS		10000
+#define MAX_ITERATIONS			100000
+
+struct sample {
+	const char *name;
+	const char *id;
+	ocpp_message_t type;
+	const char *frame;
+};
+
+struct heap {
+	size_t count;
+	size_t used;
+	size_t peak;
+};
+
+struct result {
+	const char *name;
+	int err;
+	size_t bytes;
+	uint32_t decode_ns;
+	struct heap decode;
+};
+
+static const struct sample samples[] = {
+	{ "BootNotification", "boot-1", OCPP_MSG_BOOTNOTIFICATION,
+		"[3,\"boot-1\",{\"currentTime\":\"2024-01-01T00:00:00Z\","
+		"\"interval\":300,\"status\":\"Accepted\"}]" },
+	{ "Heartbeat", "hb-1", OCPP_MSG_HEARTBEAT,
+		"[3,\"hb-1\",{\"currentTime\":\"2024-01-01T00:00:00.000Z\"}]" },
+	{ "Authorize", "auth-1", OCPP_MSG_AUTHORIZE,
+		"[3,\"auth-1\",{\"idTagInfo\":{\"status\":\"Accepted\","
+		"\"expiryDate\":\"2024-12-31T23:59:59Z\","
+		"\"parentIdTag\":\"PARENT0001\"}}]" },
+	{ "StartTransaction", "start-1", OCPP_MSG_START_TRANSACTION,
+		"[3,\"start-1\",{\"idTagInfo\":{\"status\":\"Accepted\"},"
+		"\"transactionId\":123456}]" },
+	{ "RemoteStartTransaction", NULL, OCPP_MSG_REMOTE_START_TRANSACTION,
+		"[2,\"c-1\",\"RemoteStartTransaction\",{\"connectorId\":1,"
+		"\"idTag\":\"04A2B3C4D5E6F7\"}]" },
+	{ "RemoteStopTransaction", NULL, OCPP_MSG_REMOTE_STOP_TRANSACTION,
+		"[2,\"c-2\",\"RemoteStopTransaction\","
+		"{\"transactionId\":123456}]" },
+	{ "Reset", NULL, OCPP_MSG_RESET,
+		"[2,\"c-3\",\"Reset\",{\"type\":\"Soft\"}]" },
+	{ "ChangeAvailability", NULL, OCPP_MSG_CHANGE_AVAILABILITY,
+		"[2,\"c-4\",\"ChangeAvailability\",{\"connectorId\":1,"
+		"\"type\":\"Inoperative\"}]" },
+	{ "ChangeConfiguration", NULL, OCPP_MSG_CHANGE_CONFIGURATION,
+		"[2,\"c-5\",\"ChangeConfiguration\","
+		"{\"key\":\"MeterValueSampleInterval\",\"value\":\"60\"}]" },
+	{ "GetConfiguration", NULL, OCPP_MSG_GET_CONFIGURATION,
+		"[2,\"c-6\",\"GetConfiguration\",{\"key\":["
+		"\"HeartbeatInterval\",\"MeterValueSampleInterval\","
+		"\"ConnectionTimeOut\",\"LocalAuthorizeOffline\"]}]" },
+	{ "UpdateFirmware", NULL, OCPP_MSG_UPDATE_FIRMWARE,
+		"[2,\"c-7\",\"UpdateFirmware\",{\"location\":"
+		"\"https://example.com/firmware/v1.2.3/app.bin\","
+		"\"retries\":3,\"retrieveDate\":\"2024-01-01T00:00:00Z\","
+		"\"retryInterval\":60}]" },
+	{ "ClearCache", NULL, OCPP_MSG_CLEAR_CACHE,
+		"[2,\"c-8\",\"ClearCache\",{}]" },
+};
+
+static struct heap heap;
+
+#if defined(BENCH_WRAP_MALLOC)
+#define HEAP_TRACKER			"wrap"
+
+static void track_alloc(size_t size)
+{
+	heap.count++;
+	heap.used += size;
+	if (heap.used > heap.peak) {
+		heap.peak = heap.used;
+	}
+}
+
+static void track_free(size_t size)
+{
+	heap.used -= size < heap.used? size : heap.used;
+}
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+	void *p = __real_malloc(size);
+	if (p) {
+		track_alloc(malloc_usable_size(p));
+	}
+	return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	void *p = __real_calloc(n, size);
+	if (p) {
+		track_alloc(malloc_usable_size(p));
+	}
+	return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	const size_t old = ptr? malloc_usable_size(ptr) : 0;
+	void *p = __real_realloc(ptr, size);
+	if (p) {
+		track_free(old);
+		track_alloc(malloc_usable_size(p));
+	}
+	return p;
+}
+
+void __wrap_free(void *ptr)
+{
+	if (ptr) {
+		track_free(malloc_usable_size(ptr));
+	}
+	__real_free(ptr);
+}
+#else
+#define HEAP_TRACKER			"none"
+#endif
+
+/* The OCPP core is linked without a transport. */
+int ocpp_send(const struct ocpp_message *msg);
+int ocpp_recv(struct ocpp_message *msg);
+void ocpp_generate_message_id(void *buf, size_t bufsize);
+
+int ocpp_send(const struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOTSUP;
+}
+
+int ocpp_recv(struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOENT;
+}
+
+void ocpp_generate_message_id(void *buf, size_t bufsize)
+{
+	snprintf((char *)buf, bufsize, "%s", "1700000000-000");
+}
+
+ocpp_message_t get_type_from_idstr(const char *idstr)
+{
+	for (size_t i = 0; i < sizeof(samples) / sizeof(*samples); i++) {
+		if (samples[i].id && strcmp(samples[i].id, idstr) == 0) {
+			return samples[i].type;
+		}
+	}
+
+	return OCPP_MSG_BOOTNOTIFICATION;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t get_median(uint32_t *times, size_t n)
+{
+	qsort(times, n, sizeof(*times), compare_u32);
+	return times[n / 2];
+}
+
+static int decode(const struct sample *sample)
+{
+	struct ocpp_message msg;
+	size_t decoded_len;
+	int err = decoder_json_decode(&msg, sample->frame,
+			strlen(sample->frame), &decoded_len);
+
+	if (!err && msg.type != sample->type) {
+		err = -EBADMSG;
+	}
+
+	msgpool_free((void *)(uintptr_t)msg.payload.fmt.data);
+
+	return err;
+}
+
+static void run(struct result *result, const struct sample *sample,
+		uint32_t *times, size_t iterations)
+{
+	memset(result, 0, sizeof(*result));
+	result->name = sample->name;
+	result->bytes = strlen(sample->frame);
+
+	if ((result->err = decode(sample)) < 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < iterations; i++) {
+		const uint64_t t0 = get_time_ns();
+		decode(sample);
+		times[i] = (uint32_t)(get_time_ns() - t0);
+	}
+	result->decode_ns = get_median(times, iterations);
+
+	heap = (struct heap) { 0, };
+	decode(sample);
+	result->decode = heap;
+}
+
+static void print_result(const struct result *result)
+{
+	printf("{\"bench\":\"ocpp_decoder\",\"message\":\"%s\"", result->name);
+
+	if (result->err < 0) {
+		printf(",\"error\":%d}\n", result->err);
+		return;
+	}
+
+	printf(",\"bytes\":%zu"
+			",\"decode_ns\":%u,\"decode_allocs\":%zu"
+			",\"decode_peak_heap\":%zu"
+			",\"heap_tracker\":\"%s\"}\n",
+			result->bytes,
+			(unsigned int)result->decode_ns,
+			result->decode.count, result->decode.peak,
+			HEAP_TRACKER);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t iterations = DEFAULT_ITERATIONS;
+	struct result result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i %d]\n",
+					argv[0], DEFAULT_ITERATIONS);
+			return 1;
+		}
+	}
+
+	if (iterations == 0 || iterations > MAX_ITERATIONS) {
+		iterations = DEFAULT_ITERATIONS;
+	}
+
+	registry_init();
+
+	uint32_t *times = (uint32_t *)malloc(iterations * sizeof(*times));
+	if (!times) {
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(samples) / sizeof(*samples); i++) {
+		run(&result, &samples[i], times, iterations);
+		print_result(&result);
+	}
+
+	free(times);
+
+	return 0;
+}
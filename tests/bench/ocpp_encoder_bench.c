@@ -0,0 +1,312 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+/* Host benchmark of the OCPP-J encoder.
+ *
+ * Each outgoing message type is encoded into a frame buffer. One JSON object
+ * per message type is printed to stdout:
+ *
+ *   ocpp_encoder_bench [-i iterations]
+ *
+ * Times are the median per message in nanoseconds. Allocations are counted
+ * by wrapping malloc() when built with BENCH_WRAP_MALLOC, and not at all
+ * otherwise. */
+
+#include "encoder_json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ocpp/ocpp.h"
+
+#define DEFAULT_ITERATIONS		10000
+#define MAX_ITERATIONS			100000
+#define NR_SAMPLED_VALUES		8
+#define FRAME_BUFSIZE			4096
+#define MAX_SAMPLES			8
+
+struct sample {
+	const char *name;
+	struct ocpp_message msg;
+};
+
+struct allocs {
+	size_t count;
+	size_t bytes;
+};
+
+struct result {
+	const char *name;
+	int len;
+	uint32_t stream_ns;
+	struct allocs stream;
+};
+
+static struct allocs allocs;
+static char frame[FRAME_BUFSIZE];
+
+#if defined(BENCH_WRAP_MALLOC)
+#define ALLOC_COUNTER			"wrap"
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	allocs.count++;
+	allocs.bytes += size;
+	return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocs.count++;
+	allocs.bytes += size;
+	return __real_realloc(ptr, size);
+}
+#else
+#define ALLOC_COUNTER			"none"
+#endif
+
+/* The OCPP core is linked without a transport. */
+int ocpp_send(const struct ocpp_message *msg);
+int ocpp_recv(struct ocpp_message *msg);
+void ocpp_generate_message_id(void *buf, size_t bufsize);
+
+int ocpp_send(const struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOTSUP;
+}
+
+int ocpp_recv(struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOENT;
+}
+
+void ocpp_generate_message_id(void *buf, size_t bufsize)
+{
+	snprintf((char *)buf, bufsize, "%s", "1700000000-000");
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t get_median(uint32_t *samples, size_t n)
+{
+	qsort(samples, n, sizeof(*samples), compare_u32);
+	return samples[n / 2];
+}
+
+static void set_call(struct ocpp_message *msg, ocpp_message_t type,
+		void *payload, size_t payload_size)
+{
+	memset(msg, 0, sizeof(*msg));
+	ocpp_generate_message_id(msg->id, sizeof(msg->id));
+	msg->role = OCPP_MSG_ROLE_CALL;
+	msg->type = type;
+	msg->payload.fmt.request = payload;
+	msg->payload.size = payload_size;
+}
+
+static size_t build_samples(struct sample *samples)
+{
+	static struct ocpp_BootNotification boot;
+	static struct ocpp_Authorize authorize;
+	static struct ocpp_StatusNotification status;
+	static struct ocpp_StartTransaction start;
+	static struct ocpp_StopTransaction stop;
+	static union {
+		struct ocpp_MeterValues values;
+		uint8_t raw[sizeof(struct ocpp_MeterValues) +
+			sizeof(struct ocpp_MeterValue) +
+			sizeof(struct ocpp_SampledValue) * NR_SAMPLED_VALUES];
+	} meter;
+	const time_t now = 1700000000;
+	size_t n = 0;
+
+	strcpy(boot.chargePointModel, "EVSE-7kW");
+	strcpy(boot.chargePointVendor, "Pazzk");
+	strcpy(boot.chargePointSerialNumber, "PZ00000001");
+	strcpy(boot.firmwareVersion, "v1.2.3");
+	strcpy(authorize.idTag, "04A2B3C4D5E6F7");
+	status.connectorId = 1;
+	status.timestamp = now;
+	start.connectorId = 1;
+	start.meterStart = 1234567;
+	start.timestamp = now;
+	strcpy(start.idTag, authorize.idTag);
+	stop.transactionId = 42;
+	stop.meterStop = 1244567;
+	stop.timestamp = now;
+	strcpy(stop.idTag, authorize.idTag);
+
+	meter.values.connectorId = 1;
+	meter.values.transactionId = 42;
+	struct ocpp_MeterValue *value = (struct ocpp_MeterValue *)(void *)
+		meter.values.meterValue;
+	struct ocpp_SampledValue *sampled = (struct ocpp_SampledValue *)
+		(void *)value->sampledValue;
+	value->timestamp = now;
+	for (int i = 0; i < NR_SAMPLED_VALUES; i++) {
+		snprintf(sampled[i].value, sizeof(sampled[i].value),
+				"%d.%03d", 230 + i, i * 7);
+	}
+
+	samples[n].name = "Heartbeat";
+	set_call(&samples[n++].msg, OCPP_MSG_HEARTBEAT, NULL, 0);
+	samples[n].name = "BootNotification";
+	set_call(&samples[n++].msg, OCPP_MSG_BOOTNOTIFICATION,
+			&boot, sizeof(boot));
+	samples[n].name = "Authorize";
+	set_call(&samples[n++].msg, OCPP_MSG_AUTHORIZE,
+			&authorize, sizeof(authorize));
+	samples[n].name = "StatusNotification";
+	set_call(&samples[n++].msg, OCPP_MSG_STATUS_NOTIFICATION,
+			&status, sizeof(status));
+	samples[n].name = "StartTransaction";
+	set_call(&samples[n++].msg, OCPP_MSG_START_TRANSACTION,
+			&start, sizeof(start));
+	samples[n].name = "StopTransaction";
+	set_call(&samples[n++].msg, OCPP_MSG_STOP_TRANSACTION,
+			&stop, sizeof(stop));
+	samples[n].name = "MeterValues";
+	set_call(&samples[n++].msg, OCPP_MSG_METER_VALUES,
+			&meter, sizeof(meter));
+
+	return n;
+}
+
+static int encode_stream(const struct ocpp_message *msg)
+{
+	return encoder_json_encode(msg, frame, sizeof(frame));
+}
+
+static void run(struct result *result, const struct sample *sample,
+		uint32_t *samples, size_t iterations)
+{
+	memset(result, 0, sizeof(*result));
+	result->name = sample->name;
+
+	if ((result->len = encode_stream(&sample->msg)) < 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < iterations; i++) {
+		const uint64_t t0 = get_time_ns();
+		encode_stream(&sample->msg);
+		samples[i] = (uint32_t)(get_time_ns() - t0);
+	}
+	result->stream_ns = get_median(samples, iterations);
+
+	allocs = (struct allocs) { 0, };
+	encode_stream(&sample->msg);
+	result->stream = allocs;
+}
+
+static void print_result(const struct result *result)
+{
+	printf("{\"bench\":\"ocpp_encoder\",\"message\":\"%s\"", result->name);
+
+	if (result->len < 0) {
+		printf(",\"error\":%d}\n", result->len);
+		return;
+	}
+
+	printf(",\"bytes\":%d"
+			",\"stream_ns\":%u,\"stream_allocs\":%zu"
+			",\"stream_alloc_bytes\":%zu"
+			",\"alloc_counter\":\"%s\"}\n",
+			result->len,
+			(unsigned int)result->stream_ns,
+			result->stream.count, result->stream.bytes,
+			ALLOC_COUNTER);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t iterations = DEFAULT_ITERATIONS;
+	struct sample samples[MAX_SAMPLES];
+	struct result result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i %d]\n",
+					argv[0], DEFAULT_ITERATIONS);
+			return 1;
+		}
+	}
+
+	if (iterations == 0 || iterations > MAX_ITERATIONS) {
+		iterations = DEFAULT_ITERATIONS;
+	}
+
+	uint32_t *times = (uint32_t *)malloc(iterations * sizeof(*times));
+	if (!times) {
+		return 1;
+	}
+
+	const size_t n = build_samples(samples);
+
+	for (size_t i = 0; i < n; i++) {
+		run(&result, &samples[i], times, iterations);
+		print_result(&result);
+	}
+
+	free(times);
+
+	return 0;
+}
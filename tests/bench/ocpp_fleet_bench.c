@@ -0,0 +1,660 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+/* Host fleet runner: many scripted OCPP-J sessions against one CSMS, each on
+ * its own connection of the host transport, in a single process.
+ *
+ *   ocpp_fleet_bench [-n chargers] [-t seconds] [-u url] [-p prefix]
+ *                    [-P password] [-r chargers per second]
+ *                    [-m metervalues interval in seconds]
+ *
+ * Each charger has its own WebSocket connection to <url>/<prefix><number>
+ * and its own OCPP-J session: it boots, reports its connector Available,
+ * then sends Heartbeats at the interval the CSMS accepted it with and
+ * MeterValues at the given interval, keeping one call in flight at a time.
+ * Calls from the CSMS are answered with a CALLERROR, as there is no charger
+ * behind them.
+ *
+ * The connections share the I/O thread of the host transport, and every
+ * session is stepped from the main loop, so a fleet costs two threads however
+ * large it is.
+ *
+ * None of the charger core runs here. csms.c, the adapter, txqueue, config
+ * and the OCPP core in external/ocpp are single-instance, so a "charger"
+ * below is a transport instance and a session scripted with the JSON codec
+ * of the firmware. The figures are those of the transport and the codec per
+ * connection, not of a charger.
+ *
+ * One JSON object is printed to stdout at the end of the run with the heap
+ * taken per charger, once connected, and the messages and bytes exchanged
+ * by the whole fleet per second. */
+
+#include "encoder_json.h"
+#include "decoder_json.h"
+#include "registry.h"
+#include "msgpool.h"
+#include "net/server_ws.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "ocpp/ocpp.h"
+
+#define DEFAULT_CHARGERS		100
+#define MAX_CHARGERS			10000
+#define DEFAULT_DURATION_SEC		60
+#define DEFAULT_URL			"ws://127.0.0.1:9000"
+#define DEFAULT_PREFIX			"SIM"
+#define DEFAULT_RAMP_PER_SEC		50
+#define DEFAULT_METERVALUES_SEC		10
+
+#define DEFAULT_HEARTBEAT_SEC		60
+#define BOOT_RETRY_SEC			10
+#define CALL_TIMEOUT_NS			(30ULL * 1000000000)
+#define LOOP_INTERVAL_US		1000
+#define MAX_RX_PER_STEP			8
+#define MAX_RTT_SAMPLES			100000
+
+#define RXQ_SIZE			8192
+#define RXMSG_MAXSIZE			4096
+#define CHARGER_ID_MAXLEN		21
+#define NR_SAMPLED_VALUES		4
+
+typedef enum {
+	SESSION_OFFLINE,
+	SESSION_BOOTING,
+	SESSION_ONLINE,
+} session_state_t;
+
+struct charger {
+	struct server *server;
+	char id[CHARGER_ID_MAXLEN];
+
+	session_state_t state;
+	bool status_reported;
+	uint32_t heartbeat_sec;
+	time_t next_boot;
+	time_t next_heartbeat;
+	time_t next_metervalues;
+
+	/* OCPP-J allows a single call in flight */
+	struct {
+		char id[sizeof(((struct ocpp_message *)0)->id)];
+		ocpp_message_t type;
+		uint64_t sent;
+		bool pending;
+	} call;
+	uint32_t next_msgid;
+
+	uint32_t meter_wh;
+};
+
+struct fleet {
+	struct charger *chargers;
+	size_t nr_chargers;
+	size_t nr_created;
+
+	char url[WS_URI_MAXLEN];
+	const char *prefix;
+	const char *password;
+	uint32_t metervalues_sec;
+
+	uint64_t tx_msgs;
+	uint64_t rx_msgs;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t calls;
+	uint64_t callerrors;
+	uint64_t timeouts;
+	uint64_t errors;
+	size_t nr_connected;
+	size_t max_connected;
+
+	uint32_t *rtt_us;
+	size_t nr_rtt;
+};
+
+static struct fleet fleet;
+/* the session whose frame is being decoded */
+static const struct charger *decoding;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Bytes in use on the heap of the process, including what libwebsockets
+ * and TLS take for the connections. 0 if the platform can't tell. */
+static size_t get_heap_used(void)
+{
+#if defined(__APPLE__)
+	malloc_statistics_t stats;
+	malloc_zone_statistics(NULL, &stats);
+	return stats.size_in_use;
+#elif defined(__GLIBC__) && \
+		(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	const struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/* The OCPP core is linked for its tables, but never run. */
+int ocpp_send(const struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOTSUP;
+}
+
+int ocpp_recv(struct ocpp_message *msg)
+{
+	(void)msg;
+	return -ENOENT;
+}
+
+void ocpp_generate_message_id(void *buf, size_t bufsize)
+{
+	snprintf((char *)buf, bufsize, "%s", "0");
+}
+
+/* Responses are resolved against the call in flight of the session being
+ * decoded, as the OCPP core would do with its own. */
+ocpp_message_t get_type_from_idstr(const char *idstr)
+{
+	if (decoding && decoding->call.pending &&
+			strcmp(decoding->call.id, idstr) == 0) {
+		return decoding->call.type;
+	}
+
+	return OCPP_MSG_MAX;
+}
+
+static int send_message(struct charger *c, const struct ocpp_message *msg)
+{
+	size_t bufsize = 0;
+	char *json = (char *)server_txbuf(c->server, &bufsize);
+	const int len = encoder_json_encode(msg, json, bufsize);
+
+	if (len < 0) {
+		fleet.errors++;
+		return len;
+	}
+
+	const int err = server_send(c->server, json, (size_t)len);
+
+	if (err < 0) {
+		fleet.errors++;
+		return err;
+	}
+
+	fleet.tx_msgs++;
+	fleet.tx_bytes += (uint64_t)len;
+
+	return 0;
+}
+
+static int send_call(struct charger *c, const ocpp_message_t type,
+		const void *payload, const size_t payload_size)
+{
+	struct ocpp_message msg = {
+		.role = OCPP_MSG_ROLE_CALL,
+		.type = type,
+		.payload = {
+			.fmt.request = payload,
+			.size = payload_size,
+		},
+	};
+
+	snprintf(msg.id, sizeof(msg.id), "%u", c->next_msgid++);
+
+	const int err = send_message(c, &msg);
+
+	if (!err) {
+		memcpy(c->call.id, msg.id, sizeof(c->call.id));
+		c->call.type = type;
+		c->call.sent = get_time_ns();
+		c->call.pending = true;
+		fleet.calls++;
+	}
+
+	return err;
+}
+
+static int send_bootnotification(struct charger *c)
+{
+	struct ocpp_BootNotification boot = { 0, };
+
+	strcpy(boot.chargePointModel, "EVSE-7kW");
+	strcpy(boot.chargePointVendor, "Pazzk");
+	snprintf(boot.chargePointSerialNumber,
+			sizeof(boot.chargePointSerialNumber), "%s", c->id);
+	strcpy(boot.firmwareVersion, "fleet");
+
+	return send_call(c, OCPP_MSG_BOOTNOTIFICATION, &boot, sizeof(boot));
+}
+
+static int send_statusnotification(struct charger *c, const time_t now)
+{
+	struct ocpp_StatusNotification status = {
+		.connectorId = 1,
+		.status = OCPP_STATUS_AVAILABLE,
+		.timestamp = now,
+	};
+
+	return send_call(c, OCPP_MSG_STATUS_NOTIFICATION,
+			&status, sizeof(status));
+}
+
+static int send_metervalues(struct charger *c, const time_t now)
+{
+	static union {
+		struct ocpp_MeterValues values;
+		uint8_t raw[sizeof(struct ocpp_MeterValues) +
+			sizeof(struct ocpp_MeterValue) +
+			sizeof(struct ocpp_SampledValue) * NR_SAMPLED_VALUES];
+	} meter;
+	struct ocpp_MeterValue *value = (struct ocpp_MeterValue *)(void *)
+		meter.values.meterValue;
+	struct ocpp_SampledValue *sampled = (struct ocpp_SampledValue *)
+		(void *)value->sampledValue;
+
+	memset(&meter, 0, sizeof(meter));
+	meter.values.connectorId = 1;
+	value->timestamp = now;
+
+	c->meter_wh += 10;
+	snprintf(sampled[0].value, sizeof(sampled[0].value),
+			"%u", (unsigned int)c->meter_wh);
+	sampled[0].measurand = OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER;
+	sampled[0].unit = OCPP_UNIT_WH;
+	strcpy(sampled[1].value, "230.0");
+	sampled[1].measurand = OCPP_MEASURAND_VOLTAGE;
+	sampled[1].unit = OCPP_UNIT_V;
+	strcpy(sampled[2].value, "0.0");
+	sampled[2].measurand = OCPP_MEASURAND_CURRENT_IMPORT;
+	sampled[2].unit = OCPP_UNIT_A;
+
+	return send_call(c, OCPP_MSG_METER_VALUES, &meter, sizeof(meter));
+}
+
+static void reply_error(struct charger *c, const struct ocpp_message *req)
+{
+	struct ocpp_message msg = {
+		.role = OCPP_MSG_ROLE_CALLERROR,
+		.type = req->type,
+	};
+
+	memcpy(msg.id, req->id, sizeof(msg.id));
+	send_message(c, &msg);
+}
+
+static void add_rtt(const uint64_t ns)
+{
+	fleet.rtt_us[fleet.nr_rtt++ % MAX_RTT_SAMPLES] =
+		(uint32_t)(ns / 1000);
+}
+
+static void handle_result(struct charger *c, const struct ocpp_message *msg,
+		const time_t now)
+{
+	add_rtt(get_time_ns() - c->call.sent);
+	c->call.pending = false;
+
+	if (msg->role == OCPP_MSG_ROLE_CALLERROR) {
+		fleet.callerrors++;
+		if (c->state == SESSION_BOOTING) {
+			c->next_boot = now + BOOT_RETRY_SEC;
+		}
+		return;
+	}
+
+	if (msg->type == OCPP_MSG_BOOTNOTIFICATION) {
+		const struct ocpp_BootNotification_conf *conf =
+			(const struct ocpp_BootNotification_conf *)
+			msg->payload.fmt.response;
+		const uint32_t interval = conf && conf->interval > 0?
+			(uint32_t)conf->interval : 0;
+
+		if (conf && conf->status == OCPP_BOOT_STATUS_ACCEPTED) {
+			c->state = SESSION_ONLINE;
+			c->heartbeat_sec = interval? interval :
+				DEFAULT_HEARTBEAT_SEC;
+			c->next_heartbeat = now + (time_t)c->heartbeat_sec;
+			c->next_metervalues = now +
+				(time_t)fleet.metervalues_sec;
+		} else {
+			c->next_boot = now + (time_t)(interval? interval :
+					BOOT_RETRY_SEC);
+		}
+	} else if (msg->type == OCPP_MSG_HEARTBEAT) {
+		c->next_heartbeat = now + (time_t)c->heartbeat_sec;
+	}
+}
+
+static void receive(struct charger *c, const time_t now)
+{
+	for (int i = 0; i < MAX_RX_PER_STEP; i++) {
+		struct ocpp_message msg = { 0, };
+		const void *frame;
+		const int len = server_peek(c->server, &frame);
+
+		if (len < 0) {
+			break;
+		}
+
+		decoding = c;
+		const int err = decoder_json_decode(&msg, (const char *)frame,
+				(size_t)len, NULL);
+		decoding = NULL;
+
+		server_consume(c->server);
+
+		fleet.rx_msgs++;
+		fleet.rx_bytes += (uint64_t)len;
+
+		if (msg.role == OCPP_MSG_ROLE_CALL) {
+			reply_error(c, &msg);
+		} else if (c->call.pending && strcmp(msg.id, c->call.id) == 0) {
+			handle_result(c, &msg, now);
+		} else if (err) {
+			fleet.errors++;
+		}
+
+		msgpool_free((void *)(uintptr_t)msg.payload.fmt.data);
+	}
+}
+
+static void send_due(struct charger *c, const time_t now)
+{
+	if (c->state == SESSION_BOOTING) {
+		if (now >= c->next_boot) {
+			send_bootnotification(c);
+		}
+	} else if (!c->status_reported) {
+		if (!send_statusnotification(c, now)) {
+			c->status_reported = true;
+		}
+	} else if (fleet.metervalues_sec && now >= c->next_metervalues) {
+		if (!send_metervalues(c, now)) {
+			c->next_metervalues = now +
+				(time_t)fleet.metervalues_sec;
+		}
+	} else if (now >= c->next_heartbeat) {
+		if (!send_call(c, OCPP_MSG_HEARTBEAT, NULL, 0)) {
+			/* pushed back further once the CSMS answers */
+			c->next_heartbeat = now + (time_t)c->heartbeat_sec;
+		}
+	}
+}
+
+static void step(struct charger *c, const time_t now)
+{
+	if (!server_connected(c->server)) {
+		if (c->state != SESSION_OFFLINE) {
+			c->state = SESSION_OFFLINE;
+			c->call.pending = false;
+			fleet.nr_connected--;
+		}
+		return;
+	}
+
+	if (c->state == SESSION_OFFLINE) { /* boots again on every connect */
+		c->state = SESSION_BOOTING;
+		c->status_reported = false;
+		c->next_boot = now;
+		fleet.nr_connected++;
+		if (fleet.nr_connected > fleet.max_connected) {
+			fleet.max_connected = fleet.nr_connected;
+		}
+	}
+
+	receive(c, now);
+
+	if (c->call.pending && get_time_ns() - c->call.sent > CALL_TIMEOUT_NS) {
+		c->call.pending = false;
+		fleet.timeouts++;
+		if (c->state == SESSION_BOOTING) {
+			c->next_boot = now + BOOT_RETRY_SEC;
+		}
+	}
+
+	if (!c->call.pending) {
+		send_due(c, now);
+	}
+}
+
+static int create_charger(struct charger *c, const size_t index)
+{
+	struct ws_param param = {
+		.rxq_maxsize = RXQ_SIZE,
+		.rxmsg_maxsize = RXMSG_MAXSIZE,
+	};
+
+	snprintf(c->id, sizeof(c->id), "%s%05zu", fleet.prefix, index + 1);
+	snprintf(param.url, sizeof(param.url), "%s/%s", fleet.url, c->id);
+
+	if (fleet.password) {
+		snprintf(param.auth.id, sizeof(param.auth.id), "%s", c->id);
+		snprintf(param.auth.pass, sizeof(param.auth.pass), "%s",
+				fleet.password);
+	}
+
+	c->next_msgid = 1;
+
+	if (!(c->server = ws_create_server(&param, NULL, NULL))) {
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void print_result(const size_t heap_per_charger,
+		const uint64_t elapsed_ns)
+{
+	const double sec = (double)elapsed_ns / 1e9;
+	const size_t n = fleet.nr_rtt < MAX_RTT_SAMPLES?
+		fleet.nr_rtt : MAX_RTT_SAMPLES;
+	uint32_t p50 = 0;
+	uint32_t p99 = 0;
+
+	if (n) {
+		qsort(fleet.rtt_us, n, sizeof(*fleet.rtt_us), compare_u32);
+		p50 = fleet.rtt_us[n / 2];
+		p99 = fleet.rtt_us[(n * 99) / 100];
+	}
+
+	printf("{\"bench\":\"ocpp_fleet\",\"chargers\":%zu"
+			",\"connected\":%zu,\"max_connected\":%zu"
+			",\"duration_sec\":%.1f,\"heap_per_charger\":%zu"
+			",\"tx_msgs\":%llu,\"rx_msgs\":%llu"
+			",\"tx_per_sec\":%.1f,\"rx_per_sec\":%.1f"
+			",\"tx_bytes_per_sec\":%.1f,\"rx_bytes_per_sec\":%.1f"
+			",\"calls\":%llu,\"callerrors\":%llu,\"timeouts\":%llu"
+			",\"errors\":%llu,\"rtt_p50_us\":%u,\"rtt_p99_us\":%u}\n",
+			fleet.nr_created, fleet.nr_connected,
+			fleet.max_connected, sec, heap_per_charger,
+			(unsigned long long)fleet.tx_msgs,
+			(unsigned long long)fleet.rx_msgs,
+			(double)fleet.tx_msgs / sec,
+			(double)fleet.rx_msgs / sec,
+			(double)fleet.tx_bytes / sec,
+			(double)fleet.rx_bytes / sec,
+			(unsigned long long)fleet.calls,
+			(unsigned long long)fleet.callerrors,
+			(unsigned long long)fleet.timeouts,
+			(unsigned long long)fleet.errors,
+			(unsigned int)p50, (unsigned int)p99);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t nr_chargers = DEFAULT_CHARGERS;
+	uint32_t duration_sec = DEFAULT_DURATION_SEC;
+	uint32_t ramp_per_sec = DEFAULT_RAMP_PER_SEC;
+	const char *url = DEFAULT_URL;
+	size_t heap_per_charger = 0;
+	int opt;
+
+	fleet.prefix = DEFAULT_PREFIX;
+	fleet.metervalues_sec = DEFAULT_METERVALUES_SEC;
+
+	while ((opt = getopt(argc, argv, "n:t:u:p:P:r:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_chargers = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			duration_sec = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			url = optarg;
+			break;
+		case 'p':
+			fleet.prefix = optarg;
+			break;
+		case 'P':
+			fleet.password = optarg;
+			break;
+		case 'r':
+			ramp_per_sec = (uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			fleet.metervalues_sec =
+				(uint32_t)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n %d] [-t %d] [-u %s] "
+					"[-p %s] [-P password] [-r %d] "
+					"[-m %d]\n", argv[0],
+					DEFAULT_CHARGERS, DEFAULT_DURATION_SEC,
+					DEFAULT_URL, DEFAULT_PREFIX,
+					DEFAULT_RAMP_PER_SEC,
+					DEFAULT_METERVALUES_SEC);
+			return 1;
+		}
+	}
+
+	if (nr_chargers == 0 || nr_chargers > MAX_CHARGERS) {
+		nr_chargers = DEFAULT_CHARGERS;
+	}
+	if (ramp_per_sec == 0) {
+		ramp_per_sec = (uint32_t)nr_chargers;
+	}
+	/* the identity is appended to the path */
+	snprintf(fleet.url, sizeof(fleet.url), "%.*s",
+			(int)strcspn(url, "?#"), url);
+	if (fleet.url[0] && fleet.url[strlen(fleet.url) - 1] == '/') {
+		fleet.url[strlen(fleet.url) - 1] = '\0';
+	}
+
+	registry_init();
+
+	fleet.chargers = (struct charger *)calloc(nr_chargers,
+			sizeof(*fleet.chargers));
+	fleet.rtt_us = (uint32_t *)calloc(MAX_RTT_SAMPLES,
+			sizeof(*fleet.rtt_us));
+	fleet.nr_chargers = nr_chargers;
+
+	if (!fleet.chargers || !fleet.rtt_us) {
+		return 1;
+	}
+
+	const size_t heap0 = get_heap_used();
+	const uint64_t t0 = get_time_ns();
+	const uint64_t end = t0 + (uint64_t)duration_sec * 1000000000u;
+	uint64_t now_ns;
+
+	while ((now_ns = get_time_ns()) < end) {
+		const time_t now = time(NULL);
+		const size_t due = (size_t)((now_ns - t0) / 1000000 *
+				ramp_per_sec / 1000) + 1;
+
+		while (fleet.nr_created < fleet.nr_chargers &&
+				fleet.nr_created < due) {
+			if (create_charger(&fleet.chargers[fleet.nr_created],
+					fleet.nr_created) < 0) {
+				fprintf(stderr, "failed to create charger %zu\n",
+						fleet.nr_created);
+				fleet.nr_chargers = fleet.nr_created;
+				break;
+			}
+			fleet.nr_created++;
+		}
+
+		for (size_t i = 0; i < fleet.nr_created; i++) {
+			step(&fleet.chargers[i], now);
+		}
+
+		/* taken once the whole fleet has connected, when every
+		 * connection holds its buffers */
+		if (!heap_per_charger && fleet.nr_created &&
+				fleet.nr_created == fleet.nr_chargers &&
+				fleet.nr_connected == fleet.nr_created) {
+			const size_t heap = get_heap_used();
+			heap_per_charger = heap > heap0?
+				(heap - heap0) / fleet.nr_created : 0;
+		}
+
+		usleep(LOOP_INTERVAL_US);
+	}
+
+	print_result(heap_per_charger, get_time_ns() - t0);
+
+	for (size_t i = 0; i < fleet.nr_created; i++) {
+		ws_delete_server((struct ws_server *)fleet.chargers[i].server);
+	}
+
+	free(fleet.rtt_us);
+	free(fleet.chargers);
+
+	return 0;
+}
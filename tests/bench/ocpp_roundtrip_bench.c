@@ -0,0 +1,1063 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+/* Host benchmark of OCPP round trips.
+ *
+ * The charger side is linked as it is in the firmware: csms.c and the
+ * adapter on top of the OCPP core, the JSON encoder and decoder and the host
+ * WebSocket transport. It talks to a CSMS stand-in served by libwebsockets
+ * in the same process. Requests are made with csms_request() on a connector
+ * as the charger makes them. One JSON object per message type is printed to
+ * stdout:
+ *
+ *   ocpp_roundtrip_bench [-i iterations] [-b burst] [-p port]
+ *
+ * BootNotification, Authorize, StartTransaction and StopTransaction go out
+ * one at a time. MeterValues go out in bursts of the given size, each of
+ * them a batch of OCPP_METERVALUE_BATCH_MAX samples. GetConfiguration is
+ * called by the stand-in and answered with every configuration key.
+ *
+ * The transport csms.c creates is taken over at link time, with
+ * ws_create_server() wrapped, and its calls are stamped on the way through.
+ * Each message is stamped:
+ *
+ *   queue   from csms_request() until the adapter asks the transport for
+ *           its TX buffer in ocpp_send(). For MeterValues, from the first
+ *           sample of the batch. For GetConfiguration, from the call being
+ *           handed to the charger.
+ *   encode  from server_txbuf() until server_send()
+ *   send    server_send(), up to the frame being written to the socket
+ *   wait    from the end of the send until the reply reaches the
+ *           transport. For GetConfiguration, from the stand-in writing the
+ *           call until it reaches the transport.
+ *   rxq     from the transport until ocpp_recv() peeks at it
+ *   decode  from server_peek() until server_consume()
+ *   handle  from server_consume() until the message reaches the charger
+ *           through csms.c
+ *   total   from csms_request() until the reply reaches the charger. For
+ *           GetConfiguration, from the stand-in writing the call until it
+ *           gets the result back.
+ *
+ * Times are the median and 99th percentile in nanoseconds. The OCPP core is
+ * stepped in a tight loop, so the queue stage shows the one call in flight
+ * rule of OCPP-J rather than the period of the charger task. The stand-in
+ * accepts the boot with a heartbeat interval longer than a run, so that the
+ * core sends nothing on its own meanwhile. */
+
+#include "csms.h"
+#include "handler.h"
+#include "ocpp_connector_internal.h"
+#include "charger/ocpp.h"
+#include "net/server_ws.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <libwebsockets.h>
+
+#include "ocpp/ocpp.h"
+
+#define DEFAULT_ITERATIONS		200
+#define MAX_ITERATIONS			10000
+#define DEFAULT_BURST			8
+#define MAX_BURST			64
+#define DEFAULT_PORT			18080
+
+#define TIMEOUT_NS			(5ULL * 1000000000)
+
+#define CSMS_FRAME_MAXLEN		512
+#define CSMS_TXQ_LEN			64
+#define ID_MAXLEN			40
+
+#define ID_TAG				"04A2B3C4D5E6F7"
+#define MEASURANDS			(OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER \
+		| OCPP_MEASURAND_POWER_ACTIVE_IMPORT \
+		| OCPP_MEASURAND_CURRENT_IMPORT \
+		| OCPP_MEASURAND_VOLTAGE)
+
+struct scenario {
+	const char *name;
+	ocpp_message_t type;
+	bool from_csms;
+	bool burst;
+};
+
+struct trace {
+	char id[ID_MAXLEN];
+	uint64_t push;
+	uint64_t handled; /* the call from the stand-in handed to the charger */
+	uint64_t send;
+	uint64_t encoded;
+	uint64_t sent;
+	uint64_t arrived;
+	uint64_t recv;
+	uint64_t decoded;
+	uint64_t done;
+	size_t tx_bytes;
+	size_t rx_bytes;
+};
+
+struct stage {
+	uint32_t p50;
+	uint32_t p99;
+};
+
+struct result {
+	const char *name;
+	int err;
+	size_t count;
+	size_t tx_bytes;
+	size_t rx_bytes;
+	double per_sec;
+	struct stage queue;
+	struct stage encode;
+	struct stage send;
+	struct stage wait;
+	struct stage rxq;
+	struct stage decode;
+	struct stage handle;
+	struct stage total;
+};
+
+struct standin {
+	struct lws_context *context;
+	struct lws *wsi;
+	pthread_t thread;
+	volatile bool stop;
+
+	struct {
+		unsigned char buf[LWS_PRE + CSMS_FRAME_MAXLEN];
+		size_t len;
+		int trace; /* call of the stand-in to be stamped when written */
+	} txq[CSMS_TXQ_LEN];
+	unsigned int txq_head;
+	unsigned int txq_tail;
+
+	char rx_id[ID_MAXLEN];
+	uint32_t transaction_id;
+};
+
+/* The calls of the transport made by the adapter, stamped on their way to
+ * the ones of ws.c. */
+struct transport {
+	struct server_api real;
+	uint64_t txbuf_taken;
+	struct trace *rx; /* the frame being decoded */
+};
+
+static const struct scenario scenarios[] = {
+	{ "BootNotification", OCPP_MSG_BOOTNOTIFICATION, false, false },
+	{ "Authorize", OCPP_MSG_AUTHORIZE, false, false },
+	{ "StartTransaction", OCPP_MSG_START_TRANSACTION, false, false },
+	{ "StopTransaction", OCPP_MSG_STOP_TRANSACTION, false, false },
+	{ "MeterValues", OCPP_MSG_METER_VALUES, false, true },
+	{ "GetConfiguration", OCPP_MSG_GET_CONFIGURATION, true, false },
+};
+
+static const struct {
+	const char *action;
+	const char *payload;
+} replies[] = {
+	{ "BootNotification", "{\"currentTime\":\"2024-01-01T00:00:00Z\","
+		"\"interval\":86400,\"status\":\"Accepted\"}" },
+	{ "Heartbeat", "{\"currentTime\":\"2024-01-01T00:00:00Z\"}" },
+	{ "Authorize", "{\"idTagInfo\":{\"status\":\"Accepted\"}}" },
+	{ "StopTransaction", "{\"idTagInfo\":{\"status\":\"Accepted\"}}" },
+};
+
+static char server_url[WS_URI_MAXLEN];
+
+static const struct {
+	const char *key;
+	const char *value;
+} settings[] = {
+	{ "device.id", "PZ00000001" },
+	{ "ocpp.vendor", "Pazzk" },
+	{ "ocpp.model", "EVSE-7kW" },
+	{ "net.server.url", server_url },
+};
+
+static struct standin standin;
+static struct transport transport;
+static struct ocpp_connector connector;
+
+/* Stamps written from the transport and stand-in threads are taken under
+ * the lock, and read back once the scenario is over. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace *traces;
+static struct trace stray;
+static size_t nr_traces;
+static size_t nr_sent; /* calls of the charger sent in the scenario */
+static size_t nr_done;
+static unsigned int base_id;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Pulls the first two strings out of a frame: the message ID, and the
+ * action of a call. */
+static int parse_frame(const char *frame, size_t len,
+		char *id, char *action, size_t bufsize)
+{
+	char *out[] = { id, action };
+	const char *end = frame + len;
+	const char *p = frame;
+
+	for (size_t i = 0; i < sizeof(out) / sizeof(*out); i++) {
+		const char *s = (const char *)memchr(p, '"',
+				(size_t)(end - p));
+		const char *e = s? (const char *)memchr(s + 1, '"',
+				(size_t)(end - s - 1)) : NULL;
+
+		if (!e || (size_t)(e - s - 1) >= bufsize) {
+			return i? 1 : 0;
+		}
+
+		memcpy(out[i], s + 1, (size_t)(e - s - 1));
+		out[i][e - s - 1] = '\0';
+		p = e + 1;
+	}
+
+	return 2;
+}
+
+/* The calls of the stand-in are numbered after the trace index, prefixed
+ * with 'c'. The calls of the charger are looked up by the ID the adapter
+ * gave them, starting from the one in flight. Anything else lands in a
+ * scratch trace. Called with the lock held. */
+static struct trace *get_trace(const char *id)
+{
+	char *end;
+	const unsigned long n = strtoul(id + 1, &end, 10);
+
+	if (id[0] == 'c' && end != id + 1 && *end == '\0') {
+		if (n < base_id || n - base_id >= nr_traces) {
+			return &stray;
+		}
+		return &traces[n - base_id];
+	}
+
+	for (size_t i = nr_sent; i-- > 0;) {
+		if (strcmp(traces[i].id, id) == 0) {
+			return &traces[i];
+		}
+	}
+
+	return &stray;
+}
+
+static struct trace *get_trace_of_frame(const void *frame, size_t len)
+{
+	char id[ID_MAXLEN];
+	char action[ID_MAXLEN];
+
+	if (parse_frame((const char *)frame, len, id, action, sizeof(id)) < 1) {
+		return &stray;
+	}
+
+	pthread_mutex_lock(&lock);
+	struct trace *trace = get_trace(id);
+	pthread_mutex_unlock(&lock);
+
+	return trace;
+}
+
+/* Called with the lock held. */
+static void mark_done(struct trace *trace, const uint64_t now)
+{
+	if (trace != &stray && !trace->done) {
+		trace->done = now;
+		nr_done++;
+	}
+}
+
+static void *stamp_txbuf(struct server *self, size_t *bufsize)
+{
+	transport.txbuf_taken = get_time_ns();
+	return transport.real.txbuf(self, bufsize);
+}
+
+/* The calls of the charger go out in the order they are made. */
+static int stamp_send(struct server *self, const void *data,
+		const size_t datasize)
+{
+	const uint64_t encoded = get_time_ns();
+	const char *frame = (const char *)data;
+	struct trace *trace;
+
+	if (datasize > 3 && strncmp(frame, "[2,", 3) == 0) {
+		char action[ID_MAXLEN];
+
+		pthread_mutex_lock(&lock);
+		trace = nr_sent < nr_traces? &traces[nr_sent++] : &stray;
+		if (parse_frame(frame, datasize, trace->id, action,
+				sizeof(trace->id)) < 1) {
+			trace->id[0] = '\0';
+		}
+		pthread_mutex_unlock(&lock);
+	} else {
+		trace = get_trace_of_frame(data, datasize);
+	}
+
+	trace->send = transport.txbuf_taken;
+	trace->encoded = encoded;
+	trace->tx_bytes = datasize;
+
+	const int err = transport.real.send(self, data, datasize);
+	trace->sent = get_time_ns();
+
+	return err;
+}
+
+static int stamp_peek(struct server *self, const void **msg)
+{
+	const uint64_t now = get_time_ns();
+	const int len = transport.real.peek(self, msg);
+
+	if (len < 0) {
+		return len;
+	}
+
+	struct trace *trace = get_trace_of_frame(*msg, (size_t)len);
+
+	/* the receive callback runs after the message is queued */
+	pthread_mutex_lock(&lock);
+	if (!trace->arrived) {
+		trace->arrived = now;
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!trace->recv) {
+		trace->recv = now;
+		trace->rx_bytes = (size_t)len;
+	}
+	transport.rx = trace;
+
+	return len;
+}
+
+static int stamp_consume(struct server *self)
+{
+	if (transport.rx) {
+		transport.rx->decoded = get_time_ns();
+	}
+
+	return transport.real.consume(self);
+}
+
+/* Runs in the thread of the transport as soon as a chunk of a message
+ * arrives, before the charger sees it. */
+static void on_transport_receive(struct ws_server *srv,
+		const void *data, const size_t datasize, void *ctx)
+{
+	(void)srv;
+	(void)ctx;
+
+	if (datasize == 0 || ((const char *)data)[0] != '[') {
+		return; /* not the first chunk of a frame */
+	}
+
+	const uint64_t now = get_time_ns();
+	struct trace *trace = get_trace_of_frame(data, datasize);
+
+	pthread_mutex_lock(&lock);
+	if (!trace->arrived) {
+		trace->arrived = now;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+struct server *__real_ws_create_server(const struct ws_param *param,
+		ws_receive_cb_t cb, void *cb_ctx);
+struct server *__wrap_ws_create_server(const struct ws_param *param,
+		ws_receive_cb_t cb, void *cb_ctx);
+
+/* The transport csms.c creates, with the calls the adapter makes to it
+ * replaced in place by the stamping ones. */
+struct server *__wrap_ws_create_server(const struct ws_param *param,
+		ws_receive_cb_t cb, void *cb_ctx)
+{
+	(void)cb;
+	(void)cb_ctx;
+
+	struct server *srv = __real_ws_create_server(param,
+			on_transport_receive, NULL);
+
+	if (srv) {
+		struct server_api *api = (struct server_api *)srv;
+
+		transport.real = *api;
+		api->txbuf = stamp_txbuf;
+		api->send = stamp_send;
+		api->peek = stamp_peek;
+		api->consume = stamp_consume;
+	}
+
+	return srv;
+}
+
+/* The charger on top of csms.c. Results are where a round trip ends, and
+ * GetConfiguration is answered the way handler.c does. */
+void handler_process(struct ocpp_charger *charger,
+		const struct ocpp_message *message)
+{
+	(void)charger;
+
+	const uint64_t now = get_time_ns();
+	struct trace *trace = transport.rx;
+
+	if (!trace || strcmp(trace->id, message->id) != 0) {
+		trace = &stray;
+	}
+
+	if (message->role == OCPP_MSG_ROLE_CALL) {
+		trace->handled = now;
+		csms_response(message->type, message, NULL, NULL);
+	} else {
+		pthread_mutex_lock(&lock);
+		mark_done(trace, now);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+static int standin_queue(const int trace, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+static int standin_queue(const int trace, const char *fmt, ...)
+{
+	int err = -ENOBUFS;
+
+	pthread_mutex_lock(&lock);
+
+	if (standin.txq_tail - standin.txq_head < CSMS_TXQ_LEN) {
+		const unsigned int i = standin.txq_tail % CSMS_TXQ_LEN;
+		va_list ap;
+
+		va_start(ap, fmt);
+		const int len = vsnprintf(
+				(char *)&standin.txq[i].buf[LWS_PRE],
+				CSMS_FRAME_MAXLEN, fmt, ap);
+		va_end(ap);
+
+		if (len > 0 && len < CSMS_FRAME_MAXLEN) {
+			standin.txq[i].len = (size_t)len;
+			standin.txq[i].trace = trace;
+			standin.txq_tail++;
+			err = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return err;
+}
+
+static void standin_write(struct lws *wsi)
+{
+	pthread_mutex_lock(&lock);
+
+	if (standin.txq_head != standin.txq_tail) {
+		const unsigned int i = standin.txq_head++ % CSMS_TXQ_LEN;
+
+		if (standin.txq[i].trace >= 0 &&
+				(size_t)standin.txq[i].trace < nr_traces) {
+			traces[standin.txq[i].trace].push = get_time_ns();
+		}
+
+		lws_write(wsi, &standin.txq[i].buf[LWS_PRE],
+				standin.txq[i].len, LWS_WRITE_TEXT);
+	}
+
+	if (standin.txq_head != standin.txq_tail) {
+		lws_callback_on_writable(wsi);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static const char *get_reply(const char *action)
+{
+	for (size_t i = 0; i < sizeof(replies) / sizeof(*replies); i++) {
+		if (strcmp(replies[i].action, action) == 0) {
+			return replies[i].payload;
+		}
+	}
+
+	return "{}";
+}
+
+/* Calls of the charger are answered right away, and the results to the
+ * calls of the stand-in complete them. */
+static void standin_receive(struct lws *wsi, const char *data, size_t len)
+{
+	char action[ID_MAXLEN];
+
+	if (lws_is_first_fragment(wsi)) {
+		const int n = parse_frame(data, len,
+				standin.rx_id, action, sizeof(action));
+
+		if (n == 2 && strncmp(data, "[2,", 3) == 0) { /* a call */
+			if (strcmp(action, "StartTransaction") == 0) {
+				pthread_mutex_lock(&lock);
+				const uint32_t transaction_id =
+					++standin.transaction_id;
+				pthread_mutex_unlock(&lock);
+				standin_queue(-1, "[3,\"%s\",{\"idTagInfo\":"
+						"{\"status\":\"Accepted\"},"
+						"\"transactionId\":%u}]",
+						standin.rx_id, transaction_id);
+			} else {
+				standin_queue(-1, "[3,\"%s\",%s]",
+						standin.rx_id,
+						get_reply(action));
+			}
+			lws_callback_on_writable(wsi);
+		} else if (n < 1) {
+			standin.rx_id[0] = '\0';
+		}
+	}
+
+	if (lws_is_final_fragment(wsi) && standin.rx_id[0] == 'c') {
+		pthread_mutex_lock(&lock);
+		mark_done(get_trace(standin.rx_id), get_time_ns());
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+static int on_standin_event(struct lws *wsi,
+		enum lws_callback_reasons reason,
+		void *user, void *in, size_t len)
+{
+	(void)user;
+
+	switch (reason) {
+	case LWS_CALLBACK_ESTABLISHED:
+		pthread_mutex_lock(&lock);
+		standin.wsi = wsi;
+		pthread_mutex_unlock(&lock);
+		break;
+	case LWS_CALLBACK_CLOSED:
+		pthread_mutex_lock(&lock);
+		standin.wsi = NULL;
+		pthread_mutex_unlock(&lock);
+		break;
+	case LWS_CALLBACK_RECEIVE:
+		standin_receive(wsi, (const char *)in, len);
+		break;
+	case LWS_CALLBACK_SERVER_WRITEABLE:
+		standin_write(wsi);
+		break;
+	case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+		if (standin.wsi) {
+			lws_callback_on_writable(standin.wsi);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static const struct lws_protocols standin_protocols[] = {
+	{
+		.name = "ocpp1.6",
+		.callback = on_standin_event,
+		.rx_buffer_size = 4096,
+	},
+	LWS_PROTOCOL_LIST_TERM,
+};
+
+static void *standin_thread(void *arg)
+{
+	(void)arg;
+
+	while (!standin.stop) {
+		lws_service(standin.context, 0);
+	}
+
+	return NULL;
+}
+
+static int standin_start(const int port)
+{
+	struct lws_context_creation_info info;
+
+	memset(&info, 0, sizeof(info));
+	info.port = port;
+	info.iface = "127.0.0.1";
+	info.protocols = standin_protocols;
+
+	if (!(standin.context = lws_create_context(&info))) {
+		return -EADDRINUSE;
+	}
+
+	if (pthread_create(&standin.thread, NULL, standin_thread, NULL) != 0) {
+		lws_context_destroy(standin.context);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+static void standin_stop(void)
+{
+	standin.stop = true;
+	lws_cancel_service(standin.context);
+	pthread_join(standin.thread, NULL);
+	lws_context_destroy(standin.context);
+}
+
+/* A call from the stand-in, written out from its own thread. */
+static int standin_call(const ocpp_message_t type, const size_t index)
+{
+	struct trace *trace = &traces[index];
+
+	pthread_mutex_lock(&lock);
+	snprintf(trace->id, sizeof(trace->id), "c%u",
+			base_id + (unsigned int)index);
+	pthread_mutex_unlock(&lock);
+
+	const int err = standin_queue((int)index, "[2,\"%s\",\"%s\",{}]",
+			trace->id, ocpp_stringify_type(type));
+
+	if (!err) {
+		lws_cancel_service(standin.context);
+	}
+
+	return err;
+}
+
+/* Configuration and connector state the adapter reads while building the
+ * requests. Nothing here is on the measured path. */
+int config_get(const char *key, void *buf, size_t bufsize)
+{
+	memset(buf, 0, bufsize);
+
+	for (size_t i = 0; i < sizeof(settings) / sizeof(*settings); i++) {
+		if (strcmp(settings[i].key, key) == 0) {
+			snprintf((char *)buf, bufsize, "%s", settings[i].value);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+int config_set(const char *key, const void *data, size_t datasize)
+{
+	(void)key;
+	(void)data;
+	(void)datasize;
+	return 0;
+}
+
+bool config_is_zeroed(const char *key)
+{
+	(void)key;
+	return true;
+}
+
+ocpp_connector_state_t ocpp_connector_state(struct ocpp_connector *oc)
+{
+	(void)oc;
+	return (ocpp_connector_state_t)0;
+}
+
+ocpp_status_t ocpp_connector_map_state_to_ocpp(ocpp_connector_state_t state)
+{
+	(void)state;
+	return OCPP_STATUS_AVAILABLE;
+}
+
+ocpp_error_t ocpp_connector_map_error_to_ocpp(connector_error_t error)
+{
+	(void)error;
+	return OCPP_ERROR_NONE;
+}
+
+bool ocpp_connector_is_unavailable(const struct ocpp_connector *oc)
+{
+	(void)oc;
+	return false;
+}
+
+bool ocpp_connector_is_session_pending(const struct ocpp_connector *oc)
+{
+	(void)oc;
+	return false;
+}
+
+ocpp_charger_reboot_t
+ocpp_charger_get_pending_reboot_type(const struct charger *charger)
+{
+	(void)charger;
+	return OCPP_CHARGER_REBOOT_NONE;
+}
+
+static void prepare_connector(const ocpp_message_t type)
+{
+	connector.now = time(NULL);
+
+	pthread_mutex_lock(&lock);
+	connector.session.transaction_id = standin.transaction_id;
+	pthread_mutex_unlock(&lock);
+
+	switch (type) {
+	case OCPP_MSG_AUTHORIZE:
+		memcpy(connector.session.auth.trial.uid, ID_TAG,
+				sizeof(ID_TAG) - 1);
+		break;
+	case OCPP_MSG_START_TRANSACTION:
+		memcpy(connector.session.auth.current.uid, ID_TAG,
+				sizeof(ID_TAG) - 1);
+		connector.session.metering.start_wh = 1234567;
+		break;
+	case OCPP_MSG_STOP_TRANSACTION:
+		connector.session.metering.stop_wh = 1244567;
+		break;
+	case OCPP_MSG_METER_VALUES:
+		connector.session.metering.wh = 1240000;
+		connector.session.metering.watt = 7040;
+		connector.session.metering.milliamp = 32012;
+		connector.session.metering.millivolt = 230107;
+		connector.session.metering.context =
+			OCPP_READ_CTX_SAMPLE_PERIODIC;
+		break;
+	default:
+		break;
+	}
+}
+
+/* A MeterValues request goes out with the last sample of its batch. */
+static int request(const ocpp_message_t type)
+{
+	if (type != OCPP_MSG_METER_VALUES) {
+		return csms_request(type, &connector, NULL);
+	}
+
+	int err = 0;
+
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX && !err; i++) {
+		err = csms_request(type, &connector,
+				(void *)(uintptr_t)MEASURANDS);
+	}
+
+	return err;
+}
+
+/* Makes a request of the charger, making room in the OCPP core first if
+ * its queue is full. */
+static int push(const ocpp_message_t type, const size_t index)
+{
+	const uint64_t deadline = get_time_ns() + TIMEOUT_NS;
+	int err;
+
+	do {
+		prepare_connector(type);
+
+		traces[index].push = get_time_ns();
+		if ((err = request(type)) < 0) {
+			ocpp_step();
+		}
+	} while (err < 0 && get_time_ns() < deadline);
+
+	return err;
+}
+
+static bool is_done(const size_t expected)
+{
+	pthread_mutex_lock(&lock);
+	const bool done = nr_done >= expected;
+	pthread_mutex_unlock(&lock);
+	return done;
+}
+
+static int wait_for(const size_t expected)
+{
+	const uint64_t deadline = get_time_ns() + TIMEOUT_NS;
+
+	while (!is_done(expected)) {
+		if (get_time_ns() > deadline) {
+			return -ETIMEDOUT;
+		}
+		ocpp_step();
+	}
+
+	return 0;
+}
+
+static void get_stage(struct stage *stage, uint32_t *times, const size_t n,
+		const size_t offset_from, const size_t offset_to)
+{
+	for (size_t i = 0; i < n; i++) {
+		const uint64_t from = *(const uint64_t *)
+			(const void *)((const uint8_t *)&traces[i] +
+					offset_from);
+		const uint64_t to = *(const uint64_t *)
+			(const void *)((const uint8_t *)&traces[i] +
+					offset_to);
+		times[i] = to > from? (uint32_t)(to - from) : 0;
+	}
+
+	qsort(times, n, sizeof(*times), compare_u32);
+
+	stage->p50 = times[n / 2];
+	stage->p99 = times[(n * 99) / 100];
+}
+
+#define STAGE(stage, from, to)		get_stage(&result->stage, times, n, \
+		offsetof(struct trace, from), offsetof(struct trace, to))
+
+static void summarize(struct result *result, const size_t n,
+		uint32_t *times, const bool from_csms)
+{
+	for (size_t i = 0; i < n; i++) {
+		result->tx_bytes += traces[i].tx_bytes;
+		result->rx_bytes += traces[i].rx_bytes;
+	}
+	result->tx_bytes /= n;
+	result->rx_bytes /= n;
+
+	STAGE(encode, send, encoded);
+	STAGE(send, encoded, sent);
+	STAGE(rxq, arrived, recv);
+	STAGE(decode, recv, decoded);
+	STAGE(total, push, done);
+
+	if (from_csms) {
+		STAGE(queue, handled, send);
+		STAGE(wait, push, arrived);
+		STAGE(handle, decoded, handled);
+	} else {
+		STAGE(queue, push, send);
+		STAGE(wait, sent, arrived);
+		STAGE(handle, decoded, done);
+	}
+}
+
+static void run(struct result *result, const struct scenario *scenario,
+		const size_t iterations, const size_t burst, uint32_t *times)
+{
+	const size_t per_round = scenario->burst? burst : 1;
+	const size_t n = iterations * per_round;
+
+	memset(result, 0, sizeof(*result));
+	result->name = scenario->name;
+
+	pthread_mutex_lock(&lock);
+	memset(traces, 0, n * sizeof(*traces));
+	base_id += (unsigned int)nr_traces;
+	nr_traces = n;
+	nr_sent = 0;
+	nr_done = 0;
+	pthread_mutex_unlock(&lock);
+
+	const uint64_t t0 = get_time_ns();
+
+	for (size_t i = 0; i < n && !result->err; i += per_round) {
+		for (size_t j = i; j < i + per_round; j++) {
+			if ((result->err = scenario->from_csms?
+					standin_call(scenario->type, j) :
+					push(scenario->type, j)) < 0) {
+				break;
+			}
+		}
+
+		if (!result->err) {
+			result->err = wait_for(i + per_round);
+		}
+	}
+
+	const uint64_t elapsed = get_time_ns() - t0;
+
+	pthread_mutex_lock(&lock);
+	result->count = nr_done;
+	pthread_mutex_unlock(&lock);
+
+	if (result->err) {
+		return;
+	}
+
+	result->per_sec = (double)n * 1e9 / (double)elapsed;
+	summarize(result, n, times, scenario->from_csms);
+}
+
+static void print_stage(const char *name, const struct stage *stage)
+{
+	printf(",\"%s_p50_ns\":%u,\"%s_p99_ns\":%u", name,
+			(unsigned int)stage->p50, name,
+			(unsigned int)stage->p99);
+}
+
+static void print_result(const struct result *result, const size_t burst)
+{
+	printf("{\"bench\":\"ocpp_roundtrip\",\"message\":\"%s\"",
+			result->name);
+
+	if (result->err < 0) {
+		printf(",\"error\":%d,\"completed\":%zu}\n",
+				result->err, result->count);
+		fflush(stdout);
+		return;
+	}
+
+	printf(",\"count\":%zu,\"burst\":%zu,\"per_sec\":%.1f"
+			",\"tx_bytes\":%zu,\"rx_bytes\":%zu",
+			result->count, burst, result->per_sec,
+			result->tx_bytes, result->rx_bytes);
+	print_stage("queue", &result->queue);
+	print_stage("encode", &result->encode);
+	print_stage("send", &result->send);
+	print_stage("wait", &result->wait);
+	print_stage("rxq", &result->rxq);
+	print_stage("decode", &result->decode);
+	print_stage("handle", &result->handle);
+	print_stage("total", &result->total);
+	printf("}\n");
+	fflush(stdout);
+}
+
+static bool is_connected(void)
+{
+	pthread_mutex_lock(&lock);
+	const bool accepted = standin.wsi != NULL;
+	pthread_mutex_unlock(&lock);
+
+	return accepted && csms_is_up();
+}
+
+/* csms.c connects to the URL in the configuration, with the name of the
+ * board appended as the path. */
+static int connect_charger(const int port)
+{
+	int err;
+
+	snprintf(server_url, sizeof(server_url), "ws://127.0.0.1:%d", port);
+
+	if ((err = csms_init(NULL)) < 0) {
+		return err;
+	}
+
+	const uint64_t deadline = get_time_ns() + TIMEOUT_NS;
+
+	while (!is_connected()) {
+		if (get_time_ns() > deadline) {
+			return -ETIMEDOUT;
+		}
+		usleep(1000);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t iterations = DEFAULT_ITERATIONS;
+	size_t burst = DEFAULT_BURST;
+	int port = DEFAULT_PORT;
+	struct result result;
+	int opt;
+	int err;
+
+	while ((opt = getopt(argc, argv, "i:b:p:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			burst = (size_t)strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			port = (int)strtol(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i %d] [-b %d] [-p %d]\n",
+					argv[0], DEFAULT_ITERATIONS,
+					DEFAULT_BURST, DEFAULT_PORT);
+			return 1;
+		}
+	}
+
+	if (iterations == 0 || iterations > MAX_ITERATIONS) {
+		iterations = DEFAULT_ITERATIONS;
+	}
+	if (burst == 0 || burst > MAX_BURST) {
+		burst = DEFAULT_BURST;
+	}
+
+	lws_set_log_level(LLL_ERR, NULL);
+
+	traces = (struct trace *)calloc(iterations * burst, sizeof(*traces));
+	uint32_t *times = (uint32_t *)malloc(iterations * burst *
+			sizeof(*times));
+
+	if (!traces || !times) {
+		return 1;
+	}
+
+	connector.base.id = 1;
+
+	if ((err = standin_start(port)) < 0 ||
+			(err = connect_charger(port)) < 0) {
+		fprintf(stderr, "failed to set up: %d\n", err);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(*scenarios); i++) {
+		run(&result, &scenarios[i], iterations, burst, times);
+		print_result(&result, scenarios[i].burst? burst : 1);
+	}
+
+	standin_stop();
+	free(times);
+	free(traces);
+
+	return 0;
+}
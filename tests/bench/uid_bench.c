@@ -0,0 +1,612 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+/* Host benchmark of the UID store on littlefs over a RAM flash.
+ *
+ * Each run populates a namespace with N IDs of a given distribution and
+ * measures lookups, updates and clearing. One JSON object per run is
+ * printed to stdout, so results can be diffed or plotted across commits:
+ *
+ *   uid_bench [-n 1000,10000,100000] [-d uniform,skewed,adversarial]
+ *
+ * Latencies are in nanoseconds and flash traffic in bytes. Traffic does not
+ * depend on the host, so it is the one to watch for regressions. */
+
+#include "uid.h"
+#include "uid_snapshot.h"
+#include "flash_mmap.h"
+#include "fs/fs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#if !defined(LFS_FLASH_SIZE)
+#define LFS_FLASH_SIZE			(8 * 1024 * 1024)
+#endif
+
+/* Same as the local list in app.c */
+#if !defined(BENCH_CACHE_CAPACITY)
+#define BENCH_CACHE_CAPACITY		1024
+#endif
+#if !defined(BENCH_RAM_BUDGET)
+#define BENCH_RAM_BUDGET		(60U * 1024U)
+#endif
+#if !defined(BENCH_BLOOM_SIZE)
+#define BENCH_BLOOM_SIZE		8192
+#endif
+
+#define BENCH_NS			"localList"
+#define UID_LEN				7 /* ISO/IEC 14443 double size UID */
+#define NR_LOOKUPS			1000
+#define NR_WARM_IDS			256 /* fits in the cache */
+#define NR_UPDATES			256
+#define SNAPSHOT_RECORD_SIZE		54
+#define SNAPSHOT_SECTOR_SIZE		4096
+
+#define DEFAULT_SIZES			"1000,10000,100000"
+#define DEFAULT_DISTRIBUTIONS		"uniform,skewed,adversarial"
+
+#define MAX_SIZES			8
+
+#if !defined(MIN)
+#define MIN(a, b)			(((a) > (b))? (b) : (a))
+#endif
+
+struct traffic {
+	uint64_t read;
+	uint64_t written;
+	uint64_t erased;
+};
+
+struct flash {
+	struct flash_api api;
+	uint8_t *mem;
+	size_t size;
+	struct traffic traffic;
+};
+
+struct percentiles {
+	uint32_t p50;
+	uint32_t p90;
+	uint32_t p99;
+	uint32_t max;
+};
+
+typedef void (*id_generator_t)(uid_id_t id);
+
+struct distribution {
+	const char *name;
+	id_generator_t generate;
+};
+
+struct result {
+	size_t nr_ids;
+	const char *distribution;
+
+	uint32_t populate_ms;
+	uint64_t populate_written_bytes;
+	uint32_t open_ms;
+	uint64_t open_read_bytes;
+	size_t flash_used;
+
+	struct percentiles cold;
+	struct percentiles warm;
+	struct percentiles miss;
+	uint64_t cold_read_bytes;
+
+	bool snapshot;
+	uint32_t snapshot_build_ms;
+	struct percentiles snapshot_hit;
+
+	uint32_t update_ops_per_sec;
+	uint64_t update_written_bytes;
+	uint32_t clear_ms;
+	int err;
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t get_random(void)
+{
+	/* xorshift64*, seeded the same every run for comparable results */
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t)((rng_state * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static void fill_random(uint8_t *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		p[i] = (uint8_t)get_random();
+	}
+}
+
+/* Spread evenly over all the bucket files. */
+static void generate_uniform(uid_id_t id)
+{
+	memset(id, 0, sizeof(uid_id_t));
+	fill_random(id, UID_LEN);
+}
+
+/* Real cards share the manufacturer byte, e.g. 0x04 for NXP, and the next
+ * byte leans towards low values, so a few buckets get most of the IDs. */
+static void generate_skewed(uid_id_t id)
+{
+	generate_uniform(id);
+	id[0] = 0x04;
+	id[1] = (uint8_t)((get_random() & 0xff) * (get_random() & 0xff)
+			/ 0xff * (get_random() & 0xff) / 0xff);
+}
+
+/* Every ID lands in the same bucket file. */
+static void generate_adversarial(uid_id_t id)
+{
+	generate_uniform(id);
+	id[0] = 0x04;
+	id[1] = 0x00;
+}
+
+static const struct distribution distributions[] = {
+	{ "uniform", generate_uniform },
+	{ "skewed", generate_skewed },
+	{ "adversarial", generate_adversarial },
+};
+
+static int do_erase(struct flash *self, uintptr_t offset, size_t size)
+{
+	if (offset + size > self->size) {
+		return -ERANGE;
+	}
+
+	memset(&self->mem[offset], 0xff, size);
+	self->traffic.erased += size;
+
+	return 0;
+}
+
+static int do_write(struct flash *self,
+		uintptr_t offset, const void *data, size_t len)
+{
+	if (offset + len > self->size) {
+		return -ERANGE;
+	}
+
+	memcpy(&self->mem[offset], data, len);
+	self->traffic.written += len;
+
+	return 0;
+}
+
+static int do_read(struct flash *self, uintptr_t offset, void *buf, size_t len)
+{
+	if (offset + len > self->size) {
+		return -ERANGE;
+	}
+
+	memcpy(buf, &self->mem[offset], len);
+	self->traffic.read += len;
+
+	return 0;
+}
+
+static size_t do_size(struct flash *self)
+{
+	return self->size;
+}
+
+const void *flash_mmap(struct flash *flash, size_t *size)
+{
+	if (size) {
+		*size = flash->size;
+	}
+
+	return flash->mem;
+}
+
+static int init_flash(struct flash *flash, size_t size)
+{
+	*flash = (struct flash) {
+		.api = {
+			.erase = do_erase,
+			.write = do_write,
+			.read = do_read,
+			.size = do_size,
+		},
+		.size = size,
+	};
+
+	if ((flash->mem = (uint8_t *)malloc(size)) == NULL) {
+		return -ENOMEM;
+	}
+
+	memset(flash->mem, 0xff, size);
+
+	return 0;
+}
+
+static void deinit_flash(struct flash *flash)
+{
+	free(flash->mem);
+	flash->mem = NULL;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t elapsed_ns(const uint64_t t0)
+{
+	return (uint32_t)(get_time_ns() - t0);
+}
+
+static uint32_t elapsed_ms(const uint64_t t0)
+{
+	return (uint32_t)((get_time_ns() - t0) / 1000000u);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static struct percentiles get_percentiles(uint32_t *samples, size_t n)
+{
+	if (!n) {
+		return (struct percentiles) { 0, };
+	}
+
+	qsort(samples, n, sizeof(*samples), compare_u32);
+
+	return (struct percentiles) {
+		.p50 = samples[n * 50 / 100],
+		.p90 = samples[n * 90 / 100],
+		.p99 = samples[n * 99 / 100],
+		.max = samples[n - 1],
+	};
+}
+
+static struct uid_store *open_store(struct fs *fs,
+		struct uid_snapshot *snapshot)
+{
+	return uid_store_create(&(const struct uid_store_config) {
+		.fs = fs,
+		.ns = BENCH_NS,
+		.capacity = BENCH_CACHE_CAPACITY,
+		.ram_budget = BENCH_RAM_BUDGET,
+		.bloom_size = BENCH_BLOOM_SIZE,
+		.snapshot = snapshot,
+	});
+}
+
+static struct percentiles measure_lookups(struct uid_store *store,
+		const struct uid_batch_entry *entries, size_t nr_entries,
+		const size_t nr_lookups, uint32_t *samples)
+{
+	for (size_t i = 0; i < nr_lookups; i++) {
+		const struct uid_batch_entry *p = &entries[i % nr_entries];
+		const uint64_t t0 = get_time_ns();
+
+		if (uid_status(store, p->id, NULL, NULL) != p->status) {
+			fprintf(stderr, "lookup mismatch at %zu\n", i);
+		}
+
+		samples[i] = elapsed_ns(t0);
+	}
+
+	return get_percentiles(samples, nr_lookups);
+}
+
+static struct percentiles measure_misses(struct uid_store *store,
+		id_generator_t generate, uint32_t *samples)
+{
+	for (size_t i = 0; i < NR_LOOKUPS; i++) {
+		uid_id_t id;
+		generate(id);
+		id[UID_LEN] = 0xff; /* never stored */
+
+		const uint64_t t0 = get_time_ns();
+		uid_status(store, id, NULL, NULL);
+		samples[i] = elapsed_ns(t0);
+	}
+
+	return get_percentiles(samples, NR_LOOKUPS);
+}
+
+/* The snapshot gets a partition sized for the run rather than the one on
+ * target, so that it can be compared at every size. */
+static void measure_snapshot(struct result *result, struct fs *fs,
+		struct uid_batch_entry *entries, uint32_t *samples)
+{
+	struct flash flash;
+	struct uid_snapshot *snapshot;
+	struct uid_store *store;
+	const size_t size = (SNAPSHOT_SECTOR_SIZE + result->nr_ids *
+			(SNAPSHOT_RECORD_SIZE + 2) + SNAPSHOT_SECTOR_SIZE) /
+			SNAPSHOT_SECTOR_SIZE * SNAPSHOT_SECTOR_SIZE;
+
+	if (init_flash(&flash, size) < 0) {
+		return;
+	}
+
+	if ((snapshot = uid_snapshot_create(&flash)) == NULL ||
+			(store = open_store(fs, snapshot)) == NULL) {
+		goto out;
+	}
+
+	const uint64_t t0 = get_time_ns();
+	if (uid_refresh_snapshot(store) == 0) {
+		result->snapshot = true;
+		result->snapshot_build_ms = elapsed_ms(t0);
+		result->snapshot_hit = measure_lookups(store, entries,
+				result->nr_ids, NR_LOOKUPS, samples);
+	}
+
+	uid_store_destroy(store);
+out:
+	uid_snapshot_destroy(snapshot);
+	deinit_flash(&flash);
+}
+
+static void run(struct result *result, struct flash *flash,
+		const struct distribution *dist, const size_t nr_ids)
+{
+	struct uid_batch_entry *entries;
+	uint32_t *samples;
+	struct uid_store *store;
+	struct fs *fs;
+	uint64_t t0;
+
+	*result = (struct result) {
+		.nr_ids = nr_ids,
+		.distribution = dist->name,
+	};
+
+	memset(flash->mem, 0xff, flash->size);
+	fs = fs_create(flash);
+
+	entries = (struct uid_batch_entry *)calloc(nr_ids, sizeof(*entries));
+	samples = (uint32_t *)calloc(NR_LOOKUPS, sizeof(*samples));
+
+	if (!fs || !entries || !samples || fs_mount(fs) < 0) {
+		result->err = -ENOMEM;
+		goto out;
+	}
+
+	for (size_t i = 0; i < nr_ids; i++) {
+		dist->generate(entries[i].id);
+		entries[i].status = UID_STATUS_ACCEPTED;
+	}
+
+	if ((store = open_store(fs, NULL)) == NULL) {
+		result->err = -ENOMEM;
+		goto out_unmount;
+	}
+
+	/* Populate the way SendLocalList does. */
+	uint64_t written0 = flash->traffic.written;
+	t0 = get_time_ns();
+	result->err = uid_update_batch(store, entries, nr_ids,
+			UID_BATCH_FULL, 1);
+	result->populate_ms = elapsed_ms(t0);
+	result->populate_written_bytes = flash->traffic.written - written0;
+	uid_store_destroy(store);
+
+	if (result->err < 0) {
+		goto out_unmount;
+	}
+
+	fs_usage(fs, &result->flash_used, NULL);
+
+	/* A fresh instance, so that every first lookup misses the cache. */
+	uint64_t read0 = flash->traffic.read;
+	t0 = get_time_ns();
+	store = open_store(fs, NULL);
+	result->open_ms = elapsed_ms(t0);
+	result->open_read_bytes = flash->traffic.read - read0;
+
+	const size_t nr_cold = MIN(nr_ids, (size_t)NR_LOOKUPS);
+	const size_t nr_warm = MIN(nr_ids, (size_t)NR_WARM_IDS);
+
+	read0 = flash->traffic.read;
+
+	result->cold = measure_lookups(store, entries, nr_ids,
+			nr_cold, samples);
+	result->cold_read_bytes = (flash->traffic.read - read0) / nr_cold;
+
+	/* The first pass loads the working set into the cache. */
+	measure_lookups(store, entries, nr_warm, NR_LOOKUPS, samples);
+	result->warm = measure_lookups(store, entries, nr_warm,
+			NR_LOOKUPS, samples);
+	result->miss = measure_misses(store, dist->generate, samples);
+
+	uid_store_destroy(store);
+	measure_snapshot(result, fs, entries, samples);
+	store = open_store(fs, NULL);
+
+	written0 = flash->traffic.written;
+	t0 = get_time_ns();
+	for (size_t i = 0; i < NR_UPDATES; i++) {
+		uid_id_t id;
+		dist->generate(id);
+		uid_update(store, id, NULL, UID_STATUS_ACCEPTED, 0);
+	}
+	const uint64_t update_ns = get_time_ns() - t0;
+	result->update_ops_per_sec = (uint32_t)((uint64_t)NR_UPDATES *
+			1000000000u / (update_ns? update_ns : 1));
+	result->update_written_bytes =
+		(flash->traffic.written - written0) / NR_UPDATES;
+
+	t0 = get_time_ns();
+	uid_clear(store);
+	result->clear_ms = elapsed_ms(t0);
+
+	uid_store_destroy(store);
+out_unmount:
+	fs_unmount(fs);
+out:
+	fs_destroy(fs);
+	free(samples);
+	free(entries);
+}
+
+static void print_percentiles(const char *name, const struct percentiles *p)
+{
+	printf(",\"%s\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}", name,
+			(unsigned int)p->p50, (unsigned int)p->p90,
+			(unsigned int)p->p99, (unsigned int)p->max);
+}
+
+static void print_result(const struct result *result)
+{
+	printf("{\"bench\":\"uid\",\"ids\":%zu,\"distribution\":\"%s\"",
+			result->nr_ids, result->distribution);
+
+	if (result->err < 0) {
+		printf(",\"error\":%d}\n", result->err);
+		return;
+	}
+
+	printf(",\"populate_ms\":%u,\"populate_written_bytes\":%llu"
+			",\"open_ms\":%u,\"open_read_bytes\":%llu"
+			",\"flash_used\":%zu",
+			(unsigned int)result->populate_ms,
+			(unsigned long long)result->populate_written_bytes,
+			(unsigned int)result->open_ms,
+			(unsigned long long)result->open_read_bytes,
+			result->flash_used);
+	print_percentiles("cold_ns", &result->cold);
+	printf(",\"cold_read_bytes\":%llu",
+			(unsigned long long)result->cold_read_bytes);
+	print_percentiles("warm_ns", &result->warm);
+	print_percentiles("miss_ns", &result->miss);
+
+	if (result->snapshot) {
+		printf(",\"snapshot_build_ms\":%u",
+				(unsigned int)result->snapshot_build_ms);
+		print_percentiles("snapshot_ns", &result->snapshot_hit);
+	}
+
+	printf(",\"update_ops_per_sec\":%u,\"update_written_bytes\":%llu"
+			",\"clear_ms\":%u}\n",
+			(unsigned int)result->update_ops_per_sec,
+			(unsigned long long)result->update_written_bytes,
+			(unsigned int)result->clear_ms);
+	fflush(stdout);
+}
+
+static size_t parse_sizes(char *str, size_t *sizes, size_t max)
+{
+	size_t n = 0;
+
+	for (char *tok = strtok(str, ","); tok && n < max;
+			tok = strtok(NULL, ",")) {
+		const unsigned long v = strtoul(tok, NULL, 10);
+		if (v) {
+			sizes[n++] = (size_t)v;
+		}
+	}
+
+	return n;
+}
+
+static bool is_selected(const char *name, const char *list)
+{
+	const size_t len = strlen(name);
+
+	for (const char *p = strstr(list, name); p; p = strstr(p + 1, name)) {
+		if ((p == list || p[-1] == ',') &&
+				(p[len] == '\0' || p[len] == ',')) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	char sizes_str[64] = DEFAULT_SIZES;
+	const char *dists = DEFAULT_DISTRIBUTIONS;
+	size_t sizes[MAX_SIZES];
+	struct flash flash;
+	struct result result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+		switch (opt) {
+		case 'n':
+			strncpy(sizes_str, optarg, sizeof(sizes_str) - 1);
+			break;
+		case 'd':
+			dists = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n %s] [-d %s]\n", argv[0],
+					DEFAULT_SIZES, DEFAULT_DISTRIBUTIONS);
+			return 1;
+		}
+	}
+
+	const size_t nr_sizes = parse_sizes(sizes_str, sizes, MAX_SIZES);
+
+	if (init_flash(&flash, LFS_FLASH_SIZE) < 0) {
+		fprintf(stderr, "failed to allocate %u bytes of flash\n",
+				(unsigned int)LFS_FLASH_SIZE);
+		return 1;
+	}
+
+	for (size_t i = 0; i < nr_sizes; i++) {
+		for (size_t j = 0; j < sizeof(distributions) /
+				sizeof(*distributions); j++) {
+			if (!is_selected(distributions[j].name, dists)) {
+				continue;
+			}
+
+			run(&result, &flash, &distributions[j], sizes[i]);
+			print_result(&result);
+		}
+	}
+
+	deinit_flash(&flash);
+
+	return 0;
+}
@@ -41,6 +41,33 @@ static int do_append(struct fs *self, const char *filepath,
 		.returnIntValue();
 }
 
+static int do_writev(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	return mock().actualCall(__func__)
+		.withParameter("filepath", filepath)
+		.withParameter("iov", iov)
+		.withParameter("iovcnt", iovcnt)
+		.returnIntValue();
+}
+
+static int do_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	return mock().actualCall(__func__)
+		.withParameter("filepath", filepath)
+		.withParameter("iov", iov)
+		.withParameter("iovcnt", iovcnt)
+		.returnIntValue();
+}
+
+static int do_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	return mock().actualCall(__func__)
+		.withParameter("filepath", filepath)
+		.withParameter("iov", iov)
+		.withParameter("iovcnt", iovcnt)
+		.returnIntValue();
+}
+
 static int do_erase(struct fs *self, const char *filepath) {
 	return mock().actualCall(__func__)
 		.withParameter("filepath", filepath)
@@ -74,6 +101,9 @@ struct fs *fs_create(struct flash *flash) {
 		.read = do_read,
 		.write = do_write,
 		.append = do_append,
+		.writev = do_writev,
+		.append_batch = do_append_batch,
+		.replace = do_replace,
 		.erase = do_erase,
 		.size = do_size,
 		.dir = do_dir,
@@ -32,6 +32,15 @@ COMPONENT_NAME = OcppMessage
 
 SRC_FILES = \
 	../src/charger/ocpp/adapter.c \
+	../src/charger/ocpp/registry.c \
+	../src/charger/ocpp/msgpool.c \
+	../src/charger/ocpp/txqueue.c \
+	../src/charger/ocpp/encoder_json.c \
+	../src/charger/ocpp/decoder_json.c \
+	../external/ocpp/src/strconv.c \
+	../external/libmcu/modules/common/src/crc32.c \
+	../external/libmcu/modules/common/src/strext.c \
+	../external/libmcu/modules/common/src/timext.c \
 	../external/libmcu/modules/metrics/src/metrics.c \
 	../external/libmcu/modules/metrics/src/metrics_overrides.c \
 
@@ -40,6 +49,7 @@ TEST_SRC_FILES = \
 	src/test_all.cpp \
 	stubs/logging.c \
 	stubs/logger.c \
+	../external/libmcu/tests/stubs/board.cpp \
 	../external/libmcu/tests/mocks/assert.cpp \
 
 INCLUDE_DIRS = \
@@ -32,6 +32,10 @@ COMPONENT_NAME = OcppDecoder
 
 SRC_FILES = \
 	../src/charger/ocpp/decoder_json.c \
+	../src/charger/ocpp/registry.c \
+	../src/charger/ocpp/msgpool.c \
+	../external/ocpp/src/strconv.c \
+	../external/libmcu/modules/common/src/timext.c \
 	../external/libmcu/modules/metrics/src/metrics.c \
 	../external/libmcu/modules/metrics/src/metrics_overrides.c \
 
@@ -40,6 +44,7 @@ TEST_SRC_FILES = \
 	src/test_all.cpp \
 	stubs/logging.c \
 	stubs/logger.c \
+	mocks/ocpp.cpp \
 	../external/libmcu/tests/mocks/assert.cpp \
 
 INCLUDE_DIRS = \
@@ -48,7 +53,6 @@ INCLUDE_DIRS = \
 	../include \
 	../src/charger/ocpp \
 	../external/ocpp/include \
-	../external/cJSON \
 	../external/libmcu/modules/common/include \
 	../external/libmcu/modules/logging/include \
 	../external/libmcu/modules/metrics/include \
@@ -32,6 +32,10 @@ COMPONENT_NAME = OcppEncoder
 
 SRC_FILES = \
 	../src/charger/ocpp/encoder_json.c \
+	../src/charger/ocpp/registry.c \
+	../external/ocpp/src/strconv.c \
+	../external/libmcu/modules/common/src/strext.c \
+	../external/libmcu/modules/common/src/timext.c \
 	../external/libmcu/modules/metrics/src/metrics.c \
 	../external/libmcu/modules/metrics/src/metrics_overrides.c \
 
@@ -40,6 +44,7 @@ TEST_SRC_FILES = \
 	src/test_all.cpp \
 	stubs/logging.c \
 	stubs/logger.c \
+	mocks/ocpp.cpp \
 	../external/libmcu/tests/mocks/assert.cpp \
 
 INCLUDE_DIRS = \
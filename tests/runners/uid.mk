@@ -32,10 +32,12 @@ COMPONENT_NAME = UID
 
 SRC_FILES = \
 	../src/uid.c \
+	../src/uid_snapshot.c \
 	../external/libmcu/modules/common/src/hexdump.c \
 
 TEST_SRC_FILES = \
 	src/uid_test.cpp \
+	src/uid_snapshot_test.cpp \
 	src/test_all.cpp \
 	stubs/logging.c \
 	../external/libmcu/tests/stubs/board.cpp \
@@ -33,16 +33,410 @@
 #include "CppUTest/TestHarness.h"
 #include "CppUTestExt/MockSupport.h"
 
+#include <string.h>
+
 #include "adapter.h"
+#include "ocpp_connector_internal.h"
+#include "charger/ocpp.h"
+#include "net/server.h"
+#include "config.h"
+#include "msgpool.h"
+#include "txqueue.h"
+#include "encoder_json.h"
+
+#define FILESIZE_MAX		4096
+
+struct server {
+	struct server_api api;
+};
+
+struct fs {
+	struct fs_api api;
+};
+
+static struct {
+	uint8_t data[FILESIZE_MAX];
+	size_t size;
+	bool exists;
+} file;
+
+static struct {
+	const char *rx;
+	char tx[256];
+	int txlen;
+	bool connected;
+} transport;
+
+static struct {
+	void *data;
+	size_t datasize;
+} pushed[8];
+static int npushed;
+
+static int fake_read(struct fs *self, const char *filepath,
+		const size_t offset, void *buf, const size_t bufsize) {
+	if (!file.exists) {
+		return -ENOENT;
+	} else if (offset >= file.size) {
+		return 0;
+	}
+	const size_t len = file.size - offset < bufsize?
+		file.size - offset : bufsize;
+	memcpy(buf, &file.data[offset], len);
+	return (int)len;
+}
+static int fake_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	int total = 0;
+	for (size_t i = 0; i < iovcnt; i++) {
+		memcpy(&file.data[file.size], iov[i].data, iov[i].datasize);
+		file.size += iov[i].datasize;
+		total += (int)iov[i].datasize;
+	}
+	file.exists = true;
+	return total;
+}
+static int fake_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	file.size = 0;
+	return fake_append_batch(self, filepath, iov, iovcnt);
+}
+static int fake_erase(struct fs *self, const char *filepath) {
+	const bool existed = file.exists;
+	file.exists = false;
+	file.size = 0;
+	return existed? 0 : -ENOENT;
+}
+static int fake_size(struct fs *self, const char *filepath, size_t *size) {
+	if (!file.exists) {
+		return -ENOENT;
+	}
+	*size = file.size;
+	return 0;
+}
+
+static int fake_send(struct server *self,
+		const void *data, const size_t datasize) {
+	memcpy(transport.tx, data, datasize);
+	transport.tx[datasize] = '\0';
+	transport.txlen = (int)datasize;
+	return (int)datasize;
+}
+static int fake_peek(struct server *self, const void **msg) {
+	if (!transport.rx) {
+		return -ENOENT;
+	}
+	*msg = transport.rx;
+	return (int)strlen(transport.rx);
+}
+static int fake_consume(struct server *self) {
+	transport.rx = NULL;
+	return 0;
+}
+static bool fake_connected(const struct server *self) {
+	return transport.connected;
+}
+
+static int push(const char *name, ocpp_message_t type,
+		const void *data, size_t datasize) {
+	const int err = mock().actualCall(name)
+		.withParameter("type", type)
+		.returnIntValueOrDefault(0);
+	if (!err) { /* freed by the test as it is by csms otherwise */
+		pushed[npushed].data = (void *)data;
+		pushed[npushed++].datasize = datasize;
+	}
+	return err;
+}
+int ocpp_push_request(ocpp_message_t type, const void *data, size_t datasize,
+		void *ctx) {
+	return push(__func__, type, data, datasize);
+}
+int ocpp_push_request_force(ocpp_message_t type, const void *data,
+		size_t datasize, void *ctx) {
+	return push(__func__, type, data, datasize);
+}
+int ocpp_push_request_defer(ocpp_message_t type,
+		const void *data, size_t datasize, uint32_t timer_sec,
+		void *ctx) {
+	return push(__func__, type, data, datasize);
+}
+int ocpp_push_response(const struct ocpp_message *req,
+		const void *data, size_t datasize, bool err, void *ctx) {
+	return push(__func__, req->type, data, datasize);
+}
+const struct ocpp_message *ocpp_get_message_by_id(const char *id) {
+	return NULL;
+}
+const char *ocpp_stringify_type(ocpp_message_t msgtype) {
+	return "";
+}
+ocpp_message_t ocpp_get_type_from_idstr(const char *idstr) {
+	return OCPP_MSG_MAX;
+}
+size_t ocpp_compute_configuration_size(void) {
+	return sizeof(((struct config_ocpp *)0)->config);
+}
+size_t ocpp_count_configurations(void) {
+	return 0;
+}
+const char *ocpp_get_configuration_keystr_from_index(int index) {
+	return NULL;
+}
+size_t ocpp_get_configuration_size(const char * const keystr) {
+	return 0;
+}
+bool ocpp_is_configuration_readable(const char * const keystr) {
+	return false;
+}
+int ocpp_get_configuration(const char * const keystr,
+		void *buf, size_t bufsize, bool *readonly) {
+	return -ENOENT;
+}
+const char *ocpp_stringify_configuration_value(const char *keystr,
+		char *buf, size_t bufsize) {
+	return "";
+}
+int config_get(const char *key, void *buf, size_t bufsize) {
+	memset(buf, 0, bufsize);
+	return 0;
+}
+ocpp_charger_reboot_t
+ocpp_charger_get_pending_reboot_type(const struct charger *charger) {
+	return OCPP_CHARGER_REBOOT_NONE;
+}
+ocpp_connector_state_t ocpp_connector_state(struct ocpp_connector *oc) {
+	return (ocpp_connector_state_t)0;
+}
+ocpp_status_t ocpp_connector_map_state_to_ocpp(ocpp_connector_state_t state) {
+	return (ocpp_status_t)0;
+}
+ocpp_error_t ocpp_connector_map_error_to_ocpp(connector_error_t error) {
+	return (ocpp_error_t)0;
+}
+bool ocpp_connector_is_unavailable(const struct ocpp_connector *oc) {
+	return false;
+}
+bool ocpp_connector_is_session_pending(const struct ocpp_connector *oc) {
+	return false;
+}
 
 TEST_GROUP(OcppMessage) {
+	struct server server;
+	struct fs fs;
+	struct ocpp_connector connector;
+
 	void setup(void) {
+		memset(&transport, 0, sizeof(transport));
+		memset(&file, 0, sizeof(file));
+		memset(pushed, 0, sizeof(pushed));
+		npushed = 0;
+
+		server = (struct server) {
+			.api = {
+				.send = fake_send,
+				.peek = fake_peek,
+				.consume = fake_consume,
+				.connected = fake_connected,
+			},
+		};
+		fs = (struct fs) {
+			.api = {
+				.read = fake_read,
+				.append_batch = fake_append_batch,
+				.replace = fake_replace,
+				.erase = fake_erase,
+				.size = fake_size,
+			},
+		};
+		memset(&connector, 0, sizeof(connector));
+		connector.base.id = 1;
+
+		adapter_init(&server);
+		LONGS_EQUAL(0, txqueue_init(&fs));
 	}
 	void teardown(void) {
+		txqueue_deinit();
+		for (int i = 0; i < npushed; i++) {
+			msgpool_free(pushed[i].data);
+		}
+
 		mock().checkExpectations();
 		mock().clear();
 	}
+
+	int sample(time_t now) {
+		connector.now = now;
+		return adapter_push_request(&connector, OCPP_MSG_METER_VALUES,
+				(void *)(uintptr_t)
+				OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER);
+	}
+	void expect_metervalues(void) {
+		mock().expectOneCall("ocpp_push_request")
+			.withParameter("type", OCPP_MSG_METER_VALUES);
+	}
+	void check_metervalues(int index, int tid, size_t nentries) {
+		const struct ocpp_MeterValues *p =
+			(const struct ocpp_MeterValues *)pushed[index].data;
+		LONGS_EQUAL(sizeof(*p) + nentries *
+				encoder_json_metervalue_size(1),
+				pushed[index].datasize);
+		LONGS_EQUAL(tid, p->transactionId);
+	}
 };
 
-TEST(OcppMessage, t) {
+TEST(OcppMessage, recv_ShouldAnswerNotImplemented_WhenUnknownActionReceived) {
+	struct ocpp_message msg;
+	transport.rx = "[2,\"123-000\",\"Resets\",{}]";
+
+	LONGS_EQUAL(-ENOTSUP, ocpp_recv(&msg));
+	LONGS_EQUAL(OCPP_MSG_ROLE_CALL, msg.role);
+	LONGS_EQUAL(OCPP_MSG_MAX, msg.type);
+	STRCMP_EQUAL("123-000", msg.id);
+	POINTERS_EQUAL(NULL, transport.rx);
+
+	/* not dispatched to any handler: no ocpp_push_response expected */
+	LONGS_EQUAL(-ENOENT,
+			adapter_push_response(&connector, msg.type, &msg, NULL));
+
+	msg.role = OCPP_MSG_ROLE_CALLERROR;
+	LONGS_EQUAL(0, ocpp_send(&msg));
+	STRCMP_EQUAL("[4,\"123-000\",\"NotImplemented\",\"\",{}]",
+			transport.tx);
+}
+
+TEST(OcppMessage, push_ShouldKeepMeterValues_WhenSentWhileOffline) {
+	connector.session.transaction_id = 7;
+	connector.session.metering.wh = 1234;
+
+	expect_metervalues();
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX; i++) {
+		LONGS_EQUAL(0, sample(1000 + i * 10));
+	}
+	LONGS_EQUAL(1, txqueue_depth());
+
+	txqueue_deinit();
+	LONGS_EQUAL(0, txqueue_init(&fs));
+	LONGS_EQUAL(1, txqueue_depth());
+
+	mock().expectOneCall("ocpp_push_request_force")
+		.withParameter("type", OCPP_MSG_METER_VALUES);
+	LONGS_EQUAL(0, txqueue_replay());
+	LONGS_EQUAL(2, npushed);
+	LONGS_EQUAL(pushed[0].datasize, pushed[1].datasize);
+	MEMCMP_EQUAL(pushed[0].data, pushed[1].data, pushed[0].datasize);
+}
+
+TEST(OcppMessage, metervalue_ShouldSendBatch_WhenFull) {
+	transport.connected = true;
+	connector.session.transaction_id = 7;
+
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX - 1; i++) {
+		LONGS_EQUAL(0, sample(1000 + i));
+	}
+	LONGS_EQUAL(0, npushed);
+
+	expect_metervalues();
+	LONGS_EQUAL(0, sample(1000 + OCPP_METERVALUE_BATCH_MAX));
+	LONGS_EQUAL(1, npushed);
+	check_metervalues(0, 7, OCPP_METERVALUE_BATCH_MAX);
+}
+
+TEST(OcppMessage, metervalue_ShouldSendBatch_WhenOldestSampleAgedWhileOnline) {
+	transport.connected = true;
+	connector.session.transaction_id = 7;
+
+	LONGS_EQUAL(0, sample(1000));
+	connector.now = 1000 + OCPP_METERVALUE_BATCH_AGE_SEC - 1;
+	LONGS_EQUAL(0, adapter_push_request(&connector,
+			OCPP_MSG_METER_VALUES, NULL));
+	LONGS_EQUAL(0, npushed);
+
+	expect_metervalues();
+	connector.now = 1000 + OCPP_METERVALUE_BATCH_AGE_SEC;
+	LONGS_EQUAL(0, adapter_push_request(&connector,
+			OCPP_MSG_METER_VALUES, NULL));
+	check_metervalues(0, 7, 1);
+}
+
+TEST(OcppMessage, metervalue_ShouldKeepBatch_WhenAgedWhileOffline) {
+	LONGS_EQUAL(0, sample(1000));
+	LONGS_EQUAL(0, sample(1000 + OCPP_METERVALUE_BATCH_AGE_SEC * 10));
+	LONGS_EQUAL(0, npushed);
+	LONGS_EQUAL(2, connector.metervalues.count);
+}
+
+TEST(OcppMessage, metervalue_ShouldSendBatchFirst_WhenTransactionStops) {
+	transport.connected = true;
+	connector.session.transaction_id = 7;
+	LONGS_EQUAL(0, sample(1000));
+
+	mock().strictOrder();
+	expect_metervalues();
+	mock().expectOneCall("ocpp_push_request_force")
+		.withParameter("type", OCPP_MSG_STOP_TRANSACTION);
+	LONGS_EQUAL(0, adapter_push_request(&connector,
+			OCPP_MSG_STOP_TRANSACTION, NULL));
+	check_metervalues(0, 7, 1);
+	LONGS_EQUAL(0, connector.metervalues.count);
+}
+
+TEST(OcppMessage, metervalue_ShouldSendBatch_WhenTransactionIdChanges) {
+	transport.connected = true;
+	connector.session.transaction_id = 7;
+	LONGS_EQUAL(0, sample(1000));
+	LONGS_EQUAL(0, sample(1001));
+
+	expect_metervalues();
+	connector.session.transaction_id = 8;
+	LONGS_EQUAL(0, sample(1002));
+	check_metervalues(0, 7, 2);
+	LONGS_EQUAL(1, connector.metervalues.count);
+	LONGS_EQUAL(8, connector.metervalues.transaction_id);
+}
+
+TEST(OcppMessage, metervalue_ShouldStartNewBatch_WhenSampleAddedAfterFull) {
+	connector.session.transaction_id = 7;
+
+	expect_metervalues();
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX + 1; i++) {
+		LONGS_EQUAL(0, sample(1000 + i));
+	}
+	LONGS_EQUAL(1, npushed);
+	check_metervalues(0, 7, OCPP_METERVALUE_BATCH_MAX);
+	LONGS_EQUAL(1, connector.metervalues.count);
+	LONGS_EQUAL(1000 + OCPP_METERVALUE_BATCH_MAX,
+			connector.metervalues.samples[0].timestamp);
+}
+
+TEST(OcppMessage, metervalue_ShouldLeaveOutMeasurand_WhenNoReadingForIt) {
+	transport.connected = true;
+	connector.session.transaction_id = 7;
+	connector.session.metering.wh = 1234;
+
+	expect_metervalues();
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX; i++) {
+		connector.now = 1000 + i;
+		LONGS_EQUAL(0, adapter_push_request(&connector,
+				OCPP_MSG_METER_VALUES, (void *)(uintptr_t)
+				(OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER |
+				 OCPP_MEASURAND_POWER_OFFERED)));
+	}
+	check_metervalues(0, 7, OCPP_METERVALUE_BATCH_MAX);
+
+	const uint8_t *entries = ((const struct ocpp_MeterValues *)
+			pushed[0].data)->meterValue;
+	for (int i = 0; i < OCPP_METERVALUE_BATCH_MAX; i++) {
+		const struct ocpp_MeterValue *p =
+			(const struct ocpp_MeterValue *)(const void *)
+			&entries[i * encoder_json_metervalue_size(1)];
+		const struct ocpp_SampledValue *v =
+			(const struct ocpp_SampledValue *)(const void *)
+			p->sampledValue;
+		LONGS_EQUAL(1000 + i, p->timestamp);
+		LONGS_EQUAL(OCPP_MEASURAND_ENERGY_ACTIVE_IMPORT_REGISTER,
+				v[0].measurand);
+		STRCMP_EQUAL("1234", v[0].value);
+		LONGS_EQUAL(0, v[1].value[0]);
+	}
 }
@@ -33,16 +33,160 @@
 #include "CppUTest/TestHarness.h"
 #include "CppUTestExt/MockSupport.h"
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "decoder_json.h"
+#include "registry.h"
+#include "msgpool.h"
 
 TEST_GROUP(OcppDecoder) {
+	struct ocpp_message msg;
+	size_t decoded_len;
+
 	void setup(void) {
+		memset(&msg, 0, sizeof(msg));
+		decoded_len = 0;
+
+		registry_init();
 	}
 	void teardown(void) {
+		msgpool_free((void *)msg.payload.fmt.data);
+
 		mock().checkExpectations();
 		mock().clear();
 	}
+
+	int decode(const char *json) {
+		return decoder_json_decode(&msg, json, strlen(json),
+				&decoded_len);
+	}
+	void expect_call(void) {
+		mock().expectOneCall("ocpp_get_type_from_idstr")
+			.andReturnValue(OCPP_MSG_BOOTNOTIFICATION);
+	}
 };
 
-TEST(OcppDecoder, t) {
+TEST(OcppDecoder, decode_ShouldReturnENOMSG_WhenEmptyBufferGiven) {
+	LONGS_EQUAL(-ENOMSG, decode(""));
+	LONGS_EQUAL(0, decoded_len);
+}
+
+TEST(OcppDecoder, decode_ShouldDropWholeBuffer_WhenMalformed) {
+	const char *json = "[2,\"1\",\"Reset\",{\"type\":\"Hard\"";
+	LONGS_EQUAL(-EINVAL, decode(json));
+	LONGS_EQUAL(strlen(json), decoded_len);
+}
+
+TEST(OcppDecoder, decode_ShouldReturnEPROTO_WhenNotAnArray) {
+	LONGS_EQUAL(-EPROTO, decode("{\"a\":1}"));
+	LONGS_EQUAL(-EPROTO, decode("[2,\"1\"]"));
+}
+
+TEST(OcppDecoder, decode_ShouldReturnEBADMSG_WhenRoleInvalid) {
+	mock().expectOneCall("ocpp_get_type_from_idstr")
+		.andReturnValue(OCPP_MSG_BOOTNOTIFICATION);
+	LONGS_EQUAL(-EBADMSG, decode("[5,\"1\",\"Reset\",{}]"));
+}
+
+TEST(OcppDecoder, decode_ShouldDecodeCall) {
+	const char *json = " [2, \"abc-1\", \"RemoteStopTransaction\", "
+		"{ \"transactionId\" : 42 }]";
+	expect_call();
+
+	LONGS_EQUAL(0, decode(json));
+	LONGS_EQUAL(strlen(json), decoded_len);
+	LONGS_EQUAL(OCPP_MSG_ROLE_CALL, msg.role);
+	LONGS_EQUAL(OCPP_MSG_REMOTE_STOP_TRANSACTION, msg.type);
+	STRCMP_EQUAL("abc-1", msg.id);
+
+	const struct ocpp_RemoteStopTransaction *p =
+		(const struct ocpp_RemoteStopTransaction *)
+		msg.payload.fmt.data;
+	LONGS_EQUAL(42, p->transactionId);
+}
+
+TEST(OcppDecoder, decode_ShouldReturnENOTSUP_WhenUnknownActionGiven) {
+	expect_call();
+	mock().expectOneCall("ocpp_stringify_type");
+
+	LONGS_EQUAL(-ENOTSUP, decode("[2,\"1\",\"Resets\",{}]"));
+	LONGS_EQUAL(OCPP_MSG_MAX, msg.type);
+}
+
+TEST(OcppDecoder, decode_ShouldConsumeFirstFrameOnly_WhenFramesConcatenated) {
+	const char *first = "[2,\"1\",\"Reset\",{\"type\":\"Hard\"}]";
+	const char *json = "[2,\"1\",\"Reset\",{\"type\":\"Hard\"}]"
+		"[2,\"2\",\"Reset\",{\"type\":\"Soft\"}]";
+	expect_call();
+	expect_call();
+
+	LONGS_EQUAL(0, decode(json));
+	LONGS_EQUAL(strlen(first), decoded_len);
+	LONGS_EQUAL(OCPP_MSG_RESET, msg.type);
+	LONGS_EQUAL(OCPP_RESET_HARD,
+		((const struct ocpp_Reset *)msg.payload.fmt.data)->type);
+	msgpool_free((void *)msg.payload.fmt.data);
+
+	LONGS_EQUAL(0, decode(json + decoded_len));
+	LONGS_EQUAL(strlen(first), decoded_len);
+	STRCMP_EQUAL("2", msg.id);
+	LONGS_EQUAL(OCPP_RESET_SOFT,
+		((const struct ocpp_Reset *)msg.payload.fmt.data)->type);
+}
+
+TEST(OcppDecoder, decode_ShouldUnescapeStrings) {
+	expect_call();
+
+	LONGS_EQUAL(0, decode("[2,\"1\",\"ChangeConfiguration\","
+			"{\"key\":\"a\\\"b\\\\c\",\"value\":\"\\u00e9\\n\"}]"));
+
+	const struct ocpp_ChangeConfiguration *p =
+		(const struct ocpp_ChangeConfiguration *)
+		msg.payload.fmt.data;
+	LONGS_EQUAL(OCPP_MSG_CHANGE_CONFIGURATION, msg.type);
+	STRCMP_EQUAL("a\"b\\c", p->key);
+	STRCMP_EQUAL("\xc3\xa9\n", p->value);
+}
+
+TEST(OcppDecoder, decode_ShouldRejectMessage_WhenStringTooLongForField) {
+	char json[256];
+	char tag[64];
+	memset(tag, 'A', sizeof(tag) - 1);
+	tag[sizeof(tag) - 1] = '\0';
+	snprintf(json, sizeof(json), "[2,\"1\",\"RemoteStartTransaction\","
+			"{\"idTag\":\"%s\"}]", tag);
+	expect_call();
+
+	LONGS_EQUAL(-EBADMSG, decode(json));
+	POINTERS_EQUAL(NULL, msg.payload.fmt.data);
+}
+
+TEST(OcppDecoder, decode_ShouldJoinKeys_WhenGetConfigurationGiven) {
+	expect_call();
+
+	LONGS_EQUAL(0, decode("[2,\"1\",\"GetConfiguration\","
+			"{\"key\":[\"HeartbeatInterval\",\"MeterValueSampleInterval\"]}]"));
+
+	const struct ocpp_GetConfiguration *p =
+		(const struct ocpp_GetConfiguration *)msg.payload.fmt.data;
+	STRCMP_EQUAL("HeartbeatInterval,MeterValueSampleInterval", p->keys);
+}
+
+TEST(OcppDecoder, decode_ShouldReturnEINVAL_WhenNestedTooDeep) {
+	LONGS_EQUAL(-EINVAL, decode("[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]"));
+}
+
+TEST(OcppDecoder, decode_ShouldSkipUnknownMembers) {
+	expect_call();
+
+	LONGS_EQUAL(0, decode("[2,\"1\",\"ChangeAvailability\","
+			"{\"extra\":{\"a\":[1,2,{\"b\":null}]},"
+			"\"type\":\"Inoperative\",\"connectorId\":1}]"));
+
+	const struct ocpp_ChangeAvailability *p =
+		(const struct ocpp_ChangeAvailability *)msg.payload.fmt.data;
+	LONGS_EQUAL(1, p->connectorId);
+	LONGS_EQUAL(OCPP_INOPERATIVE, p->type);
 }
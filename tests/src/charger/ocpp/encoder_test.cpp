@@ -33,10 +33,21 @@
 #include "CppUTest/TestHarness.h"
 #include "CppUTestExt/MockSupport.h"
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "encoder_json.h"
 
 TEST_GROUP(OcppEncoder) {
+	struct ocpp_message msg;
+	char buf[512];
+
 	void setup(void) {
+		memset(&msg, 0, sizeof(msg));
+		memset(buf, 0xff, sizeof(buf));
+		strcpy(msg.id, "123-000");
 	}
 	void teardown(void) {
 		mock().checkExpectations();
@@ -44,5 +55,132 @@ TEST_GROUP(OcppEncoder) {
 	}
 };
 
-TEST(OcppEncoder, t) {
+TEST(OcppEncoder, encode_ShouldReturnEINVAL_WhenNullArgumentsGiven) {
+	LONGS_EQUAL(-EINVAL, encoder_json_encode(NULL, buf, sizeof(buf)));
+	LONGS_EQUAL(-EINVAL, encoder_json_encode(&msg, NULL, sizeof(buf)));
+	LONGS_EQUAL(-EINVAL, encoder_json_encode(&msg, buf, 0));
+}
+
+TEST(OcppEncoder, encode_ShouldWriteCallFrame_WhenHeartbeatGiven) {
+	const char *expected = "[2,\"123-000\",\"Heartbeat\",{}]";
+	msg.role = OCPP_MSG_ROLE_CALL;
+	msg.type = OCPP_MSG_HEARTBEAT;
+	LONGS_EQUAL(strlen(expected),
+			encoder_json_encode(&msg, buf, sizeof(buf)));
+	STRCMP_EQUAL(expected, buf);
+}
+
+TEST(OcppEncoder, encode_ShouldEscapeStrings) {
+	struct ocpp_Authorize authorize = { 0, };
+	strcpy(authorize.idTag, "a\"b\\c\n");
+	msg.role = OCPP_MSG_ROLE_CALL;
+	msg.type = OCPP_MSG_AUTHORIZE;
+	msg.payload.fmt.request = &authorize;
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_EQUAL("[2,\"123-000\",\"Authorize\","
+			"{\"idTag\":\"a\\\"b\\\\c\\u000a\"}]", buf);
+}
+
+TEST(OcppEncoder, encode_ShouldSkipEmptyOptionalFields_WhenBootNotificationGiven) {
+	struct ocpp_BootNotification boot;
+	memset(&boot, 0, sizeof(boot));
+	strcpy(boot.chargePointModel, "model");
+	strcpy(boot.chargePointVendor, "vendor");
+	strcpy(boot.firmwareVersion, "v1.0.0");
+	msg.role = OCPP_MSG_ROLE_CALL;
+	msg.type = OCPP_MSG_BOOTNOTIFICATION;
+	msg.payload.fmt.request = &boot;
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_EQUAL("[2,\"123-000\",\"BootNotification\","
+			"{\"chargePointModel\":\"model\","
+			"\"chargePointVendor\":\"vendor\","
+			"\"firmwareVersion\":\"v1.0.0\"}]", buf);
+}
+
+TEST(OcppEncoder, encode_ShouldWriteErrorFrame_WhenCallErrorGiven) {
+	msg.role = OCPP_MSG_ROLE_CALLERROR;
+	msg.type = OCPP_MSG_RESET;
+
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_EQUAL("[4,\"123-000\",\"NotImplemented\",\"\",{}]", buf);
+}
+
+TEST(OcppEncoder, encode_ShouldReturnENOBUFS_WhenBufferTooSmall) {
+	const char *expected = "[2,\"123-000\",\"Heartbeat\",{}]";
+	msg.role = OCPP_MSG_ROLE_CALL;
+	msg.type = OCPP_MSG_HEARTBEAT;
+	mock().expectOneCall("ocpp_stringify_type");
+
+	LONGS_EQUAL(-ENOBUFS, encoder_json_encode(&msg, buf, strlen(expected)));
+	STRCMP_EQUAL("", buf);
+	LONGS_EQUAL(strlen(expected),
+			encoder_json_encode(&msg, buf, strlen(expected) + 1));
+}
+
+TEST(OcppEncoder, encode_ShouldListUnknownKeysOnly_WhenNoKeyKnown) {
+	msg.role = OCPP_MSG_ROLE_CALLRESULT;
+	msg.type = OCPP_MSG_GET_CONFIGURATION;
+	char keys[] = "Foo, Bar";
+	msg.payload.fmt.data = keys;
+	mock().expectNCalls(4, "ocpp_get_configuration_size")
+		.andReturnValue(0);
+
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_EQUAL("[3,\"123-000\",{\"unknownKey\":[\"Foo\",\"Bar\"]}]", buf);
+}
+
+TEST(OcppEncoder, encode_ShouldListKnownKeys_WhenReadableKeyGiven) {
+	msg.role = OCPP_MSG_ROLE_CALLRESULT;
+	msg.type = OCPP_MSG_GET_CONFIGURATION;
+	char keys[] = "HeartbeatInterval";
+	msg.payload.fmt.data = keys;
+	mock().expectNCalls(2, "ocpp_get_configuration_size")
+		.andReturnValue(4);
+	mock().expectOneCall("ocpp_is_configuration_readable")
+		.andReturnValue(true);
+	mock().expectOneCall("ocpp_get_configuration")
+		.ignoreOtherParameters();
+	mock().expectOneCall("ocpp_stringify_configuration_value")
+		.andReturnValue("60");
+
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_EQUAL("[3,\"123-000\",{\"configurationKey\":[{"
+			"\"key\":\"HeartbeatInterval\","
+			"\"readonly\":false,\"value\":\"60\"}]}]", buf);
+}
+
+TEST(OcppEncoder, encode_ShouldWriteEveryEntry_WhenMeterValuesBatched) {
+	const size_t first = encoder_json_metervalue_size(1);
+	const size_t total = sizeof(struct ocpp_MeterValues) + first +
+		encoder_json_metervalue_size(2);
+	struct ocpp_MeterValues *p =
+		(struct ocpp_MeterValues *)calloc(1, total);
+	uint8_t *entries = (uint8_t *)(void *)p->meterValue;
+	struct ocpp_MeterValue *e1 = (struct ocpp_MeterValue *)(void *)entries;
+	struct ocpp_MeterValue *e2 =
+		(struct ocpp_MeterValue *)(void *)&entries[first];
+	struct ocpp_SampledValue *s1 =
+		(struct ocpp_SampledValue *)(void *)e1->sampledValue;
+	struct ocpp_SampledValue *s2 =
+		(struct ocpp_SampledValue *)(void *)e2->sampledValue;
+	p->connectorId = 1;
+	p->transactionId = 7;
+	strcpy(s1[0].value, "10");
+	strcpy(s2[0].value, "20");
+	strcpy(s2[1].value, "230.000");
+	msg.role = OCPP_MSG_ROLE_CALL;
+	msg.type = OCPP_MSG_METER_VALUES;
+	msg.payload.fmt.request = p;
+	msg.payload.size = total;
+
+	CHECK(encoder_json_encode(&msg, buf, sizeof(buf)) > 0);
+	STRCMP_CONTAINS("[2,\"123-000\",\"MeterValues\",{\"connectorId\":1,"
+			"\"transactionId\":7,\"meterValue\":[{\"timestamp\":",
+			buf);
+	STRCMP_CONTAINS("\"sampledValue\":[{\"value\":\"10\"}]},"
+			"{\"timestamp\":", buf);
+	STRCMP_CONTAINS("\"sampledValue\":[{\"value\":\"20\"},"
+			"{\"value\":\"230.000\"}]}]}]", buf);
+
+	free(p);
 }
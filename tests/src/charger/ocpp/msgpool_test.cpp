@@ -0,0 +1,138 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include "libmcu/metrics.h"
+#include "msgpool.h"
+
+#define SMALL_BLOCKS		16
+#define ALL_BLOCKS		(16 + 8 + 4 + 2)
+
+TEST_GROUP(MsgPool) {
+	void *blocks[ALL_BLOCKS + 1];
+	int nblocks;
+
+	void setup(void) {
+		mock().ignoreOtherCalls();
+		metrics_init(true);
+		nblocks = 0;
+	}
+	void teardown(void) {
+		for (int i = 0; i < nblocks; i++) {
+			msgpool_free(blocks[i]);
+		}
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	void *alloc(size_t size) {
+		void *p = msgpool_alloc(size);
+		blocks[nblocks++] = p;
+		return p;
+	}
+	bool is_distinct(void) {
+		for (int i = 0; i < nblocks; i++) {
+			for (int j = i + 1; j < nblocks; j++) {
+				if (blocks[i] == blocks[j]) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+};
+
+TEST(MsgPool, alloc_ShouldReturnZeroFilledBlock) {
+	uint8_t zero[64] = { 0, };
+	uint8_t *p = (uint8_t *)msgpool_alloc(sizeof(zero));
+	memset(p, 0xA5, sizeof(zero));
+	msgpool_free(p);
+
+	p = (uint8_t *)alloc(sizeof(zero));
+	MEMCMP_EQUAL(zero, p, sizeof(zero));
+}
+
+TEST(MsgPool, alloc_ShouldReuseFreedBlock) {
+	void *p = msgpool_alloc(32);
+	msgpool_free(p);
+	POINTERS_EQUAL(p, alloc(32));
+}
+
+TEST(MsgPool, alloc_ShouldAlignBlocks) {
+	for (int i = 0; i < SMALL_BLOCKS; i++) {
+		uintptr_t addr = (uintptr_t)alloc(1);
+		LONGS_EQUAL(0, addr % sizeof(max_align_t));
+	}
+}
+
+TEST(MsgPool, alloc_ShouldFallBackToLargerClass_WhenClassExhausted) {
+	for (int i = 0; i < SMALL_BLOCKS; i++) {
+		CHECK(alloc(64) != NULL);
+	}
+
+	uint8_t *p = (uint8_t *)alloc(64);
+	CHECK(p != NULL);
+	CHECK(is_distinct());
+	LONGS_EQUAL(1, metrics_get(OCPPPoolSmallFailCount));
+	LONGS_EQUAL(0, metrics_get(OCPPPoolMediumFailCount));
+	LONGS_EQUAL(SMALL_BLOCKS, metrics_get(OCPPPoolSmallPeak));
+	/* the larger block is still usable beyond the requested size */
+	memset(p, 0, 256);
+}
+
+TEST(MsgPool, alloc_ShouldFallBackToHeap_WhenAllClassesExhausted) {
+	for (int i = 0; i < ALL_BLOCKS; i++) {
+		CHECK(alloc(1) != NULL);
+	}
+
+	CHECK(alloc(1) != NULL);
+	CHECK(is_distinct());
+	LONGS_EQUAL(1, metrics_get(OCPPPoolHeapFallbackCount));
+}
+
+TEST(MsgPool, alloc_ShouldFallBackToHeap_WhenSizeExceedsLargestClass) {
+	uint8_t *p = (uint8_t *)alloc(4096);
+	CHECK(p != NULL);
+	LONGS_EQUAL(0, p[4095]);
+	LONGS_EQUAL(1, metrics_get(OCPPPoolHeapFallbackCount));
+	LONGS_EQUAL(0, metrics_get(OCPPPoolSmallFailCount));
+}
+
+TEST(MsgPool, free_ShouldDoNothing_WhenNullGiven) {
+	msgpool_free(NULL);
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "CppUTest/TestHarness.h"
+
+#include <string.h>
+
+#include "registry.h"
+
+TEST_GROUP(OcppRegistry) {
+	void setup(void) {
+		registry_init();
+	}
+	void teardown(void) {
+	}
+
+	void check_action(ocpp_message_t type, const char *action) {
+		STRCMP_EQUAL(action, registry_get_action(type));
+		LONGS_EQUAL(type, registry_find_type(action, strlen(action)));
+	}
+};
+
+TEST(OcppRegistry, find_ShouldReturnType_WhenRegisteredActionGiven) {
+	check_action(OCPP_MSG_AUTHORIZE, "Authorize");
+	check_action(OCPP_MSG_BOOTNOTIFICATION, "BootNotification");
+	check_action(OCPP_MSG_CHANGE_AVAILABILITY, "ChangeAvailability");
+	check_action(OCPP_MSG_CHANGE_CONFIGURATION, "ChangeConfiguration");
+	check_action(OCPP_MSG_CLEAR_CACHE, "ClearCache");
+	check_action(OCPP_MSG_DATA_TRANSFER, "DataTransfer");
+	check_action(OCPP_MSG_DIAGNOSTICS_NOTIFICATION,
+			"DiagnosticsStatusNotification");
+	check_action(OCPP_MSG_FIRMWARE_NOTIFICATION,
+			"FirmwareStatusNotification");
+	check_action(OCPP_MSG_GET_CONFIGURATION, "GetConfiguration");
+	check_action(OCPP_MSG_HEARTBEAT, "Heartbeat");
+	check_action(OCPP_MSG_METER_VALUES, "MeterValues");
+	check_action(OCPP_MSG_REMOTE_START_TRANSACTION,
+			"RemoteStartTransaction");
+	check_action(OCPP_MSG_REMOTE_STOP_TRANSACTION,
+			"RemoteStopTransaction");
+	check_action(OCPP_MSG_RESET, "Reset");
+	check_action(OCPP_MSG_START_TRANSACTION, "StartTransaction");
+	check_action(OCPP_MSG_STATUS_NOTIFICATION, "StatusNotification");
+	check_action(OCPP_MSG_STOP_TRANSACTION, "StopTransaction");
+	check_action(OCPP_MSG_UNLOCK_CONNECTOR, "UnlockConnector");
+	check_action(OCPP_MSG_UPDATE_FIRMWARE, "UpdateFirmware");
+}
+
+TEST(OcppRegistry, find_ShouldReturnMax_WhenUnknownActionGiven) {
+	LONGS_EQUAL(OCPP_MSG_MAX, registry_find_type("Foo", 3));
+	LONGS_EQUAL(OCPP_MSG_MAX, registry_find_type("", 0));
+	LONGS_EQUAL(OCPP_MSG_MAX, registry_find_type("reset", 5));
+}
+
+TEST(OcppRegistry, find_ShouldCompareWholeLength_WhenPrefixGiven) {
+	LONGS_EQUAL(OCPP_MSG_MAX, registry_find_type("Reset", 4));
+	LONGS_EQUAL(OCPP_MSG_MAX, registry_find_type("Resets", 6));
+	LONGS_EQUAL(OCPP_MSG_RESET, registry_find_type("Resets", 5));
+}
+
+TEST(OcppRegistry, get_action_ShouldReturnNull_WhenTypeOutOfRange) {
+	POINTERS_EQUAL(NULL, registry_get_action(OCPP_MSG_MAX));
+}
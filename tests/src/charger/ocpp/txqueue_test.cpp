@@ -0,0 +1,356 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "txqueue.h"
+#include "msgpool.h"
+
+#define FILESIZE_MAX		32768
+
+struct fs {
+	struct fs_api api;
+};
+
+static struct {
+	uint8_t data[FILESIZE_MAX];
+	size_t size;
+	bool exists;
+} file;
+
+static struct ocpp_message outstanding;
+static void *pushed[8];
+static int npushed;
+
+static int fake_read(struct fs *self, const char *filepath,
+		const size_t offset, void *buf, const size_t bufsize) {
+	if (!file.exists) {
+		return -ENOENT;
+	} else if (offset >= file.size) {
+		return 0;
+	}
+	const size_t len = file.size - offset < bufsize?
+		file.size - offset : bufsize;
+	memcpy(buf, &file.data[offset], len);
+	return (int)len;
+}
+static int fake_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	int total = 0;
+	for (size_t i = 0; i < iovcnt; i++) {
+		memcpy(&file.data[file.size], iov[i].data, iov[i].datasize);
+		file.size += iov[i].datasize;
+		total += (int)iov[i].datasize;
+	}
+	file.exists = true;
+	return total;
+}
+static int fake_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	mock().actualCall(__func__);
+	file.size = 0;
+	return fake_append_batch(self, filepath, iov, iovcnt);
+}
+static int fake_erase(struct fs *self, const char *filepath) {
+	mock().actualCall(__func__);
+	const bool existed = file.exists;
+	file.exists = false;
+	file.size = 0;
+	return existed? 0 : -ENOENT;
+}
+static int fake_size(struct fs *self, const char *filepath, size_t *size) {
+	if (!file.exists) {
+		return -ENOENT;
+	}
+	*size = file.size;
+	return 0;
+}
+
+const struct ocpp_message *ocpp_get_message_by_id(const char *id) {
+	return &outstanding;
+}
+int ocpp_push_request_force(ocpp_message_t type, const void *data,
+		size_t datasize, void *ctx) {
+	const int err = mock().actualCall(__func__)
+		.withParameter("type", type)
+		.withParameter("datasize", datasize)
+		.returnIntValueOrDefault(0);
+	if (!err) { /* freed by the test as it is by csms otherwise */
+		pushed[npushed++] = (void *)data;
+	}
+	return err;
+}
+const char *ocpp_stringify_type(ocpp_message_t msgtype) {
+	return "";
+}
+
+TEST_GROUP(TxQueue) {
+	struct fs fs;
+	struct ocpp_StartTransaction start;
+	struct ocpp_StopTransaction stop;
+	/* struct ocpp_MeterValues ends with a flexible array member */
+	uint8_t meter[sizeof(struct ocpp_MeterValues)];
+
+	void setup(void) {
+		memset(&file, 0, sizeof(file));
+		memset(&outstanding, 0, sizeof(outstanding));
+		memset(pushed, 0, sizeof(pushed));
+		npushed = 0;
+
+		fs = (struct fs) {
+			.api = {
+				.read = fake_read,
+				.append_batch = fake_append_batch,
+				.replace = fake_replace,
+				.erase = fake_erase,
+				.size = fake_size,
+			},
+		};
+
+		memset(&start, 0, sizeof(start));
+		memset(meter, 0, sizeof(meter));
+		memset(&stop, 0, sizeof(stop));
+		start.connectorId = 1;
+
+		mock().ignoreOtherCalls();
+		LONGS_EQUAL(0, txqueue_init(&fs));
+	}
+	void teardown(void) {
+		txqueue_deinit();
+		for (int i = 0; i < npushed; i++) {
+			msgpool_free(pushed[i]);
+		}
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	void reboot(void) {
+		txqueue_deinit();
+		LONGS_EQUAL(0, txqueue_init(&fs));
+	}
+
+	bool answer(const void *req, ocpp_message_role_t role,
+			const void *conf) {
+		struct ocpp_message resp = {
+			.role = role,
+		};
+		resp.payload.fmt.response = conf;
+		outstanding.payload.fmt.data = req;
+		return txqueue_settle(&resp);
+	}
+
+	void expect_push(ocpp_message_t type, size_t datasize) {
+		mock().expectOneCall("ocpp_push_request_force")
+			.withParameter("type", type)
+			.withParameter("datasize", datasize);
+	}
+
+	int get_tid(const void *data, ocpp_message_t type) {
+		if (type == OCPP_MSG_METER_VALUES) {
+			return ((const struct ocpp_MeterValues *)data)
+				->transactionId;
+		}
+		return ((const struct ocpp_StopTransaction *)data)
+			->transactionId;
+	}
+};
+
+TEST(TxQueue, init_ShouldStartEmpty_WhenNoFileExists) {
+	LONGS_EQUAL(0, txqueue_depth());
+	LONGS_EQUAL(0, file.size);
+}
+
+TEST(TxQueue, init_ShouldReturnEINVAL_WhenNoFilesystemGiven) {
+	LONGS_EQUAL(-EINVAL, txqueue_init(NULL));
+	LONGS_EQUAL(-ENODEV, txqueue_append(OCPP_MSG_START_TRANSACTION, 1,
+			&start, sizeof(start)));
+}
+
+TEST(TxQueue, append_ShouldRejectNonTransactionMessages) {
+	struct ocpp_Authorize auth = { 0, };
+	LONGS_EQUAL(-EINVAL, txqueue_append(OCPP_MSG_AUTHORIZE, 1,
+			&auth, sizeof(auth)));
+	LONGS_EQUAL(0, txqueue_depth());
+}
+
+TEST(TxQueue, settle_ShouldEraseFile_WhenLastMessageAnswered) {
+	struct ocpp_StartTransaction_conf conf = { .transactionId = 1, };
+
+	LONGS_EQUAL(0, txqueue_append(OCPP_MSG_START_TRANSACTION, 1,
+			&start, sizeof(start)));
+	LONGS_EQUAL(1, txqueue_depth());
+	CHECK(file.size > sizeof(start));
+
+	mock().expectOneCall("fake_erase");
+	CHECK_FALSE(answer(&start, OCPP_MSG_ROLE_CALLRESULT, &conf));
+	LONGS_EQUAL(0, txqueue_depth());
+	CHECK_FALSE(file.exists);
+}
+
+TEST(TxQueue, settle_ShouldIgnore_WhenRequestNotQueued) {
+	int other;
+	LONGS_EQUAL(0, txqueue_append(OCPP_MSG_START_TRANSACTION, 1,
+			&start, sizeof(start)));
+	CHECK_FALSE(answer(&other, OCPP_MSG_ROLE_CALLRESULT, NULL));
+	LONGS_EQUAL(1, txqueue_depth());
+}
+
+TEST(TxQueue, init_ShouldLoadPendingMessages_AfterReboot) {
+	struct ocpp_StartTransaction_conf conf = { .transactionId = 1, };
+
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	txqueue_append(OCPP_MSG_METER_VALUES, 1, meter, sizeof(meter));
+	answer(&start, OCPP_MSG_ROLE_CALLRESULT, &conf);
+
+	mock().expectOneCall("fake_replace");
+	reboot();
+
+	LONGS_EQUAL(1, txqueue_depth());
+	LONGS_EQUAL(20 + sizeof(meter), file.size);
+}
+
+TEST(TxQueue, init_ShouldDropTornTail) {
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	txqueue_append(OCPP_MSG_METER_VALUES, 1, meter, sizeof(meter));
+	file.size -= 3;
+
+	mock().expectOneCall("fake_replace");
+	reboot();
+
+	LONGS_EQUAL(1, txqueue_depth());
+	LONGS_EQUAL(20 + sizeof(start), file.size);
+}
+
+TEST(TxQueue, init_ShouldDropCorruptedRecords) {
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	file.data[25] ^= 0xff;
+
+	mock().expectOneCall("fake_erase");
+	reboot();
+
+	LONGS_EQUAL(0, txqueue_depth());
+	CHECK_FALSE(file.exists);
+}
+
+TEST(TxQueue, replay_ShouldSendInOrder_WithTransactionIdFilledIn) {
+	struct ocpp_StartTransaction_conf conf = { .transactionId = 42, };
+
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	txqueue_append(OCPP_MSG_METER_VALUES, 1, meter, sizeof(meter));
+	txqueue_append(OCPP_MSG_STOP_TRANSACTION, 1, &stop, sizeof(stop));
+	reboot();
+	LONGS_EQUAL(3, txqueue_depth());
+
+	/* the rest waits for the transaction ID */
+	expect_push(OCPP_MSG_START_TRANSACTION, sizeof(start));
+	LONGS_EQUAL(0, txqueue_replay());
+	LONGS_EQUAL(1, npushed);
+
+	expect_push(OCPP_MSG_METER_VALUES, sizeof(meter));
+	expect_push(OCPP_MSG_STOP_TRANSACTION, sizeof(stop));
+	CHECK_TRUE(answer(pushed[0], OCPP_MSG_ROLE_CALLRESULT, &conf));
+	LONGS_EQUAL(3, npushed);
+	LONGS_EQUAL(42, get_tid(pushed[1], OCPP_MSG_METER_VALUES));
+	LONGS_EQUAL(42, get_tid(pushed[2], OCPP_MSG_STOP_TRANSACTION));
+
+	CHECK_TRUE(answer(pushed[1], OCPP_MSG_ROLE_CALLRESULT, NULL));
+	mock().expectOneCall("fake_erase");
+	CHECK_TRUE(answer(pushed[2], OCPP_MSG_ROLE_CALLRESULT, NULL));
+	LONGS_EQUAL(0, txqueue_depth());
+}
+
+TEST(TxQueue, replay_ShouldUseTransactionId_WhenStartAnsweredBeforeReboot) {
+	struct ocpp_StartTransaction_conf conf = { .transactionId = 7, };
+
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	txqueue_append(OCPP_MSG_STOP_TRANSACTION, 1, &stop, sizeof(stop));
+	answer(&start, OCPP_MSG_ROLE_CALLRESULT, &conf);
+	reboot();
+	LONGS_EQUAL(1, txqueue_depth());
+
+	expect_push(OCPP_MSG_STOP_TRANSACTION, sizeof(stop));
+	txqueue_replay();
+	LONGS_EQUAL(7, get_tid(pushed[0], OCPP_MSG_STOP_TRANSACTION));
+}
+
+TEST(TxQueue, replay_ShouldPause_WhenPushFails) {
+	txqueue_append(OCPP_MSG_METER_VALUES, 1, meter, sizeof(meter));
+	reboot();
+
+	mock().expectOneCall("ocpp_push_request_force")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOSPC);
+	txqueue_replay();
+	LONGS_EQUAL(0, npushed);
+	mock().checkExpectations();
+
+	expect_push(OCPP_MSG_METER_VALUES, sizeof(meter));
+	LONGS_EQUAL(0, txqueue_replay());
+	LONGS_EQUAL(1, npushed);
+}
+
+TEST(TxQueue, release_ShouldResendOnNextReplay_WhenDroppedUnanswered) {
+	txqueue_append(OCPP_MSG_METER_VALUES, 1, meter, sizeof(meter));
+	txqueue_release(meter);
+	LONGS_EQUAL(1, txqueue_depth());
+
+	expect_push(OCPP_MSG_METER_VALUES, sizeof(meter));
+	txqueue_replay();
+	LONGS_EQUAL(1, npushed);
+}
+
+TEST(TxQueue, append_ShouldEvictOldestMeterValuesFirst_WhenFull) {
+	uint8_t meters[32][sizeof(meter)];
+
+	txqueue_append(OCPP_MSG_START_TRANSACTION, 1, &start, sizeof(start));
+	for (int i = 0; i < 31; i++) {
+		memcpy(meters[i], meter, sizeof(meter));
+		LONGS_EQUAL(0, txqueue_append(OCPP_MSG_METER_VALUES, 1,
+				meters[i], sizeof(meters[i])));
+	}
+	LONGS_EQUAL(32, txqueue_depth());
+
+	LONGS_EQUAL(0, txqueue_append(OCPP_MSG_STOP_TRANSACTION, 1,
+			&stop, sizeof(stop)));
+	LONGS_EQUAL(32, txqueue_depth());
+
+	/* the first MeterValues is gone while StartTransaction remains */
+	CHECK_FALSE(answer(meters[0], OCPP_MSG_ROLE_CALLRESULT, NULL));
+	LONGS_EQUAL(32, txqueue_depth());
+	CHECK_FALSE(answer(&start, OCPP_MSG_ROLE_CALLRESULT, NULL));
+	LONGS_EQUAL(31, txqueue_depth());
+}
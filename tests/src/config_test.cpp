@@ -34,9 +34,13 @@
 #include "CppUTestExt/MockSupport.h"
 
 #include "config.h"
+#include "config_journal.h"
 #include "libmcu/kvstore.h"
 #include "libmcu/crc32.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #define X509_BUFSIZE		2048
 
 extern struct kvstore *mock_kvstore_create(void);
@@ -217,3 +221,505 @@ TEST(Config, ShouldClearSpecificConfig_WhenCustomKeyGiven) {
 TEST(Config, ShouldReturnNoEntry_WhenGivenKeyNotFound) {
 	LONGS_EQUAL(-ENOENT, config_reset("not.found"));
 }
+TEST(Config, ShouldFindEveryKey_WhenLookedUpByString) {
+	static const char *keys[] = {
+#define CONFIG_DEFINE(id, key, field, type, count, perm)	key,
+#include "config.def"
+#undef CONFIG_DEFINE
+	};
+	uint8_t buf[1024];
+
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		LONGS_EQUAL(0, config_get(keys[i], buf, sizeof(buf)));
+	}
+}
+TEST(Config, ShouldAccessValue_WhenTypedAccessorUsed) {
+	uint32_t health = 10;
+	uint32_t actual = 0;
+	LONGS_EQUAL(0, config_set_net_health(&health));
+	LONGS_EQUAL(0, config_get_net_health(&actual));
+	LONGS_EQUAL(10, actual);
+	actual = 0;
+	LONGS_EQUAL(0, config_get("net.health", &actual, sizeof(actual)));
+	LONGS_EQUAL(10, actual);
+}
+TEST(Config, ShouldReturnPermissionDenied_WhenTypedSetterOnReadonlyKey) {
+	uint32_t version = 2;
+	LONGS_EQUAL(-EPERM, config_set_version(&version));
+}
+static void on_config_change(const char *key, void *ctx) {
+	mock().actualCall(__func__)
+		.withStringParameter("key", key? key : "(null)")
+		.withPointerParameter("ctx", ctx);
+}
+
+TEST(Config, subscribe_ShouldNotify_WhenKeyWithPrefixChanged) {
+	uint32_t health = 10;
+	uint8_t level = 3;
+	LONGS_EQUAL(0, config_subscribe("net.", on_config_change, NULL));
+
+	mock().expectOneCall("on_config_change")
+		.withStringParameter("key", "net.health")
+		.withPointerParameter("ctx", NULL);
+	config_set("net.health", &health, sizeof(health));
+	config_set("log.level", &level, sizeof(level));
+
+	LONGS_EQUAL(0, config_unsubscribe(on_config_change, NULL));
+}
+TEST(Config, subscribe_ShouldNotNotify_WhenValueUnchanged) {
+	uint32_t health;
+	config_get("net.health", &health, sizeof(health));
+	config_subscribe(NULL, on_config_change, NULL);
+	config_set("net.health", &health, sizeof(health));
+}
+TEST(Config, subscribe_ShouldNotifyWithNullKey_WhenAllConfigsWritten) {
+	config_subscribe(NULL, on_config_change, NULL);
+	config_read_all(&config);
+	config.log_level = 7;
+	mock().expectOneCall("on_config_change")
+		.withStringParameter("key", "(null)")
+		.withPointerParameter("ctx", NULL);
+	config_write_all(&config);
+}
+TEST(Config, subscribe_ShouldReturnENOSPC_WhenTooManySubscribers) {
+	int err;
+	while ((err = config_subscribe(NULL, on_config_change, NULL)) == 0) {
+	}
+	LONGS_EQUAL(-ENOSPC, err);
+}
+TEST(Config, unsubscribe_ShouldReturnENOENT_WhenNotSubscribed) {
+	LONGS_EQUAL(-ENOENT, config_unsubscribe(on_config_change, NULL));
+}
+TEST(Config, snapshot_ShouldStayIntact_WhenUpdatedWhileHeld) {
+	const struct config *snapshot = config_snapshot_acquire();
+	const uint32_t generation = config_generation();
+	uint32_t health = 10;
+	uint32_t actual;
+
+	config_set_net_health(&health);
+
+	LONGS_EQUAL(60000, snapshot->net.health_check_interval);
+	config_get_net_health(&actual);
+	LONGS_EQUAL(10, actual);
+	LONGS_EQUAL(generation + 1, config_generation());
+
+	config_snapshot_release(snapshot);
+
+	health = 20;
+	config_set_net_health(&health);
+	health = 30;
+	config_set_net_health(&health);
+	config_get_net_health(&actual);
+	LONGS_EQUAL(30, actual);
+}
+
+TEST_GROUP(ConfigJournal) {
+	struct kvstore *kvstore;
+	struct config config;
+
+	void setup(void) {
+		kvstore = mock_kvstore_create();
+		init_with_record(NULL);
+	}
+	void teardown(void) {
+		mock_kvstore_destroy(kvstore);
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	void init_with_record(const struct journal_record *rec) {
+		config = (struct config) {
+			.version = CONFIG_VERSION,
+			.device_id = "my device",
+		};
+		config.crc = crc32_cksum((const uint8_t *)&config,
+				sizeof(config)-sizeof(config.crc));
+
+		mock().expectOneCall("open")
+			.withPointerParameter("self", kvstore)
+			.withStringParameter("ns", "config")
+			.andReturnValue(0);
+		mock().expectOneCall("read")
+			.withStringParameter("key", "basic")
+			.withOutputParameterReturning("buf", &config, sizeof(config))
+			.withParameter("size", sizeof(config))
+			.andReturnValue(0);
+		if (rec) {
+			mock().expectOneCall("read")
+				.withStringParameter("key", "j00")
+				.withOutputParameterReturning("buf", rec, sizeof(*rec))
+				.withParameter("size", sizeof(*rec))
+				.andReturnValue((int)sizeof(*rec));
+			mock().expectOneCall("read")
+				.withStringParameter("key", "j01")
+				.ignoreOtherParameters()
+				.andReturnValue(-ENOENT);
+		} else {
+			mock().expectOneCall("read")
+				.withStringParameter("key", "j00")
+				.ignoreOtherParameters()
+				.andReturnValue(-ENOENT);
+		}
+		config_init(kvstore, on_config_save, NULL);
+	}
+
+	void expect_write(const char *key, size_t size) {
+		mock().expectOneCall("write")
+			.withStringParameter("key", key)
+			.withParameter("size", size)
+			.ignoreOtherParameters()
+			.andReturnValue(0);
+		mock().expectOneCall("on_config_save")
+			.withPointerParameter("ctx", NULL);
+	}
+};
+
+TEST(ConfigJournal, ShouldAppendRecord_WhenSmallFieldChanged) {
+	uint8_t checkpoint[16] = { 1, 2, 3, };
+	expect_write("j00", sizeof(struct journal_record));
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+}
+
+TEST(ConfigJournal, ShouldAppendRecord_WhenOnlyFewBytesChangedInLargeField) {
+	uint8_t ocpp[546] = { 0, };
+	ocpp[300] = 1;
+	ocpp[301] = 2;
+	expect_write("j00", sizeof(struct journal_record));
+	LONGS_EQUAL(0, config_set_and_save("ocpp.config", ocpp, sizeof(ocpp)));
+}
+
+TEST(ConfigJournal, ShouldNotWrite_WhenNothingChanged) {
+	uint8_t checkpoint[16] = { 0, };
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+}
+
+TEST(ConfigJournal, ShouldWriteWholeBlob_WhenChangeTooLargeForRecord) {
+	char url[256] = "wss://a.very.long.server.url.example.com:9000/ocpp";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_set_and_save("net.server.url", url, sizeof(url)));
+}
+
+TEST(ConfigJournal, ShouldWriteWholeBlob_WhenAllConfigsWritten) {
+	config_read_all(&config);
+	config_write_all(&config);
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_save());
+}
+
+TEST(ConfigJournal, ShouldCompact_WhenJournalFull) {
+	uint8_t checkpoint[16] = { 0, };
+
+	for (uint8_t i = 0; i < 16; i++) {
+		char key[8];
+		snprintf(key, sizeof(key), "j%02u", i);
+		checkpoint[0] = (uint8_t)(i + 1);
+		expect_write(key, sizeof(struct journal_record));
+		LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+				checkpoint, sizeof(checkpoint)));
+	}
+
+	checkpoint[0] = 0xff;
+	expect_write("basic", sizeof(config));
+	mock().expectOneCall("clear")
+		.withStringParameter("key", "j00")
+		.andReturnValue(0);
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+
+	expect_write("j00", sizeof(struct journal_record));
+	checkpoint[0] = 0;
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+}
+
+TEST(ConfigJournal, ShouldReplayRecords_WhenInitialized) {
+	struct journal_record rec = {
+		.seq = 7,
+		.base_crc = config.crc,
+		.offset = (uint16_t)offsetof(struct config, ocpp.checkpoint),
+		.len = 3,
+		.value = { 0xa, 0xb, 0xc },
+	};
+	rec.crc = crc32_cksum((const uint8_t *)&rec,
+			sizeof(rec)-sizeof(rec.crc));
+	init_with_record(&rec);
+
+	uint8_t checkpoint[16];
+	uint8_t expected[16] = { 0xa, 0xb, 0xc };
+	LONGS_EQUAL(0, config_get("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+	MEMCMP_EQUAL(expected, checkpoint, sizeof(checkpoint));
+}
+
+TEST(ConfigJournal, ShouldWriteWholeBlob_WhenBootedWithoutBlob) {
+	mock().expectOneCall("open")
+		.withPointerParameter("self", kvstore)
+		.withStringParameter("ns", "config")
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "basic")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOENT);
+	config_init(kvstore, on_config_save, NULL);
+
+	uint8_t checkpoint[16] = { 1, 2, 3, };
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+
+	struct config saved;
+	config_read_all(&saved);
+	mock().expectOneCall("open")
+		.withPointerParameter("self", kvstore)
+		.withStringParameter("ns", "config")
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "basic")
+		.withOutputParameterReturning("buf", &saved, sizeof(saved))
+		.withParameter("size", sizeof(saved))
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "j00")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOENT);
+	config_init(kvstore, on_config_save, NULL);
+
+	uint8_t actual[16];
+	LONGS_EQUAL(0, config_get("ocpp.checkpoint", actual, sizeof(actual)));
+	MEMCMP_EQUAL(checkpoint, actual, sizeof(actual));
+}
+
+TEST(ConfigJournal, ShouldIgnoreRecord_WhenWrittenAgainstOtherBase) {
+	struct journal_record rec = {
+		.seq = 7,
+		.base_crc = config.crc + 1,
+		.offset = (uint16_t)offsetof(struct config, ocpp.checkpoint),
+		.len = 3,
+		.value = { 0xa, 0xb, 0xc },
+	};
+	rec.crc = crc32_cksum((const uint8_t *)&rec,
+			sizeof(rec)-sizeof(rec.crc));
+
+	mock().expectOneCall("open")
+		.withPointerParameter("self", kvstore)
+		.withStringParameter("ns", "config")
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "basic")
+		.withOutputParameterReturning("buf", &config, sizeof(config))
+		.withParameter("size", sizeof(config))
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "j00")
+		.withOutputParameterReturning("buf", &rec, sizeof(rec))
+		.withParameter("size", sizeof(rec))
+		.andReturnValue((int)sizeof(rec));
+	config_init(kvstore, on_config_save, NULL);
+
+	uint8_t checkpoint[16];
+	uint8_t expected[16] = { 0, };
+	config_get("ocpp.checkpoint", checkpoint, sizeof(checkpoint));
+	MEMCMP_EQUAL(expected, checkpoint, sizeof(checkpoint));
+}
+
+TEST(ConfigJournal, ShouldIgnoreRecord_WhenReadShort) {
+	struct journal_record rec = {
+		.seq = 7,
+		.base_crc = config.crc,
+		.offset = (uint16_t)offsetof(struct config, ocpp.checkpoint),
+		.len = 3,
+		.value = { 0xa, 0xb, 0xc },
+	};
+	rec.crc = crc32_cksum((const uint8_t *)&rec,
+			sizeof(rec)-sizeof(rec.crc));
+
+	mock().expectOneCall("open")
+		.withPointerParameter("self", kvstore)
+		.withStringParameter("ns", "config")
+		.andReturnValue(0);
+	mock().expectOneCall("read")
+		.withStringParameter("key", "basic")
+		.withOutputParameterReturning("buf", &config, sizeof(config))
+		.withParameter("size", sizeof(config))
+		.andReturnValue(0);
+	/* a missing key reads 0 bytes on the host nvs, leaving whatever was
+	 * in the buffer before */
+	mock().expectOneCall("read")
+		.withStringParameter("key", "j00")
+		.withOutputParameterReturning("buf", &rec, sizeof(rec))
+		.withParameter("size", sizeof(rec))
+		.andReturnValue(0);
+	config_init(kvstore, on_config_save, NULL);
+
+	uint8_t checkpoint[16];
+	uint8_t expected[16] = { 0, };
+	config_get("ocpp.checkpoint", checkpoint, sizeof(checkpoint));
+	MEMCMP_EQUAL(expected, checkpoint, sizeof(checkpoint));
+}
+
+struct export_buf {
+	char data[4096];
+	size_t len;
+};
+
+static int on_export(const void *data, size_t datasize, void *ctx) {
+	struct export_buf *out = (struct export_buf *)ctx;
+	if (out->len + datasize >= sizeof(out->data)) {
+		return -ENOSPC;
+	}
+	memcpy(&out->data[out->len], data, datasize);
+	out->len += datasize;
+	out->data[out->len] = '\0';
+	return (int)datasize;
+}
+
+TEST(ConfigJournal, update_json_ShouldApplyAllValuesInSingleWrite) {
+	const char *json = "{ \"log.level\": 2, \"dfu.reboot_manually\": true,"
+		"\"net.server.url\": \"wss://csms.example.com\\/ocpp\","
+		"\"chg.param\": \"00f2000000aB\" }";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_update_json(json, strlen(json)));
+
+	uint8_t level;
+	bool reboot;
+	char url[256];
+	uint8_t param[16];
+	config_get_log_level(&level);
+	config_get_dfu_reboot_manually(&reboot);
+	config_get_net_server_url(url);
+	config_get_chg_param(param);
+	LONGS_EQUAL(2, level);
+	CHECK_TRUE(reboot);
+	STRCMP_EQUAL("wss://csms.example.com/ocpp", url);
+	MEMCMP_EQUAL("\x00\xf2\x00\x00\x00\xab\0\0\0\0\0\0\0\0\0\0",
+			param, sizeof(param));
+}
+
+TEST(ConfigJournal, update_json_ShouldApplyNothing_WhenAnyKeyIsReadonly) {
+	const char *json = "{\"log.level\":2,\"device.id\":\"other\"}";
+	LONGS_EQUAL(-EPERM, config_update_json(json, strlen(json)));
+
+	uint8_t level = 0xff;
+	config_get_log_level(&level);
+	LONGS_EQUAL(0, level);
+}
+
+TEST(ConfigJournal, update_json_ShouldApplyNothing_WhenAnyKeyIsDeviceState) {
+	const char *keys[] = {
+		"ocpp.checkpoint", "ocpp.config", "chg.c1.metering",
+		"chg.c1.plc_mac", "net.mac",
+	};
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		char json[64];
+		snprintf(json, sizeof(json),
+				"{\"log.level\":2,\"%s\":\"01\"}", keys[i]);
+		LONGS_EQUAL(-EPERM, config_update_json(json, strlen(json)));
+	}
+
+	uint8_t level = 0xff;
+	config_get_log_level(&level);
+	LONGS_EQUAL(0, level);
+}
+
+TEST(ConfigJournal, update_json_ShouldReturnENOENT_WhenKeyUnknown) {
+	const char *json = "{\"not.found\":1}";
+	LONGS_EQUAL(-ENOENT, config_update_json(json, strlen(json)));
+}
+
+TEST(ConfigJournal, update_json_ShouldReturnENOMEM_WhenStringTooLong) {
+	const char *json = "{\"chg.mode\":\"123456789\"}";
+	LONGS_EQUAL(-ENOMEM, config_update_json(json, strlen(json)));
+}
+
+TEST(ConfigJournal, update_json_ShouldAcceptString_WhenFillingWholeField) {
+	const char *json = "{\"chg.mode\":\"12345678\"}";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_update_json(json, strlen(json)));
+
+	char mode[CONFIG_CHARGER_MODE_MAXLEN];
+	config_get_chg_mode(mode);
+	MEMCMP_EQUAL("12345678", mode, sizeof(mode));
+}
+
+TEST(ConfigJournal, update_json_ShouldReturnERANGE_WhenNumberTooLarge) {
+	const char *json = "{\"log.level\":256}";
+	LONGS_EQUAL(-ERANGE, config_update_json(json, strlen(json)));
+}
+
+TEST(ConfigJournal, update_json_ShouldReturnEINVAL_WhenMalformed) {
+	const char *inputs[] = {
+		"", "{", "{\"log.level\"}", "{\"log.level\":}",
+		"{\"log.level\":1,}", "{\"log.level\":1} x", "[1]",
+		"{\"chg.param\":\"0\"}", "{\"dfu.reboot_manually\":1}",
+	};
+	for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		LONGS_EQUAL(-EINVAL,
+				config_update_json(inputs[i], strlen(inputs[i])));
+	}
+}
+
+TEST(ConfigJournal, update_json_ShouldNotWrite_WhenNothingChanged) {
+	const char *json = "{}";
+	LONGS_EQUAL(0, config_update_json(json, strlen(json) + 1));
+}
+
+TEST(ConfigJournal, export_json_ShouldBeImportableAsIs) {
+	const char *json = "{\"device.name\":\"a\\\"b\",\"net.health\":60000}";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_update_json(json, strlen(json)));
+
+	static struct export_buf exported;
+	exported.len = 0;
+	const int len = config_export_json(on_export, &exported);
+	LONGS_EQUAL(exported.len, len);
+	CHECK(strstr(exported.data, "\"device.name\":\"a\\\"b\""));
+	CHECK(strstr(exported.data, "\"net.health\":60000"));
+	CHECK(strstr(exported.data, "\"device.id\"") == NULL);
+
+	LONGS_EQUAL(0, config_update_json(exported.data, exported.len));
+}
+
+TEST(ConfigJournal, export_json_ShouldRoundTrip_WhenStringFillsWholeField) {
+	const char *json = "{\"chg.mode\":\"12345678\"}";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_update_json(json, strlen(json)));
+
+	static struct export_buf exported;
+	exported.len = 0;
+	config_export_json(on_export, &exported);
+	CHECK(strstr(exported.data, "\"chg.mode\":\"12345678\""));
+
+	LONGS_EQUAL(0, config_update_json(exported.data, exported.len));
+}
+
+TEST(ConfigJournal, export_json_ShouldLeaveOutServerPassword) {
+	const char *json = "{\"net.server.pass\":\"secret\"}";
+	expect_write("basic", sizeof(config));
+	LONGS_EQUAL(0, config_update_json(json, strlen(json)));
+
+	static struct export_buf exported;
+	exported.len = 0;
+	config_export_json(on_export, &exported);
+	CHECK(strstr(exported.data, "net.server.pass") == NULL);
+	CHECK(strstr(exported.data, "secret") == NULL);
+}
+
+TEST(ConfigJournal, export_json_ShouldLeaveOutDeviceState) {
+	uint8_t checkpoint[16] = { 1, 2, 3, };
+	expect_write("j00", sizeof(struct journal_record));
+	LONGS_EQUAL(0, config_set_and_save("ocpp.checkpoint",
+			checkpoint, sizeof(checkpoint)));
+
+	static struct export_buf exported;
+	exported.len = 0;
+	config_export_json(on_export, &exported);
+	CHECK(strstr(exported.data, "\"ocpp.checkpoint\"") == NULL);
+	CHECK(strstr(exported.data, "\"ocpp.config\"") == NULL);
+	CHECK(strstr(exported.data, "\"chg.c1.metering\"") == NULL);
+	CHECK(strstr(exported.data, "\"chg.c1.plc_mac\"") == NULL);
+	CHECK(strstr(exported.data, "\"net.mac\"") == NULL);
+	CHECK(strstr(exported.data, "\"chg.param\"") != NULL);
+}
@@ -0,0 +1,283 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "fs/kvstore.h"
+#include "libmcu/kvstore.h"
+#include <errno.h>
+#include <string.h>
+
+#define CACHE_SIZE		16
+#define FLUSH_INTERVAL_MS	1000
+
+struct fs {
+	struct fs_api api;
+};
+
+static uint32_t fake_time_ms;
+
+uint32_t board_get_time_since_boot_ms(void) {
+	return fake_time_ms;
+}
+
+static int fake_read(struct fs *self, const char *filepath,
+		const size_t offset, void *buf, const size_t bufsize) {
+	return mock().actualCall(__func__)
+		.withStringParameter("filepath", filepath)
+		.withOutputParameter("buf", buf)
+		.returnIntValueOrDefault((int)bufsize);
+}
+
+static int fake_write(struct fs *self, const char *filepath,
+		const size_t offset, const void *data, const size_t datasize) {
+	return mock().actualCall(__func__)
+		.withStringParameter("filepath", filepath)
+		.withMemoryBufferParameter("data",
+				(const unsigned char *)data, datasize)
+		.returnIntValueOrDefault((int)datasize);
+}
+
+static int fake_erase(struct fs *self, const char *filepath) {
+	return mock().actualCall(__func__)
+		.withStringParameter("filepath", filepath)
+		.returnIntValueOrDefault(0);
+}
+
+static struct fs fake_fs = {
+	.api = {
+		.read = fake_read,
+		.write = fake_write,
+		.erase = fake_erase,
+	},
+};
+
+TEST_GROUP(kvstore) {
+	struct kvstore *kvstore;
+
+	void setup(void) {
+		fake_time_ms = 0;
+		kvstore = fs_kvstore_create_cached(&fake_fs,
+				CACHE_SIZE, FLUSH_INTERVAL_MS);
+		kvstore_open(kvstore, "ns");
+	}
+	void teardown(void) {
+		fs_kvstore_destroy(kvstore);
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	void expect_write(const char *path, const void *data, size_t size) {
+		mock().expectOneCall("fake_write")
+			.withStringParameter("filepath", path)
+			.withMemoryBufferParameter("data",
+					(const unsigned char *)data, size);
+	}
+};
+
+TEST(kvstore, write_ShouldWriteThrough_WhenCacheDisabled) {
+	struct kvstore *uncached = fs_kvstore_create(&fake_fs);
+	kvstore_open(uncached, "ns");
+
+	expect_write("ns/key", "value", 5);
+	LONGS_EQUAL(5, kvstore_write(uncached, "key", "value", 5));
+
+	fs_kvstore_destroy(uncached);
+}
+
+TEST(kvstore, write_ShouldNotTouchFlash_UntilFlushed) {
+	LONGS_EQUAL(5, kvstore_write(kvstore, "key", "value", 5));
+	mock().checkExpectations();
+
+	expect_write("ns/key", "value", 5);
+	LONGS_EQUAL(0, fs_kvstore_flush(kvstore));
+}
+
+TEST(kvstore, write_ShouldCoalesceRepeatedWrites_WhenSameKey) {
+	kvstore_write(kvstore, "key", "first", 5);
+	kvstore_write(kvstore, "key", "other", 5);
+	kvstore_write(kvstore, "key", "final", 5);
+
+	expect_write("ns/key", "final", 5);
+	fs_kvstore_flush(kvstore);
+	/* nothing left dirty */
+	fs_kvstore_flush(kvstore);
+}
+
+TEST(kvstore, write_ShouldSkipFlash_WhenValueUnchangedAfterFlush) {
+	expect_write("ns/key", "value", 5);
+	kvstore_write(kvstore, "key", "value", 5);
+	fs_kvstore_flush(kvstore);
+
+	kvstore_write(kvstore, "key", "value", 5);
+	fs_kvstore_flush(kvstore);
+}
+
+TEST(kvstore, write_ShouldFlush_WhenIntervalElapsed) {
+	kvstore_write(kvstore, "a", "1", 1);
+	fake_time_ms = FLUSH_INTERVAL_MS - 1;
+	kvstore_write(kvstore, "b", "2", 1);
+	mock().checkExpectations();
+
+	expect_write("ns/a", "1", 1);
+	expect_write("ns/b", "2", 1);
+	fake_time_ms = FLUSH_INTERVAL_MS;
+	kvstore_write(kvstore, "b", "2", 1);
+}
+
+TEST(kvstore, write_ShouldWriteThrough_WhenValueLargerThanCache) {
+	uint8_t big[CACHE_SIZE+1] = { 0, };
+	expect_write("ns/big", big, sizeof(big));
+	LONGS_EQUAL(sizeof(big), kvstore_write(kvstore, "big", big, sizeof(big)));
+}
+
+TEST(kvstore, write_ShouldFlushDirtyEntries_WhenCacheFull) {
+	uint8_t v1[CACHE_SIZE/2] = { 1, };
+	uint8_t v2[CACHE_SIZE/2] = { 2, };
+	uint8_t v3[CACHE_SIZE/2] = { 3, };
+
+	kvstore_write(kvstore, "1", v1, sizeof(v1));
+	kvstore_write(kvstore, "2", v2, sizeof(v2));
+
+	expect_write("ns/1", v1, sizeof(v1));
+	expect_write("ns/2", v2, sizeof(v2));
+	kvstore_write(kvstore, "3", v3, sizeof(v3));
+	mock().checkExpectations();
+
+	expect_write("ns/3", v3, sizeof(v3));
+}
+
+TEST(kvstore, write_ShouldReturnError_WhenFlushFails) {
+	uint8_t v1[CACHE_SIZE] = { 1, };
+	kvstore_write(kvstore, "1", v1, sizeof(v1));
+
+	mock().expectOneCall("fake_write")
+		.withStringParameter("filepath", "ns/1")
+		.ignoreOtherParameters()
+		.andReturnValue(-EIO);
+	LONGS_EQUAL(-EIO, kvstore_write(kvstore, "2", "x", 1));
+
+	expect_write("ns/1", v1, sizeof(v1));
+}
+
+TEST(kvstore, read_ShouldServeFromCache_WhenKeyCached) {
+	char buf[8] = { 0, };
+	kvstore_write(kvstore, "key", "value", 5);
+	LONGS_EQUAL(5, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+	STRCMP_EQUAL("value", buf);
+
+	expect_write("ns/key", "value", 5);
+}
+
+TEST(kvstore, read_ShouldReadFromFlash_WhenKeyNotCached) {
+	char buf[8];
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "ns/key")
+		.withOutputParameterReturning("buf", "value", 5)
+		.andReturnValue(5);
+	LONGS_EQUAL(5, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+}
+
+TEST(kvstore, read_ShouldFillCache_WhenKeyReadFromFlash) {
+	char buf[8] = { 0, };
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "ns/key")
+		.withOutputParameterReturning("buf", "value", 5)
+		.andReturnValue(5);
+	LONGS_EQUAL(5, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+
+	memset(buf, 0, sizeof(buf));
+	LONGS_EQUAL(5, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+	STRCMP_EQUAL("value", buf);
+}
+
+TEST(kvstore, read_ShouldNotFillCache_WhenValueLargerThanBuffer) {
+	char buf[4];
+	mock().expectNCalls(2, "fake_read")
+		.withStringParameter("filepath", "ns/key")
+		.withOutputParameterReturning("buf", "value", 5)
+		.andReturnValue(5);
+	LONGS_EQUAL(4, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+	MEMCMP_EQUAL("valu", buf, sizeof(buf));
+	LONGS_EQUAL(4, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+}
+
+TEST(kvstore, read_ShouldMoveValueIntoNamespace_WhenFoundAtRoot) {
+	char buf[8] = { 0, };
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "ns/key")
+		.andReturnValue(-ENOENT);
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "key")
+		.withOutputParameterReturning("buf", "value", 5)
+		.andReturnValue(5);
+	expect_write("ns/key", "value", 5);
+	mock().expectOneCall("fake_erase")
+		.withStringParameter("filepath", "key")
+		.andReturnValue(0);
+
+	LONGS_EQUAL(5, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+	STRCMP_EQUAL("value", buf);
+}
+
+TEST(kvstore, read_ShouldReturnENOENT_WhenNeitherInNamespaceNorAtRoot) {
+	char buf[8];
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "ns/key")
+		.andReturnValue(-ENOENT);
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "key")
+		.andReturnValue(-ENOENT);
+	LONGS_EQUAL(-ENOENT, kvstore_read(kvstore, "key", buf, sizeof(buf)));
+}
+
+TEST(kvstore, clear_ShouldDropPendingWrite) {
+	kvstore_write(kvstore, "key", "value", 5);
+	mock().expectOneCall("fake_erase")
+		.withStringParameter("filepath", "ns/key")
+		.andReturnValue(-ENOENT);
+	LONGS_EQUAL(0, kvstore_clear(kvstore, "key"));
+}
+
+TEST(kvstore, open_ShouldReturnENAMETOOLONG_WhenNamespaceTooLong) {
+	char ns[FS_FILENAME_MAX+1];
+	memset(ns, 'a', sizeof(ns)-1);
+	ns[sizeof(ns)-1] = '\0';
+	LONGS_EQUAL(-ENAMETOOLONG, kvstore_open(kvstore, ns));
+}
+
+TEST(kvstore, destroy_ShouldFlushDirtyEntries) {
+	kvstore_write(kvstore, "key", "value", 5);
+	expect_write("ns/key", "value", 5);
+}
@@ -62,6 +62,18 @@ static int fake_append(struct fs *self, const char *filepath,
 		.returnIntValue();
 }
 
+static int fake_append_batch(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	size_t datasize = 0;
+	for (size_t i = 0; i < iovcnt; i++) {
+		datasize += iov[i].datasize;
+	}
+	return mock().actualCall(__func__)
+		.withParameter("filepath", filepath)
+		.withParameter("datasize", datasize)
+		.returnIntValue();
+}
+
 static int fake_erase(struct fs *self, const char *filepath) {
 	return mock().actualCall(__func__)
 		.withParameter("filepath", filepath)
@@ -126,6 +138,7 @@ TEST_GROUP(logfs) {
 	void setup(void) {
 		log_count = 0;
 		fs = fs_create(0);
+		((struct fs_api *)fs)->append_batch = NULL;
 		logfs = logfs_create(fs, BASE_PATH, MAX_SIZE, 10, CACHE_SIZE);
 	}
 	void teardown(void) {
@@ -293,6 +306,23 @@ TEST(logfs, write_ShouldFlushCache_WhenLogSizeIsLargerThanCacheSize) {
 		.andReturnValue(16);
 	LONGS_EQUAL(17, logfs_write(logfs, 0, buf, 17));
 }
+TEST(logfs, write_ShouldAppendInSingleBatch_WhenFSSupportsBatch) {
+	size_t dir_size = 0;
+	size_t file_size = 16;
+	char buf[17];
+
+	((struct fs_api *)fs)->append_batch = fake_append_batch;
+
+	mock().expectOneCall("fake_dir")
+		.withParameter("path", BASE_PATH)
+		.andReturnValue(-ENOENT);
+	expect_no_reclaim("logfs/0", &dir_size, &file_size);
+	mock().expectOneCall("fake_append_batch")
+		.withParameter("filepath", "logfs/0")
+		.withParameter("datasize", 16)
+		.andReturnValue(16);
+	LONGS_EQUAL(17, logfs_write(logfs, 0, buf, 17));
+}
 TEST(logfs, write_ShouldInitializeLogListFirst_WhenLogListIsEmptyWhileFSIsNotEmpty) {
 	size_t size = 10;
 	time_t ts = 1;
@@ -0,0 +1,221 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "net/server_rxq.h"
+
+#define CAPACITY		64
+#define MSG_MAXLEN		32
+#define HDRSIZE			4
+
+TEST_GROUP(ServerRxq) {
+	struct server_rxq *rxq;
+
+	void setup(void) {
+		rxq = server_rxq_create(CAPACITY, MSG_MAXLEN);
+	}
+	void teardown(void) {
+		server_rxq_destroy(rxq);
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	int put(const char *msg) {
+		int err = server_rxq_begin(rxq, strlen(msg));
+		if (!err && !(err = server_rxq_append(rxq, msg, strlen(msg)))) {
+			err = server_rxq_end(rxq);
+		}
+		return err;
+	}
+	void check_head(const char *expected) {
+		const void *msg;
+		LONGS_EQUAL(strlen(expected), server_rxq_peek(rxq, &msg));
+		MEMCMP_EQUAL(expected, msg, strlen(expected));
+	}
+};
+
+TEST(ServerRxq, create_ShouldReturnNull_WhenCapacityTooSmall) {
+	POINTERS_EQUAL(NULL, server_rxq_create(HDRSIZE, MSG_MAXLEN));
+}
+
+TEST(ServerRxq, peek_ShouldReturnENODATA_WhenEmpty) {
+	const void *msg;
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+	LONGS_EQUAL(-ENODATA, server_rxq_consume(rxq));
+}
+
+TEST(ServerRxq, peek_ShouldReturnWholeMessage_WhenFragmentsAppended) {
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 4));
+	LONGS_EQUAL(0, server_rxq_append(rxq, "[2,\"", 4));
+	LONGS_EQUAL(0, server_rxq_append(rxq, "1\"]", 3));
+	LONGS_EQUAL(0, server_rxq_end(rxq));
+
+	check_head("[2,\"1\"]");
+}
+
+TEST(ServerRxq, peek_ShouldNotSeeMessage_UntilEnded) {
+	const void *msg;
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 3));
+	LONGS_EQUAL(0, server_rxq_append(rxq, "abc", 3));
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+}
+
+TEST(ServerRxq, peek_ShouldKeepMessagesInOrder) {
+	LONGS_EQUAL(0, put("first"));
+	LONGS_EQUAL(0, put("second"));
+
+	check_head("first");
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	check_head("second");
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	LONGS_EQUAL(-ENODATA, server_rxq_consume(rxq));
+}
+
+TEST(ServerRxq, begin_ShouldReturnEMSGSIZE_WhenSizeHintExceedsLimit) {
+	LONGS_EQUAL(-EMSGSIZE, server_rxq_begin(rxq, MSG_MAXLEN + 1));
+	LONGS_EQUAL(-ENOENT, server_rxq_append(rxq, "a", 1));
+	LONGS_EQUAL(-ENOENT, server_rxq_end(rxq));
+}
+
+TEST(ServerRxq, append_ShouldDropMessage_WhenGrowingBeyondLimit) {
+	char big[MSG_MAXLEN + 1];
+	memset(big, 'a', sizeof(big));
+
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 1));
+	LONGS_EQUAL(-EMSGSIZE, server_rxq_append(rxq, big, sizeof(big)));
+	LONGS_EQUAL(-ENOENT, server_rxq_append(rxq, "a", 1));
+	LONGS_EQUAL(-ENOENT, server_rxq_end(rxq));
+
+	const void *msg;
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+	LONGS_EQUAL(0, put("next"));
+	check_head("next");
+}
+
+TEST(ServerRxq, begin_ShouldDropOpenMessage) {
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 4));
+	LONGS_EQUAL(0, server_rxq_append(rxq, "lost", 4));
+	LONGS_EQUAL(0, put("kept"));
+
+	check_head("kept");
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	const void *msg;
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+}
+
+TEST(ServerRxq, begin_ShouldReturnENOSPC_WhenFull) {
+	char msg[MSG_MAXLEN];
+	memset(msg, 'a', sizeof(msg));
+
+	LONGS_EQUAL(0, server_rxq_begin(rxq, sizeof(msg)));
+	LONGS_EQUAL(0, server_rxq_append(rxq, msg, sizeof(msg)));
+	LONGS_EQUAL(0, server_rxq_end(rxq));
+	/* 64 - (4 + 32) = 28 bytes left */
+	LONGS_EQUAL(-ENOSPC, server_rxq_begin(rxq, 25));
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 24));
+	LONGS_EQUAL(-ENOSPC, server_rxq_append(rxq, msg, 25));
+}
+
+TEST(ServerRxq, append_ShouldKeepMessageContiguous_WhenWrappingAround) {
+	char a[18];
+	char b[20];
+	memset(a, 'a', sizeof(a));
+	memset(b, 'b', sizeof(b));
+
+	LONGS_EQUAL(0, put("0123456789012345678")); /* 0..23 */
+	LONGS_EQUAL(0, put("abcdefghijklmnopqrs")); /* 23..46 */
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	/* 18 bytes left at the end, 23 at the front */
+	LONGS_EQUAL(0, server_rxq_begin(rxq, sizeof(a)));
+	LONGS_EQUAL(0, server_rxq_append(rxq, a, sizeof(a)));
+	LONGS_EQUAL(0, server_rxq_end(rxq));
+
+	check_head("abcdefghijklmnopqrs");
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+
+	const void *msg;
+	LONGS_EQUAL(sizeof(a), server_rxq_peek(rxq, &msg));
+	MEMCMP_EQUAL(a, msg, sizeof(a));
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+
+	LONGS_EQUAL(0, server_rxq_begin(rxq, sizeof(b)));
+	LONGS_EQUAL(0, server_rxq_append(rxq, b, sizeof(b)));
+	LONGS_EQUAL(0, server_rxq_end(rxq));
+	LONGS_EQUAL(sizeof(b), server_rxq_peek(rxq, &msg));
+	MEMCMP_EQUAL(b, msg, sizeof(b));
+}
+
+TEST(ServerRxq, peek_ShouldSkipPadding_WhenConsumedBeforeWrappedMessageEnds) {
+	char a[20];
+	memset(a, 'a', sizeof(a));
+
+	LONGS_EQUAL(0, put("0123456789012345678901234567")); /* 0..32 */
+	LONGS_EQUAL(0, put("abcdefghijklmnopqrst")); /* 32..56 */
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	/* 8 bytes left at the end, 32 at the front */
+	LONGS_EQUAL(0, server_rxq_begin(rxq, 20));
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	LONGS_EQUAL(0, server_rxq_append(rxq, a, 20));
+	LONGS_EQUAL(0, server_rxq_end(rxq));
+
+	const void *msg;
+	LONGS_EQUAL(20, server_rxq_peek(rxq, &msg));
+	MEMCMP_EQUAL(a, msg, 20);
+	LONGS_EQUAL(0, server_rxq_consume(rxq));
+	LONGS_EQUAL(-ENODATA, server_rxq_peek(rxq, &msg));
+}
+
+TEST(ServerRxq, read_ShouldCopyOutAndRemoveMessage) {
+	char buf[16];
+
+	LONGS_EQUAL(0, put("hello"));
+	LONGS_EQUAL(5, server_rxq_read(rxq, buf, sizeof(buf)));
+	MEMCMP_EQUAL("hello", buf, 5);
+	LONGS_EQUAL(-ENODATA, server_rxq_read(rxq, buf, sizeof(buf)));
+}
+
+TEST(ServerRxq, read_ShouldDropMessage_WhenBufferTooSmall) {
+	char buf[4];
+
+	LONGS_EQUAL(0, put("hello"));
+	LONGS_EQUAL(0, put("hi"));
+	LONGS_EQUAL(-EMSGSIZE, server_rxq_read(rxq, buf, sizeof(buf)));
+	LONGS_EQUAL(2, server_rxq_read(rxq, buf, sizeof(buf)));
+	MEMCMP_EQUAL("hi", buf, 2);
+}
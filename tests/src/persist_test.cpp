@@ -0,0 +1,269 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTestExt/MockSupport.h"
+
+#include "persist.h"
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+static int fake_writer(const char *key, const void *data, size_t datasize) {
+	return mock().actualCall(__func__)
+		.withStringParameter("key", key)
+		.withMemoryBufferParameter("data",
+				(const unsigned char *)data, datasize)
+		.returnIntValueOrDefault(0);
+}
+
+static void on_done(const char *key, int err, void *ctx) {
+	mock().actualCall(__func__)
+		.withStringParameter("key", key)
+		.withParameter("err", err)
+		.withParameter("ctx", ctx);
+}
+
+static void on_done_request_again(const char *key, int err, void *ctx) {
+	uint8_t large[PERSIST_DATA_MAXLEN + 1] = { 0, };
+	on_done(key, err, ctx);
+	persist_request("large", large, sizeof(large),
+			PERSIST_PRIO_LOW, NULL, NULL);
+}
+
+TEST_GROUP(persist) {
+	void setup(void) {
+		persist_init(fake_writer);
+	}
+	void teardown(void) {
+		persist_deinit();
+
+		mock().checkExpectations();
+		mock().clear();
+	}
+
+	void expect_write(const char *key, const void *data, size_t datasize) {
+		mock().expectOneCall("fake_writer")
+			.withStringParameter("key", key)
+			.withMemoryBufferParameter("data",
+					(const unsigned char *)data, datasize)
+			.andReturnValue(0);
+	}
+};
+
+TEST(persist, init_ShouldReturnEINVAL_WhenNoWriterGiven) {
+	LONGS_EQUAL(-EINVAL, persist_init(NULL));
+}
+
+TEST(persist, request_ShouldNotWrite_UntilWorkerRuns) {
+	uint32_t v = 1;
+	LONGS_EQUAL(0, persist_request("key", &v, sizeof(v),
+			PERSIST_PRIO_LOW, NULL, NULL));
+	LONGS_EQUAL(1, persist_pending());
+
+	expect_write("key", &v, sizeof(v));
+	persist_step();
+	LONGS_EQUAL(0, persist_pending());
+}
+
+TEST(persist, request_ShouldCopyData_WhenCallerBufferChanges) {
+	uint32_t v = 1;
+	const uint32_t expected = 1;
+	persist_request("key", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+	v = 2;
+
+	expect_write("key", &expected, sizeof(expected));
+	persist_step();
+}
+
+TEST(persist, request_ShouldCoalesce_WhenSameKeyRequestedRepeatedly) {
+	uint32_t v[] = { 1, 2, 3 };
+	for (size_t i = 0; i < sizeof(v) / sizeof(*v); i++) {
+		persist_request("key", &v[i], sizeof(v[i]),
+				PERSIST_PRIO_LOW, NULL, NULL);
+	}
+	LONGS_EQUAL(1, persist_pending());
+
+	expect_write("key", &v[2], sizeof(v[2]));
+	persist_step();
+}
+
+TEST(persist, request_ShouldCancelSuperseded_WhenCoalesced) {
+	uint32_t v[] = { 1, 2 };
+	int ctx[2];
+
+	mock().expectOneCall("on_done")
+		.withStringParameter("key", "key")
+		.withParameter("err", -ECANCELED)
+		.withParameter("ctx", &ctx[0]);
+	persist_request("key", &v[0], sizeof(v[0]),
+			PERSIST_PRIO_LOW, on_done, &ctx[0]);
+	persist_request("key", &v[1], sizeof(v[1]),
+			PERSIST_PRIO_LOW, on_done, &ctx[1]);
+
+	expect_write("key", &v[1], sizeof(v[1]));
+	mock().expectOneCall("on_done")
+		.withStringParameter("key", "key")
+		.withParameter("err", 0)
+		.withParameter("ctx", &ctx[1]);
+	persist_step();
+}
+
+TEST(persist, step_ShouldCommitInPriorityOrder) {
+	uint32_t v = 1;
+	persist_request("low", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+	persist_request("normal", &v, sizeof(v),
+			PERSIST_PRIO_NORMAL, NULL, NULL);
+	persist_request("high", &v, sizeof(v), PERSIST_PRIO_HIGH, NULL, NULL);
+
+	mock().strictOrder();
+	expect_write("high", &v, sizeof(v));
+	expect_write("normal", &v, sizeof(v));
+	expect_write("low", &v, sizeof(v));
+	persist_step();
+}
+
+TEST(persist, step_ShouldKeepRequestOrder_WhenSamePriority) {
+	uint32_t v = 1;
+	persist_request("first", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+	persist_request("second", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+
+	mock().strictOrder();
+	expect_write("first", &v, sizeof(v));
+	expect_write("second", &v, sizeof(v));
+	persist_step();
+}
+
+TEST(persist, step_ShouldReportError_WhenWriterFails) {
+	uint32_t v = 1;
+	persist_request("key", &v, sizeof(v), PERSIST_PRIO_LOW, on_done, NULL);
+
+	mock().expectOneCall("fake_writer")
+		.ignoreOtherParameters()
+		.andReturnValue(-EIO);
+	mock().expectOneCall("on_done")
+		.withStringParameter("key", "key")
+		.withParameter("err", -EIO)
+		.withParameter("ctx", (void *)NULL);
+	LONGS_EQUAL(-EIO, persist_step());
+}
+
+TEST(persist, flush_ShouldCommitAllPending) {
+	uint32_t v = 1;
+	persist_request("a", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+	persist_request("b", &v, sizeof(v), PERSIST_PRIO_HIGH, NULL, NULL);
+
+	expect_write("a", &v, sizeof(v));
+	expect_write("b", &v, sizeof(v));
+	LONGS_EQUAL(0, persist_flush(PERSIST_PRIO_LOW));
+	LONGS_EQUAL(0, persist_pending());
+}
+
+TEST(persist, flush_ShouldLeaveLowerPriority_WhenMinPriorityGiven) {
+	uint32_t v = 1;
+	persist_request("low", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+	persist_request("normal", &v, sizeof(v),
+			PERSIST_PRIO_NORMAL, NULL, NULL);
+	persist_request("high", &v, sizeof(v), PERSIST_PRIO_HIGH, NULL, NULL);
+
+	expect_write("high", &v, sizeof(v));
+	LONGS_EQUAL(0, persist_flush(PERSIST_PRIO_HIGH));
+	LONGS_EQUAL(2, persist_pending());
+
+	mock().strictOrder();
+	expect_write("normal", &v, sizeof(v));
+	expect_write("low", &v, sizeof(v));
+	persist_step();
+}
+
+TEST(persist, request_ShouldCommitSynchronously_WhenDataTooLarge) {
+	uint8_t big[PERSIST_DATA_MAXLEN + 1] = { 0, };
+	uint32_t v = 1;
+	persist_request("small", &v, sizeof(v), PERSIST_PRIO_LOW, NULL, NULL);
+
+	mock().strictOrder();
+	expect_write("small", &v, sizeof(v));
+	expect_write("big", big, sizeof(big));
+	mock().expectOneCall("on_done")
+		.withStringParameter("key", "big")
+		.withParameter("err", 0)
+		.withParameter("ctx", (void *)NULL);
+	LONGS_EQUAL(0, persist_request("big", big, sizeof(big),
+			PERSIST_PRIO_LOW, on_done, NULL));
+	LONGS_EQUAL(0, persist_pending());
+}
+
+TEST(persist, request_ShouldCommitSynchronously_WhenQueueFull) {
+	char keys[PERSIST_QUEUE_MAX][8];
+	uint32_t v = 1;
+
+	for (int i = 0; i < PERSIST_QUEUE_MAX; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "k%d", i);
+		persist_request(keys[i], &v, sizeof(v),
+				PERSIST_PRIO_LOW, NULL, NULL);
+	}
+
+	mock().expectNCalls(PERSIST_QUEUE_MAX + 1, "fake_writer")
+		.ignoreOtherParameters()
+		.andReturnValue(0);
+	LONGS_EQUAL(0, persist_request("full", &v, sizeof(v),
+			PERSIST_PRIO_LOW, NULL, NULL));
+	LONGS_EQUAL(0, persist_pending());
+}
+
+TEST(persist, request_ShouldReturnEINVAL_WhenKeyTooLong) {
+	char key[PERSIST_KEY_MAXLEN + 1];
+	uint32_t v = 1;
+	memset(key, 'a', sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	LONGS_EQUAL(-EINVAL, persist_request(key, &v, sizeof(v),
+			PERSIST_PRIO_LOW, NULL, NULL));
+}
+
+TEST(persist, step_ShouldLetCallbackRequestSynchronously) {
+	uint8_t large[PERSIST_DATA_MAXLEN + 1] = { 0, };
+	uint32_t v = 1;
+
+	persist_request("key", &v, sizeof(v), PERSIST_PRIO_LOW,
+			on_done_request_again, NULL);
+
+	mock().strictOrder();
+	expect_write("key", &v, sizeof(v));
+	mock().expectOneCall("on_done")
+		.withStringParameter("key", "key")
+		.withParameter("err", 0)
+		.withParameter("ctx", (const void *)NULL);
+	expect_write("large", large, sizeof(large));
+
+	LONGS_EQUAL(0, persist_step());
+}
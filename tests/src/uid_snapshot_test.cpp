@@ -0,0 +1,249 @@
+/*
+ * This file is part of the Pazzk project <https://pazzk.net/>.
+ * Copyright (c) 2025 Pazzk <team@pazzk.net>.
+ *
+ * Community Version License (GPLv3):
+ * This software is open-source and licensed under the GNU General Public
+ * License v3.0 (GPLv3). You are free to use, modify, and distribute this code
+ * under the terms of the GPLv3. For more details, see
+ * <https://www.gnu.org/licenses/gpl-3.0.en.html>.
+ * Note: If you modify and distribute this software, you must make your
+ * modifications publicly available under the same license (GPLv3), including
+ * the source code.
+ *
+ * Commercial Version License:
+ * For commercial use, including redistribution or integration into proprietary
+ * systems, you must obtain a commercial license. This license includes
+ * additional benefits such as dedicated support and feature customization.
+ * Contact us for more details.
+ *
+ * Contact Information:
+ * Maintainer: 권경환 Kyunghwan Kwon (on behalf of the Pazzk Team)
+ * Email: k@pazzk.net
+ * Website: <https://pazzk.net/>
+ *
+ * Disclaimer:
+ * This software is provided "as-is", without any express or implied warranty,
+ * including, but not limited to, the implied warranties of merchantability or
+ * fitness for a particular purpose. In no event shall the authors or
+ * maintainers be held liable for any damages, whether direct, indirect,
+ * incidental, special, or consequential, arising from the use of this software.
+ */
+
+
+#include "CppUTest/TestHarness.h"
+
+#include "uid_snapshot.h"
+#include "flash_mmap.h"
+#include <string.h>
+#include <errno.h>
+
+#define FLASH_SIZE	(64 * 1024)
+#define TAG		0x1234
+
+struct flash {
+	struct flash_api api;
+	uint8_t mem[FLASH_SIZE];
+	size_t erased;
+};
+
+struct record {
+	uid_id_t id;
+	uint32_t value;
+};
+
+struct source {
+	struct record *records;
+	size_t n;
+	int fail_at; /* fails the n-th visit if positive */
+	int cancel_at; /* cancels on the n-th poll if positive */
+};
+
+static int fake_erase(struct flash *self, uintptr_t offset, size_t size) {
+	if (offset + size > sizeof(self->mem)) {
+		return -EINVAL;
+	}
+	memset(&self->mem[offset], 0xff, size);
+	self->erased += size;
+	return 0;
+}
+static int fake_write(struct flash *self, uintptr_t offset,
+		const void *data, size_t len) {
+	if (offset + len > sizeof(self->mem)) {
+		return -EINVAL;
+	}
+	/* NOR flash only clears bits */
+	for (size_t i = 0; i < len; i++) {
+		self->mem[offset + i] &= ((const uint8_t *)data)[i];
+	}
+	return 0;
+}
+static int fake_read(struct flash *self, uintptr_t offset,
+		void *buf, size_t len) {
+	memcpy(buf, &self->mem[offset], len);
+	return 0;
+}
+static size_t fake_size(struct flash *self) {
+	return sizeof(self->mem);
+}
+
+const void *flash_mmap(struct flash *flash, size_t *size) {
+	if (size) {
+		*size = sizeof(flash->mem);
+	}
+	return flash->mem;
+}
+
+static int iterate(void *ctx, uid_snapshot_visit_t visit, void *visit_ctx) {
+	struct source *source = (struct source *)ctx;
+
+	for (size_t i = 0; i < source->n; i++) {
+		if (source->fail_at > 0 && --source->fail_at == 0) {
+			return -EIO;
+		}
+
+		int err = (*visit)(&source->records[i], visit_ctx);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static bool canceled(void *ctx) {
+	struct source *source = (struct source *)ctx;
+	return source->cancel_at > 0 && --source->cancel_at == 0;
+}
+
+TEST_GROUP(UIDSnapshot) {
+	struct flash flash;
+	struct uid_snapshot *snap;
+	struct record records[1000];
+	struct source source;
+
+	void setup() {
+		flash.api = (struct flash_api) {
+			.erase = fake_erase,
+			.write = fake_write,
+			.read = fake_read,
+			.size = fake_size,
+		};
+		memset(flash.mem, 0xff, sizeof(flash.mem));
+		flash.erased = 0;
+
+		memset(records, 0, sizeof(records));
+		for (uint32_t i = 0; i < 1000; i++) {
+			records[i].id[0] = (uint8_t)(i >> 8);
+			records[i].id[1] = (uint8_t)i;
+			records[i].id[5] = 0xA5;
+			records[i].value = i;
+		}
+		source = (struct source) { .records = records, .n = 1000, };
+
+		snap = uid_snapshot_create(&flash);
+	}
+	void teardown() {
+		uid_snapshot_destroy(snap);
+	}
+};
+
+TEST(UIDSnapshot, ShouldFindEveryRecord_WhenBuilt) {
+	struct record record;
+
+	LONGS_EQUAL(0, uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source));
+	CHECK_TRUE(uid_snapshot_is_valid(snap, TAG));
+
+	for (size_t i = 0; i < source.n; i++) {
+		LONGS_EQUAL(0, uid_snapshot_find(snap, records[i].id,
+				&record, sizeof(record)));
+		MEMCMP_EQUAL(&records[i], &record, sizeof(record));
+	}
+}
+
+TEST(UIDSnapshot, ShouldReturnNoEntry_WhenIdIsNotInSnapshot) {
+	const uid_id_t id = { 0xde, 0xad, 0xbe, 0xef, };
+	struct record record;
+
+	uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source);
+
+	LONGS_EQUAL(-ENOENT, uid_snapshot_find(snap, id,
+			&record, sizeof(record)));
+}
+
+TEST(UIDSnapshot, ShouldBuildEmptySnapshot_WhenNoRecords) {
+	struct record record;
+	source.n = 0;
+
+	LONGS_EQUAL(0, uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source));
+	CHECK_TRUE(uid_snapshot_is_valid(snap, TAG));
+	LONGS_EQUAL(-ENOENT, uid_snapshot_find(snap, records[0].id,
+			&record, sizeof(record)));
+}
+
+TEST(UIDSnapshot, ShouldBeInvalid_WhenInvalidated) {
+	struct record record;
+
+	uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source);
+	LONGS_EQUAL(0, uid_snapshot_invalidate(snap));
+
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG));
+	LONGS_EQUAL(-ENODATA, uid_snapshot_find(snap, records[0].id,
+			&record, sizeof(record)));
+}
+
+TEST(UIDSnapshot, ShouldBeInvalid_WhenTagDiffers) {
+	uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source);
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG + 1));
+}
+
+TEST(UIDSnapshot, ShouldReturnNoData_WhenRecordSizeDiffers) {
+	uint8_t buf[sizeof(struct record) + 1];
+
+	uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source);
+	LONGS_EQUAL(-ENODATA, uid_snapshot_find(snap, records[0].id,
+			buf, sizeof(buf)));
+}
+
+TEST(UIDSnapshot, ShouldStayInvalid_WhenBuildInterrupted) {
+	/* counted and hashed, then fails halfway through writing */
+	source.fail_at = 2500;
+
+	LONGS_EQUAL(-EIO, uid_snapshot_build(snap, TAG, sizeof(struct record),
+			iterate, NULL, &source));
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG));
+}
+
+TEST(UIDSnapshot, ShouldReturnNoSpace_WhenRecordsDoNotFitPartition) {
+	LONGS_EQUAL(-ENOSPC, uid_snapshot_build(snap, TAG, 100,
+			iterate, NULL, &source));
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG));
+}
+
+TEST(UIDSnapshot, ShouldReturnNull_WhenFlashIsNull) {
+	POINTERS_EQUAL(NULL, uid_snapshot_create(NULL));
+}
+
+TEST(UIDSnapshot, ShouldStopErasing_WhenCanceledDuringErase) {
+	source.cancel_at = 2; /* after the first sector of the records */
+
+	LONGS_EQUAL(-ECANCELED, uid_snapshot_build(snap, TAG,
+			sizeof(struct record), iterate, canceled, &source));
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG));
+	/* the header sector and one more */
+	LONGS_EQUAL(2 * 4096, flash.erased);
+}
+
+TEST(UIDSnapshot, ShouldStayInvalid_WhenCanceledDuringWrite) {
+	source.cancel_at = 100;
+
+	LONGS_EQUAL(-ECANCELED, uid_snapshot_build(snap, TAG,
+			sizeof(struct record), iterate, canceled, &source));
+	CHECK_FALSE(uid_snapshot_is_valid(snap, TAG));
+}
@@ -34,12 +34,15 @@
 #include "CppUTestExt/MockSupport.h"
 
 #include "uid.h"
+#include "uid_snapshot.h"
+#include "flash_mmap.h"
 #include "fs/fs.h"
 #include <string.h>
 #include <time.h>
 
 #define CACHE_CAPACITY	1024
 #define ENTRY_SIZE	54
+#define FORMAT		2
 
 struct fs {
 	struct fs_api api;
@@ -75,6 +78,66 @@ static int fake_write(struct fs *self, const char *filepath,
 		.returnIntValue();
 }
 
+static int fake_replace(struct fs *self, const char *filepath,
+		const struct fs_iovec *iov, const size_t iovcnt) {
+	return mock().actualCall(__func__)
+		.withStringParameter("filepath", filepath)
+		.withMemoryBufferParameter("data",
+				(const uint8_t *)iov[0].data, iov[0].datasize)
+		.returnIntValue();
+}
+static int fake_erase(struct fs *self, const char *filepath) {
+	return mock().actualCall(__func__)
+		.withStringParameter("filepath", filepath)
+		.returnIntValue();
+}
+static int fake_dir(struct fs *self, const char *path,
+		fs_dir_cb_t cb, void *cb_ctx) {
+	if (strcmp(path, "uid/cache") == 0) {
+		(*cb)(self, FS_FILE_TYPE_DIR, "01", cb_ctx);
+		return 1;
+	} else if (strcmp(path, "uid/cache/01") == 0) {
+		(*cb)(self, FS_FILE_TYPE_FILE, "01.bin", cb_ctx);
+		return 1;
+	}
+	return -ENOENT;
+}
+static int fake_dir_empty(struct fs *self, const char *path,
+		fs_dir_cb_t cb, void *cb_ctx) {
+	return -ENOENT;
+}
+static int fake_dir_broken(struct fs *self, const char *path,
+		fs_dir_cb_t cb, void *cb_ctx) {
+	return mock().actualCall(__func__)
+		.withStringParameter("path", path)
+		.returnIntValue();
+}
+
+/* Same layout as the one flash_mmap() in uid_snapshot_test.cpp maps. */
+struct flash {
+	struct flash_api api;
+	uint8_t mem[64 * 1024];
+};
+
+static int fake_flash_erase(struct flash *self, uintptr_t offset,
+		size_t size) {
+	memset(&self->mem[offset], 0xff, size);
+	return 0;
+}
+static int fake_flash_write(struct flash *self, uintptr_t offset,
+		const void *data, size_t len) {
+	memcpy(&self->mem[offset], data, len);
+	return 0;
+}
+static int fake_flash_read(struct flash *self, uintptr_t offset,
+		void *buf, size_t len) {
+	memcpy(buf, &self->mem[offset], len);
+	return 0;
+}
+static size_t fake_flash_size(struct flash *self) {
+	return sizeof(self->mem);
+}
+
 static void on_uid_update(const uid_id_t id, uid_status_t status,
 		time_t expiry, void *ctx) {
 	mock().actualCall(__func__)
@@ -84,6 +147,14 @@ static void on_uid_update(const uid_id_t id, uid_status_t status,
 		.withParameter("ctx", ctx);
 }
 
+static void on_uid_batch(size_t nr_updated, size_t nr_removed,
+		uint32_t version, void *ctx) {
+	mock().actualCall(__func__)
+		.withParameter("nr_updated", nr_updated)
+		.withParameter("nr_removed", nr_removed)
+		.withParameter("version", version);
+}
+
 static time_t mock_time = 0;
 
 time_t time(time_t *tloc) {
@@ -114,6 +185,7 @@ TEST_GROUP(UID) {
 			.ns = "cache",
 			.capacity = CACHE_CAPACITY,
 		};
+		expect_format("uid/cache/format");
 		cache = uid_store_create(&config);
 
 		memset(id1, 0x01, sizeof(uid_id_t));
@@ -128,6 +200,14 @@ TEST_GROUP(UID) {
 		mock().clear();
 	}
 
+	void expect_format(const char *filepath) {
+		static const uint32_t format = FORMAT;
+		mock().expectOneCall("fake_read")
+			.withStringParameter("filepath", filepath)
+			.withParameter("offset", 0)
+			.withOutputParameterReturning("buf", &format, sizeof(format))
+			.andReturnValue((int)sizeof(format));
+	}
 	void expect_size(const char *filepath, const size_t *size) {
 		if (*size <= 0) {
 			mock().expectOneCall("fake_size")
@@ -305,8 +385,8 @@ TEST(UID, ShouldDeleteUIDBothCacheAndFlash_WhenUIDDeleted) {
 		0x00,0x00,
 	};
 	const uint8_t expected[] = {
-		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+		0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
+		0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,
 		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
 		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
 		0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
@@ -378,6 +458,7 @@ TEST(UID, ShouldNotFail_WhenPIDisNull) {
 TEST(UID, ShouldAllowMultipleStores_IsolatedBehavior) {
 	struct uid_store_config c2 = config;
 	c2.ns = "other";
+	expect_format("uid/other/format");
 	struct uid_store *other = uid_store_create(&c2);
 	uid_id_t id_other;
 	memset(id_other, 0x30, sizeof(uid_id_t));
@@ -406,7 +487,6 @@ TEST(UID, ShouldOverwriteSecondEntry_WhenUIDUpdatedWithMiddleOffset) {
 	const size_t offset_second = ENTRY_SIZE * 1;
 	const size_t size[] = { ENTRY_SIZE, (size_t)-ENOENT };
 
-	const uint8_t empty_entry[ENTRY_SIZE] = { 0 };
 	uint8_t second_entry[ENTRY_SIZE] = { 0 };
 	memset(second_entry, 0x02, sizeof(uid_id_t)); // id2
 	memset(&second_entry[UID_ID_MAXLEN], 0xA0, sizeof(uid_id_t)); // pid
@@ -434,9 +514,13 @@ TEST(UID, ShouldOverwriteSecondEntry_WhenUIDUpdatedWithMiddleOffset) {
 	uid_update(cache, id3, pid, UID_STATUS_ACCEPTED, 3);
 
 	// 4. overwrite id2 → simulate entry found at offset 1
+	uint8_t file[ENTRY_SIZE * 3] = { 0 };
+	memcpy(&file[ENTRY_SIZE], second_entry, sizeof(second_entry));
+	memset(&file[ENTRY_SIZE * 2], 0x03, sizeof(uid_id_t));
+	file[ENTRY_SIZE * 2 + UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+
 	expect_size("uid/cache/02/02.bin", &file_size);
-	expect_read("uid/cache/02/02.bin", empty_entry, &size[0], NULL);
-	expect_read("uid/cache/02/02.bin", second_entry, &size[0], &offset_second);
+	expect_read("uid/cache/02/02.bin", file, &file_size, NULL);
 	expect_write("uid/cache/02/02.bin", updated_entry, &size[0], &offset_second);
 
 	uid_update(cache, id2, pid, UID_STATUS_BLOCKED, 120);
@@ -451,11 +535,6 @@ TEST(UID, ShouldOverwriteSecondEntry_WhenUIDUpdatedWithMiddleOffset) {
 TEST(UID, ShouldSkipZeroedEntry_WhenSearchingInFile) {
 	const size_t file_size = ENTRY_SIZE * 2;
 	const size_t offset0 = 0;
-	const size_t offset1 = ENTRY_SIZE;
-	const size_t size = ENTRY_SIZE;
-
-	uid_id_t id;
-	memset(id, 0x02, sizeof(uid_id_t));
 
 	uint8_t zeroed[ENTRY_SIZE] = { 0 };
 	uint8_t valid[ENTRY_SIZE] = { 0 };
@@ -464,9 +543,12 @@ TEST(UID, ShouldSkipZeroedEntry_WhenSearchingInFile) {
 	*((uint64_t *)(void *)&valid[UID_ID_MAXLEN*2]) = 123;
 	valid[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
 
+	uint8_t file[ENTRY_SIZE * 2];
+	memcpy(&file[0], zeroed, sizeof(zeroed));
+	memcpy(&file[ENTRY_SIZE], valid, sizeof(valid));
+
 	expect_size("uid/cache/02/02.bin", &file_size);
-	expect_read("uid/cache/02/02.bin", zeroed, &size, &offset0);
-	expect_read("uid/cache/02/02.bin", valid, &size, &offset1);
+	expect_read("uid/cache/02/02.bin", file, &file_size, &offset0);
 
 	time_t expiry = 0;
 	uid_status_t status = uid_status(cache, id2, NULL, &expiry);
@@ -483,15 +565,15 @@ TEST(UID, ShouldHandleMultipleZeroedEntriesBeforeValidOne) {
 	*((uint64_t *)(void *)&valid[UID_ID_MAXLEN*2]) = 789;
 	*((uint32_t *)(void *)&valid[UID_ID_MAXLEN*2+8]) = UID_STATUS_EXPIRED;
 
-	const size_t size = ENTRY_SIZE;
-	const size_t off[] = { 0, ENTRY_SIZE, ENTRY_SIZE*2, ENTRY_SIZE*3 };
 	const size_t file_size = ENTRY_SIZE * 4;
+	uint8_t file[ENTRY_SIZE * 4];
+	for (int i = 0; i < 3; i++) {
+		memcpy(&file[ENTRY_SIZE * i], zeroed, sizeof(zeroed));
+	}
+	memcpy(&file[ENTRY_SIZE * 3], valid, sizeof(valid));
 
 	expect_size("uid/cache/03/03.bin", &file_size);
-	expect_read("uid/cache/03/03.bin", zeroed, &size, &off[0]);
-	expect_read("uid/cache/03/03.bin", zeroed, &size, &off[1]);
-	expect_read("uid/cache/03/03.bin", zeroed, &size, &off[2]);
-	expect_read("uid/cache/03/03.bin", valid, &size, &off[3]);
+	expect_read("uid/cache/03/03.bin", file, &file_size, NULL);
 
 	time_t expiry = 0;
 	uid_id_t id3;
@@ -512,13 +594,459 @@ TEST(UID, ShouldUpdateWithoutCallback_WhenCallbackNotRegistered) {
 
 TEST(UID, ShouldReturnNoEntry_WhenFileContainsOnlyZeroedRecords) {
 	const size_t file_size = ENTRY_SIZE * 2;
-	const uint8_t zero[ENTRY_SIZE] = { 0 };
-	const size_t size = ENTRY_SIZE;
-	const size_t off[] = { 0, ENTRY_SIZE };
+	const uint8_t zero[ENTRY_SIZE * 2] = { 0 };
 
 	expect_size("uid/cache/01/01.bin", &file_size);
-	expect_read("uid/cache/01/01.bin", zero, &size, &off[0]);
-	expect_read("uid/cache/01/01.bin", zero, &size, &off[1]);
+	expect_read("uid/cache/01/01.bin", zero, &file_size, NULL);
 
 	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(cache, id1, NULL, NULL));
 }
+
+TEST(UID, ShouldReturnNoEntry_WhenRecordIsTombstone) {
+	uint8_t tombstone[ENTRY_SIZE] = { 0 };
+	memcpy(tombstone, id1, sizeof(uid_id_t));
+	const size_t size = ENTRY_SIZE;
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", tombstone, &size, NULL);
+
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(cache, id1, NULL, NULL));
+}
+
+TEST(UID, ShouldFindRecordWithSingleRead_WhenProbedInTheMiddle) {
+	const size_t file_size = ENTRY_SIZE * 32;
+	const size_t offset = ENTRY_SIZE * 16;
+	const size_t size = ENTRY_SIZE;
+	uint8_t valid[ENTRY_SIZE] = { 0 };
+	memcpy(valid, id1, sizeof(uid_id_t));
+	valid[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+
+	expect_size("uid/cache/01/01.bin", &file_size);
+	expect_read("uid/cache/01/01.bin", valid, &size, &offset);
+
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(cache, id1, NULL, NULL));
+}
+
+TEST(UID, ShouldNarrowDownToChunk_WhenRecordNotInTheMiddle) {
+	const size_t file_size = ENTRY_SIZE * 32;
+	const size_t offset[] = { ENTRY_SIZE * 16, ENTRY_SIZE * 8, ENTRY_SIZE * 9 };
+	const size_t size[] = { ENTRY_SIZE, ENTRY_SIZE * 7 };
+	uint8_t upper[ENTRY_SIZE] = { 0 };
+	memset(upper, 0x02, sizeof(uid_id_t));
+	upper[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	uint8_t lower[ENTRY_SIZE] = { 0 };
+	memset(lower, 0x01, sizeof(uid_id_t));
+	lower[UID_ID_MAXLEN - 1] = 0x00;
+	lower[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	uint8_t chunk[ENTRY_SIZE * 7];
+	for (int i = 0; i < 7; i++) {
+		memcpy(&chunk[ENTRY_SIZE * i], lower, sizeof(lower));
+	}
+	memcpy(&chunk[ENTRY_SIZE * 6], id1, sizeof(uid_id_t));
+	chunk[ENTRY_SIZE * 6 + UID_ID_MAXLEN*2+8] = UID_STATUS_BLOCKED;
+
+	expect_size("uid/cache/01/01.bin", &file_size);
+	expect_read("uid/cache/01/01.bin", upper, &size[0], &offset[0]);
+	expect_read("uid/cache/01/01.bin", lower, &size[0], &offset[1]);
+	expect_read("uid/cache/01/01.bin", chunk, &size[1], &offset[2]);
+
+	LONGS_EQUAL(UID_STATUS_BLOCKED, uid_status(cache, id1, NULL, NULL));
+}
+
+TEST(UID, ShouldInsertInOrder_WhenNewUIDSortsBeforeExistingOnes) {
+	uid_id_t id;
+	memset(id, 0x01, sizeof(uid_id_t));
+	id[UID_ID_MAXLEN - 1] = 0x02;
+
+	uint8_t file[ENTRY_SIZE] = { 0 };
+	memcpy(file, id, sizeof(uid_id_t));
+	file[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	uint8_t inserted[ENTRY_SIZE] = { 0 };
+	memcpy(inserted, id1, sizeof(uid_id_t));
+	memcpy(&inserted[UID_ID_MAXLEN], pid, sizeof(uid_id_t));
+	inserted[UID_ID_MAXLEN*2] = 10;
+	inserted[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const size_t size = ENTRY_SIZE;
+	const size_t offset[] = { 0, ENTRY_SIZE };
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", file, &size, &offset[0]);
+	expect_read("uid/cache/01/01.bin", file, &size, &offset[0]);
+	expect_write("uid/cache/01/01.bin", inserted, &size, &offset[0]);
+	expect_write("uid/cache/01/01.bin", file, &size, &offset[1]);
+
+	LONGS_EQUAL(0, uid_update(cache, id1, pid, UID_STATUS_ACCEPTED, 10));
+}
+
+TEST(UID, ShouldEvictLeastRecentlyUsed_WhenSetIsFull) {
+	uid_id_t id3;
+	memset(id3, 0x03, sizeof(uid_id_t));
+	const size_t size = (size_t)-ENOENT;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 2, });
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_append("uid/cache/01/01.bin", NULL, NULL);
+	uid_update(store, id1, pid, UID_STATUS_ACCEPTED, 10);
+	expect_size("uid/cache/02/02.bin", &size);
+	expect_append("uid/cache/02/02.bin", NULL, NULL);
+	uid_update(store, id2, pid, UID_STATUS_ACCEPTED, 10);
+
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id1, NULL, NULL));
+
+	expect_size("uid/cache/03/03.bin", &size);
+	expect_append("uid/cache/03/03.bin", NULL, NULL);
+	uid_update(store, id3, pid, UID_STATUS_ACCEPTED, 10);
+
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id1, NULL, NULL));
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id3, NULL, NULL));
+	expect_size("uid/cache/02/02.bin", &size);
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(store, id2, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldRejectUnknownUIDWithoutFlashAccess_WhenBloomFilterEnabled) {
+	fs.api.dir = fake_dir_empty;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 16, .bloom_size = 64, });
+
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(store, id1, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldLoadBloomFilterFromFlash_WhenStoreCreated) {
+	uint8_t record[ENTRY_SIZE] = { 0 };
+	memcpy(record, id1, sizeof(uid_id_t));
+	record[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const size_t size = ENTRY_SIZE;
+
+	fs.api.dir = fake_dir;
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", record, &size, NULL);
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 16, .bloom_size = 64, });
+
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(store, id2, NULL, NULL));
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", record, &size, NULL);
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id1, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldPassBloomFilter_WhenUIDUpdatedAfterStartup) {
+	const size_t size = (size_t)-ENOENT;
+	fs.api.dir = fake_dir_empty;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 1, .bloom_size = 64, });
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_append("uid/cache/01/01.bin", NULL, NULL);
+	uid_update(store, id1, pid, UID_STATUS_ACCEPTED, 10);
+	expect_size("uid/cache/02/02.bin", &size);
+	expect_append("uid/cache/02/02.bin", NULL, NULL);
+	uid_update(store, id2, pid, UID_STATUS_ACCEPTED, 10);
+
+	expect_size("uid/cache/01/01.bin", &size);
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(store, id1, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldWriteEachBucketOnce_WhenFullBatchGiven) {
+	struct uid_batch_entry entries[] = {
+		{ .status = UID_STATUS_ACCEPTED, .expiry = 20 },
+		{ .status = UID_STATUS_BLOCKED, .expiry = 10 },
+	};
+	memcpy(entries[0].id, id2, sizeof(uid_id_t));
+	memcpy(entries[1].id, id1, sizeof(uid_id_t));
+	uint8_t record1[ENTRY_SIZE] = { 0 };
+	memcpy(record1, id1, sizeof(uid_id_t));
+	record1[UID_ID_MAXLEN*2] = 10;
+	record1[UID_ID_MAXLEN*2+8] = UID_STATUS_BLOCKED;
+	uint8_t record2[ENTRY_SIZE] = { 0 };
+	memcpy(record2, id2, sizeof(uid_id_t));
+	record2[UID_ID_MAXLEN*2] = 20;
+	record2[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const uint32_t version = 7;
+	const size_t size[] = { (size_t)-ENOENT, ENTRY_SIZE, sizeof(version) };
+
+	fs.api.dir = fake_dir_empty;
+	uid_register_batch_cb(cache, on_uid_batch, NULL);
+
+	expect_size("uid/cache/01/01.bin", &size[0]);
+	expect_write("uid/cache/01/01.bin", record1, &size[1], NULL);
+	expect_size("uid/cache/02/02.bin", &size[0]);
+	expect_write("uid/cache/02/02.bin", record2, &size[1], NULL);
+	expect_write("uid/cache/version", (const uint8_t *)&version,
+			&size[2], NULL);
+	mock().expectOneCall("on_uid_batch")
+		.withParameter("nr_updated", 2)
+		.withParameter("nr_removed", 0)
+		.withParameter("version", 7);
+
+	LONGS_EQUAL(0, uid_update_batch(cache, entries, 2, UID_BATCH_FULL, 7));
+	LONGS_EQUAL(7, uid_version(cache));
+}
+
+TEST(UID, ShouldRejectDifferentialBatch_WhenVersionIsNotNewer) {
+	const uint32_t version = 5;
+	const size_t size = sizeof(version);
+	struct uid_batch_entry entry = { .status = UID_STATUS_ACCEPTED };
+	memcpy(entry.id, id1, sizeof(uid_id_t));
+
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "uid/cache/version")
+		.withParameter("offset", 0)
+		.withOutputParameterReturning("buf", &version, size)
+		.andReturnValue((int)size);
+
+	LONGS_EQUAL(-ESTALE, uid_update_batch(cache, &entry, 1,
+			UID_BATCH_DIFFERENTIAL, 5));
+}
+
+TEST(UID, ShouldMergeIntoExistingFile_WhenDifferentialBatchGiven) {
+	uid_id_t id;
+	memcpy(id, id1, sizeof(uid_id_t));
+	id[UID_ID_MAXLEN - 1] = 0x02;
+	struct uid_batch_entry entries[] = {
+		{ .status = UID_STATUS_ACCEPTED, .expiry = 30 },
+		{ .status = UID_STATUS_UNKNOWN },
+	};
+	memcpy(entries[0].id, id, sizeof(uid_id_t));
+	memcpy(entries[1].id, id1, sizeof(uid_id_t));
+
+	uint8_t file[ENTRY_SIZE] = { 0 };
+	memcpy(file, id1, sizeof(uid_id_t));
+	file[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	uint8_t merged[ENTRY_SIZE * 2] = { 0 };
+	memcpy(merged, id1, sizeof(uid_id_t));
+	memcpy(&merged[ENTRY_SIZE], id, sizeof(uid_id_t));
+	merged[ENTRY_SIZE + UID_ID_MAXLEN*2] = 30;
+	merged[ENTRY_SIZE + UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const uint32_t version = 1;
+	const size_t size[] = { ENTRY_SIZE, sizeof(merged), sizeof(version) };
+
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "uid/cache/version")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOENT);
+	expect_size("uid/cache/01/01.bin", &size[0]);
+	expect_read("uid/cache/01/01.bin", file, &size[0], NULL);
+	expect_write("uid/cache/01/01.bin", merged, &size[1], NULL);
+	expect_write("uid/cache/version", (const uint8_t *)&version,
+			&size[2], NULL);
+
+	LONGS_EQUAL(0, uid_update_batch(cache, entries, 2,
+			UID_BATCH_DIFFERENTIAL, 1));
+}
+
+TEST(UID, ShouldDropTombstones_WhenCompacted) {
+	uint8_t file[ENTRY_SIZE * 2] = { 0 };
+	memcpy(file, id1, sizeof(uid_id_t));
+	file[UID_ID_MAXLEN - 1] = 0x00;
+	memcpy(&file[ENTRY_SIZE], id1, sizeof(uid_id_t));
+	file[ENTRY_SIZE + UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const size_t size = sizeof(file);
+	size_t live, dead;
+
+	fs.api.dir = fake_dir;
+	fs.api.replace = fake_replace;
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", file, &size, NULL);
+	mock().expectOneCall("fake_replace")
+		.withStringParameter("filepath", "uid/cache/01/01.bin")
+		.withMemoryBufferParameter("data", &file[ENTRY_SIZE], ENTRY_SIZE)
+		.andReturnValue(ENTRY_SIZE);
+
+	LONGS_EQUAL(-ENODATA, uid_usage(cache, &live, &dead));
+	LONGS_EQUAL(0, uid_compact(cache, 1000));
+	LONGS_EQUAL(0, uid_usage(cache, &live, &dead));
+	LONGS_EQUAL(ENTRY_SIZE, live);
+	LONGS_EQUAL(ENTRY_SIZE, dead);
+}
+
+TEST(UID, ShouldDeleteBucket_WhenAllRecordsExpired) {
+	uint8_t file[ENTRY_SIZE] = { 0 };
+	memcpy(file, id1, sizeof(uid_id_t));
+	file[UID_ID_MAXLEN*2] = 5;
+	file[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const size_t size = sizeof(file);
+
+	fs.api.dir = fake_dir_empty;
+	fs.api.erase = fake_erase;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 4, .expire = true, });
+	fs.api.dir = fake_dir;
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", file, &size, NULL);
+	mock().expectOneCall("fake_erase")
+		.withStringParameter("filepath", "uid/cache/01/01.bin")
+		.andReturnValue(0);
+
+	mock_time = 10;
+	LONGS_EQUAL(0, uid_compact(store, 1000));
+	mock_time = 0;
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldKeepRecordsWithoutExpiry_WhenSweepingExpired) {
+	uint8_t file[ENTRY_SIZE] = { 0 };
+	memcpy(file, id1, sizeof(uid_id_t));
+	file[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	const size_t size = sizeof(file);
+
+	fs.api.dir = fake_dir_empty;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 4, .expire = true, });
+	fs.api.dir = fake_dir;
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_read("uid/cache/01/01.bin", file, &size, NULL);
+
+	mock_time = 10;
+	LONGS_EQUAL(0, uid_compact(store, 1000));
+	mock_time = 0;
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldLimitCapacityToRamBudget_WhenPreallocated) {
+	uid_id_t id3;
+	memset(id3, 0x03, sizeof(uid_id_t));
+	const size_t size = (size_t)-ENOENT;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 16,
+		.ram_budget = (sizeof(void *) + 56) * 2, });
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_append("uid/cache/01/01.bin", NULL, NULL);
+	uid_update(store, id1, pid, UID_STATUS_ACCEPTED, 10);
+	expect_size("uid/cache/02/02.bin", &size);
+	expect_append("uid/cache/02/02.bin", NULL, NULL);
+	uid_update(store, id2, pid, UID_STATUS_ACCEPTED, 10);
+	expect_size("uid/cache/03/03.bin", &size);
+	expect_append("uid/cache/03/03.bin", NULL, NULL);
+	uid_update(store, id3, pid, UID_STATUS_ACCEPTED, 10);
+
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id2, NULL, NULL));
+	LONGS_EQUAL(UID_STATUS_ACCEPTED, uid_status(store, id3, NULL, NULL));
+	expect_size("uid/cache/01/01.bin", &size);
+	LONGS_EQUAL(UID_STATUS_NO_ENTRY, uid_status(store, id1, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldReuseSlabEntry_WhenDeletedAndUpdatedAgain) {
+	const size_t size = (size_t)-ENOENT;
+	expect_format("uid/cache/format");
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 1,
+		.ram_budget = sizeof(void *) + 56, });
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_append("uid/cache/01/01.bin", NULL, NULL);
+	LONGS_EQUAL(0, uid_update(store, id1, pid, UID_STATUS_ACCEPTED, 10));
+
+	expect_size("uid/cache/01/01.bin", &size);
+	uid_delete(store, id1);
+
+	expect_size("uid/cache/02/02.bin", &size);
+	expect_append("uid/cache/02/02.bin", NULL, NULL);
+	LONGS_EQUAL(0, uid_update(store, id2, pid, UID_STATUS_BLOCKED, 10));
+	LONGS_EQUAL(UID_STATUS_BLOCKED, uid_status(store, id2, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldReturnNullStore_WhenRamBudgetTooSmall) {
+	POINTERS_EQUAL(NULL, uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 16, .ram_budget = 1, }));
+}
+
+TEST(UID, ShouldSortLegacyBucket_WhenStoreCreatedWithoutFormat) {
+	uid_id_t id0;
+	memcpy(id0, id1, sizeof(uid_id_t));
+	id0[UID_ID_MAXLEN - 1] = 0x00;
+	uint8_t legacy[ENTRY_SIZE * 3] = { 0 };
+	memcpy(&legacy[0], id1, sizeof(uid_id_t));
+	legacy[UID_ID_MAXLEN*2+8] = UID_STATUS_ACCEPTED;
+	memcpy(&legacy[ENTRY_SIZE * 2], id0, sizeof(uid_id_t));
+	legacy[ENTRY_SIZE * 2 + UID_ID_MAXLEN*2+8] = UID_STATUS_BLOCKED;
+	uint8_t sorted[ENTRY_SIZE * 2];
+	memcpy(&sorted[0], &legacy[ENTRY_SIZE * 2], ENTRY_SIZE);
+	memcpy(&sorted[ENTRY_SIZE], &legacy[0], ENTRY_SIZE);
+	const uint32_t format = FORMAT;
+	const size_t size[] = { sizeof(legacy), sizeof(sorted), sizeof(format) };
+
+	fs.api.dir = fake_dir;
+	fs.api.replace = fake_replace;
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "uid/cache/format")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOENT);
+	expect_size("uid/cache/01/01.bin", &size[0]);
+	expect_read("uid/cache/01/01.bin", legacy, &size[0], NULL);
+	mock().expectOneCall("fake_replace")
+		.withStringParameter("filepath", "uid/cache/01/01.bin")
+		.withMemoryBufferParameter("data", sorted, sizeof(sorted))
+		.andReturnValue((int)sizeof(sorted));
+	expect_write("uid/cache/format", (const uint8_t *)&format,
+			&size[2], NULL);
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 4, });
+
+	expect_size("uid/cache/01/01.bin", &size[1]);
+	expect_read("uid/cache/01/01.bin", sorted, &size[1], NULL);
+	LONGS_EQUAL(UID_STATUS_BLOCKED, uid_status(store, id0, NULL, NULL));
+
+	uid_store_destroy(store);
+}
+
+TEST(UID, ShouldNotRetrySnapshotBuild_UntilStoreChanges) {
+	static struct flash flash;
+	flash.api = (struct flash_api) {
+		.erase = fake_flash_erase,
+		.write = fake_flash_write,
+		.read = fake_flash_read,
+		.size = fake_flash_size,
+	};
+	memset(flash.mem, 0xff, sizeof(flash.mem));
+	struct uid_snapshot *snap = uid_snapshot_create(&flash);
+	const size_t size = (size_t)-ENOENT;
+
+	fs.api.dir = fake_dir_broken;
+	expect_format("uid/cache/format");
+	mock().expectOneCall("fake_read")
+		.withStringParameter("filepath", "uid/cache/version")
+		.ignoreOtherParameters()
+		.andReturnValue(-ENOENT);
+	struct uid_store *store = uid_store_create(&(struct uid_store_config) {
+		.fs = &fs, .ns = "cache", .capacity = 4, .snapshot = snap, });
+
+	mock().expectNCalls(2, "fake_dir_broken")
+		.withStringParameter("path", "uid/cache")
+		.andReturnValue(-EIO);
+	LONGS_EQUAL(-EIO, uid_refresh_snapshot(store));
+	LONGS_EQUAL(-EIO, uid_refresh_snapshot(store));
+
+	expect_size("uid/cache/01/01.bin", &size);
+	expect_append("uid/cache/01/01.bin", NULL, NULL);
+	uid_update(store, id1, pid, UID_STATUS_ACCEPTED, 10);
+	LONGS_EQUAL(-EIO, uid_refresh_snapshot(store));
+
+	uid_store_destroy(store);
+	uid_snapshot_destroy(snap);
+}